@@ -0,0 +1,593 @@
+#include "BenchChecks.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include "../VCamProducer/FrameProducer.h"
+#include "../VCamSampleSource/FrameBuffer.h"
+#include "../VCamSampleSource/ColorConvert.h"
+#include "../VCamSampleSource/ColorLut.h"
+#include "../VCamSampleSource/TaskScheduler.h"
+
+#define LUT_CHECK_STEP 3 // between the inputs compared to the scalar reference, on each axis
+#define LUT_CHECK_TOLERANCE 1 // levels, kernels against the scalar reference, like the media source's debug check
+#define LUT_CHECK_FRAME_TOLERANCE 2 // levels, graded frames against the plain conversions or the exact grade
+#define LUT_CHECK_WIDTH 640
+#define LUT_CHECK_HEIGHT 360
+#define LUT_CHECK_SIZE 33 // points per axis of the cube frames are graded with
+#define SCHEDULER_CHECK_WORKERS 4 // more than most CI runners have cores, so workers & callers get preempted in the middle of loops
+#define SCHEDULER_CHECK_CALLERS 20 // more than the scheduler's deques for external threads, so some callers share one
+#define SCHEDULER_CHECK_THROWN 0x5EED
+#define SCHEDULER_CHECK_TIMEOUT_S 60 // plus a second per round, the default 300 rounds take seconds, a loop that loses items never returns
+
+static const char* GetRingFormatName(uint32_t format)
+{
+	return format == FRAME_RING_FORMAT_BGRA ? "BGRA" : (format == FRAME_RING_FORMAT_I420 ? "I420" : "NV12");
+}
+
+// changes a field of the ring's header, checks the consumer side rejects it, and puts it back
+static bool CheckRejected(FrameRingHeader* header, size_t size, uint32_t& field, uint32_t value, const char* name)
+{
+	auto original = field;
+	field = value;
+	auto rejected = !FrameRingValidate(header, size);
+	field = original;
+	if (!rejected)
+	{
+		printf("Ring with %s %u was not rejected\n", name, value);
+	}
+	return rejected;
+}
+
+int RunRingCheck(uint32_t format, uint32_t width, uint32_t height, uint32_t frames)
+{
+	// a ring left by a previous run may have another geometry
+	FrameRingMapping::Unlink();
+	FrameProducer producer;
+	FrameConsumer consumer;
+	if (!producer.Open(format, width, height, 30, 1) || !consumer.Open())
+	{
+		printf("Ring %ux%u %s cannot be created\n", width, height, GetRingFormatName(format));
+		return 1;
+	}
+
+	// frames are filled with words, strides are aligned
+	auto words = FrameRingFrameSize(format, producer.GetStride(), height) / sizeof(uint32_t);
+	std::atomic<bool> done(false);
+	auto failed = false;
+	printf("Publishing %u frames %ux%u %s in a ring of %u slots\n", frames, width, height, GetRingFormatName(format), consumer.GetLayout().slotCount);
+	auto start = std::chrono::steady_clock::now();
+	std::thread producerThread([&]()
+		{
+			for (uint32_t i = 1; i <= frames; i++)
+			{
+				auto pixels = (uint32_t*)producer.BeginFrame();
+				if (!pixels)
+				{
+					failed = true;
+					break;
+				}
+
+				std::fill(pixels, pixels + words, i);
+				producer.EndFrame(i);
+			}
+			done = true;
+		});
+
+	uint64_t acquired = 0;
+	uint64_t distinct = 0;
+	uint64_t torn = 0;
+	uint64_t backwards = 0;
+	uint64_t last = 0;
+	for (;;)
+	{
+		// read before acquiring, so the last frame is acquired once the producer is done
+		auto finished = done.load();
+		uint64_t frameNumber;
+		int64_t timestamp;
+		auto pixels = (const uint32_t*)consumer.Acquire(&frameNumber, &timestamp);
+		if (pixels)
+		{
+			acquired++;
+			if (frameNumber != last)
+			{
+				distinct++;
+			}
+
+			if (frameNumber < last)
+			{
+				backwards++;
+			}
+			last = frameNumber;
+
+			if (timestamp != (int64_t)frameNumber || std::find_if(pixels, pixels + words, [&](uint32_t word) { return word != (uint32_t)frameNumber; }) != pixels + words)
+			{
+				torn++;
+			}
+		}
+
+		if (finished)
+			break;
+	}
+	producerThread.join();
+	consumer.Release();
+	auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	printf("Acquired %llu frames (%llu distinct, last %llu) in %.3f s: torn %llu, out of order %llu\n", (unsigned long long)acquired, (unsigned long long)distinct, (unsigned long long)last, seconds, (unsigned long long)torn, (unsigned long long)backwards);
+	failed |= torn || backwards || last != frames;
+
+	// a third view of the ring, whose header is tampered with like a hostile producer would
+	FrameRingMapping mapping;
+	auto header = mapping.Open(0, false) ? (FrameRingHeader*)mapping.GetMemory() : nullptr;
+	FrameRingLayout layout{};
+	if (!header || !FrameRingValidate(header, mapping.GetSize(), &layout) || layout.width != width || layout.height != height || layout.format != format)
+	{
+		printf("Ring cannot be validated\n");
+		return 1;
+	}
+
+	auto size = mapping.GetSize();
+	auto rowSize = format == FRAME_RING_FORMAT_BGRA ? width * 4 : width;
+	auto rejected = CheckRejected(header, size, header->stride, rowSize - 1, "stride");
+	rejected &= CheckRejected(header, size, header->width, header->stride + 2, "width");
+	rejected &= CheckRejected(header, size, header->height, header->height * 2, "height");
+	rejected &= CheckRejected(header, size, header->slotCount, FRAME_RING_MAX_SLOTS + 1, "slot count");
+	rejected &= CheckRejected(header, size, header->slotSize, header->slotSize - FRAME_RING_ALIGNMENT, "slot size");
+	rejected &= CheckRejected(header, size, header->slotSize, header->slotSize + 1, "slot size");
+	rejected &= CheckRejected(header, size, header->format, 0, "format");
+
+	// the consumer keeps its copy of the layout, a published slot out of it is not served
+	auto published = header->published.load();
+	header->published.store(((uint64_t)frames + 1) << 8 | layout.slotCount);
+	auto outOfRing = FrameRingAcquire(header, layout);
+	header->published.store(published);
+	FrameRingRelease(header);
+	if (outOfRing)
+	{
+		printf("Published slot %u out of the ring was acquired\n", layout.slotCount);
+		rejected = false;
+	}
+
+	// a published slot that stays odd, or whose frame number isn't the published one, is given up on instead of spinning
+	auto slot = FrameRingGetSlot(header, layout, (uint32_t)(published & 0xFF));
+	auto sequence = slot->sequence.load();
+	slot->sequence.store(sequence | 1);
+	auto unstable = FrameRingAcquire(header, layout);
+	slot->sequence.store(sequence);
+	FrameRingRelease(header);
+	auto frameNumber = slot->frameNumber.load();
+	slot->frameNumber.store(frameNumber + 1);
+	auto mismatched = FrameRingAcquire(header, layout);
+	slot->frameNumber.store(frameNumber);
+	FrameRingRelease(header);
+	if (unstable || mismatched)
+	{
+		printf("Published slot %u was acquired with %s\n", (uint32_t)(published & 0xFF), unstable ? "an odd sequence" : "another frame number");
+		rejected = false;
+	}
+	printf("Tampered rings rejected: %s\n", rejected ? "yes" : "no");
+
+	mapping.Close();
+	consumer.Close();
+	producer.Close();
+	FrameRingMapping::Unlink();
+	return failed || !rejected ? 1 : 0;
+}
+
+// a smooth grade for the .cube files: a bit of crosstalk between channels and an S curve
+static void Grade(const double rgb[3], double output[3])
+{
+	double mixed[3] = { 0.9 * rgb[0] + 0.1 * rgb[1], 0.05 * rgb[0] + 0.9 * rgb[1] + 0.05 * rgb[2], 0.1 * rgb[1] + 0.9 * rgb[2] };
+	for (uint32_t i = 0; i < 3; i++)
+	{
+		output[i] = mixed[i] - 0.04 * sin(6.283185307179586 * mixed[i]);
+	}
+}
+
+// parses a cube of the grade, or of no grade, written as a .cube file
+static bool ParseCube(ColorLut& lut, uint32_t size, bool graded)
+{
+	std::string text = "TITLE \"vcambench\"\nLUT_3D_SIZE " + std::to_string(size) + "\n";
+	auto last = (double)(size - 1);
+	for (uint32_t b = 0; b < size; b++)
+	{
+		for (uint32_t g = 0; g < size; g++)
+		{
+			for (uint32_t r = 0; r < size; r++)
+			{
+				double grid[3] = { r / last, g / last, b / last };
+				double output[3] = { grid[0], grid[1], grid[2] };
+				if (graded)
+				{
+					Grade(grid, output);
+				}
+
+				char line[64];
+				snprintf(line, sizeof(line), "%.6f %.6f %.6f\n", output[0], output[1], output[2]);
+				text += line;
+			}
+		}
+	}
+
+	std::vector<char> buffer(text.begin(), text.end());
+	buffer.push_back(0);
+	uint32_t line;
+	auto error = lut.Parse(buffer.data(), text.size(), line);
+	if (error)
+	{
+		printf("Cube %u cannot be parsed, line %u: %s\n", size, line, error);
+		return false;
+	}
+	return true;
+}
+
+static uint8_t ToLevel(double value)
+{
+	return (uint8_t)std::min(std::max(lround(value), 0l), 255l);
+}
+
+// like ProcAmp's brightness 10, contrast 120 & saturation 80 (see ColorAdjust in ProcAmp.h)
+static ColorLutAdjust GetProcAmpAdjust()
+{
+	ColorLutAdjust adjust;
+	for (uint32_t i = 0; i < 256; i++)
+	{
+		adjust.rgbCurve[i] = ToLevel(((i / 255.0 - 0.5) * 1.2 + 0.5) * 255 + 10);
+		adjust.yCurve[i] = ToLevel(((i - 16) / 219.0 - 0.5) * 1.2 * 219 + 0.5 * 219 + 16 + 10);
+	}
+
+	const double saturation = 0.8;
+	const double luma[3] = { 0.299, 0.587, 0.114 };
+	for (uint32_t i = 0; i < 3; i++)
+	{
+		for (uint32_t j = 0; j < 3; j++)
+		{
+			adjust.rgbMatrix[i * 3 + j] = (int32_t)lround(((i == j ? saturation : 0) + (1 - saturation) * luma[j]) * (1 << COLOR_LUT_SHIFT));
+		}
+	}
+	adjust.uvMatrix[0] = (int32_t)lround(saturation * (1 << COLOR_LUT_SHIFT));
+	adjust.uvMatrix[3] = adjust.uvMatrix[0];
+	return adjust;
+}
+
+static uint32_t ComputeMaxDifference(const std::vector<uint8_t>& a, const std::vector<uint8_t>& b)
+{
+	uint32_t difference = 0;
+	for (size_t i = 0; i < a.size(); i++)
+	{
+		difference = std::max<uint32_t>(difference, (uint32_t)abs(a[i] - b[i]));
+	}
+	return difference;
+}
+
+static bool CheckDifference(const char* name, uint32_t difference, uint32_t tolerance)
+{
+	printf("%-44s max error %u (tolerance %u)\n", name, difference, tolerance);
+	return difference <= tolerance;
+}
+
+int RunLutCheck()
+{
+	// the SIMD interpolation of the 4 baked cubes against the textbook one
+	auto passed = true;
+	ColorLutAdjust none;
+	auto procAmp = GetProcAmpAdjust();
+	const uint32_t sizes[] = { 17, LUT_CHECK_SIZE, 65 };
+	for (auto size : sizes)
+	{
+		for (auto graded : { false, true })
+		{
+			for (auto adjust : { &none, &procAmp })
+			{
+				ColorLut lut;
+				if (!ParseCube(lut, size, graded))
+					return 1;
+
+				lut.Bake(*adjust);
+				char name[64];
+				snprintf(name, sizeof(name), "Cube %u%s%s, kernels", size, graded ? " graded" : "", adjust == &procAmp ? " with ProcAmp" : "");
+				passed &= CheckDifference(name, lut.ComputeMaxError(LUT_CHECK_STEP), LUT_CHECK_TOLERANCE);
+			}
+		}
+	}
+
+	// a frame of random 2x2 blocks, so the LUT's average chroma and the plain conversion's subsampled one are the same
+	const uint32_t width = LUT_CHECK_WIDTH;
+	const uint32_t height = LUT_CHECK_HEIGHT;
+	const int32_t rgbStride = width * 4;
+	std::vector<uint8_t> rgb((size_t)rgbStride * height);
+	uint32_t seed = 1;
+	for (uint32_t y = 0; y < height; y += 2)
+	{
+		for (uint32_t x = 0; x < width; x += 2)
+		{
+			seed = seed * 1664525 + 1013904223;
+			uint8_t color[4] = { (uint8_t)(seed >> 8), (uint8_t)(seed >> 16), (uint8_t)(seed >> 24), 255 };
+			for (uint32_t k = 0; k < 4; k++)
+			{
+				memcpy(&rgb[(size_t)(y + k / 2) * rgbStride + (x + k % 2) * 4], color, 4);
+			}
+		}
+	}
+
+	// a cube with no grade & no ProcAmp converts like the plain conversions
+	ColorLut identity;
+	if (!ParseCube(identity, LUT_CHECK_SIZE, false))
+		return 1;
+
+	identity.Bake(none);
+	std::vector<uint8_t> nv12((size_t)width * height * 3 / 2);
+	std::vector<uint8_t> lutNv12(nv12.size());
+	auto uv = nv12.data() + (size_t)width * height;
+	auto lutUV = lutNv12.data() + (size_t)width * height;
+	RGB32ToNV12(rgb.data(), rgbStride, width, height, nv12.data(), width, uv, width);
+	identity.RGB32ToNV12(rgb.data(), rgbStride, width, height, lutNv12.data(), width, lutUV, width);
+	passed &= CheckDifference("Identity cube, RGB32 to NV12", ComputeMaxDifference(nv12, lutNv12), LUT_CHECK_FRAME_TOLERANCE);
+
+	identity.YUV420ToNV12(nv12.data(), width, uv, width, uv + 1, width, 2, width, height, lutNv12.data(), width, lutUV, width);
+	passed &= CheckDifference("Identity cube, NV12 to NV12", ComputeMaxDifference(nv12, lutNv12), LUT_CHECK_FRAME_TOLERANCE);
+
+	std::vector<uint8_t> output(rgb.size());
+	identity.RGB32ToRGB32(rgb.data(), rgbStride, width, height, output.data(), rgbStride);
+	passed &= CheckDifference("Identity cube, RGB32 to RGB32", ComputeMaxDifference(rgb, output), LUT_CHECK_FRAME_TOLERANCE);
+
+	std::vector<uint8_t> plain(rgb.size());
+	YUV420ToRGB32(nv12.data(), width, uv, uv + 1, width, 2, width, height, plain.data(), rgbStride);
+	identity.YUV420ToRGB32(nv12.data(), width, uv, width, uv + 1, width, 2, width, height, output.data(), rgbStride);
+	passed &= CheckDifference("Identity cube, NV12 to RGB32", ComputeMaxDifference(plain, output), LUT_CHECK_FRAME_TOLERANCE);
+
+	// a graded cube grades like the exact grade
+	ColorLut graded;
+	if (!ParseCube(graded, LUT_CHECK_SIZE, true))
+		return 1;
+
+	graded.Bake(none);
+	graded.RGB32ToRGB32(rgb.data(), rgbStride, width, height, output.data(), rgbStride);
+	for (size_t i = 0; i < rgb.size(); i += 4)
+	{
+		double color[3] = { rgb[i + 2] / 255.0, rgb[i + 1] / 255.0, rgb[i] / 255.0 };
+		double exact[3];
+		Grade(color, exact);
+		plain[i] = ToLevel(exact[2] * 255);
+		plain[i + 1] = ToLevel(exact[1] * 255);
+		plain[i + 2] = ToLevel(exact[0] * 255);
+		plain[i + 3] = 255;
+	}
+	passed &= CheckDifference("Graded cube, RGB32 to RGB32", ComputeMaxDifference(plain, output), LUT_CHECK_FRAME_TOLERANCE);
+
+	printf("Color LUT accuracy: %s\n", passed ? "passed" : "failed");
+	return passed ? 0 : 1;
+}
+
+// runs a loop of count items, checking every item runs exactly once and every range is in bounds
+static bool CheckLoop(TaskScheduler& scheduler, uint32_t count, uint32_t grain)
+{
+	auto runs = std::make_unique<std::atomic<uint32_t>[]>(count);
+	for (uint32_t i = 0; i < count; i++)
+	{
+		runs[i] = 0;
+	}
+
+	std::atomic<uint32_t> invalid(0);
+	scheduler.ParallelFor(count, grain, [&](uint32_t begin, uint32_t end)
+		{
+			if (begin >= end || end > count)
+			{
+				invalid++;
+				return;
+			}
+
+			for (auto i = begin; i < end; i++)
+			{
+				runs[i]++;
+			}
+		});
+
+	uint32_t wrong = 0;
+	for (uint32_t i = 0; i < count; i++)
+	{
+		wrong += runs[i] != 1;
+	}
+
+	if (invalid || wrong)
+	{
+		printf("Loop of %u items (grain %u): %u invalid range(s), %u item(s) not run exactly once\n", count, grain, invalid.load(), wrong);
+		return false;
+	}
+	return true;
+}
+
+// loops inside the items of a loop, as the frame path does when a parallel stage calls a parallel converter
+static bool CheckNestedLoops(TaskScheduler& scheduler, uint32_t outer, uint32_t inner)
+{
+	auto runs = std::make_unique<std::atomic<uint32_t>[]>((size_t)outer * inner);
+	for (size_t i = 0; i < (size_t)outer * inner; i++)
+	{
+		runs[i] = 0;
+	}
+
+	scheduler.ParallelFor(outer, 1, [&](uint32_t begin, uint32_t end)
+		{
+			for (auto i = begin; i < end; i++)
+			{
+				scheduler.ParallelFor(inner, 0, [&](uint32_t innerBegin, uint32_t innerEnd)
+					{
+						for (auto j = innerBegin; j < innerEnd; j++)
+						{
+							runs[(size_t)i * inner + j]++;
+						}
+					});
+			}
+		});
+
+	uint32_t wrong = 0;
+	for (size_t i = 0; i < (size_t)outer * inner; i++)
+	{
+		wrong += runs[i] != 1;
+	}
+
+	if (wrong)
+	{
+		printf("Nested loops %u x %u: %u item(s) not run exactly once\n", outer, inner, wrong);
+		return false;
+	}
+	return true;
+}
+
+// a loop whose item throws rethrows it on the calling thread once all its other ranges are done, nested loops pass it up
+static bool CheckException(TaskScheduler& scheduler, uint32_t count, uint32_t thrower, bool nested)
+{
+	std::atomic<uint32_t> running(0);
+	std::atomic<uint32_t> leftRunning(0);
+	auto body = [&](uint32_t begin, uint32_t end)
+		{
+			running++;
+			for (auto i = begin; i < end; i++)
+			{
+				if (i == thrower)
+				{
+					running--;
+					throw std::runtime_error(std::to_string(SCHEDULER_CHECK_THROWN));
+				}
+			}
+			running--;
+		};
+
+	auto caught = false;
+	try
+	{
+		if (nested)
+		{
+			scheduler.ParallelFor(4, 1, [&](uint32_t begin, uint32_t end)
+				{
+					for (auto i = begin; i < end; i++)
+					{
+						scheduler.ParallelFor(count, 0, body);
+					}
+				});
+		}
+		else
+		{
+			scheduler.ParallelFor(count, 1, body);
+		}
+	}
+	catch (const std::runtime_error& e)
+	{
+		caught = std::to_string(SCHEDULER_CHECK_THROWN) == e.what();
+		leftRunning = running.load();
+	}
+
+	if (!caught || leftRunning)
+	{
+		printf("%s loop of %u items throwing at %u: %s, %u range(s) still running when it returned\n", nested ? "Nested" : "A", count, thrower,
+			caught ? "rethrown" : "not rethrown", leftRunning.load());
+		return false;
+	}
+	return true;
+}
+
+static int RunSchedulerChecks(uint32_t rounds)
+{
+	TaskScheduler scheduler(SCHEDULER_CHECK_WORKERS);
+	printf("Checking a scheduler of %u workers, %u rounds\n", scheduler.GetWorkerCount(), rounds);
+	auto passed = true;
+	const uint32_t counts[] = { 1, 2, 3, 7, 64, 1000, 1080, 65537 };
+	const uint32_t grains[] = { 0, 1, 5, 32 };
+	for (uint32_t round = 0; round < rounds && passed; round++)
+	{
+		for (auto count : counts)
+		{
+			for (auto grain : grains)
+			{
+				passed &= CheckLoop(scheduler, count, grain);
+			}
+		}
+
+		passed &= CheckNestedLoops(scheduler, 16, 257);
+		passed &= CheckException(scheduler, 1000, round * 7 % 1000, false);
+		passed &= CheckException(scheduler, 100, round * 13 % 100, true);
+
+		// the scheduler works after a loop threw
+		passed &= CheckLoop(scheduler, 1000, 0);
+	}
+	printf("Loops, nested loops & exceptions: %s\n", passed ? "passed" : "failed");
+
+	// callers on their own threads, more than there are deques for them
+	std::atomic<uint32_t> failures(0);
+	std::vector<std::thread> callers;
+	for (uint32_t i = 0; i < SCHEDULER_CHECK_CALLERS; i++)
+	{
+		callers.emplace_back([&, i]()
+			{
+				for (uint32_t round = 0; round < rounds; round++)
+				{
+					if (!CheckLoop(scheduler, 1000 + i * 37, i % 3) || !CheckNestedLoops(scheduler, 4, 100) || !CheckException(scheduler, 500, (round + i) % 500, false))
+					{
+						failures++;
+						return;
+					}
+				}
+			});
+	}
+
+	for (auto& caller : callers)
+	{
+		caller.join();
+	}
+	printf("%u concurrent callers: %s\n", SCHEDULER_CHECK_CALLERS, failures ? "failed" : "passed");
+	passed &= !failures;
+
+	// the workers restart with the first loop after a stop
+	auto stopped = true;
+	for (uint32_t round = 0; round < std::min<uint32_t>(rounds, 50); round++)
+	{
+		scheduler.Stop();
+		stopped &= CheckLoop(scheduler, 1000, 0) && CheckNestedLoops(scheduler, 8, 64);
+	}
+	scheduler.Stop();
+	scheduler.Stop();
+	stopped &= CheckLoop(scheduler, 1000, 0);
+	printf("Stop & restart: %s\n", stopped ? "passed" : "failed");
+	passed &= stopped;
+
+	auto stats = scheduler.GetStats();
+	printf("Task scheduler: %s (loops:%llu ranges:%llu steals:%llu)\n", passed ? "passed" : "failed", (unsigned long long)stats.loops, (unsigned long long)stats.ranges,
+		(unsigned long long)stats.steals);
+	return passed ? 0 : 1;
+}
+
+int RunSchedulerCheck(uint32_t rounds)
+{
+	// a hung loop fails the check rather than the CI job's timeout
+	std::mutex lock;
+	std::condition_variable finished;
+	auto done = false;
+	std::thread watchdog([&]()
+		{
+			std::unique_lock<std::mutex> guard(lock);
+			if (!finished.wait_for(guard, std::chrono::seconds(SCHEDULER_CHECK_TIMEOUT_S + rounds), [&] { return done; }))
+			{
+				printf("Task scheduler: failed, the checks did not finish in %u s\n", SCHEDULER_CHECK_TIMEOUT_S + rounds);
+				fflush(stdout);
+				_Exit(1);
+			}
+		});
+
+	auto result = RunSchedulerChecks(rounds);
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		done = true;
+	}
+	finished.notify_one();
+	watchdog.join();
+	return result;
+}
\ No newline at end of file
@@ -0,0 +1,18 @@
+#pragma once
+
+// Correctness checks of the parts of the media source that other threads or processes share, run by vcambench so they build and run on Linux too.
+// Each one returns the process exit code: 0 when everything checked is right, 1 otherwise.
+#include <cstdint>
+
+// A producer thread publishes frames in the shared memory ring (see FrameRing.h) as fast as it can, each filled with its frame number, while the consumer
+// takes the latest one and checks all of it, so a slot written while it's read shows up as a torn frame. Rings with a tampered header are then checked
+// to be rejected by the consumer side.
+int RunRingCheck(uint32_t format, uint32_t width, uint32_t height, uint32_t frames);
+
+// The 3D LUT's interpolation kernels (see ColorLut.h) against a scalar reference, for cubes of 17, 33 & 65 points with and without a grade & ProcAmp
+// adjustments, then frames converted through cubes against the plain conversions and the exact grade. Fails when an error is above its tolerance.
+int RunLutCheck();
+
+// Loops of a scheduler of a few workers (see TaskScheduler.h) run every item exactly once for many sizes & grains, nested in each other, from many
+// threads at once, and after the scheduler was stopped; an exception thrown by an item is rethrown by its loop once none of its ranges runs.
+int RunSchedulerCheck(uint32_t rounds);
\ No newline at end of file
@@ -0,0 +1,596 @@
+#define _CRT_SECURE_NO_WARNINGS // fopen is portable, fopen_s isn't
+#include "BenchSuite.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include "../VCamSampleSource/FrameBuffer.h"
+#include "../VCamSampleSource/ColorConvert.h"
+#include "../VCamSampleSource/FrameCrc.h"
+#include "../VCamSampleSource/PipCompositor.h"
+#include "../VCamSampleSource/TaskScheduler.h"
+#include "../VCamSampleSource/TileRasterizer.h"
+#include "PipelineBench.h"
+
+#define SUITE_WIDTH 1920
+#define SUITE_HEIGHT 1080
+#define SUITE_SAMPLE_MS 5.0 // a sample repeats its case for at least that long
+#define SUITE_LOOP_FRAMES 30 // frames requested per sample of the request loop
+#define SUITE_BAND_ROWS 16 // of the parallel conversion, like the media source's bands
+#define SUITE_CELL_SIZE 20 // of the rasterized pattern's blocks, like the media source's
+#define SUITE_GLYPH_WIDTH 20
+#define SUITE_GLYPH_HEIGHT 28
+#define SUITE_GLYPHS 95 // printable ASCII, like the media source's
+#define SUITE_Z_THRESHOLD 2.326 // one-sided p < 0.01
+#define SUITE_FORMAT_VERSION 1
+
+struct BenchCase
+{
+	std::string name;
+	std::vector<double> samples; // ms per iteration
+	double tolerance; // percent, negative for the default
+};
+
+static double Median(std::vector<double> values)
+{
+	if (values.empty())
+		return 0;
+
+	std::sort(values.begin(), values.end());
+	auto middle = values.size() / 2;
+	return values.size() & 1 ? values[middle] : (values[middle - 1] + values[middle]) / 2;
+}
+
+static double Mean(const std::vector<double>& values)
+{
+	double sum = 0;
+	for (auto value : values)
+	{
+		sum += value;
+	}
+	return values.empty() ? 0 : sum / values.size();
+}
+
+static double StandardDeviation(const std::vector<double>& values)
+{
+	if (values.size() < 2)
+		return 0;
+
+	auto mean = Mean(values);
+	double sum = 0;
+	for (auto value : values)
+	{
+		sum += (value - mean) * (value - mean);
+	}
+	return sqrt(sum / (values.size() - 1));
+}
+
+// z score of the Mann-Whitney U statistic of current against baseline, positive when current tends to be slower
+static double MannWhitneyZ(const std::vector<double>& baseline, const std::vector<double>& current)
+{
+	struct Value
+	{
+		double value;
+		bool current;
+	};
+
+	std::vector<Value> values;
+	for (auto value : baseline)
+	{
+		values.push_back({ value, false });
+	}
+
+	for (auto value : current)
+	{
+		values.push_back({ value, true });
+	}
+	std::sort(values.begin(), values.end(), [](const Value& a, const Value& b) { return a.value < b.value; });
+
+	// ties get the average of their ranks
+	double currentRanks = 0;
+	for (size_t i = 0; i < values.size();)
+	{
+		auto j = i;
+		while (j < values.size() && values[j].value == values[i].value)
+		{
+			j++;
+		}
+
+		auto rank = (i + 1 + j) / 2.0;
+		for (auto k = i; k < j; k++)
+		{
+			if (values[k].current)
+			{
+				currentRanks += rank;
+			}
+		}
+		i = j;
+	}
+
+	double n1 = (double)current.size();
+	double n2 = (double)baseline.size();
+	if (!n1 || !n2)
+		return 0;
+
+	auto u = currentRanks - n1 * (n1 + 1) / 2;
+	auto mean = n1 * n2 / 2;
+	auto deviation = sqrt(n1 * n2 * (n1 + n2 + 1) / 12);
+	return (u - mean - 0.5) / deviation; // with continuity correction
+}
+
+// the z of MannWhitneyZ when all current samples are slower than all baseline ones, the most significant slowdown these counts can show
+static double MaxMannWhitneyZ(size_t baseline, size_t current)
+{
+	double n1 = (double)current;
+	double n2 = (double)baseline;
+	return (n1 * n2 / 2 - 0.5) / sqrt(n1 * n2 * (n1 + n2 + 1) / 12);
+}
+
+uint32_t GetMinBenchSuiteSamples()
+{
+	uint32_t samples = 2;
+	while (MaxMannWhitneyZ(samples, samples) <= SUITE_Z_THRESHOLD)
+	{
+		samples++;
+	}
+	return samples;
+}
+
+// times iterations of a case, each sample runs it for at least SUITE_SAMPLE_MS
+static bool TimeCase(const char* name, uint32_t samples, const std::function<bool(double&)>& iteration, std::vector<BenchCase>& cases)
+{
+	using Clock = std::chrono::steady_clock;
+	BenchCase benchCase{ name, {}, -1 };
+
+	// the iteration returns its own time when it's not just the wall time of the call (ms per frame of the request loop)
+	auto run = [&](uint32_t count, double& ms)
+		{
+			double own = 0;
+			double total = 0;
+			auto start = Clock::now();
+			for (uint32_t i = 0; i < count; i++)
+			{
+				own = -1;
+				if (!iteration(own))
+					return false;
+
+				if (own >= 0)
+				{
+					total += own;
+				}
+			}
+			ms = own >= 0 ? total / count : std::chrono::duration<double, std::milli>(Clock::now() - start).count() / count;
+			return true;
+		};
+
+	double warmup;
+	if (!run(1, warmup))
+	{
+		printf("%s failed\n", name);
+		return false;
+	}
+
+	auto iterations = (uint32_t)std::max(1.0, ceil(SUITE_SAMPLE_MS / std::max(warmup, 0.001)));
+	for (uint32_t s = 0; s < samples; s++)
+	{
+		double ms;
+		if (!run(iterations, ms))
+		{
+			printf("%s failed\n", name);
+			return false;
+		}
+		benchCase.samples.push_back(ms);
+	}
+
+	printf("  %-32s median %9.4f ms  stddev %8.4f\n", name, Median(benchCase.samples), StandardDeviation(benchCase.samples));
+	cases.push_back(std::move(benchCase));
+	return true;
+}
+
+// the pattern with 2 insets, composed like the picture-in-picture source
+static bool StartSources(uint32_t width, uint32_t height, PipPatternSource& main, PipCompositor& compositor)
+{
+	for (uint32_t i = 0; i < 2; i++)
+	{
+		compositor.AddInset(std::make_unique<PipPatternSource>(), (int32_t)(width - (i + 1) * (width / 4 + 16)), (int32_t)(height - height / 4 - 16), width / 4, height / 4);
+	}
+
+	if (!main.Start(width, height, 30, 1) || !compositor.Start(30, 1))
+	{
+		printf("Sources cannot be started\n");
+		return false;
+	}
+	return true;
+}
+
+// the media source's pattern without a GPU: blocks, 4 circles, a frame and 4 lines of text, with made up glyphs
+static void RecordPattern(TileRasterizer& raster, uint32_t width, uint32_t height, uint32_t frame)
+{
+	raster.Begin(0xFF0000FF);
+	for (uint32_t i = 0; i < width / SUITE_CELL_SIZE; i++)
+	{
+		for (uint32_t j = 0; j < height / SUITE_CELL_SIZE; j++)
+		{
+			auto color = 0xFF000000 | (i * 255 * SUITE_CELL_SIZE / width) << 16 | (j * 255 * SUITE_CELL_SIZE / height) << 8 | ((i + j + frame) & 0xFF);
+			raster.FillRectangle((float)(i * SUITE_CELL_SIZE), (float)(j * SUITE_CELL_SIZE), (float)((i + 1) * SUITE_CELL_SIZE), (float)((j + 1) * SUITE_CELL_SIZE), color);
+		}
+	}
+
+	const float radius = SUITE_CELL_SIZE * 2;
+	for (auto x : { radius + 1, width - radius - 1 })
+	{
+		for (auto y : { radius + 1, height - radius - 1 })
+		{
+			raster.DrawEllipse(x, y, radius, radius, 1, 0xFFFFFFFF);
+		}
+	}
+	raster.DrawRectangle(radius, radius, width - radius, height - radius, 1, 0xFFFFFFFF);
+
+	for (uint32_t line = 0; line < 4; line++)
+	{
+		auto baseline = height / 2.0f + (line - 1.5f) * SUITE_GLYPH_HEIGHT * 1.5f;
+		for (uint32_t i = 0; i < 24; i++)
+		{
+			raster.DrawGlyph((line * 24 + i + frame) % SUITE_GLYPHS, width / 2.0f + (i - 12.0f) * SUITE_GLYPH_WIDTH * 1.1f, baseline, 0xFFFFFFFF);
+		}
+	}
+}
+
+static bool RunCases(uint32_t samples, std::vector<BenchCase>& cases)
+{
+	const uint32_t width = SUITE_WIDTH;
+	const uint32_t height = SUITE_HEIGHT;
+
+	// a deterministic gradient so converters see the same data on every run
+	std::vector<uint8_t> rgb((size_t)width * height * 4);
+	for (uint32_t y = 0; y < height; y++)
+	{
+		for (uint32_t x = 0; x < width; x++)
+		{
+			auto pixel = &rgb[((size_t)y * width + x) * 4];
+			pixel[0] = (uint8_t)(x * 255 / width);
+			pixel[1] = (uint8_t)(y * 255 / height);
+			pixel[2] = (uint8_t)((x + y) & 0xFF);
+			pixel[3] = 0xFF;
+		}
+	}
+
+	std::vector<uint8_t> nv12((size_t)width * height * 3 / 2);
+	auto uv = nv12.data() + (size_t)width * height;
+	RGB32ToNV12(rgb.data(), width * 4, width, height, nv12.data(), width, uv, width);
+
+	std::vector<uint8_t> u((size_t)width * height / 4);
+	std::vector<uint8_t> v((size_t)width * height / 4);
+	for (size_t i = 0; i < u.size(); i++)
+	{
+		u[i] = uv[i * 2];
+		v[i] = uv[i * 2 + 1];
+	}
+
+	std::vector<uint8_t> output((size_t)width * height * 4);
+	auto paddedStride = (int32_t)width + 64;
+	std::vector<uint8_t> padded((size_t)paddedStride * height * 3 / 2);
+
+	printf("Color converters %ux%u:\n", width, height);
+	auto ok =
+		TimeCase("convert/rgb32_to_nv12", samples, [&](double&) { RGB32ToNV12(rgb.data(), width * 4, width, height, output.data(), width, output.data() + (size_t)width * height, width); return true; }, cases) &&
+		TimeCase("convert/nv12_to_rgb32", samples, [&](double&) { YUV420ToRGB32(nv12.data(), width, uv, uv + 1, width, 2, width, height, output.data(), width * 4); return true; }, cases) &&
+		TimeCase("convert/i420_to_rgb32", samples, [&](double&) { YUV420ToRGB32(nv12.data(), width, u.data(), v.data(), width / 2, 1, width, height, output.data(), width * 4); return true; }, cases) &&
+		TimeCase("convert/i420_to_nv12_uv", samples, [&](double&) { I420ToNV12UV(u.data(), width / 2, v.data(), width / 2, width / 2, height / 2, output.data(), width); return true; }, cases) &&
+		TimeCase("convert/copy_plane_nv12", samples, [&](double&) { CopyPlane(nv12.data(), width, width, height * 3 / 2, padded.data(), paddedStride); return true; }, cases);
+	if (!ok)
+		return false;
+
+	// the fork/join cost of an empty loop, and a conversion in bands of rows like the media source's
+	auto& scheduler = TaskScheduler::GetShared();
+	printf("Task scheduler, %u worker(s):\n", scheduler.GetWorkerCount());
+	ok =
+		TimeCase("scheduler/fork_join", samples, [&](double&) { scheduler.ParallelFor(64, 1, [](uint32_t, uint32_t) {}); return true; }, cases) &&
+		TimeCase("scheduler/rgb32_to_nv12_bands", samples, [&](double&)
+			{
+				scheduler.ParallelFor((height + SUITE_BAND_ROWS - 1) / SUITE_BAND_ROWS, 1, [&](uint32_t first, uint32_t last)
+					{
+						auto top = first * SUITE_BAND_ROWS;
+						auto bottom = std::min<uint32_t>(last * SUITE_BAND_ROWS, height);
+						RGB32ToNV12(rgb.data() + (size_t)top * width * 4, width * 4, width, bottom - top, output.data() + (size_t)top * width, width, output.data() + (size_t)width * height + (size_t)top / 2 * width, width);
+					});
+				return true;
+			}, cases);
+	if (!ok)
+		return false;
+
+	// the pattern rendered in parallel must be the one rendered on the calling thread
+	TileRasterizer raster;
+	std::vector<uint8_t> glyph(SUITE_GLYPH_WIDTH * SUITE_GLYPH_HEIGHT);
+	for (uint32_t i = 0; i < SUITE_GLYPHS; i++)
+	{
+		for (uint32_t y = 0; y < SUITE_GLYPH_HEIGHT; y++)
+		{
+			for (uint32_t x = 0; x < SUITE_GLYPH_WIDTH; x++)
+			{
+				glyph[y * SUITE_GLYPH_WIDTH + x] = (uint8_t)((x * 7 + y * 13 + i * 29) & 0xFF);
+			}
+		}
+		raster.SetGlyph(i, glyph.data(), SUITE_GLYPH_WIDTH, SUITE_GLYPH_WIDTH, SUITE_GLYPH_HEIGHT, 0, -(int32_t)SUITE_GLYPH_HEIGHT * 3 / 4);
+	}
+
+	std::vector<uint8_t> serial((size_t)width * height * 4);
+	raster.Start(width, height);
+	RecordPattern(raster, width, height, 0);
+	raster.Render(serial.data(), width * 4, nullptr);
+	raster.Render(output.data(), width * 4, &scheduler);
+	if (memcmp(serial.data(), output.data(), serial.size()))
+	{
+		printf("Rasterized pattern differs when rendered in parallel\n");
+		return false;
+	}
+
+	printf("Pattern rasterizer %ux%u, %u primitives:\n", width, height, raster.GetPrimitiveCount());
+	uint32_t frame = 0;
+	ok =
+		TimeCase("raster/pattern_rgb32", samples, [&](double&) { RecordPattern(raster, width, height, frame++); raster.Render(output.data(), width * 4, &scheduler); return true; }, cases) &&
+		TimeCase("raster/pattern_rgb32_serial", samples, [&](double&) { RecordPattern(raster, width, height, frame++); raster.Render(output.data(), width * 4, nullptr); return true; }, cases);
+	if (!ok)
+		return false;
+
+	printf("Frame generation %ux%u:\n", width, height);
+	for (auto format : { PipFormat::Nv12, PipFormat::Rgb32 })
+	{
+		PipPatternSource main;
+		PipCompositor compositor;
+		if (!StartSources(width, height, main, compositor))
+			return false;
+
+		auto nv12Format = format == PipFormat::Nv12;
+		auto stride = (int32_t)(nv12Format ? width : width * 4);
+		int64_t time = 0;
+		ok = TimeCase(nv12Format ? "generate/compose_nv12" : "generate/compose_rgb32", samples, [&](double&)
+			{
+				PipFrame frame{};
+				time += 333333;
+				return main.GetFrame(time, format, frame) && compositor.Compose(frame, time, output.data(), stride, output.data() + (size_t)stride * height, stride);
+			}, cases);
+
+		if (ok && nv12Format)
+		{
+			ok = TimeCase("generate/frame_crc_nv12", samples, [&](double&)
+				{
+					uint32_t crcs[FRAME_CRC_MAX_PLANES];
+					return FrameCrc32c(FrameCrcFormat::Nv12, output.data(), stride, output.data() + (size_t)stride * height, stride, width, height, crcs) == 2;
+				}, cases);
+		}
+		compositor.Stop();
+		main.Stop();
+		if (!ok)
+			return false;
+	}
+
+	// the request loop, as fast as samples come back to the pool, 1 consumer
+	printf("Request loop %ux%u:\n", width, height);
+	PipPatternSource main;
+	PipCompositor compositor;
+	if (!StartSources(width, height, main, compositor))
+		return false;
+
+	PipelineOptions options{ width, height, PipFormat::Nv12, SUITE_LOOP_FRAMES, 0, 1, 10, false, false, 0, false, ThreadPriority::Normal, 0 };
+	ok = TimeCase("loop/request_nv12", samples, [&](double& ms)
+		{
+			PipelineResults results;
+			if (!RunRequestLoop(options, main, compositor, results) || !results.produced)
+				return false;
+
+			ms = results.seconds * 1000 / results.produced;
+			return true;
+		}, cases);
+	compositor.Stop();
+	main.Stop();
+	return ok;
+}
+
+static bool WriteResults(const char* path, const std::vector<BenchCase>& cases)
+{
+	auto file = fopen(path, "w");
+	if (!file)
+	{
+		printf("Cannot create '%s'\n", path);
+		return false;
+	}
+
+#if defined(_MSC_VER)
+	auto compiler = "msvc";
+#elif defined(__clang__)
+	auto compiler = "clang";
+#elif defined(__GNUC__)
+	auto compiler = "gcc";
+#else
+	auto compiler = "unknown";
+#endif
+#if defined(_WIN32)
+	auto system = "windows";
+#elif defined(__APPLE__)
+	auto system = "macos";
+#else
+	auto system = "linux";
+#endif
+
+	fprintf(file, "{\n  \"version\": %d,\n  \"system\": \"%s\",\n  \"compiler\": \"%s\",\n  \"threads\": %u,\n  \"unit\": \"ms\",\n  \"cases\": [\n",
+		SUITE_FORMAT_VERSION, system, compiler, std::thread::hardware_concurrency());
+	for (size_t i = 0; i < cases.size(); i++)
+	{
+		auto& benchCase = cases[i];
+		fprintf(file, "    {\n      \"name\": \"%s\",\n      \"median\": %.6f,\n      \"mean\": %.6f,\n      \"stddev\": %.6f,\n      \"samples\": [",
+			benchCase.name.c_str(), Median(benchCase.samples), Mean(benchCase.samples), StandardDeviation(benchCase.samples));
+		for (size_t s = 0; s < benchCase.samples.size(); s++)
+		{
+			fprintf(file, "%s%.6f", s ? ", " : "", benchCase.samples[s]);
+		}
+		fprintf(file, "]\n    }%s\n", i + 1 < cases.size() ? "," : "");
+	}
+	fprintf(file, "  ]\n}\n");
+	auto ok = !ferror(file);
+	fclose(file);
+	return ok;
+}
+
+// value of a key in a JSON object without nested objects, npos when it's missing
+static size_t FindValue(const std::string& object, const char* key)
+{
+	auto quoted = std::string("\"") + key + "\"";
+	auto position = object.find(quoted);
+	if (position == std::string::npos)
+		return position;
+
+	position = object.find(':', position + quoted.size());
+	if (position == std::string::npos)
+		return position;
+
+	return object.find_first_not_of(" \t\r\n", position + 1);
+}
+
+// reads the cases of a results file, as written by WriteResults or edited by hand (keys in any order, "tolerance" added to a case)
+static bool ReadResults(const char* path, std::vector<BenchCase>& cases)
+{
+	auto file = fopen(path, "rb");
+	if (!file)
+		return false;
+
+	std::string text;
+	char buffer[4096];
+	size_t read;
+	while ((read = fread(buffer, 1, sizeof(buffer), file)) > 0)
+	{
+		text.append(buffer, read);
+	}
+	fclose(file);
+
+	auto position = text.find("\"cases\"");
+	if (position == std::string::npos)
+		return false;
+
+	for (;;)
+	{
+		auto start = text.find('{', position);
+		if (start == std::string::npos)
+			break;
+
+		auto end = text.find('}', start);
+		if (end == std::string::npos)
+			return false;
+
+		auto object = text.substr(start, end - start + 1);
+		position = end + 1;
+
+		BenchCase benchCase{ {}, {}, -1 };
+		auto name = FindValue(object, "name");
+		if (name == std::string::npos || object[name] != '"')
+			return false;
+
+		auto nameEnd = object.find('"', name + 1);
+		if (nameEnd == std::string::npos)
+			return false;
+		benchCase.name = object.substr(name + 1, nameEnd - name - 1);
+
+		auto tolerance = FindValue(object, "tolerance");
+		if (tolerance != std::string::npos)
+		{
+			benchCase.tolerance = atof(object.c_str() + tolerance);
+		}
+
+		auto samples = FindValue(object, "samples");
+		if (samples == std::string::npos || object[samples] != '[')
+			return false;
+
+		auto cursor = object.c_str() + samples + 1;
+		for (;;)
+		{
+			while (*cursor == ' ' || *cursor == ',' || *cursor == '\t' || *cursor == '\r' || *cursor == '\n')
+			{
+				cursor++;
+			}
+
+			if (*cursor == ']' || !*cursor)
+				break;
+
+			char* next;
+			auto value = strtod(cursor, &next);
+			if (next == cursor)
+				return false;
+
+			benchCase.samples.push_back(value);
+			cursor = next;
+		}
+		cases.push_back(std::move(benchCase));
+	}
+	return !cases.empty();
+}
+
+static bool Compare(const std::vector<BenchCase>& baseline, const std::vector<BenchCase>& cases, double defaultTolerance)
+{
+	printf("%-32s %12s %12s %8s %6s %9s\n", "Case", "baseline ms", "current ms", "change", "z", "tolerance");
+	auto regressed = false;
+	for (auto& benchCase : cases)
+	{
+		auto reference = std::find_if(baseline.begin(), baseline.end(), [&](const BenchCase& c) { return c.name == benchCase.name; });
+		if (reference == baseline.end() || reference->samples.empty())
+		{
+			printf("%-32s %12s %12.4f %8s %6s %9s  new\n", benchCase.name.c_str(), "-", Median(benchCase.samples), "", "", "");
+			continue;
+		}
+
+		auto tolerance = reference->tolerance >= 0 ? reference->tolerance : defaultTolerance;
+		auto before = Median(reference->samples);
+		auto after = Median(benchCase.samples);
+		auto change = before > 0 ? (after / before - 1) * 100 : 0;
+		auto z = MannWhitneyZ(reference->samples, benchCase.samples);
+		auto slower = change > tolerance && z > SUITE_Z_THRESHOLD;
+
+		// a gate that cannot see a slowdown fails rather than passing everything
+		auto undecidable = MaxMannWhitneyZ(reference->samples.size(), benchCase.samples.size()) <= SUITE_Z_THRESHOLD;
+		regressed |= slower || undecidable;
+		printf("%-32s %12.4f %12.4f %+7.1f%% %6.2f %8.1f%%  %s\n", benchCase.name.c_str(), before, after, change, z, tolerance, slower ? "REGRESSION" : (undecidable ? "TOO FEW SAMPLES" : "ok"));
+	}
+
+	for (auto& reference : baseline)
+	{
+		if (std::none_of(cases.begin(), cases.end(), [&](const BenchCase& c) { return c.name == reference.name; }))
+		{
+			printf("%-32s not run anymore\n", reference.name.c_str());
+		}
+	}
+	return !regressed;
+}
+
+int RunBenchSuite(const BenchSuiteOptions& options)
+{
+	// read first, so a missing baseline doesn't wait for the whole suite
+	std::vector<BenchCase> baseline;
+	if (options.baselinePath && !ReadResults(options.baselinePath, baseline))
+	{
+		printf("Baseline '%s' cannot be read, record one on this machine with -b\n", options.baselinePath);
+		return 2;
+	}
+
+	std::vector<BenchCase> cases;
+	if (!RunCases(options.samples, cases))
+		return 1;
+
+	if (options.resultsPath)
+	{
+		if (!WriteResults(options.resultsPath, cases))
+			return 1;
+
+		printf("Results written to '%s'\n", options.resultsPath);
+	}
+
+	if (!options.baselinePath)
+		return 0;
+
+	return Compare(baseline, cases, options.tolerance) ? 0 : 1;
+}
\ No newline at end of file
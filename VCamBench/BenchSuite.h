@@ -0,0 +1,21 @@
+#pragma once
+
+// A fixed suite of benchmarks (the color converters, the task scheduler, the pattern rasterizer, frame generation & the request loop) that writes its results as JSON and compares them
+// to a baseline results file, recorded on the same machine, to catch performance regressions. Each case is timed as a number of samples, and
+// a case regresses when its median is slower than the baseline's by more than its tolerance and a one-sided Mann-Whitney U test says the
+// slowdown is significant, so noise alone doesn't fail the gate.
+#include <cstdint>
+
+struct BenchSuiteOptions
+{
+	const char* resultsPath; // written when not null
+	const char* baselinePath; // compared to when not null
+	double tolerance; // default allowed slowdown of the median in percent, a case of the baseline can have its own "tolerance"
+	uint32_t samples; // per case
+};
+
+// fewer samples per case can't make any slowdown significant (p < 0.01), even when all of them are slower than all of the baseline's
+uint32_t GetMinBenchSuiteSamples();
+
+// returns the process exit code: 0 when there's no regression, 1 when there's one, 2 when the baseline cannot be read
+int RunBenchSuite(const BenchSuiteOptions& options);
\ No newline at end of file
@@ -0,0 +1,428 @@
+#include "PipelineBench.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "../VCamSampleSource/FrameCode.h"
+#include "../VCamSampleSource/FrameCrc.h"
+#include "../VCamSampleSource/AllocationCounter.h"
+#include "../VCamSampleSource/FrameBuffer.h"
+#if defined(_WIN32)
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+struct BenchSample
+{
+	FrameBuffer buffer;
+	uint32_t frame;
+	int64_t time;
+	uint32_t crcs[FRAME_CRC_MAX_PLANES];
+	uint32_t crcCount;
+	FrameTiming::Clock::time_point requested;
+	std::atomic<uint32_t> references; // consumers that haven't released it yet
+};
+
+// counts what a request allocated on the producer thread once warmed up, like MediaStream::CheckAllocations
+class RequestAllocations
+{
+	AllocationScope _scope;
+	PipelineResults& _results;
+	bool _check;
+
+public:
+	RequestAllocations(PipelineResults& results, bool check) :
+		_results(results),
+		_check(check)
+	{
+	}
+
+	~RequestAllocations()
+	{
+		auto allocations = _scope.GetAllocations();
+		if (_check && allocations)
+		{
+			_results.allocatingFrames++;
+			_results.allocations += allocations;
+		}
+	}
+};
+
+// stand-in for IMFVideoSampleAllocatorEx, a fixed pool of samples, allocation fails when they're all in use (MF_E_SAMPLEALLOCATOR_EMPTY)
+class BenchAllocator
+{
+	std::unique_ptr<BenchSample[]> _samples;
+	std::unique_ptr<BenchSample*[]> _free;
+	uint32_t _freeCount;
+	std::mutex _lock;
+	std::condition_variable _released;
+
+public:
+	BenchAllocator() :
+		_freeCount(0)
+	{
+	}
+
+	// samples have 64-byte aligned buffers from the shared frame buffer pool
+	bool Initialize(uint32_t count, size_t size)
+	{
+		_samples = std::make_unique<BenchSample[]>(count);
+		_free = std::make_unique<BenchSample*[]>(count);
+		for (uint32_t i = 0; i < count; i++)
+		{
+			_samples[i].buffer = FrameBufferPool::GetShared().Acquire(size);
+			if (!_samples[i].buffer)
+				return false;
+
+			memset(_samples[i].buffer.get(), 0, size); // committed now, not on the first frames
+			_free[i] = &_samples[i];
+		}
+		_freeCount = count;
+		return true;
+	}
+
+	// wait is for a caller that requests frames as fast as possible, like the frame server requesting again when a sample comes back
+	BenchSample* Allocate(bool wait)
+	{
+		std::unique_lock<std::mutex> lock(_lock);
+		if (wait)
+		{
+			_released.wait(lock, [&] { return _freeCount != 0; });
+		}
+		return _freeCount ? _free[--_freeCount] : nullptr;
+	}
+
+	void Release(BenchSample* sample)
+	{
+		{
+			std::lock_guard<std::mutex> lock(_lock);
+			_free[_freeCount++] = sample;
+		}
+		_released.notify_one();
+	}
+};
+
+// stand-in for IMFMediaEventQueue, one ring of samples per consumer, each consumer gets every sample
+class BenchEventQueue
+{
+	struct Ring
+	{
+		std::unique_ptr<BenchSample*[]> samples;
+		uint32_t head;
+		uint32_t count;
+	};
+
+	std::unique_ptr<Ring[]> _rings;
+	uint32_t _consumers;
+	uint32_t _capacity;
+	bool _shutdown;
+	std::mutex _lock;
+	std::condition_variable _queued;
+
+public:
+	BenchEventQueue() :
+		_consumers(0),
+		_capacity(0),
+		_shutdown(false)
+	{
+	}
+
+	// capacity is the allocator's pool size, there can't be more samples in flight
+	void Initialize(uint32_t consumers, uint32_t capacity)
+	{
+		_rings = std::make_unique<Ring[]>(consumers);
+		for (uint32_t i = 0; i < consumers; i++)
+		{
+			_rings[i].samples = std::make_unique<BenchSample*[]>(capacity);
+			_rings[i].head = 0;
+			_rings[i].count = 0;
+		}
+		_consumers = consumers;
+		_capacity = capacity;
+	}
+
+	void Queue(BenchSample* sample)
+	{
+		sample->references.store(_consumers);
+		{
+			std::lock_guard<std::mutex> lock(_lock);
+			for (uint32_t i = 0; i < _consumers; i++)
+			{
+				auto& ring = _rings[i];
+				ring.samples[(ring.head + ring.count++) % _capacity] = sample;
+			}
+		}
+		_queued.notify_all();
+	}
+
+	// null once shut down & drained
+	BenchSample* GetEvent(uint32_t consumer)
+	{
+		std::unique_lock<std::mutex> lock(_lock);
+		auto& ring = _rings[consumer];
+		_queued.wait(lock, [&] { return ring.count != 0 || _shutdown; });
+		if (!ring.count)
+			return nullptr;
+
+		auto sample = ring.samples[ring.head];
+		ring.head = (ring.head + 1) % _capacity;
+		ring.count--;
+		return sample;
+	}
+
+	void Shutdown()
+	{
+		{
+			std::lock_guard<std::mutex> lock(_lock);
+			_shutdown = true;
+		}
+		_queued.notify_all();
+	}
+};
+
+static double GetCpuSeconds()
+{
+#if defined(_WIN32)
+	FILETIME creation, exit, kernel, user;
+	if (!GetProcessTimes(GetCurrentProcess(), &creation, &exit, &kernel, &user))
+		return 0;
+
+	auto ticks = ((uint64_t)kernel.dwHighDateTime << 32 | kernel.dwLowDateTime) + ((uint64_t)user.dwHighDateTime << 32 | user.dwLowDateTime);
+	return ticks / 10000000.0;
+#else
+	rusage usage{};
+	getrusage(RUSAGE_SELF, &usage);
+	return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1000000.0;
+#endif
+}
+
+static uint64_t GetPeakMemory()
+{
+#if defined(_WIN32)
+	PROCESS_MEMORY_COUNTERS counters{};
+	return GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)) ? counters.PeakWorkingSetSize : 0;
+#else
+	rusage usage{};
+	getrusage(RUSAGE_SELF, &usage);
+#if defined(__APPLE__)
+	return (uint64_t)usage.ru_maxrss;
+#else
+	return (uint64_t)usage.ru_maxrss * 1024;
+#endif
+#endif
+}
+
+static void PrintHistogram(const char* name, const FrameTimingHistogram& histogram)
+{
+	printf("  %-16s count %8llu  mean %7.3f  p50 %7.3f  p99 %7.3f  max %7.3f ms  over a frame %llu\n", name, (unsigned long long)histogram.GetCount(),
+		histogram.GetMean() / 1000.0, histogram.GetPercentile(50) / 1000.0, histogram.GetPercentile(99) / 1000.0, histogram.GetMaximum() / 1000.0, (unsigned long long)histogram.GetOverBudget());
+}
+
+bool RunRequestLoop(const PipelineOptions& options, PipSource& main, PipCompositor& compositor, PipelineResults& results)
+{
+	auto width = options.width;
+	auto height = options.height;
+	auto nv12 = options.format == PipFormat::Nv12;
+	auto bufferFormat = nv12 ? FrameBufferFormat::Nv12 : FrameBufferFormat::Rgb32;
+	auto stride = GetAlignedFrameStride(bufferFormat, width);
+	auto frameSize = GetFrameBufferSize(bufferFormat, stride, height);
+	auto codeFormat = nv12 ? FrameCodeFormat::Nv12 : FrameCodeFormat::Rgb32;
+	auto crcFormat = nv12 ? FrameCrcFormat::Nv12 : FrameCrcFormat::Rgb32;
+	auto budgetUs = 1000000ull / (options.fps ? options.fps : 30);
+
+	BenchAllocator allocator;
+	if (!allocator.Initialize(options.samples, frameSize))
+	{
+		fprintf(stderr, "Cannot allocate %u samples of %zu bytes\n", options.samples, frameSize);
+		return false;
+	}
+
+	BenchEventQueue queue;
+	queue.Initialize(options.consumers, options.samples);
+
+	results.consumers = std::make_unique<PipelineConsumerResults[]>(options.consumers);
+	std::vector<std::thread> consumers;
+	for (uint32_t c = 0; c < options.consumers; c++)
+	{
+		results.consumers[c].frames = 0;
+		results.consumers[c].verified = 0;
+		consumers.emplace_back([&, c]()
+			{
+				auto copy = std::make_unique<uint8_t[]>(frameSize);
+				auto& consumerStats = results.consumers[c];
+				while (auto sample = queue.GetEvent(c))
+				{
+					memcpy(copy.get(), sample->buffer.get(), frameSize);
+					if (sample->crcCount && VerifyFrameCrc32c(sample->crcs, sample->crcCount, crcFormat, copy.get(), stride, GetFrameBufferUV(copy.get(), stride, height), stride, width, height))
+					{
+						consumerStats.verified++;
+					}
+
+					auto latency = std::chrono::duration_cast<std::chrono::microseconds>(FrameTiming::Clock::now() - sample->requested).count();
+					consumerStats.latency.Add((uint64_t)latency, budgetUs);
+					consumerStats.frames++;
+					if (sample->references.fetch_sub(1) == 1)
+					{
+						allocator.Release(sample);
+					}
+				}
+			});
+	}
+
+	auto& timing = results.timing;
+	timing.Reset(budgetUs);
+	uint64_t empty = 0;
+	uint64_t failed = 0;
+	results.allocatingFrames = 0;
+	results.allocations = 0;
+	results.producerProcessor = options.producerAffinity ? ProcessorReservations::GetShared().Reserve(options.producerAffinity) : THREAD_POLICY_NO_PROCESSOR;
+	results.producerPolicyApplied = !options.producerAffinity || results.producerProcessor != THREAD_POLICY_NO_PROCESSOR;
+	results.migrations = 0;
+	auto producerMask = results.producerProcessor != THREAD_POLICY_NO_PROCESSOR ? 1ull << results.producerProcessor : 0;
+	auto processor = THREAD_POLICY_NO_PROCESSOR;
+	auto cpuStart = GetCpuSeconds();
+	auto start = FrameTiming::Clock::now();
+	auto period = std::chrono::nanoseconds(options.fps ? 1000000000ull / options.fps : 0);
+	for (uint32_t i = 0; i < options.frames; i++)
+	{
+		if (options.fps)
+		{
+			std::this_thread::sleep_until(start + period * i);
+		}
+
+		auto time = (int64_t)i * 10000000 / (options.fps ? options.fps : 30);
+		ThreadPolicyScope policy(options.producerPriority, producerMask);
+		results.producerPolicyApplied &= policy.IsApplied();
+		auto current = GetCurrentProcessor();
+		if (processor != THREAD_POLICY_NO_PROCESSOR && current != processor)
+		{
+			results.migrations++;
+		}
+		processor = current;
+		RequestAllocations allocations(results, options.allocationWarmup && i >= options.allocationWarmup);
+		FrameRequestTimer requestTimer(timing);
+		auto requested = FrameTiming::Clock::now();
+		BenchSample* sample;
+		{
+			FrameStageTimer timer(timing, FrameStage::Allocate);
+			sample = allocator.Allocate(!options.fps);
+		}
+
+		if (!sample)
+		{
+			empty++;
+			continue;
+		}
+
+		{
+			FrameStageTimer timer(timing, FrameStage::Generate);
+			auto output = sample->buffer.get();
+			auto uv = GetFrameBufferUV(output, stride, height);
+			PipFrame frame{};
+			if (!main.GetFrame(time, options.format, frame) || !compositor.Compose(frame, time, output, stride, uv, stride))
+			{
+				failed++;
+				allocator.Release(sample);
+				continue;
+			}
+
+			if (options.code)
+			{
+				WriteFrameCode(FrameCode{ i, (uint64_t)time }, codeFormat, output, stride, uv, stride, width, height);
+			}
+			sample->crcCount = options.crc ? FrameCrc32c(crcFormat, output, stride, uv, stride, width, height, sample->crcs) : 0;
+		}
+
+		{
+			FrameStageTimer timer(timing, FrameStage::Attributes);
+			sample->frame = i;
+			sample->time = time;
+			sample->requested = requested;
+		}
+
+		FrameStageTimer timer(timing, FrameStage::Queue);
+		queue.Queue(sample);
+	}
+
+	queue.Shutdown();
+	for (auto& consumer : consumers)
+	{
+		consumer.join();
+	}
+
+	ProcessorReservations::GetShared().Release(results.producerProcessor);
+	results.seconds = std::chrono::duration<double>(FrameTiming::Clock::now() - start).count();
+	results.cpuSeconds = GetCpuSeconds() - cpuStart;
+	results.produced = timing.GetHistogram(FrameStage::Queue).GetCount();
+	results.empty = empty;
+	results.failed = failed;
+	return !failed;
+}
+
+int RunPipeline(const PipelineOptions& options, PipSource& main, PipCompositor& compositor)
+{
+	char rate[32] = "as fast as possible";
+	if (options.fps)
+	{
+		snprintf(rate, sizeof(rate), "at %u fps", options.fps);
+	}
+	printf("Requesting %u frames %ux%u %s %s, %u sample(s) in the pool, %u consumer(s)\n", options.frames, options.width, options.height, options.format == PipFormat::Nv12 ? "NV12" : "RGB32", rate, options.samples, options.consumers);
+
+	auto& pool = FrameBufferPool::GetShared();
+	pool.SetLargePages(options.largePages);
+	PipelineResults results;
+	auto succeeded = RunRequestLoop(options, main, compositor, results);
+	if (!results.consumers)
+		return 1;
+
+	auto seconds = results.seconds;
+	auto cpu = results.cpuSeconds;
+	printf("Produced %llu frames in %.3f s: %.1f fps, %llu request(s) found the pool empty, %llu failed\n", (unsigned long long)results.produced, seconds, results.produced / seconds, (unsigned long long)results.empty, (unsigned long long)results.failed);
+	printf("CPU time %.3f s (%.0f%% of one core), peak memory %.1f MB\n", cpu, cpu * 100 / seconds, GetPeakMemory() / (1024.0 * 1024.0));
+	char processor[32] = "not pinned";
+	if (results.producerProcessor != THREAD_POLICY_NO_PROCESSOR)
+	{
+		snprintf(processor, sizeof(processor), "pinned to processor %u", results.producerProcessor);
+	}
+	printf("Producer %s, priority %u%s, %llu migration(s) between requests\n", processor, (uint32_t)options.producerPriority, results.producerPolicyApplied ? "" : " (refused by the system)", (unsigned long long)results.migrations);
+	printf("Request stages:\n");
+	for (int i = 0; i < (int)FrameStage::Count; i++)
+	{
+		PrintHistogram(GetFrameStageName((FrameStage)i), results.timing.GetHistogram((FrameStage)i));
+	}
+
+	printf("Request to consumer copy:\n");
+	for (uint32_t c = 0; c < options.consumers; c++)
+	{
+		auto& consumer = results.consumers[c];
+		char name[32];
+		snprintf(name, sizeof(name), "Consumer %u", c);
+		PrintHistogram(name, consumer.latency);
+		if (options.crc)
+		{
+			printf("  %-16s verified %llu of %llu\n", "", (unsigned long long)consumer.verified, (unsigned long long)consumer.frames);
+		}
+	}
+
+	if (options.largePages)
+	{
+		auto stats = pool.GetStats();
+		printf("Frame buffers: %llu allocated, %llu with large pages, %llu with huge page hints, %llu fell back to normal pages (large page size %llu KB)\n", (unsigned long long)stats.allocated,
+			(unsigned long long)stats.largePages, (unsigned long long)stats.hugePageHints, (unsigned long long)stats.largePageFailures, (unsigned long long)FrameBufferPool::GetLargePageSize() / 1024);
+	}
+
+	if (options.allocationWarmup)
+	{
+		printf("Allocations after %u warm-up request(s): %llu in %llu request(s)\n", options.allocationWarmup, (unsigned long long)results.allocations, (unsigned long long)results.allocatingFrames);
+	}
+	return succeeded && !results.allocatingFrames ? 0 : 1;
+}
\ No newline at end of file
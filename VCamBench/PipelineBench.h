@@ -0,0 +1,56 @@
+#pragma once
+
+// The request-generate-queue loop of MediaStream::RequestSample, run against in-process stand-ins for the sample allocator and the event queue.
+// Samples come from a fixed pool like the frame server's allocator, are generated with the portable parts of the frame path (pattern, picture-in-picture,
+// frame code, CRC32C) and are queued to consumer threads that each copy every frame, like the frame server serving several applications.
+#include <cstdint>
+#include <memory>
+#include "../VCamSampleSource/PipCompositor.h"
+#include "../VCamSampleSource/FrameTiming.h"
+#include "../VCamSampleSource/ThreadPolicy.h"
+
+struct PipelineOptions
+{
+	uint32_t width;
+	uint32_t height;
+	PipFormat format;
+	uint32_t frames;
+	uint32_t fps; // 0 requests frames as fast as samples are available
+	uint32_t consumers;
+	uint32_t samples; // in the allocator's pool
+	bool code;
+	bool crc;
+	uint32_t allocationWarmup; // requests after these must not allocate, 0 doesn't check
+	bool largePages; // samples' buffers are large pages when the system has some
+	ThreadPriority producerPriority; // of the requesting thread while it requests a frame, like MediaStream::RequestSample
+	uint64_t producerAffinity; // the requests are pinned to a processor of the mask when not 0
+};
+
+struct PipelineConsumerResults
+{
+	FrameTimingHistogram latency; // from the request to this consumer's copy of the frame
+	uint64_t frames;
+	uint64_t verified;
+};
+
+struct PipelineResults
+{
+	FrameTiming timing; // of the request stages
+	std::unique_ptr<PipelineConsumerResults[]> consumers;
+	double seconds;
+	double cpuSeconds;
+	uint64_t produced;
+	uint64_t empty; // requests that found the pool empty
+	uint64_t failed;
+	uint64_t allocatingFrames; // requests after the warm-up that allocated
+	uint64_t allocations;
+	uint32_t producerProcessor; // THREAD_POLICY_NO_PROCESSOR when not pinned
+	bool producerPolicyApplied;
+	uint64_t migrations; // requests that didn't run on the previous request's processor
+};
+
+// main & compositor are started, false if a frame cannot be generated
+bool RunRequestLoop(const PipelineOptions& options, PipSource& main, PipCompositor& compositor, PipelineResults& results);
+
+// runs the loop & prints the results, returns the process exit code
+int RunPipeline(const PipelineOptions& options, PipSource& main, PipCompositor& compositor);
\ No newline at end of file
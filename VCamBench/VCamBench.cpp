@@ -0,0 +1,310 @@
+// Headless benchmark for the VCamSample picture-in-picture compositor, it needs no camera, no GPU and no Windows.
+// A pattern main frame gets pattern insets and one deliberately slow inset, frames are composed at the stream's rate and compose times are reported.
+// With -c, each frame also gets the frame code, is scaled to 2/3 like a received frame, and the code is decoded back.
+// With -k, the CRC32C of each frame is computed, and verified on a copy with a different stride like a received frame.
+// With -p, frames go through the request-generate-queue loop of the media source, against stand-ins for the sample allocator & the event queue (see PipelineBench.h).
+// With -b or -g, a fixed suite of benchmarks is run, its results are written as JSON and compared to a baseline (see BenchSuite.h).
+// With -e, a correctness check is run instead (see BenchChecks.h).
+// On Linux: g++ -O2 -std=c++17 -msse2 -pthread VCamBench/*.cpp VCamSampleSource/PipCompositor.cpp VCamSampleSource/FrameCode.cpp VCamSampleSource/FrameCrc.cpp VCamSampleSource/FrameTiming.cpp VCamSampleSource/ColorConvert.cpp VCamSampleSource/AllocationCounter.cpp VCamSampleSource/FrameBuffer.cpp VCamSampleSource/TaskScheduler.cpp VCamSampleSource/TileRasterizer.cpp VCamSampleSource/ThreadPolicy.cpp VCamSampleSource/ColorLut.cpp VCamProducer/FrameProducer.cpp -o vcambench
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <vector>
+#include "../VCamSampleSource/PipCompositor.h"
+#include "../VCamSampleSource/FrameCode.h"
+#include "../VCamSampleSource/FrameCrc.h"
+#include "../VCamSampleSource/FrameRing.h"
+#include "PipelineBench.h"
+#include "BenchSuite.h"
+#include "BenchChecks.h"
+
+// a pattern source that takes a given time to produce each frame, like a file source stuck on I/O
+class SlowSource : public PipSource
+{
+	PipPatternSource _pattern;
+	uint32_t _delayMs;
+
+public:
+	SlowSource(uint32_t delayMs) :
+		_delayMs(delayMs)
+	{
+	}
+
+	// frames are twice the inset size, so they're also scaled down
+	bool Start(uint32_t width, uint32_t height, uint32_t fpsNumerator, uint32_t fpsDenominator) { return _pattern.Start(width * 2, height * 2, fpsNumerator, fpsDenominator); }
+	bool GetFrame(int64_t time, PipFormat preferredFormat, PipFrame& frame)
+	{
+		std::this_thread::sleep_for(std::chrono::milliseconds(_delayMs));
+		return _pattern.GetFrame(time, preferredFormat, frame);
+	}
+	void Stop() { _pattern.Stop(); }
+};
+
+static void Usage()
+{
+	printf("Usage: vcambench [-w width] [-h height] [-f rgb32|nv12] [-n frames] [-r fps] [-i insets] [-s slowms] [-c] [-k] [-p consumers [-a samples] [-z warmup] [-l] [-y priority] [-x mask]]\n");
+	printf("  defaults: 1920x1080 nv12, 300 frames at 30 fps, 2 insets plus 1 inset taking 100 ms per frame (-s 0 for none)\n");
+	printf("  -c: burn the frame code in frames, and decode it from frames scaled to 2/3\n");
+	printf("  -k: compute the CRC32C of frames, and verify them\n");
+	printf("  -p: request frames through a pool of samples (default 10) and queue them to consumers that copy them, -r 0 requests them as fast as possible\n");
+	printf("  -z: fail if a request allocates after the first warmup requests\n");
+	printf("  -l: back the samples with large pages (on Linux, reserved huge pages or else transparent huge pages)\n");
+	printf("  -y: priority of the requests, 0 normal, 1 above normal, 2 highest, 3 real-time (on Linux, raising it needs CAP_SYS_NICE)\n");
+	printf("  -x: pin the requests to a processor of the mask (hexadecimal, bit n for processor n)\n");
+	printf("   or: vcambench [-b results.json] [-g baseline.json [-t percent]] [-m samples]\n");
+	printf("  -b: run the benchmark suite and write its results, -g: compare them to a baseline, failing on significant slowdowns above -t (default 10%%)\n");
+	printf("   or: vcambench -e ring [-w width] [-h height] [-f rgb32|nv12] [-n frames]\n");
+	printf("   or: vcambench -e lut\n");
+	printf("   or: vcambench -e scheduler [-n rounds]\n");
+	printf("  -e ring: publish frames in the shared memory ring from a thread and check none is read torn, and that tampered rings are rejected\n");
+	printf("  -e lut: check the 3D LUT kernels against scalar references and plain conversions, failing above the tolerance\n");
+	printf("  -e scheduler: check the task scheduler's loops, nested, from concurrent threads, throwing, and across stops\n");
+}
+
+int main(int argc, char* argv[])
+{
+	uint32_t width = 1920;
+	uint32_t height = 1080;
+	auto format = PipFormat::Nv12;
+	uint32_t frames = 300;
+	uint32_t fps = 30;
+	uint32_t insets = 2;
+	uint32_t slowMs = 100;
+	auto code = false;
+	auto crc = false;
+	uint32_t consumers = 0;
+	uint32_t samples = 10;
+	uint32_t allocationWarmup = 0;
+	auto largePages = false;
+	uint32_t priority = 0;
+	uint64_t affinity = 0;
+	BenchSuiteOptions suite{ nullptr, nullptr, 10, 15 };
+	const char* check = nullptr;
+	for (int i = 1; i < argc; i++)
+	{
+		auto hasValue = i + 1 < argc;
+		if (!strcmp(argv[i], "-w") && hasValue) width = (uint32_t)atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-h") && hasValue) height = (uint32_t)atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-n") && hasValue) frames = (uint32_t)atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-r") && hasValue) fps = (uint32_t)atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-i") && hasValue) insets = (uint32_t)atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-s") && hasValue) slowMs = (uint32_t)atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-p") && hasValue) consumers = (uint32_t)atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-a") && hasValue) samples = (uint32_t)atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-z") && hasValue) allocationWarmup = (uint32_t)atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-y") && hasValue) priority = (uint32_t)atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-x") && hasValue) affinity = strtoull(argv[++i], nullptr, 16);
+		else if (!strcmp(argv[i], "-b") && hasValue) suite.resultsPath = argv[++i];
+		else if (!strcmp(argv[i], "-g") && hasValue) suite.baselinePath = argv[++i];
+		else if (!strcmp(argv[i], "-t") && hasValue) suite.tolerance = atof(argv[++i]);
+		else if (!strcmp(argv[i], "-m") && hasValue) suite.samples = (uint32_t)atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-e") && hasValue) check = argv[++i];
+		else if (!strcmp(argv[i], "-c")) code = true;
+		else if (!strcmp(argv[i], "-k")) crc = true;
+		else if (!strcmp(argv[i], "-l")) largePages = true;
+		else if (!strcmp(argv[i], "-f") && hasValue)
+		{
+			i++;
+			if (!strcmp(argv[i], "rgb32")) format = PipFormat::Rgb32;
+			else if (!strcmp(argv[i], "nv12")) format = PipFormat::Nv12;
+			else
+			{
+				Usage();
+				return 1;
+			}
+		}
+		else
+		{
+			Usage();
+			return 1;
+		}
+	}
+
+	if (suite.resultsPath || suite.baselinePath)
+	{
+		if (suite.tolerance < 0)
+		{
+			Usage();
+			return 1;
+		}
+
+		if (suite.samples < GetMinBenchSuiteSamples())
+		{
+			printf("-m must be at least %u, fewer samples cannot show a significant slowdown\n", GetMinBenchSuiteSamples());
+			return 1;
+		}
+		return RunBenchSuite(suite);
+	}
+
+	if (check)
+	{
+		if (!strcmp(check, "ring") && width && height && frames && (format == PipFormat::Rgb32 || (!(width & 1) && !(height & 1))))
+			return RunRingCheck(format == PipFormat::Rgb32 ? FRAME_RING_FORMAT_BGRA : FRAME_RING_FORMAT_NV12, width, height, frames);
+
+		if (!strcmp(check, "lut"))
+			return RunLutCheck();
+
+		if (!strcmp(check, "scheduler") && frames)
+			return RunSchedulerCheck(frames);
+
+		Usage();
+		return 1;
+	}
+
+	if (!width || !height || !frames || (!fps && !consumers) || !samples || insets + (slowMs ? 1 : 0) > PIP_MAX_INSETS || priority > (uint32_t)ThreadPriority::RealTime)
+	{
+		Usage();
+		return 1;
+	}
+
+	// insets are a quarter of the frame, along the bottom, the slow one top left
+	PipCompositor compositor;
+	auto insetWidth = width / 4;
+	auto insetHeight = height / 4;
+	for (uint32_t i = 0; i < insets; i++)
+	{
+		compositor.AddInset(std::make_unique<PipPatternSource>(), (int32_t)(width - (i + 1) * (insetWidth + 16)), (int32_t)(height - insetHeight - 16), insetWidth, insetHeight);
+	}
+
+	if (slowMs)
+	{
+		compositor.AddInset(std::make_unique<SlowSource>(slowMs), 16, 16, insetWidth, insetHeight);
+	}
+
+	PipPatternSource main;
+	if (!main.Start(width, height, fps ? fps : 30, 1) || !compositor.Start(fps ? fps : 30, 1))
+	{
+		printf("Sources cannot be started for %ux%u\n", width, height);
+		return 1;
+	}
+
+	if (consumers)
+	{
+		if (code && !FrameCodeFits(width, height))
+		{
+			printf("Frame code needs frames of at least %ux%u\n", FRAME_CODE_MIN_WIDTH, FRAME_CODE_MIN_HEIGHT);
+			return 1;
+		}
+
+		PipelineOptions options{ width, height, format, frames, fps, consumers, samples, code, crc, allocationWarmup, largePages, (ThreadPriority)priority, affinity };
+		auto result = RunPipeline(options, main, compositor);
+		compositor.Stop();
+		main.Stop();
+		return result;
+	}
+
+	std::vector<uint8_t> output((size_t)width * height * 4);
+	auto stride = (int32_t)(format == PipFormat::Rgb32 ? width * 4 : width);
+	auto uv = output.data() + (size_t)width * height;
+	std::vector<double> times;
+	times.reserve(frames);
+
+	// the code is read from the Y plane of NV12 frames
+	auto codeFormat = format == PipFormat::Rgb32 ? FrameCodeFormat::Rgb32 : FrameCodeFormat::Nv12;
+	auto channels = format == PipFormat::Rgb32 ? 4u : 1u;
+	auto receivedWidth = width * 2 / 3;
+	auto receivedHeight = height * 2 / 3;
+	std::vector<uint8_t> received((size_t)receivedWidth * receivedHeight * channels);
+	PlaneScaler receiver;
+	if (code && (!FrameCodeFits(receivedWidth, receivedHeight) || !receiver.Initialize(width, height, receivedWidth, receivedHeight, channels)))
+	{
+		printf("Frame code needs frames of at least %ux%u after scaling\n", FRAME_CODE_MIN_WIDTH, FRAME_CODE_MIN_HEIGHT);
+		return 1;
+	}
+	uint32_t decoded = 0;
+
+	// received frames have rows padded to 64 bytes more
+	auto crcFormat = format == PipFormat::Rgb32 ? FrameCrcFormat::Rgb32 : FrameCrcFormat::Nv12;
+	auto copyStride = stride + 64;
+	std::vector<uint8_t> copy((size_t)copyStride * height * 3 / 2);
+	auto copyUV = copy.data() + (size_t)copyStride * height;
+	std::vector<double> crcTimes;
+	crcTimes.reserve(frames);
+	uint32_t verified = 0;
+
+	printf("Composing %u frames %ux%u %s at %u fps with %u inset(s)\n", frames, width, height, format == PipFormat::Rgb32 ? "RGB32" : "NV12", fps, compositor.GetInsetCount());
+	auto start = std::chrono::steady_clock::now();
+	auto period = std::chrono::nanoseconds(1000000000ull / fps);
+	for (uint32_t i = 0; i < frames; i++)
+	{
+		// frames are paced like a stream, so workers get the same time as in the camera
+		auto due = start + period * i;
+		std::this_thread::sleep_until(due);
+		auto time = (int64_t)i * 10000000 / fps;
+		PipFrame frame{};
+		auto composeStart = std::chrono::steady_clock::now();
+		if (!main.GetFrame(time, format, frame) || !compositor.Compose(frame, time, output.data(), stride, uv, stride))
+		{
+			printf("Frame %u cannot be composed\n", i);
+			return 1;
+		}
+		times.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - composeStart).count());
+
+		if (code)
+		{
+			FrameCode written{ i, (uint64_t)time };
+			FrameCode read{};
+			WriteFrameCode(written, codeFormat, output.data(), stride, uv, stride, width, height);
+			receiver.Scale(output.data(), stride, received.data(), (int32_t)(receivedWidth * channels));
+			if (ReadFrameCode(codeFormat, received.data(), (int32_t)(receivedWidth * channels), receivedWidth, receivedHeight, read) && read.frame == written.frame && read.time == written.time)
+			{
+				decoded++;
+			}
+		}
+
+		if (crc)
+		{
+			uint32_t crcs[FRAME_CRC_MAX_PLANES];
+			auto crcStart = std::chrono::steady_clock::now();
+			auto planes = FrameCrc32c(crcFormat, output.data(), stride, uv, stride, width, height, crcs);
+			crcTimes.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - crcStart).count());
+
+			auto rowSize = format == PipFormat::Rgb32 ? width * 4 : width;
+			for (uint32_t row = 0; row < height; row++)
+			{
+				memcpy(copy.data() + (size_t)row * copyStride, output.data() + (size_t)row * stride, rowSize);
+			}
+
+			for (uint32_t row = 0; format == PipFormat::Nv12 && row < height / 2; row++)
+			{
+				memcpy(copyUV + (size_t)row * copyStride, uv + (size_t)row * stride, width);
+			}
+
+			if (VerifyFrameCrc32c(crcs, planes, crcFormat, copy.data(), copyStride, copyUV, copyStride, width, height))
+			{
+				verified++;
+			}
+		}
+	}
+	compositor.Stop();
+	main.Stop();
+
+	std::sort(times.begin(), times.end());
+	double total = 0;
+	for (auto t : times)
+	{
+		total += t;
+	}
+	printf("Frame (main + compose) ms: avg %.3f  p50 %.3f  p99 %.3f  max %.3f\n", total / times.size(), times[times.size() / 2], times[std::min<size_t>(times.size() * 99 / 100, times.size() - 1)], times.back());
+	for (uint32_t i = 0; i < compositor.GetInsetCount(); i++)
+	{
+		uint64_t rendered, reused;
+		compositor.GetInsetStats(i, rendered, reused);
+		printf("Inset %u%s: rendered %llu, reused previous %llu\n", i, slowMs && i == insets ? " (slow)" : "", (unsigned long long)rendered, (unsigned long long)reused);
+	}
+
+	if (code)
+	{
+		printf("Frame code decoded from %ux%u frames: %u of %u\n", receivedWidth, receivedHeight, decoded, frames);
+	}
+
+	if (crc)
+	{
+		std::sort(crcTimes.begin(), crcTimes.end());
+		printf("Frame CRC32C ms (one thread): p50 %.3f  max %.3f, verified %u of %u\n", crcTimes[crcTimes.size() / 2], crcTimes.back(), verified, frames);
+	}
+	return 0;
+}
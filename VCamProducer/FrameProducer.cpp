@@ -0,0 +1,264 @@
+#include "FrameProducer.h"
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+bool FrameRingMapping::Open(size_t size, bool create)
+{
+	Close();
+#ifdef _WIN32
+	auto handle = OpenFileMappingW(FILE_MAP_READ | FILE_MAP_WRITE, FALSE, FRAME_RING_WINDOWS_NAME);
+	if (!handle && create)
+	{
+		handle = CreateFileMappingW(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, (DWORD)((unsigned long long)size >> 32), (DWORD)size, FRAME_RING_WINDOWS_NAME);
+		_created = handle && GetLastError() != ERROR_ALREADY_EXISTS;
+	}
+
+	if (!handle)
+		return false;
+
+	_memory = MapViewOfFile(handle, FILE_MAP_READ | FILE_MAP_WRITE, 0, 0, 0);
+	if (!_memory)
+	{
+		CloseHandle(handle);
+		return false;
+	}
+
+	MEMORY_BASIC_INFORMATION mbi{};
+	VirtualQuery(_memory, &mbi, sizeof(mbi));
+	_size = mbi.RegionSize;
+	_handle = handle;
+#else
+	auto fd = shm_open(FRAME_RING_POSIX_NAME, O_RDWR, 0);
+	if (fd < 0 && create)
+	{
+		fd = shm_open(FRAME_RING_POSIX_NAME, O_RDWR | O_CREAT | O_EXCL, 0660);
+		if (fd >= 0)
+		{
+			if (ftruncate(fd, (off_t)size) != 0)
+			{
+				close(fd);
+				shm_unlink(FRAME_RING_POSIX_NAME);
+				return false;
+			}
+			_created = true;
+		}
+	}
+
+	if (fd < 0)
+		return false;
+
+	struct stat st {};
+	if (fstat(fd, &st) != 0 || !st.st_size)
+	{
+		close(fd);
+		return false;
+	}
+
+	auto memory = mmap(nullptr, (size_t)st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd); // the mapping keeps the object alive
+	if (memory == MAP_FAILED)
+		return false;
+
+	_memory = memory;
+	_size = (size_t)st.st_size;
+#endif
+	return true;
+}
+
+void FrameRingMapping::Close()
+{
+#ifdef _WIN32
+	if (_memory)
+	{
+		UnmapViewOfFile(_memory);
+	}
+
+	if (_handle)
+	{
+		CloseHandle(_handle);
+	}
+#else
+	if (_memory)
+	{
+		munmap(_memory, _size);
+	}
+#endif
+	_handle = nullptr;
+	_memory = nullptr;
+	_size = 0;
+	_created = false;
+}
+
+void FrameRingMapping::Unlink()
+{
+#ifndef _WIN32
+	shm_unlink(FRAME_RING_POSIX_NAME);
+#endif
+}
+
+bool FrameProducer::Open(uint32_t format, uint32_t width, uint32_t height, uint32_t fpsNumerator, uint32_t fpsDenominator, uint32_t slotCount)
+{
+	Close();
+	auto stride = FrameRingAlign(format == FRAME_RING_FORMAT_BGRA ? width * 4 : width);
+	auto slotSize = FrameRingAlign(sizeof(FrameRingSlot) + FrameRingFrameSize(format, stride, height));
+	if (!_mapping.Open(FrameRingSize(slotCount, slotSize), true))
+		return false;
+
+	if (_mapping.IsCreated() && !FrameRingInitialize(_mapping.GetMemory(), _mapping.GetSize(), slotCount, format, width, height, fpsNumerator, fpsDenominator))
+	{
+		Close();
+		return false;
+	}
+
+	// the ring may have been created by the virtual camera, from its settings
+	_header = FrameRingValidate(_mapping.GetMemory(), _mapping.GetSize());
+	if (!_header || _header->format != format || _header->width != width || _header->height != height)
+	{
+		Close();
+		return false;
+	}
+
+	_header->fpsNumerator = fpsNumerator;
+	_header->fpsDenominator = fpsDenominator;
+	_frameNumber = _header->published.load() >> 8;
+	return true;
+}
+
+void FrameProducer::Close()
+{
+	if (_header && _writing)
+	{
+		// give back the claimed slot, making its sequence even again
+		auto slot = FrameRingGetSlot(_header, _slot);
+		slot->sequence.store(slot->sequence.load() + 1);
+	}
+
+	_header = nullptr;
+	_slot = FRAME_RING_NO_SLOT;
+	_writing = false;
+	_mapping.Close();
+}
+
+uint8_t* FrameProducer::BeginFrame()
+{
+	if (!_header)
+		return nullptr;
+
+	if (!_writing)
+	{
+		auto slot = FrameRingBeginWrite(_header, _slot);
+		if (slot == FRAME_RING_NO_SLOT)
+			return nullptr;
+
+		_slot = slot;
+		_writing = true;
+	}
+	return FrameRingGetPixels(FrameRingGetSlot(_header, _slot));
+}
+
+bool FrameProducer::EndFrame(int64_t timestamp)
+{
+	if (!_header || !_writing)
+		return false;
+
+	FrameRingEndWrite(_header, _slot, ++_frameNumber, timestamp);
+	_writing = false;
+	return true;
+}
+
+bool FrameProducer::WriteFrame(const uint8_t* data, uint32_t stride, int64_t timestamp)
+{
+	if (!data)
+		return false;
+
+	auto pixels = BeginFrame();
+	if (!pixels)
+		return false;
+
+	auto ringStride = _header->stride;
+	auto height = _header->height;
+	auto rowSize = _header->format == FRAME_RING_FORMAT_BGRA ? _header->width * 4 : _header->width;
+	for (uint32_t y = 0; y < height; y++)
+	{
+		memcpy(pixels + (size_t)y * ringStride, data + (size_t)y * stride, rowSize);
+	}
+
+	// chroma planes follow the luma plane in both buffers
+	if (_header->format == FRAME_RING_FORMAT_NV12)
+	{
+		auto uv = data + (size_t)stride * height;
+		auto ringUV = pixels + (size_t)ringStride * height;
+		for (uint32_t y = 0; y < height / 2; y++)
+		{
+			memcpy(ringUV + (size_t)y * ringStride, uv + (size_t)y * stride, rowSize);
+		}
+	}
+	else if (_header->format == FRAME_RING_FORMAT_I420)
+	{
+		auto chroma = data + (size_t)stride * height;
+		auto ringChroma = pixels + (size_t)ringStride * height;
+		for (uint32_t y = 0; y < height; y++) // U rows then V rows
+		{
+			memcpy(ringChroma + (size_t)y * (ringStride / 2), chroma + (size_t)y * (stride / 2), rowSize / 2);
+		}
+	}
+	return EndFrame(timestamp);
+}
+
+bool FrameConsumer::Open()
+{
+	Close();
+	if (!_mapping.Open(0, false))
+		return false;
+
+	_header = FrameRingValidate(_mapping.GetMemory(), _mapping.GetSize(), &_layout);
+	if (!_header)
+	{
+		_mapping.Close();
+		return false;
+	}
+	return true;
+}
+
+void FrameConsumer::Close()
+{
+	Release();
+	_header = nullptr;
+	_mapping.Close();
+}
+
+const uint8_t* FrameConsumer::Acquire(uint64_t* frameNumber, int64_t* timestamp)
+{
+	if (!_header)
+		return nullptr;
+
+	auto slot = FrameRingAcquire(_header, _layout);
+	if (!slot)
+		return nullptr;
+
+	if (frameNumber)
+	{
+		*frameNumber = slot->frameNumber.load();
+	}
+
+	if (timestamp)
+	{
+		*timestamp = slot->timestamp;
+	}
+	return FrameRingGetPixels(slot);
+}
+
+void FrameConsumer::Release()
+{
+	if (_header)
+	{
+		FrameRingRelease(_header);
+	}
+}
@@ -0,0 +1,105 @@
+#pragma once
+
+// Producer library for the VCamSample shared memory frame ring.
+// Builds on Windows (named file mapping) and on POSIX systems (shm_open), the latter being a stand-in that allows testing both sides of the ring on Linux.
+#include <cstdint>
+#include <cstddef>
+#include "../VCamSampleSource/FrameRing.h"
+
+class FrameRingMapping
+{
+	void* _handle;
+	void* _memory;
+	size_t _size;
+	bool _created;
+
+public:
+	FrameRingMapping() :
+		_handle(nullptr),
+		_memory(nullptr),
+		_size(0),
+		_created(false)
+	{
+	}
+
+	~FrameRingMapping()
+	{
+		Close();
+	}
+
+	FrameRingMapping(const FrameRingMapping&) = delete;
+	FrameRingMapping& operator=(const FrameRingMapping&) = delete;
+
+	// opens the existing ring, or creates it with the given size if it doesn't exist and create is true
+	bool Open(size_t size, bool create);
+	void Close();
+
+	void* GetMemory() const { return _memory; }
+	size_t GetSize() const { return _size; }
+	bool IsCreated() const { return _created; }
+
+	// POSIX only: removes the shared memory name, it's a no-op on Windows where the object goes away with the last handle
+	static void Unlink();
+};
+
+class FrameProducer
+{
+	FrameRingMapping _mapping;
+	FrameRingHeader* _header;
+	uint32_t _slot;
+	uint64_t _frameNumber;
+	bool _writing;
+
+public:
+	FrameProducer() :
+		_header(nullptr),
+		_slot(FRAME_RING_NO_SLOT),
+		_frameNumber(0),
+		_writing(false)
+	{
+	}
+
+	// opens the ring created by the virtual camera (with matching parameters), or creates it if it doesn't exist yet.
+	// on Windows, creating a global object requires SeCreateGlobalPrivilege, so start the camera first when running as a normal user.
+	bool Open(uint32_t format, uint32_t width, uint32_t height, uint32_t fpsNumerator, uint32_t fpsDenominator, uint32_t slotCount = 4);
+	void Close();
+
+	uint32_t GetFormat() const { return _header ? _header->format : 0; }
+	uint32_t GetWidth() const { return _header ? _header->width : 0; }
+	uint32_t GetHeight() const { return _header ? _header->height : 0; }
+	uint32_t GetStride() const { return _header ? _header->stride : 0; }
+
+	// returns the buffer to render the next frame to (GetStride() bytes per row), nullptr on error. Each call must be followed by EndFrame
+	uint8_t* BeginFrame();
+
+	// publishes the frame rendered in the buffer returned by BeginFrame, timestamp is in 100ns units
+	bool EndFrame(int64_t timestamp);
+
+	// copies a frame in the ring & publishes it, stride is the source's luma (or BGRA) stride
+	bool WriteFrame(const uint8_t* data, uint32_t stride, int64_t timestamp);
+};
+
+// consumer side, mostly for testing the ring outside of the virtual camera
+class FrameConsumer
+{
+	FrameRingMapping _mapping;
+	FrameRingHeader* _header;
+	FrameRingLayout _layout;
+
+public:
+	FrameConsumer() :
+		_header(nullptr),
+		_layout()
+	{
+	}
+
+	bool Open();
+	void Close();
+
+	const FrameRingHeader* GetHeader() const { return _header; }
+	const FrameRingLayout& GetLayout() const { return _layout; }
+
+	// returns the last published frame's pixels (valid until the next Acquire or Release call), nullptr if there's none yet
+	const uint8_t* Acquire(uint64_t* frameNumber, int64_t* timestamp);
+	void Release();
+};
@@ -0,0 +1,136 @@
+// Sample producer for the VCamSample shared memory frame ring.
+// Set the "Source" setting to "ring" (see README), start the virtual camera, then run this program.
+// It renders moving color bars and publishes them at the requested frame rate, until it's stopped with Ctrl+C.
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <vector>
+#include "../VCamProducer/FrameProducer.h"
+
+static volatile sig_atomic_t _stop;
+
+static void OnSignal(int)
+{
+	_stop = 1;
+}
+
+static void RenderBGRA(uint8_t* pixels, uint32_t stride, uint32_t width, uint32_t height, uint64_t frame)
+{
+	for (uint32_t y = 0; y < height; y++)
+	{
+		auto row = pixels + (size_t)y * stride;
+		for (uint32_t x = 0; x < width; x++)
+		{
+			auto bar = ((x + frame * 4) * 8 / width) % 8;
+			row[x * 4 + 0] = (bar & 1) ? 0xFF : 0;
+			row[x * 4 + 1] = (bar & 4) ? 0xFF : 0;
+			row[x * 4 + 2] = (bar & 2) ? 0xFF : 0;
+			row[x * 4 + 3] = 0xFF;
+		}
+	}
+}
+
+static void RenderYUV(uint8_t* pixels, uint32_t stride, uint32_t width, uint32_t height, uint64_t frame, bool nv12)
+{
+	static const uint8_t barsY[8] = { 16, 41, 145, 170, 81, 106, 210, 235 };
+	static const uint8_t barsU[8] = { 128, 240, 54, 166, 90, 202, 16, 128 };
+	static const uint8_t barsV[8] = { 128, 110, 34, 16, 240, 222, 146, 128 };
+	auto bar = [&](uint32_t x) { return (uint32_t)(((x + frame * 4) * 8 / width) % 8); };
+	for (uint32_t y = 0; y < height; y++)
+	{
+		auto row = pixels + (size_t)y * stride;
+		for (uint32_t x = 0; x < width; x++)
+		{
+			row[x] = barsY[bar(x)];
+		}
+	}
+
+	auto chroma = pixels + (size_t)stride * height;
+	for (uint32_t y = 0; y < height / 2; y++)
+	{
+		if (nv12)
+		{
+			auto row = chroma + (size_t)y * stride;
+			for (uint32_t x = 0; x < width / 2; x++)
+			{
+				row[x * 2] = barsU[bar(x * 2)];
+				row[x * 2 + 1] = barsV[bar(x * 2)];
+			}
+		}
+		else
+		{
+			auto u = chroma + (size_t)y * (stride / 2);
+			auto v = chroma + (size_t)(height / 2 + y) * (stride / 2);
+			for (uint32_t x = 0; x < width / 2; x++)
+			{
+				u[x] = barsU[bar(x * 2)];
+				v[x] = barsV[bar(x * 2)];
+			}
+		}
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	// usage: VCamProducerSample [NV12|I420|BGRA] [width] [height] [fps]
+	auto formatName = argc > 1 ? argv[1] : "NV12";
+	auto width = argc > 2 ? (uint32_t)atoi(argv[2]) : 1280u;
+	auto height = argc > 3 ? (uint32_t)atoi(argv[3]) : 960u;
+	auto fps = argc > 4 ? (uint32_t)atoi(argv[4]) : 30u;
+	uint32_t format = FRAME_RING_FORMAT_NV12;
+	if (!strcmp(formatName, "I420"))
+	{
+		format = FRAME_RING_FORMAT_I420;
+	}
+	else if (!strcmp(formatName, "BGRA"))
+	{
+		format = FRAME_RING_FORMAT_BGRA;
+	}
+
+	if (!width || !height || !fps)
+	{
+		fprintf(stderr, "Invalid parameters.\n");
+		return 1;
+	}
+
+	FrameProducer producer;
+	if (!producer.Open(format, width, height, fps, 1))
+	{
+		fprintf(stderr, "Cannot open the frame ring, make sure the virtual camera is started with the same format & size.\n");
+		return 1;
+	}
+
+	signal(SIGINT, OnSignal);
+	printf("Producing %s %u x %u at %u fps, press Ctrl+C to stop.\n", formatName, width, height, fps);
+
+	auto start = std::chrono::steady_clock::now();
+	auto period = std::chrono::nanoseconds(1000000000 / fps);
+	uint64_t frame = 0;
+	while (!_stop)
+	{
+		auto pixels = producer.BeginFrame();
+		if (pixels)
+		{
+			if (format == FRAME_RING_FORMAT_BGRA)
+			{
+				RenderBGRA(pixels, producer.GetStride(), width, height, frame);
+			}
+			else
+			{
+				RenderYUV(pixels, producer.GetStride(), width, height, frame, format == FRAME_RING_FORMAT_NV12);
+			}
+
+			auto now = std::chrono::steady_clock::now();
+			producer.EndFrame(std::chrono::duration_cast<std::chrono::nanoseconds>(now - start).count() / 100);
+		}
+
+		frame++;
+		std::this_thread::sleep_until(start + period * frame);
+	}
+
+	producer.Close();
+	return 0;
+}
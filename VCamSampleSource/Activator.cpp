@@ -3,6 +3,7 @@
 #include "Tools.h"
 #include "EnumNames.h"
 #include "MFTools.h"
+#include "FrameTiming.h"
 #include "FrameGenerator.h"
 #include "MediaStream.h"
 #include "MediaSource.h"
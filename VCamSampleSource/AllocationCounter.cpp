@@ -0,0 +1,124 @@
+#include "AllocationCounter.h"
+#include <cstdlib>
+#include <new>
+#if defined(_MSC_VER)
+#include <malloc.h>
+#endif
+
+// constant initialized, so the operators can use them before anything else runs on a thread
+static thread_local uint64_t _allocations = 0;
+static thread_local uint64_t _deallocations = 0;
+
+AllocationCounts GetThreadAllocationCounts()
+{
+	return AllocationCounts{ _allocations, _deallocations };
+}
+
+static void* Allocate(size_t size) noexcept
+{
+	auto p = malloc(size ? size : 1);
+	if (p)
+	{
+		_allocations++;
+	}
+	return p;
+}
+
+static void* AllocateAligned(size_t size, size_t alignment) noexcept
+{
+	if (!size)
+	{
+		size = 1;
+	}
+#if defined(_MSC_VER)
+	auto p = _aligned_malloc(size, alignment);
+#else
+	void* p;
+	if (posix_memalign(&p, alignment < sizeof(void*) ? sizeof(void*) : alignment, size))
+	{
+		p = nullptr;
+	}
+#endif
+	if (p)
+	{
+		_allocations++;
+	}
+	return p;
+}
+
+static void Free(void* p) noexcept
+{
+	if (p)
+	{
+		_deallocations++;
+		free(p);
+	}
+}
+
+static void FreeAligned(void* p) noexcept
+{
+	if (p)
+	{
+		_deallocations++;
+#if defined(_MSC_VER)
+		_aligned_free(p);
+#else
+		free(p);
+#endif
+	}
+}
+
+// the throwing versions call the new handler until it gives up, as the standard ones do
+static void* AllocateOrThrow(size_t size)
+{
+	for (;;)
+	{
+		auto p = Allocate(size);
+		if (p)
+			return p;
+
+		auto handler = std::get_new_handler();
+		if (!handler)
+			throw std::bad_alloc();
+
+		handler();
+	}
+}
+
+static void* AllocateAlignedOrThrow(size_t size, size_t alignment)
+{
+	for (;;)
+	{
+		auto p = AllocateAligned(size, alignment);
+		if (p)
+			return p;
+
+		auto handler = std::get_new_handler();
+		if (!handler)
+			throw std::bad_alloc();
+
+		handler();
+	}
+}
+
+void* operator new(size_t size) { return AllocateOrThrow(size); }
+void* operator new[](size_t size) { return AllocateOrThrow(size); }
+void* operator new(size_t size, const std::nothrow_t&) noexcept { return Allocate(size); }
+void* operator new[](size_t size, const std::nothrow_t&) noexcept { return Allocate(size); }
+void* operator new(size_t size, std::align_val_t alignment) { return AllocateAlignedOrThrow(size, (size_t)alignment); }
+void* operator new[](size_t size, std::align_val_t alignment) { return AllocateAlignedOrThrow(size, (size_t)alignment); }
+void* operator new(size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept { return AllocateAligned(size, (size_t)alignment); }
+void* operator new[](size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept { return AllocateAligned(size, (size_t)alignment); }
+
+void operator delete(void* p) noexcept { Free(p); }
+void operator delete[](void* p) noexcept { Free(p); }
+void operator delete(void* p, size_t) noexcept { Free(p); }
+void operator delete[](void* p, size_t) noexcept { Free(p); }
+void operator delete(void* p, const std::nothrow_t&) noexcept { Free(p); }
+void operator delete[](void* p, const std::nothrow_t&) noexcept { Free(p); }
+void operator delete(void* p, std::align_val_t) noexcept { FreeAligned(p); }
+void operator delete[](void* p, std::align_val_t) noexcept { FreeAligned(p); }
+void operator delete(void* p, size_t, std::align_val_t) noexcept { FreeAligned(p); }
+void operator delete[](void* p, size_t, std::align_val_t) noexcept { FreeAligned(p); }
+void operator delete(void* p, std::align_val_t, const std::nothrow_t&) noexcept { FreeAligned(p); }
+void operator delete[](void* p, std::align_val_t, const std::nothrow_t&) noexcept { FreeAligned(p); }
\ No newline at end of file
@@ -0,0 +1,29 @@
+#pragma once
+
+// Counts the calls to the global operator new & delete made by the calling thread, so the frame path can be checked to allocate nothing once warmed up.
+// The replacement operators are defined in AllocationCounter.cpp and only see the allocations of the module it's linked in: Media Foundation,
+// Direct2D & the other system components allocate from their own heaps.
+#include <cstdint>
+
+struct AllocationCounts
+{
+	uint64_t allocations;
+	uint64_t deallocations;
+};
+
+AllocationCounts GetThreadAllocationCounts();
+
+// what the calling thread allocated since the scope was constructed
+class AllocationScope
+{
+	AllocationCounts _start;
+
+public:
+	AllocationScope() :
+		_start(GetThreadAllocationCounts())
+	{
+	}
+
+	uint64_t GetAllocations() const { return GetThreadAllocationCounts().allocations - _start.allocations; }
+	uint64_t GetDeallocations() const { return GetThreadAllocationCounts().deallocations - _start.deallocations; }
+};
\ No newline at end of file
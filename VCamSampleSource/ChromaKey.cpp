@@ -0,0 +1,208 @@
+#include "pch.h"
+#include "Tools.h"
+#include "Settings.h"
+#include "ChromaKey.h"
+
+#if defined(_M_IX86) || defined(_M_X64)
+#define KEY_SSE
+#endif
+
+#define KEY_BAND_ROWS 32 // chroma rows keyed per parallel task, the frame is processed in tiles of 2 luma rows x 16 pixels
+#define KEY_NO_COLOR 0xFFFFFFFF
+#define KEY_DEFAULT_COLOR 0x00B140 // usual chroma key green
+#define KEY_DEFAULT_TOLERANCE 40
+#define KEY_DEFAULT_SOFTNESS 24
+#define KEY_DEFAULT_SPILL 50
+
+void ChromaKey::Load()
+{
+	_enabled = false;
+	auto color = GetSettingDWORD(L"KeyColor", KEY_NO_COLOR);
+	if (color == KEY_NO_COLOR)
+		return;
+
+	auto tolerance = GetSettingDWORD(L"KeyTolerance", KEY_DEFAULT_TOLERANCE);
+	auto softness = GetSettingDWORD(L"KeySoftness", KEY_DEFAULT_SOFTNESS);
+	auto spill = GetSettingDWORD(L"KeySpill", KEY_DEFAULT_SPILL);
+	Set(color, tolerance, softness, spill);
+	WINTRACE(L"ChromaKey::Load color:0x%06X U:%i V:%i tolerance:%u softness:%u spill:%u", color, _keyU, _keyV, tolerance, softness, spill);
+}
+
+void ChromaKey::Set(UINT rgb, UINT tolerance, UINT softness, UINT spill)
+{
+	// BT.601 limited range, same as the conversions
+	int r = (rgb >> 16) & 0xFF;
+	int g = (rgb >> 8) & 0xFF;
+	int b = rgb & 0xFF;
+	_keyU = (short)(((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128);
+	_keyV = (short)(((112 * r - 94 * g - 18 * b + 128) >> 8) + 128);
+	_tolerance = (float)std::min<UINT>(tolerance, 361); // above the largest U/V distance, 255 * sqrt(2)
+	_invSoftness = 1.0f / std::max<UINT>(softness, 1);
+
+	// a gray key has no hue to suppress
+	auto u = (double)(_keyU - 128);
+	auto v = (double)(_keyV - 128);
+	auto length = sqrt(u * u + v * v);
+	if (length < 1)
+	{
+		u = 0;
+		v = 0;
+	}
+	else
+	{
+		u /= length;
+		v /= length;
+	}
+
+	auto strength = std::min<UINT>(spill, 100) / 100.0;
+	_spillU = (short)lround(u * strength * 128);
+	_spillV = (short)lround(v * strength * 128);
+	_directionU = (short)lround(u * 128);
+	_directionV = (short)lround(v * 128);
+	_enabled = true;
+}
+
+// keys a 2-row tile of count chroma samples starting at x (in chroma samples), the reference for the SIMD version
+static inline void KeySamples(short keyU, short keyV, float tolerance, float invSoftness, short spillU, short spillV, short directionU, short directionV,
+	BYTE* y0, BYTE* y1, BYTE* uv, const BYTE* backgroundY0, const BYTE* backgroundY1, const BYTE* backgroundU, const BYTE* backgroundV, UINT backgroundUVStep, UINT x, UINT count)
+{
+	for (auto i = x; i < x + count; i++)
+	{
+		int u = uv[i * 2];
+		int v = uv[i * 2 + 1];
+
+		// foreground weight from the distance to the key, 0 to 256
+		auto du = u - keyU;
+		auto dv = v - keyV;
+		auto distance = sqrtf((float)(du * du + dv * dv));
+		auto alpha = (int)(std::min<float>(std::max<float>((distance - tolerance) * invSoftness, 0.0f), 1.0f) * 256.0f);
+
+		// the part of the chroma going toward the key is removed
+		auto cu = u - 128;
+		auto cv = v - 128;
+		auto spill = std::max<int>(cu * spillU + cv * spillV, 0) >> 7;
+		auto fu = std::min<int>(std::max<int>(cu - ((spill * directionU) >> 7) + 128, 0), 255);
+		auto fv = std::min<int>(std::max<int>(cv - ((spill * directionV) >> 7) + 128, 0), 255);
+
+		auto bu = backgroundU[i * backgroundUVStep];
+		auto bv = backgroundV[i * backgroundUVStep];
+		uv[i * 2] = (BYTE)((fu * alpha + bu * (256 - alpha) + 128) >> 8);
+		uv[i * 2 + 1] = (BYTE)((fv * alpha + bv * (256 - alpha) + 128) >> 8);
+		for (auto j = i * 2; j < i * 2 + 2; j++)
+		{
+			y0[j] = (BYTE)((y0[j] * alpha + backgroundY0[j] * (256 - alpha) + 128) >> 8);
+			y1[j] = (BYTE)((y1[j] * alpha + backgroundY1[j] * (256 - alpha) + 128) >> 8);
+		}
+	}
+}
+
+#if defined(KEY_SSE)
+// (foreground * alpha + background * (256 - alpha) + 128) >> 8 on 16-bit lanes holding bytes, the sum fits in 16 unsigned bits
+static inline __m128i Mix(__m128i foreground, __m128i background, __m128i alpha)
+{
+	auto sum = _mm_add_epi16(_mm_mullo_epi16(foreground, alpha), _mm_mullo_epi16(background, _mm_sub_epi16(_mm_set1_epi16(256), alpha)));
+	return _mm_srli_epi16(_mm_add_epi16(sum, _mm_set1_epi16(128)), 8);
+}
+
+static inline __m128i MixBytes(__m128i foreground, __m128i background, __m128i alphaLo, __m128i alphaHi)
+{
+	auto zero = _mm_setzero_si128();
+	auto lo = Mix(_mm_unpacklo_epi8(foreground, zero), _mm_unpacklo_epi8(background, zero), alphaLo);
+	auto hi = Mix(_mm_unpackhi_epi8(foreground, zero), _mm_unpackhi_epi8(background, zero), alphaHi);
+	return _mm_packus_epi16(lo, hi);
+}
+
+// foreground weights of 4 interleaved U/V pairs, as 32-bit lanes
+static inline __m128i KeyAlpha(__m128i pairs, __m128i key, __m128 tolerance, __m128 invSoftness)
+{
+	auto d = _mm_sub_epi16(pairs, key);
+	auto distance = _mm_sqrt_ps(_mm_cvtepi32_ps(_mm_madd_epi16(d, d)));
+	auto alpha = _mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_sub_ps(distance, tolerance), invSoftness), _mm_setzero_ps()), _mm_set1_ps(1.0f));
+	return _mm_cvttps_epi32(_mm_mul_ps(alpha, _mm_set1_ps(256.0f)));
+}
+
+// spill amount of 4 centered U/V pairs, as 32-bit lanes
+static inline __m128i KeySpill(__m128i centered, __m128i spill)
+{
+	auto amount = _mm_madd_epi16(centered, spill);
+	return _mm_srai_epi32(_mm_and_si128(amount, _mm_cmpgt_epi32(amount, _mm_setzero_si128())), 7);
+}
+#endif
+
+HRESULT ChromaKey::Apply(BYTE* y, LONG yStride, BYTE* uv, LONG uvStride, UINT width, UINT height, const BYTE* backgroundY, LONG backgroundYStride, const BYTE* backgroundU, const BYTE* backgroundV, LONG backgroundUVStride, UINT backgroundUVStep) const
+{
+	RETURN_HR_IF(E_NOT_VALID_STATE, !_enabled);
+	RETURN_HR_IF_NULL(E_POINTER, y);
+	RETURN_HR_IF_NULL(E_POINTER, uv);
+	RETURN_HR_IF_NULL(E_POINTER, backgroundY);
+	RETURN_HR_IF_NULL(E_POINTER, backgroundU);
+	RETURN_HR_IF_NULL(E_POINTER, backgroundV);
+	RETURN_HR_IF(E_INVALIDARG, (width & 1) || (height & 1) || (backgroundUVStep != 1 && backgroundUVStep != 2));
+
+	auto samples = width / 2;
+	return ForEachBand(height / 2, KEY_BAND_ROWS, [&](UINT top, UINT bottom)
+		{
+			for (auto row = top; row < bottom; row++)
+			{
+				auto y0 = y + (ptrdiff_t)row * 2 * yStride;
+				auto y1 = y0 + yStride;
+				auto uvRow = uv + (ptrdiff_t)row * uvStride;
+				auto backgroundY0 = backgroundY + (ptrdiff_t)row * 2 * backgroundYStride;
+				auto backgroundY1 = backgroundY0 + backgroundYStride;
+				auto backgroundURow = backgroundU + (ptrdiff_t)row * backgroundUVStride;
+				auto backgroundVRow = backgroundV + (ptrdiff_t)row * backgroundUVStride;
+				UINT x = 0;
+#if defined(KEY_SSE)
+				// 8 chroma samples (16 bytes of U/V, 2 rows of 16 luma pixels) at once
+				auto zero = _mm_setzero_si128();
+				auto key = _mm_set_epi16(_keyV, _keyU, _keyV, _keyU, _keyV, _keyU, _keyV, _keyU);
+				auto spill = _mm_set_epi16(_spillV, _spillU, _spillV, _spillU, _spillV, _spillU, _spillV, _spillU);
+				auto direction = _mm_set_epi16(_directionV, _directionU, _directionV, _directionU, _directionV, _directionU, _directionV, _directionU);
+				auto gray = _mm_set1_epi16(128);
+				auto white = _mm_set1_epi16(255);
+				auto tolerance = _mm_set1_ps(_tolerance);
+				auto invSoftness = _mm_set1_ps(_invSoftness);
+				for (; x + 8 <= samples; x += 8)
+				{
+					auto chroma = _mm_loadu_si128((const __m128i*)(uvRow + x * 2));
+					auto lo = _mm_unpacklo_epi8(chroma, zero);
+					auto hi = _mm_unpackhi_epi8(chroma, zero);
+
+					// one weight per sample, each is repeated for the U/V pair and the 2 luma pixels of the sample
+					auto alpha = _mm_packs_epi32(KeyAlpha(lo, key, tolerance, invSoftness), KeyAlpha(hi, key, tolerance, invSoftness));
+					auto alphaLo = _mm_unpacklo_epi16(alpha, alpha);
+					auto alphaHi = _mm_unpackhi_epi16(alpha, alpha);
+
+					auto centeredLo = _mm_sub_epi16(lo, gray);
+					auto centeredHi = _mm_sub_epi16(hi, gray);
+					auto amount = _mm_packs_epi32(KeySpill(centeredLo, spill), KeySpill(centeredHi, spill));
+					auto amountLo = _mm_unpacklo_epi16(amount, amount);
+					auto amountHi = _mm_unpackhi_epi16(amount, amount);
+					lo = _mm_add_epi16(_mm_sub_epi16(centeredLo, _mm_srai_epi16(_mm_mullo_epi16(amountLo, direction), 7)), gray);
+					hi = _mm_add_epi16(_mm_sub_epi16(centeredHi, _mm_srai_epi16(_mm_mullo_epi16(amountHi, direction), 7)), gray);
+					lo = _mm_min_epi16(_mm_max_epi16(lo, zero), white);
+					hi = _mm_min_epi16(_mm_max_epi16(hi, zero), white);
+
+					__m128i background;
+					if (backgroundUVStep == 2)
+					{
+						background = _mm_loadu_si128((const __m128i*)(backgroundURow + x * 2));
+					}
+					else
+					{
+						background = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(backgroundURow + x)), _mm_loadl_epi64((const __m128i*)(backgroundVRow + x)));
+					}
+					lo = Mix(lo, _mm_unpacklo_epi8(background, zero), alphaLo);
+					hi = Mix(hi, _mm_unpackhi_epi8(background, zero), alphaHi);
+					_mm_storeu_si128((__m128i*)(uvRow + x * 2), _mm_packus_epi16(lo, hi));
+
+					auto luma0 = _mm_loadu_si128((const __m128i*)(y0 + x * 2));
+					auto luma1 = _mm_loadu_si128((const __m128i*)(y1 + x * 2));
+					_mm_storeu_si128((__m128i*)(y0 + x * 2), MixBytes(luma0, _mm_loadu_si128((const __m128i*)(backgroundY0 + x * 2)), alphaLo, alphaHi));
+					_mm_storeu_si128((__m128i*)(y1 + x * 2), MixBytes(luma1, _mm_loadu_si128((const __m128i*)(backgroundY1 + x * 2)), alphaLo, alphaHi));
+				}
+#endif
+				KeySamples(_keyU, _keyV, _tolerance, _invSoftness, _spillU, _spillV, _directionU, _directionV, y0, y1, uvRow, backgroundY0, backgroundY1, backgroundURow, backgroundVRow, backgroundUVStep, x, samples - x);
+			}
+		});
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+// replaces the pixels whose chroma is close to a key color (a green or blue screen) by a background, in NV12, without going back to RGB
+// the key is measured as the U/V distance to the key color: below tolerance the background shows, above tolerance + softness the foreground stays,
+// in between both are mixed, which gives soft edges. Spill suppression removes the key color's hue that the screen reflects on the foreground
+class ChromaKey
+{
+	bool _enabled;
+	short _keyU;
+	short _keyV;
+	float _tolerance; // U/V distance, 0 to 361
+	float _invSoftness;
+	short _spillU; // unit key direction (from gray) times the spill strength, Q7
+	short _spillV;
+	short _directionU; // unit key direction, Q7
+	short _directionV;
+
+public:
+	ChromaKey() :
+		_enabled(false),
+		_keyU(128),
+		_keyV(128),
+		_tolerance(0),
+		_invSoftness(1),
+		_spillU(0),
+		_spillV(0),
+		_directionU(0),
+		_directionV(0)
+	{
+	}
+
+	// reads the KeyXXX settings, the key is disabled if KeyColor is not set
+	void Load();
+	void Reset() { _enabled = false; }
+	bool IsEnabled() const { return _enabled; }
+
+	// rgb is 0xRRGGBB, tolerance & softness are U/V distances, spill is 0 to 100%
+	void Set(UINT rgb, UINT tolerance, UINT softness, UINT spill);
+
+	// keys an NV12 frame in place over a background of the same size, NV12 (uvStep 2, v is u + 1) or I420 (uvStep 1), width & height must be even
+	HRESULT Apply(BYTE* y, LONG yStride, BYTE* uv, LONG uvStride, UINT width, UINT height, const BYTE* backgroundY, LONG backgroundYStride, const BYTE* backgroundU, const BYTE* backgroundV, LONG backgroundUVStride, UINT backgroundUVStep) const;
+};
@@ -0,0 +1,112 @@
+#include "FrameBuffer.h"
+#include "ColorConvert.h"
+#include <cstddef>
+#include <cstring>
+
+static inline void RGB24ToYUY2(int r, int g, int b, uint8_t* y, uint8_t* u, uint8_t* v)
+{
+	*y = (uint8_t)(((66 * r + 129 * g + 25 * b + 128) >> 8) + 16);
+	*u = (uint8_t)(((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128);
+	*v = (uint8_t)(((112 * r - 94 * g - 18 * b + 128) >> 8) + 128);
+}
+
+static inline void RGB24ToY(int r, int g, int b, uint8_t* y)
+{
+	*y = (uint8_t)(((66 * r + 129 * g + 25 * b + 128) >> 8) + 16);
+}
+
+static inline void RGB32ToNV12(const uint8_t rgb1[8], const uint8_t rgb2[8], uint8_t* y1, uint8_t* y2, uint8_t* uv)
+{
+	RGB24ToYUY2(rgb1[2], rgb1[1], rgb1[0], y1, uv, uv + 1);
+	RGB24ToY(rgb1[6], rgb1[5], rgb1[4], y1 + 1);
+	RGB24ToYUY2(rgb2[2], rgb2[1], rgb2[0], y2, uv, uv + 1);
+	RGB24ToY(rgb2[6], rgb2[5], rgb2[4], y2 + 1);
+};
+
+void RGB32ToNV12(const uint8_t* input, int32_t inputStride, uint32_t width, uint32_t height, uint8_t* y, int32_t yStride, uint8_t* uv, int32_t uvStride)
+{
+	for (uint32_t h = 0; h + 1 < height; h += 2)
+	{
+		auto rgb1 = input + (ptrdiff_t)h * inputStride;
+		auto rgb2 = input + (ptrdiff_t)(h + 1) * inputStride;
+		auto y1 = y + (ptrdiff_t)h * yStride;
+		auto y2 = y + (ptrdiff_t)(h + 1) * yStride;
+		auto puv = uv + (ptrdiff_t)(h / 2) * uvStride;
+		for (uint32_t w = 0; w < width; w += 2)
+		{
+			RGB32ToNV12(rgb1, rgb2, y1, y2, puv);
+			rgb1 += 8;
+			rgb2 += 8;
+			y1 += 2;
+			y2 += 2;
+			puv += 2;
+		}
+	}
+}
+
+void RGB32ToNV12(const Rgb32View& input, const Nv12View& output)
+{
+	auto width = input.width < output.width ? input.width : output.width;
+	auto height = input.height < output.height ? input.height : output.height;
+	RGB32ToNV12(input.planes[0].data, input.planes[0].stride, width, height, output.planes[0].data, output.planes[0].stride, output.planes[1].data, output.planes[1].stride);
+}
+
+void CopyPlane(const uint8_t* input, int32_t inputStride, uint32_t widthInBytes, uint32_t height, uint8_t* output, int32_t outputStride)
+{
+	if (inputStride == outputStride && inputStride == (int32_t)widthInBytes)
+	{
+		memcpy(output, input, (size_t)widthInBytes * height);
+		return;
+	}
+
+	for (uint32_t h = 0; h < height; h++)
+	{
+		memcpy(output, input, widthInBytes);
+		input += inputStride;
+		output += outputStride;
+	}
+}
+
+void I420ToNV12UV(const uint8_t* u, int32_t uStride, const uint8_t* v, int32_t vStride, uint32_t width, uint32_t height, uint8_t* uv, int32_t uvStride)
+{
+	for (uint32_t h = 0; h < height; h++)
+	{
+		auto out = uv;
+		for (uint32_t w = 0; w < width; w++)
+		{
+			*out++ = u[w];
+			*out++ = v[w];
+		}
+		u += uStride;
+		v += vStride;
+		uv += uvStride;
+	}
+}
+
+static inline uint8_t Clamp255(int value)
+{
+	return (uint8_t)(value < 0 ? 0 : (value > 255 ? 255 : value));
+}
+
+// same coefficients as RGB24ToYUY2
+void YUV420ToRGB32(const uint8_t* y, int32_t yStride, const uint8_t* u, const uint8_t* v, int32_t uvStride, uint32_t uvStep, uint32_t width, uint32_t height, uint8_t* output, int32_t outputStride)
+{
+	for (uint32_t h = 0; h < height; h++)
+	{
+		auto py = y + (ptrdiff_t)h * yStride;
+		auto pu = u + (ptrdiff_t)(h / 2) * uvStride;
+		auto pv = v + (ptrdiff_t)(h / 2) * uvStride;
+		auto rgb = output + (ptrdiff_t)h * outputStride;
+		for (uint32_t w = 0; w < width; w++)
+		{
+			auto c = 298 * (py[w] - 16);
+			auto d = pu[(w / 2) * uvStep] - 128;
+			auto e = pv[(w / 2) * uvStep] - 128;
+			rgb[0] = Clamp255((c + 516 * d + 128) >> 8);
+			rgb[1] = Clamp255((c - 100 * d - 208 * e + 128) >> 8);
+			rgb[2] = Clamp255((c + 409 * e + 128) >> 8);
+			rgb[3] = 0xFF;
+			rgb += 4;
+		}
+	}
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+// Plain BT.601 limited range conversions & plane copies, with no color adjustment (see ProcAmp.h & ColorLut.h for those).
+#include <cstdint>
+
+void RGB32ToNV12(const uint8_t* input, int32_t inputStride, uint32_t width, uint32_t height, uint8_t* y, int32_t yStride, uint8_t* uv, int32_t uvStride);
+void CopyPlane(const uint8_t* input, int32_t inputStride, uint32_t widthInBytes, uint32_t height, uint8_t* output, int32_t outputStride);
+
+// interleaves I420 U & V planes into an NV12 UV plane, width & height are the chroma plane's
+void I420ToNV12UV(const uint8_t* u, int32_t uStride, const uint8_t* v, int32_t vStride, uint32_t width, uint32_t height, uint8_t* uv, int32_t uvStride);
+
+// works for NV12 (uvStep = 2) and I420 (uvStep = 1)
+void YUV420ToRGB32(const uint8_t* y, int32_t yStride, const uint8_t* u, const uint8_t* v, int32_t uvStride, uint32_t uvStep, uint32_t width, uint32_t height, uint8_t* output, int32_t outputStride);
+
+// over frame views (FrameBuffer.h), of the size both frames have
+void RGB32ToNV12(const Rgb32View& input, const Nv12View& output);
+
+template <FrameBufferFormat Format>
+void CopyFrame(const FrameView<Format>& input, const FrameView<Format>& output)
+{
+	for (uint32_t i = 0; i < FrameFormatTraits<Format>::Planes; i++)
+	{
+		auto& in = input.planes[i];
+		auto& out = output.planes[i];
+		CopyPlane(in.data, in.stride, in.widthInBytes < out.widthInBytes ? in.widthInBytes : out.widthInBytes, in.height < out.height ? in.height : out.height, out.data, out.stride);
+	}
+}
@@ -0,0 +1,587 @@
+#include "ColorLut.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#if defined(_M_IX86) || defined(_M_X64) || defined(__SSE2__)
+#include <emmintrin.h>
+#define LUT_SSE
+#elif defined(_M_ARM64) || defined(__aarch64__)
+#include <arm_neon.h>
+#define LUT_NEON
+#endif
+
+#define LUT_MAX_SIZE 65 // points per axis
+
+// BT.601 limited range, same coefficients as the ColorConvert.cpp conversions, output conversions are not adjusted
+static const double _rgbToYuv[9] =
+{
+	66 / 256.0, 129 / 256.0, 25 / 256.0,
+	-38 / 256.0, -74 / 256.0, 112 / 256.0,
+	112 / 256.0, -94 / 256.0, -18 / 256.0
+};
+
+ColorLutAdjust::ColorLutAdjust() :
+	rgbMatrix(),
+	uvMatrix()
+{
+	for (uint32_t i = 0; i < 256; i++)
+	{
+		rgbCurve[i] = (uint8_t)i;
+		yCurve[i] = (uint8_t)i;
+	}
+
+	for (uint32_t i = 0; i < 3; i++)
+	{
+		rgbMatrix[i * 4] = 1 << COLOR_LUT_SHIFT;
+	}
+	uvMatrix[0] = 1 << COLOR_LUT_SHIFT;
+	uvMatrix[3] = 1 << COLOR_LUT_SHIFT;
+}
+
+// one cube point, the 4 channels are interpolated at once
+#if defined(LUT_SSE)
+typedef __m128 Vector;
+static inline Vector VLoad(const float* p) { return _mm_loadu_ps(p); } // heap blocks are only 8 bytes aligned on x86
+static inline Vector VAdd(Vector a, Vector b) { return _mm_add_ps(a, b); }
+static inline Vector VSub(Vector a, Vector b) { return _mm_sub_ps(a, b); }
+static inline Vector VMul(Vector a, float b) { return _mm_mul_ps(a, _mm_set1_ps(b)); }
+static inline uint32_t VToBytes(Vector v)
+{
+	auto i = _mm_cvtps_epi32(v);
+	i = _mm_packs_epi32(i, i);
+	return (uint32_t)_mm_cvtsi128_si32(_mm_packus_epi16(i, i));
+}
+#elif defined(LUT_NEON)
+typedef float32x4_t Vector;
+static inline Vector VLoad(const float* p) { return vld1q_f32(p); }
+static inline Vector VAdd(Vector a, Vector b) { return vaddq_f32(a, b); }
+static inline Vector VSub(Vector a, Vector b) { return vsubq_f32(a, b); }
+static inline Vector VMul(Vector a, float b) { return vmulq_n_f32(a, b); }
+static inline uint32_t VToBytes(Vector v)
+{
+	auto w = vqmovun_s32(vcvtnq_s32_f32(v));
+	return vget_lane_u32(vreinterpret_u32_u8(vqmovn_u16(vcombine_u16(w, w))), 0);
+}
+#else
+struct Vector { float v[4]; };
+static inline Vector VLoad(const float* p) { return { p[0], p[1], p[2], p[3] }; }
+static inline Vector VAdd(Vector a, Vector b) { return { a.v[0] + b.v[0], a.v[1] + b.v[1], a.v[2] + b.v[2], a.v[3] + b.v[3] }; }
+static inline Vector VSub(Vector a, Vector b) { return { a.v[0] - b.v[0], a.v[1] - b.v[1], a.v[2] - b.v[2], a.v[3] - b.v[3] }; }
+static inline Vector VMul(Vector a, float b) { return { a.v[0] * b, a.v[1] * b, a.v[2] * b, a.v[3] * b }; }
+static inline uint32_t VToBytes(Vector v)
+{
+	uint32_t bytes = 0;
+	for (uint32_t i = 0; i < 4; i++)
+	{
+		bytes |= (uint32_t)std::min(std::max(lroundf(v.v[i]), 0l), 255l) << (i * 8);
+	}
+	return bytes;
+}
+#endif
+
+// first two axes of the tetrahedron a point is in, by decreasing fraction, indexed by (f0 > f1) | (f1 > f2) << 1 | (f0 > f2) << 2
+// 3 & 4 cannot happen
+static const uint8_t _tetrahedra[8][2] =
+{
+	{ 2, 1 }, { 2, 0 }, { 1, 2 }, { 0, 1 }, { 2, 1 }, { 0, 2 }, { 1, 0 }, { 0, 1 }
+};
+
+// branchless tetrahedral interpolation: the cell's cube is split in 6 tetrahedra sharing its diagonal,
+// the point is a weighted sum of the 4 corners of the one it's in, weights are the sorted fractions
+static inline Vector Interpolate(const float* cube, const uint32_t* steps, const LutIndex& i0, const LutIndex& i1, const LutIndex& i2)
+{
+	auto f0 = i0.fraction;
+	auto f1 = i1.fraction;
+	auto f2 = i2.fraction;
+	auto key = (f0 > f1) | ((f1 > f2) << 1) | ((f0 > f2) << 2);
+	auto fmax = std::max(f0, std::max(f1, f2));
+	auto fmin = std::min(f0, std::min(f1, f2));
+	auto fmid = f0 + f1 + f2 - fmax - fmin;
+
+	auto p0 = cube + i0.offset + i1.offset + i2.offset;
+	auto p1 = p0 + steps[key * 2];
+	auto p2 = p1 + steps[key * 2 + 1];
+	auto c0 = VLoad(p0);
+	auto c1 = VLoad(p1);
+	auto c2 = VLoad(p2);
+	auto c3 = VLoad(p0 + steps[16]);
+	return VAdd(VAdd(c0, VMul(VSub(c1, c0), fmax)), VAdd(VMul(VSub(c2, c1), fmid), VMul(VSub(c3, c2), fmin)));
+}
+
+static inline Vector InterpolateBGRA(const float* cube, const uint32_t* steps, const LutIndex(*index)[256], const uint8_t* pixel)
+{
+	return Interpolate(cube, steps, index[0][pixel[2]], index[1][pixel[1]], index[2][pixel[0]]);
+}
+
+// textbook tetrahedral interpolation, the reference for the branchless one
+// cells are clamped to the cube, so positions outside of it are extrapolated
+static void InterpolateReference(const float* points, uint32_t size, uint32_t pointSize, const double position[3], double output[3])
+{
+	uint32_t cell[3];
+	double f[3];
+	for (uint32_t i = 0; i < 3; i++)
+	{
+		auto c = std::min(std::max((int)floor(position[i]), 0), (int)size - 2);
+		cell[i] = c;
+		f[i] = position[i] - c;
+	}
+
+	auto point = [&](uint32_t x, uint32_t y, uint32_t z)
+		{
+			return points + ((cell[0] + x) + (cell[1] + y) * size + (cell[2] + z) * size * size) * pointSize;
+		};
+
+	const float* p1;
+	const float* p2;
+	double w1, w2, w3;
+	if (f[0] > f[1])
+	{
+		if (f[1] > f[2])
+		{
+			p1 = point(1, 0, 0);
+			p2 = point(1, 1, 0);
+			w1 = f[0]; w2 = f[1]; w3 = f[2];
+		}
+		else if (f[0] > f[2])
+		{
+			p1 = point(1, 0, 0);
+			p2 = point(1, 0, 1);
+			w1 = f[0]; w2 = f[2]; w3 = f[1];
+		}
+		else
+		{
+			p1 = point(0, 0, 1);
+			p2 = point(1, 0, 1);
+			w1 = f[2]; w2 = f[0]; w3 = f[1];
+		}
+	}
+	else
+	{
+		if (f[2] > f[1])
+		{
+			p1 = point(0, 0, 1);
+			p2 = point(0, 1, 1);
+			w1 = f[2]; w2 = f[1]; w3 = f[0];
+		}
+		else if (f[2] > f[0])
+		{
+			p1 = point(0, 1, 0);
+			p2 = point(0, 1, 1);
+			w1 = f[1]; w2 = f[2]; w3 = f[0];
+		}
+		else
+		{
+			p1 = point(0, 1, 0);
+			p2 = point(1, 1, 0);
+			w1 = f[1]; w2 = f[0]; w3 = f[2];
+		}
+	}
+
+	auto p0 = point(0, 0, 0);
+	auto p3 = point(1, 1, 1);
+	for (uint32_t i = 0; i < 3; i++)
+	{
+		output[i] = p0[i] + w1 * (p1[i] - p0[i]) + w2 * (p2[i] - p1[i]) + w3 * (p3[i] - p2[i]);
+	}
+}
+
+// .cube keywords are followed by their values on the same line
+static bool IsKeyword(const char* line, const char* keyword, const char** values)
+{
+	auto len = strlen(keyword);
+	if (strncmp(line, keyword, len) || (line[len] != ' ' && line[len] != '\t'))
+		return false;
+
+	*values = line + len;
+	return true;
+}
+
+static bool ParseFloats(const char* text, float* values, uint32_t count)
+{
+	for (uint32_t i = 0; i < count; i++)
+	{
+		char* end;
+		values[i] = strtof(text, &end);
+		if (end == text)
+			return false;
+
+		text = end;
+	}
+	return true;
+}
+
+const char* ColorLut::Parse(char* text, size_t size, uint32_t& line)
+{
+	Reset();
+	uint32_t lutSize = 0;
+	uint32_t total = 0;
+	uint32_t count = 0;
+	std::unique_ptr<float[]> points;
+	float domainMin[3] = { 0, 0, 0 };
+	float domainMax[3] = { 1, 1, 1 };
+	line = 0;
+	auto p = text;
+	auto end = p + size;
+	while (p < end)
+	{
+		line++;
+		auto next = (char*)memchr(p, '\n', end - p);
+		if (next)
+		{
+			*next = 0;
+		}
+		else
+		{
+			next = end;
+		}
+
+		auto start = p;
+		p = next + 1;
+		while (*start == ' ' || *start == '\t')
+		{
+			start++;
+		}
+
+		if (!*start || *start == '\r' || *start == '#')
+			continue;
+
+		const char* values;
+		if (IsKeyword(start, "LUT_3D_SIZE", &values))
+		{
+			if (lutSize)
+				return "duplicate LUT_3D_SIZE";
+
+			lutSize = strtoul(values, nullptr, 10);
+			if (lutSize < 2 || lutSize > LUT_MAX_SIZE)
+				return "unsupported LUT_3D_SIZE";
+
+			total = lutSize * lutSize * lutSize;
+			points = std::make_unique<float[]>((size_t)total * 3);
+		}
+		else if (IsKeyword(start, "LUT_1D_SIZE", &values))
+			return "1D LUTs are not supported";
+		else if (IsKeyword(start, "DOMAIN_MIN", &values))
+		{
+			if (!ParseFloats(values, domainMin, 3))
+				return "invalid DOMAIN_MIN";
+		}
+		else if (IsKeyword(start, "DOMAIN_MAX", &values))
+		{
+			if (!ParseFloats(values, domainMax, 3))
+				return "invalid DOMAIN_MAX";
+		}
+		else if (IsKeyword(start, "LUT_3D_INPUT_RANGE", &values))
+		{
+			float range[2];
+			if (!ParseFloats(values, range, 2))
+				return "invalid LUT_3D_INPUT_RANGE";
+
+			for (uint32_t i = 0; i < 3; i++)
+			{
+				domainMin[i] = range[0];
+				domainMax[i] = range[1];
+			}
+		}
+		else if ((*start >= '0' && *start <= '9') || *start == '-' || *start == '+' || *start == '.')
+		{
+			if (!points)
+				return "point before LUT_3D_SIZE";
+
+			if (count == total)
+				return "too many points";
+
+			if (!ParseFloats(start, points.get() + (size_t)count * 3, 3))
+				return "invalid point";
+
+			count++;
+		}
+		// other keywords (TITLE, etc.) are ignored
+	}
+
+	line = 0;
+	if (!lutSize || count != total)
+		return "missing points";
+
+	for (uint32_t i = 0; i < 3; i++)
+	{
+		if (domainMax[i] <= domainMin[i])
+			return "invalid domain";
+
+		_domainMin[i] = domainMin[i];
+		_domainMax[i] = domainMax[i];
+	}
+
+	_points = std::move(points);
+	_size = lutSize;
+	AllocateCubes();
+	return nullptr;
+}
+
+void ColorLut::AllocateCubes()
+{
+	auto cubeSize = (size_t)_size * _size * _size * 4;
+	_rgbToRgb = std::make_unique<float[]>(cubeSize);
+	_rgbToYuv = std::make_unique<float[]>(cubeSize);
+	_yuvToYuv = std::make_unique<float[]>(cubeSize);
+	_yuvToRgb = std::make_unique<float[]>(cubeSize);
+}
+
+void ColorLut::CopyCube(const ColorLut& lut)
+{
+	Reset();
+	if (!lut._size)
+		return;
+
+	for (uint32_t i = 0; i < 3; i++)
+	{
+		_domainMin[i] = lut._domainMin[i];
+		_domainMax[i] = lut._domainMax[i];
+	}
+	_points = lut._points;
+	_size = lut._size;
+	AllocateCubes();
+}
+
+void ColorLut::Reset()
+{
+	_size = 0;
+	_points.reset();
+	_rgbToRgb.reset();
+	_rgbToYuv.reset();
+	_yuvToYuv.reset();
+	_yuvToRgb.reset();
+}
+
+// the loaded cube at an RGB color (0-1), with the file's domain
+void ColorLut::Sample(const double rgb[3], double output[3]) const
+{
+	double position[3];
+	for (uint32_t i = 0; i < 3; i++)
+	{
+		position[i] = (rgb[i] - _domainMin[i]) / (_domainMax[i] - _domainMin[i]) * (_size - 1);
+	}
+	InterpolateReference(_points.get(), _size, 3, position, output);
+}
+
+void ColorLut::SetIndex(LutIndex& index, double value, uint32_t axis) const
+{
+	auto position = std::min(std::max(value, 0.0), 1.0) * (_size - 1);
+	auto cell = std::min<uint32_t>((uint32_t)position, _size - 2);
+	auto stride = 4 * (axis == 0 ? 1 : (axis == 1 ? _size : _size * _size));
+	index.offset = cell * stride;
+	index.fraction = (float)(position - cell);
+}
+
+// stores a graded color (0-1) in the baked cubes
+static void StorePoints(const double rgb[3], float* rgbPoint, float* yuvPoint)
+{
+	auto r = rgb[0] * 255;
+	auto g = rgb[1] * 255;
+	auto b = rgb[2] * 255;
+	rgbPoint[0] = (float)b;
+	rgbPoint[1] = (float)g;
+	rgbPoint[2] = (float)r;
+	rgbPoint[3] = 255;
+	yuvPoint[0] = (float)(_rgbToYuv[0] * r + _rgbToYuv[1] * g + _rgbToYuv[2] * b + 16);
+	yuvPoint[1] = (float)(_rgbToYuv[3] * r + _rgbToYuv[4] * g + _rgbToYuv[5] * b + 128);
+	yuvPoint[2] = (float)(_rgbToYuv[6] * r + _rgbToYuv[7] * g + _rgbToYuv[8] * b + 128);
+	yuvPoint[3] = 0;
+}
+
+void ColorLut::Bake(const ColorLutAdjust& adjust)
+{
+	if (!_size)
+		return;
+
+	uint32_t strides[3] = { 4, 4 * _size, 4 * _size * _size };
+	for (uint32_t i = 0; i < 8; i++)
+	{
+		_steps[i * 2] = strides[_tetrahedra[i][0]];
+		_steps[i * 2 + 1] = strides[_tetrahedra[i][1]];
+	}
+	_steps[16] = strides[0] + strides[1] + strides[2];
+
+	// ProcAmp's brightness, contrast & gamma curves are applied on input values, hue & saturation on grid points
+	for (uint32_t v = 0; v < 256; v++)
+	{
+		for (uint32_t axis = 0; axis < 3; axis++)
+		{
+			SetIndex(_rgbIndex[axis][v], adjust.rgbCurve[v] / 255.0, axis);
+		}
+		SetIndex(_yuvIndex[0][v], adjust.yCurve[v] / 255.0, 0);
+		SetIndex(_yuvIndex[1][v], v / 255.0, 1);
+		SetIndex(_yuvIndex[2][v], v / 255.0, 2);
+	}
+
+	const double scale = 1.0 / (1 << COLOR_LUT_SHIFT);
+	auto last = (double)(_size - 1);
+	auto m = adjust.rgbMatrix;
+	auto uv = adjust.uvMatrix;
+	size_t offset = 0;
+	for (uint32_t z = 0; z < _size; z++)
+	{
+		for (uint32_t y = 0; y < _size; y++)
+		{
+			for (uint32_t x = 0; x < _size; x++)
+			{
+				double graded[3];
+
+				// R, G, B grid
+				double grid[3] = { x / last, y / last, z / last };
+				double rgb[3];
+				for (uint32_t i = 0; i < 3; i++)
+				{
+					rgb[i] = (m[i * 3] * grid[0] + m[i * 3 + 1] * grid[1] + m[i * 3 + 2] * grid[2]) * scale;
+				}
+				Sample(rgb, graded);
+				StorePoints(graded, _rgbToRgb.get() + offset, _rgbToYuv.get() + offset);
+
+				// Y, U, V grid, BT.601 limited range back to RGB, out of gamut points are extrapolated
+				auto c = 298 * (x / last * 255 - 16);
+				auto d0 = y / last * 255 - 128;
+				auto e0 = z / last * 255 - 128;
+				auto d = (uv[0] * d0 + uv[1] * e0) * scale;
+				auto e = (uv[2] * d0 + uv[3] * e0) * scale;
+				rgb[0] = (c + 409 * e) / (256 * 255);
+				rgb[1] = (c - 100 * d - 208 * e) / (256 * 255);
+				rgb[2] = (c + 516 * d) / (256 * 255);
+				Sample(rgb, graded);
+				StorePoints(graded, _yuvToRgb.get() + offset, _yuvToYuv.get() + offset);
+				offset += 4;
+			}
+		}
+	}
+}
+
+uint32_t ColorLut::ComputeMaxError(uint32_t step) const
+{
+	if (!_size)
+		return 0;
+
+	step = std::max<uint32_t>(step, 1);
+	const float* cubes[] = { _rgbToRgb.get(), _rgbToYuv.get(), _yuvToYuv.get(), _yuvToRgb.get() };
+	uint32_t maxError = 0;
+	for (uint32_t i = 0; i < sizeof(cubes) / sizeof(cubes[0]); i++)
+	{
+		auto index = i < 2 ? _rgbIndex : _yuvIndex;
+		for (uint32_t c2 = 0; c2 < 256; c2 += step)
+		{
+			for (uint32_t c1 = 0; c1 < 256; c1 += step)
+			{
+				for (uint32_t c0 = 0; c0 < 256; c0 += step)
+				{
+					auto& i0 = index[0][c0];
+					auto& i1 = index[1][c1];
+					auto& i2 = index[2][c2];
+					auto bytes = VToBytes(Interpolate(cubes[i], _steps, i0, i1, i2));
+
+					double position[3] = { i0.offset / 4 + (double)i0.fraction, i1.offset / (4 * _size) + (double)i1.fraction, i2.offset / (4 * _size * _size) + (double)i2.fraction };
+					double reference[3];
+					InterpolateReference(cubes[i], _size, 4, position, reference);
+					for (uint32_t k = 0; k < 3; k++)
+					{
+						auto expected = std::min(std::max((int)lround(reference[k]), 0), 255);
+						auto error = (uint32_t)abs(expected - (int)((bytes >> (k * 8)) & 0xFF));
+						maxError = std::max(maxError, error);
+					}
+				}
+			}
+		}
+	}
+	return maxError;
+}
+
+void ColorLut::RGB32ToRGB32(const uint8_t* input, int32_t inputStride, uint32_t width, uint32_t height, uint8_t* output, int32_t outputStride) const
+{
+	auto cube = _rgbToRgb.get();
+	for (uint32_t h = 0; h < height; h++)
+	{
+		auto in = input + (ptrdiff_t)h * inputStride;
+		auto out = (uint32_t*)(output + (ptrdiff_t)h * outputStride);
+		for (uint32_t w = 0; w < width; w++)
+		{
+			out[w] = VToBytes(InterpolateBGRA(cube, _steps, _rgbIndex, in));
+			in += 4;
+		}
+	}
+}
+
+void ColorLut::RGB32ToNV12(const uint8_t* input, int32_t inputStride, uint32_t width, uint32_t height, uint8_t* y, int32_t yStride, uint8_t* uv, int32_t uvStride) const
+{
+	auto cube = _rgbToYuv.get();
+	for (uint32_t h = 0; h + 1 < height; h += 2)
+	{
+		auto rgb1 = input + (ptrdiff_t)h * inputStride;
+		auto rgb2 = rgb1 + inputStride;
+		auto y1 = y + (ptrdiff_t)h * yStride;
+		auto y2 = y1 + yStride;
+		auto puv = uv + (ptrdiff_t)(h / 2) * uvStride;
+		for (uint32_t w = 0; w + 1 < width; w += 2)
+		{
+			auto p0 = InterpolateBGRA(cube, _steps, _rgbIndex, rgb1);
+			auto p1 = InterpolateBGRA(cube, _steps, _rgbIndex, rgb1 + 4);
+			auto p2 = InterpolateBGRA(cube, _steps, _rgbIndex, rgb2);
+			auto p3 = InterpolateBGRA(cube, _steps, _rgbIndex, rgb2 + 4);
+			y1[w] = (uint8_t)VToBytes(p0);
+			y1[w + 1] = (uint8_t)VToBytes(p1);
+			y2[w] = (uint8_t)VToBytes(p2);
+			y2[w + 1] = (uint8_t)VToBytes(p3);
+
+			// chroma is the average of the 4 pixels
+			auto chroma = VToBytes(VMul(VAdd(VAdd(p0, p1), VAdd(p2, p3)), 0.25f));
+			puv[w] = (uint8_t)(chroma >> 8);
+			puv[w + 1] = (uint8_t)(chroma >> 16);
+			rgb1 += 8;
+			rgb2 += 8;
+		}
+	}
+}
+
+void ColorLut::YUV420ToNV12(const uint8_t* y, int32_t yStride, const uint8_t* u, int32_t uStride, const uint8_t* v, int32_t vStride, uint32_t uvStep, uint32_t width, uint32_t height, uint8_t* outputY, int32_t outputYStride, uint8_t* outputUV, int32_t outputUVStride) const
+{
+	auto cube = _yuvToYuv.get();
+	for (uint32_t h = 0; h + 1 < height; h += 2)
+	{
+		auto py1 = y + (ptrdiff_t)h * yStride;
+		auto py2 = py1 + yStride;
+		auto pu = u + (ptrdiff_t)(h / 2) * uStride;
+		auto pv = v + (ptrdiff_t)(h / 2) * vStride;
+		auto oy1 = outputY + (ptrdiff_t)h * outputYStride;
+		auto oy2 = oy1 + outputYStride;
+		auto ouv = outputUV + (ptrdiff_t)(h / 2) * outputUVStride;
+		for (uint32_t w = 0; w + 1 < width; w += 2)
+		{
+			auto& iu = _yuvIndex[1][pu[(w / 2) * uvStep]];
+			auto& iv = _yuvIndex[2][pv[(w / 2) * uvStep]];
+			auto p0 = Interpolate(cube, _steps, _yuvIndex[0][py1[w]], iu, iv);
+			auto p1 = Interpolate(cube, _steps, _yuvIndex[0][py1[w + 1]], iu, iv);
+			auto p2 = Interpolate(cube, _steps, _yuvIndex[0][py2[w]], iu, iv);
+			auto p3 = Interpolate(cube, _steps, _yuvIndex[0][py2[w + 1]], iu, iv);
+			oy1[w] = (uint8_t)VToBytes(p0);
+			oy1[w + 1] = (uint8_t)VToBytes(p1);
+			oy2[w] = (uint8_t)VToBytes(p2);
+			oy2[w + 1] = (uint8_t)VToBytes(p3);
+
+			auto chroma = VToBytes(VMul(VAdd(VAdd(p0, p1), VAdd(p2, p3)), 0.25f));
+			ouv[w] = (uint8_t)(chroma >> 8);
+			ouv[w + 1] = (uint8_t)(chroma >> 16);
+		}
+	}
+}
+
+void ColorLut::YUV420ToRGB32(const uint8_t* y, int32_t yStride, const uint8_t* u, int32_t uStride, const uint8_t* v, int32_t vStride, uint32_t uvStep, uint32_t width, uint32_t height, uint8_t* output, int32_t outputStride) const
+{
+	auto cube = _yuvToRgb.get();
+	for (uint32_t h = 0; h < height; h++)
+	{
+		auto py = y + (ptrdiff_t)h * yStride;
+		auto pu = u + (ptrdiff_t)(h / 2) * uStride;
+		auto pv = v + (ptrdiff_t)(h / 2) * vStride;
+		auto out = (uint32_t*)(output + (ptrdiff_t)h * outputStride);
+		for (uint32_t w = 0; w < width; w++)
+		{
+			out[w] = VToBytes(Interpolate(cube, _steps, _yuvIndex[0][py[w]], _yuvIndex[1][pu[(w / 2) * uvStep]], _yuvIndex[2][pv[(w / 2) * uvStep]]));
+		}
+	}
+}
\ No newline at end of file
@@ -0,0 +1,82 @@
+#pragma once
+
+// 3D color lookup table parsed from a .cube file, applied with tetrahedral interpolation
+// the cube is resampled ("baked") for each conversion the generator does, with ProcAmp adjustments and RGB <=> YUV matrices folded in,
+// so a frame is graded and converted in a single pass
+// conversions work on the rows they're given, callers split frames in bands to run them in parallel
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+#define COLOR_LUT_SHIFT 14 // fixed point bits of the adjustment matrices, same as ProcAmp.h's COLOR_ADJUST_SHIFT
+
+// ProcAmp adjustments baked in the cubes (see ColorAdjust in ProcAmp.h), none when default constructed
+struct ColorLutAdjust
+{
+	uint8_t rgbCurve[256]; // brightness, contrast & gamma on full range R, G & B
+	uint8_t yCurve[256]; // same on limited range Y
+	int32_t rgbMatrix[9]; // hue & saturation on RGB
+	int32_t uvMatrix[4]; // hue & saturation on U - 128 & V - 128
+
+	ColorLutAdjust();
+};
+
+// position of an 8-bit input value in a cube
+struct LutIndex
+{
+	uint32_t offset; // in floats, lower corner of the cell on that axis
+	float fraction; // position in the cell, 0 to 1
+};
+
+class ColorLut
+{
+	uint32_t _size; // points per axis, 0 if not loaded
+	std::shared_ptr<float[]> _points; // as loaded, R, G, B per point, R varies fastest, shared by the copies baked with other adjustments
+	float _domainMin[3];
+	float _domainMax[3];
+	uint32_t _steps[17]; // offsets to the 2nd & 3rd corners of each tetrahedron, and to the opposite corner of the cell
+	LutIndex _rgbIndex[3][256]; // R, G, B bytes => positions, with ProcAmp's curves
+	LutIndex _yuvIndex[3][256]; // Y, U, V bytes => positions, with ProcAmp's curve on Y
+
+	// baked cubes, 4 floats per point, first axis varies fastest, values are 0-255 bytes (including YUV offsets)
+	std::unique_ptr<float[]> _rgbToRgb; // R, G, B => B, G, R, A
+	std::unique_ptr<float[]> _rgbToYuv; // R, G, B => Y, U, V
+	std::unique_ptr<float[]> _yuvToYuv; // Y, U, V => Y, U, V
+	std::unique_ptr<float[]> _yuvToRgb; // Y, U, V => B, G, R, A
+
+	void Sample(const double rgb[3], double output[3]) const;
+	void SetIndex(LutIndex& index, double value, uint32_t axis) const;
+	void AllocateCubes();
+
+public:
+	ColorLut() :
+		_size(0),
+		_domainMin(),
+		_domainMax(),
+		_steps(),
+		_rgbIndex(),
+		_yuvIndex()
+	{
+	}
+
+	// 3D .cube file contents (17, 33 or 65 points per axis are common), modified in place and followed by a null character, the cube must be baked before use
+	// returns nullptr on success, or the error & the line it's on (0 if it's not on a line)
+	const char* Parse(char* text, size_t size, uint32_t& line);
+	void Reset();
+
+	// the cube another LUT loaded, to bake it with other adjustments while that one is still used, not baked
+	void CopyCube(const ColorLut& lut);
+	bool HasSameCube(const ColorLut& lut) const { return _points == lut._points; }
+	bool IsLoaded() const { return _size != 0; }
+	uint32_t GetSize() const { return _size; }
+	void Bake(const ColorLutAdjust& adjust);
+
+	// largest difference, in 8-bit levels, between the SIMD interpolation & a scalar reference over a grid of inputs
+	uint32_t ComputeMaxError(uint32_t step) const;
+
+	// same as the conversions in ColorConvert.h & ProcAmp.h, width & height must be even for 4:2:0 formats
+	void RGB32ToRGB32(const uint8_t* input, int32_t inputStride, uint32_t width, uint32_t height, uint8_t* output, int32_t outputStride) const;
+	void RGB32ToNV12(const uint8_t* input, int32_t inputStride, uint32_t width, uint32_t height, uint8_t* y, int32_t yStride, uint8_t* uv, int32_t uvStride) const;
+	void YUV420ToNV12(const uint8_t* y, int32_t yStride, const uint8_t* u, int32_t uStride, const uint8_t* v, int32_t vStride, uint32_t uvStep, uint32_t width, uint32_t height, uint8_t* outputY, int32_t outputYStride, uint8_t* outputUV, int32_t outputUVStride) const;
+	void YUV420ToRGB32(const uint8_t* y, int32_t yStride, const uint8_t* u, int32_t uStride, const uint8_t* v, int32_t vStride, uint32_t uvStep, uint32_t width, uint32_t height, uint8_t* output, int32_t outputStride) const;
+};
@@ -0,0 +1,267 @@
+#include "pch.h"
+#include "Tools.h"
+#include "FrameSource.h"
+#include "FileFrameSource.h"
+
+#define FILE_VIEW_SIZE (256 * 1024 * 1024) // size of the sliding mapped view, so we can play multi-GB files even in 32-bit processes
+#define READAHEAD_FRAMES 4 // number of frames we ask the memory manager to bring in ahead of time
+#define Y4M_MAX_HEADER 1024
+#define NO_FRAME_INDEX ((ULONGLONG)-1)
+
+HRESULT FileFrameSource::Open(PCWSTR path, PCWSTR format, UINT width, UINT height, UINT fps)
+{
+	RETURN_HR_IF_NULL(E_POINTER, path);
+	WINTRACE(L"FileFrameSource::Open '%s' format:%s size:%u x %u", path, format, width, height);
+
+	// sequential scan tells the cache manager to read ahead aggressively & to drop pages behind us
+	_file.reset(CreateFile(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr));
+	RETURN_LAST_ERROR_IF_MSG(!_file, "Cannot open '%ls'", path);
+
+	LARGE_INTEGER size;
+	RETURN_IF_WIN32_BOOL_FALSE(GetFileSizeEx(_file.get(), &size));
+	_fileSize = size.QuadPart;
+	RETURN_HR_IF_MSG(E_INVALIDARG, !_fileSize, "File '%ls' is empty", path);
+
+	_mapping.reset(CreateFileMapping(_file.get(), nullptr, PAGE_READONLY, 0, 0, nullptr));
+	RETURN_LAST_ERROR_IF_NULL(_mapping);
+
+	auto len = lstrlen(path);
+	if (len > 4 && !lstrcmpi(path + len - 4, L".y4m"))
+	{
+		RETURN_IF_FAILED(ParseY4MHeader());
+	}
+	else
+	{
+		RETURN_HR_IF_NULL(E_POINTER, format);
+		RETURN_HR_IF_MSG(E_INVALIDARG, !width || !height, "Raw files need a frame size");
+		_width = width;
+		_height = height;
+		if (fps)
+		{
+			_fileFpsNumerator = fps;
+			_fileFpsDenominator = 1;
+		}
+
+		if (!lstrcmpi(format, L"NV12"))
+		{
+			_format = MFVideoFormat_NV12;
+		}
+		else if (!lstrcmpi(format, L"I420") || !lstrcmpi(format, L"IYUV"))
+		{
+			_format = MFVideoFormat_I420;
+		}
+		else if (!lstrcmpi(format, L"BGRA") || !lstrcmpi(format, L"RGB32"))
+		{
+			_format = MFVideoFormat_RGB32;
+		}
+		else
+		{
+			RETURN_HR_MSG(E_INVALIDARG, "Unsupported raw format '%ls'", format);
+		}
+	}
+
+	if (_format == MFVideoFormat_RGB32)
+	{
+		_frameSize = (ULONGLONG)_width * _height * 4;
+	}
+	else
+	{
+		RETURN_HR_IF_MSG(E_INVALIDARG, (_width & 1) || (_height & 1), "4:2:0 frame size must be even");
+		_frameSize = (ULONGLONG)_width * _height * 3 / 2;
+	}
+
+	_frameCount = (_fileSize - _dataOffset) / (_frameHeaderSize + _frameSize);
+	RETURN_HR_IF_MSG(E_INVALIDARG, !_frameCount, "File '%ls' doesn't contain a full frame", path);
+	WINTRACE(L"FileFrameSource::Open '%s' format:%s size:%u x %u frames:%I64u", path, GUID_ToStringW(_format).c_str(), _width, _height, _frameCount);
+	return S_OK;
+}
+
+HRESULT FileFrameSource::ParseY4MHeader()
+{
+	RETURN_IF_FAILED(EnsureView(0, std::min<ULONGLONG>(_fileSize, Y4M_MAX_HEADER)));
+
+	// YUV4MPEG2 W<width> H<height> F<num>:<den> I<interlace> A<aspect> C<colorspace> X<comment>
+	std::string header((const char*)_view.get(), (size_t)std::min<ULONGLONG>(_fileSize, Y4M_MAX_HEADER));
+	auto end = header.find('\n');
+	RETURN_HR_IF_MSG(MF_E_INVALID_FILE_FORMAT, end == std::string::npos || header.rfind("YUV4MPEG2 ", 0) != 0, "Invalid Y4M header");
+	header.resize(end);
+
+	_format = MFVideoFormat_I420;
+	size_t pos = 0;
+	while (pos < header.size())
+	{
+		auto next = header.find(' ', pos);
+		if (next == std::string::npos)
+		{
+			next = header.size();
+		}
+
+		auto token = header.substr(pos, next - pos);
+		if (!token.empty())
+		{
+			switch (token[0])
+			{
+			case 'W':
+				_width = atoi(token.c_str() + 1);
+				break;
+
+			case 'H':
+				_height = atoi(token.c_str() + 1);
+				break;
+
+			case 'F':
+				if (sscanf_s(token.c_str() + 1, "%u:%u", &_fileFpsNumerator, &_fileFpsDenominator) != 2 || !_fileFpsDenominator)
+				{
+					_fileFpsNumerator = 0;
+					_fileFpsDenominator = 0;
+				}
+				break;
+
+			case 'C':
+				// the 8-bit 4:2:0 variants only differ in chroma siting, which we ignore, high bit depths (C420p10...) have 16-bit samples
+				RETURN_HR_IF_MSG(MF_E_UNSUPPORTED_FORMAT, token != "C420" && token != "C420jpeg" && token != "C420paldv" && token != "C420mpeg2", "Unsupported Y4M colorspace '%hs'", token.c_str());
+				break;
+			}
+		}
+		pos = next + 1;
+	}
+	RETURN_HR_IF_MSG(MF_E_INVALID_FILE_FORMAT, !_width || !_height, "Invalid Y4M frame size");
+
+	// each frame is prefixed by "FRAME" + optional parameters + '\n', we assume they're all the same size as the first one
+	_dataOffset = end + 1;
+	auto frame = header.size() + 1;
+	std::string first((const char*)_view.get() + frame, (size_t)std::min<ULONGLONG>(_fileSize - frame, Y4M_MAX_HEADER - frame));
+	auto frameEnd = first.find('\n');
+	RETURN_HR_IF_MSG(MF_E_INVALID_FILE_FORMAT, frameEnd == std::string::npos || first.rfind("FRAME", 0) != 0, "Invalid Y4M frame header");
+	_frameHeaderSize = frameEnd + 1;
+	return S_OK;
+}
+
+HRESULT FileFrameSource::EnsureView(ULONGLONG offset, ULONGLONG size)
+{
+	if (_view && offset >= _viewOffset && offset + size <= _viewOffset + _viewSize)
+		return S_OK;
+
+	SYSTEM_INFO si;
+	GetSystemInfo(&si);
+	auto start = offset - (offset % si.dwAllocationGranularity);
+	auto viewSize = std::min<ULONGLONG>(std::max<ULONGLONG>(FILE_VIEW_SIZE, offset - start + size), _fileSize - start);
+
+	_view.reset();
+	_view.reset((BYTE*)MapViewOfFile(_mapping.get(), FILE_MAP_READ, (DWORD)(start >> 32), (DWORD)start, (SIZE_T)viewSize));
+	RETURN_LAST_ERROR_IF_NULL(_view);
+	_viewOffset = start;
+	_viewSize = (SIZE_T)viewSize;
+	return S_OK;
+}
+
+void FileFrameSource::Prefetch(ULONGLONG first, UINT count)
+{
+	// ask the memory manager to bring the next frames in with large I/Os instead of one page fault at a time
+	WIN32_MEMORY_RANGE_ENTRY entries[READAHEAD_FRAMES];
+	ULONG entriesCount = 0;
+	for (UINT i = 0; i < count && i < READAHEAD_FRAMES; i++)
+	{
+		auto offset = _dataOffset + ((first + i) % _frameCount) * (_frameHeaderSize + _frameSize);
+		if (offset < _viewOffset || offset + _frameHeaderSize + _frameSize > _viewOffset + _viewSize)
+			continue; // not mapped yet
+
+		entries[entriesCount].VirtualAddress = _view.get() + (offset - _viewOffset);
+		entries[entriesCount].NumberOfBytes = (SIZE_T)(_frameHeaderSize + _frameSize);
+		entriesCount++;
+	}
+
+	if (entriesCount && !PrefetchVirtualMemory(GetCurrentProcess(), entriesCount, entries, 0))
+	{
+		WINTRACE(L"FileFrameSource::Prefetch error:%u", GetLastError());
+	}
+}
+
+HRESULT FileFrameSource::Start(UINT width, UINT height, UINT fpsNumerator, UINT fpsDenominator)
+{
+	RETURN_HR_IF(E_UNEXPECTED, !_mapping);
+	RETURN_HR_IF(E_INVALIDARG, !fpsNumerator || !fpsDenominator);
+	WINTRACE(L"FileFrameSource::Start stream:%u x %u file:%u x %u fps:%u/%u", width, height, _width, _height, fpsNumerator, fpsDenominator);
+
+	// we loop over the file at the given rate, the file's rate if the source is wrapped in a frame rate converter
+	_fpsNumerator = fpsNumerator;
+	_fpsDenominator = fpsDenominator;
+	_lastIndex = NO_FRAME_INDEX;
+	RETURN_IF_FAILED(EnsureView(_dataOffset, _frameHeaderSize + _frameSize));
+	Prefetch(0, READAHEAD_FRAMES);
+	return S_OK;
+}
+
+HRESULT FileFrameSource::GetFrame(MFTIME time, REFGUID preferredFormat, SourceFrame* frame)
+{
+	UNREFERENCED_PARAMETER(preferredFormat);
+	RETURN_HR_IF_NULL(E_POINTER, frame);
+	RETURN_HR_IF(E_UNEXPECTED, !_mapping);
+
+	auto index = (ULONGLONG)(std::max<MFTIME>(time, 0) * _fpsNumerator / (_fpsDenominator * 10000000ull)) % _frameCount;
+	auto offset = _dataOffset + index * (_frameHeaderSize + _frameSize) + _frameHeaderSize;
+	RETURN_IF_FAILED(EnsureView(offset, _frameSize));
+	if (index != _lastIndex)
+	{
+		// when playing sequentially, the frames in between have already been prefetched
+		if (index == (_lastIndex + 1) % _frameCount)
+		{
+			Prefetch(index + READAHEAD_FRAMES, 1);
+		}
+		else
+		{
+			Prefetch(index + 1, READAHEAD_FRAMES);
+		}
+		_lastIndex = index;
+	}
+
+	auto data = _view.get() + (offset - _viewOffset);
+	frame->format = _format;
+	frame->width = _width;
+	frame->height = _height;
+	frame->index = index;
+	frame->planes[0] = data;
+	if (_format == MFVideoFormat_RGB32)
+	{
+		frame->strides[0] = _width * 4;
+		frame->planes[1] = nullptr;
+		frame->strides[1] = 0;
+		frame->planes[2] = nullptr;
+		frame->strides[2] = 0;
+	}
+	else if (_format == MFVideoFormat_NV12)
+	{
+		frame->strides[0] = _width;
+		frame->planes[1] = data + _width * _height;
+		frame->strides[1] = _width;
+		frame->planes[2] = nullptr;
+		frame->strides[2] = 0;
+	}
+	else
+	{
+		frame->strides[0] = _width;
+		frame->planes[1] = data + _width * _height;
+		frame->strides[1] = _width / 2;
+		frame->planes[2] = frame->planes[1] + (_width / 2) * (_height / 2);
+		frame->strides[2] = _width / 2;
+	}
+	return S_OK;
+}
+
+bool FileFrameSource::GetFrameRate(UINT* numerator, UINT* denominator)
+{
+	if (!_fileFpsNumerator || !_fileFpsDenominator)
+		return false;
+
+	*numerator = _fileFpsNumerator;
+	*denominator = _fileFpsDenominator;
+	return true;
+}
+
+void FileFrameSource::Stop()
+{
+	// release the view, the mapping is kept so we can restart quickly
+	_view.reset();
+	_viewOffset = 0;
+	_viewSize = 0;
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+// serves frames from a raw NV12/I420/BGRA file or a Y4M (4:2:0) file, using a memory mapped view of the file
+// frames are served by pointer in the mapped view, there's no read or intermediate copy
+class FileFrameSource : public FrameSource
+{
+	wil::unique_hfile _file;
+	wil::unique_handle _mapping;
+	wil::unique_mapview_ptr<BYTE> _view;
+	ULONGLONG _fileSize;
+	ULONGLONG _viewOffset;
+	SIZE_T _viewSize;
+	ULONGLONG _dataOffset; // offset of the first frame (including its header for Y4M)
+	ULONGLONG _frameHeaderSize; // "FRAME\n" for Y4M, 0 for raw
+	ULONGLONG _frameSize;
+	ULONGLONG _frameCount;
+	ULONGLONG _lastIndex;
+	GUID _format;
+	UINT _width;
+	UINT _height;
+	UINT _fileFpsNumerator; // from Y4M header or settings, 0 if unknown
+	UINT _fileFpsDenominator;
+	UINT _fpsNumerator;
+	UINT _fpsDenominator;
+
+	HRESULT EnsureView(ULONGLONG offset, ULONGLONG size);
+	HRESULT ParseY4MHeader();
+	void Prefetch(ULONGLONG first, UINT count);
+
+public:
+	FileFrameSource() :
+		_fileSize(0),
+		_viewOffset(0),
+		_viewSize(0),
+		_dataOffset(0),
+		_frameHeaderSize(0),
+		_frameSize(0),
+		_frameCount(0),
+		_lastIndex(0),
+		_format(GUID_NULL),
+		_width(0),
+		_height(0),
+		_fileFpsNumerator(0),
+		_fileFpsDenominator(0),
+		_fpsNumerator(30),
+		_fpsDenominator(1)
+	{
+	}
+
+	// format, size & fps are ignored for .y4m files since they are read from the file header
+	// fps can be 0 if the raw file has no specific rate, it's then played at the stream's rate
+	HRESULT Open(PCWSTR path, PCWSTR format, UINT width, UINT height, UINT fps);
+
+	// FrameSource
+	HRESULT Start(UINT width, UINT height, UINT fpsNumerator, UINT fpsDenominator);
+	HRESULT GetFrame(MFTIME time, REFGUID preferredFormat, SourceFrame* frame);
+	void Stop();
+	bool GetFrameRate(UINT* numerator, UINT* denominator);
+};
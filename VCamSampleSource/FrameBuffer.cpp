@@ -0,0 +1,306 @@
+#include "FrameBuffer.h"
+#include <algorithm>
+#include <new>
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <cstdio>
+#include <sys/mman.h>
+#endif
+
+size_t GetFrameBufferSize(FrameBufferFormat format, int32_t stride, uint32_t height)
+{
+	return format == FrameBufferFormat::Nv12 ? Nv12View::GetSize(stride, height) : Rgb32View::GetSize(stride, height);
+}
+
+int32_t GetAlignedFrameStride(FrameBufferFormat format, uint32_t width)
+{
+	return format == FrameBufferFormat::Nv12 ? Nv12View::GetAlignedStride(width) : Rgb32View::GetAlignedStride(width);
+}
+
+FrameBuffer& FrameBuffer::operator=(FrameBuffer&& other) noexcept
+{
+	if (this != &other)
+	{
+		reset();
+		_data = other._data;
+		_size = other._size;
+		_memory = other._memory;
+		_pool = other._pool;
+		other._data = nullptr;
+		other._size = 0;
+		other._pool = nullptr;
+	}
+	return *this;
+}
+
+void FrameBuffer::reset()
+{
+	if (_data)
+	{
+		_pool->Release(_data, _size, _memory);
+		_data = nullptr;
+		_size = 0;
+		_pool = nullptr;
+	}
+}
+
+#if defined(_WIN32)
+// large pages can only be allocated by a token holding SeLockMemoryPrivilege (granted by the "Lock pages in memory" policy), which must be enabled first
+static bool EnableLockMemoryPrivilege()
+{
+	HANDLE token;
+	if (!OpenProcessToken(GetCurrentProcess(), TOKEN_ADJUST_PRIVILEGES | TOKEN_QUERY, &token))
+		return false;
+
+	TOKEN_PRIVILEGES privileges{};
+	privileges.PrivilegeCount = 1;
+	privileges.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
+	auto enabled = LookupPrivilegeValueW(nullptr, SE_LOCK_MEMORY_NAME, &privileges.Privileges[0].Luid) &&
+		AdjustTokenPrivileges(token, FALSE, &privileges, 0, nullptr, nullptr) &&
+		GetLastError() != ERROR_NOT_ALL_ASSIGNED; // AdjustTokenPrivileges succeeds when the token doesn't hold the privilege
+	CloseHandle(token);
+	return enabled;
+}
+#endif
+
+size_t FrameBufferPool::GetLargePageSize()
+{
+	static const size_t size = []() -> size_t
+		{
+#if defined(_WIN32)
+			return GetLargePageMinimum();
+#else
+			// the default huge page size, what MAP_HUGETLB & transparent huge pages use
+			size_t kb = 0;
+			auto file = fopen("/proc/meminfo", "r");
+			if (file)
+			{
+				char line[128];
+				while (fgets(line, sizeof(line), file))
+				{
+					if (sscanf(line, "Hugepagesize: %zu kB", &kb) == 1)
+						break;
+
+					kb = 0;
+				}
+				fclose(file);
+			}
+			return kb * 1024;
+#endif
+		}();
+	return size;
+}
+
+// size is rounded up to whole large pages, nullptr when there are none to be had
+static uint8_t* AllocateLargePages(size_t& size, FrameMemory& memory)
+{
+	auto pageSize = FrameBufferPool::GetLargePageSize();
+	if (!pageSize)
+		return nullptr;
+
+	auto rounded = (size + pageSize - 1) / pageSize * pageSize;
+#if defined(_WIN32)
+	static const bool privilege = EnableLockMemoryPrivilege();
+	if (!privilege)
+		return nullptr;
+
+	auto data = (uint8_t*)VirtualAlloc(nullptr, rounded, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+	if (data)
+	{
+		size = rounded;
+		memory = FrameMemory::LargePages;
+	}
+	return data;
+#else
+#if defined(MAP_HUGETLB)
+	// from the pages reserved in /proc/sys/vm/nr_hugepages
+	auto data = mmap(nullptr, rounded, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+	if (data != MAP_FAILED)
+	{
+		size = rounded;
+		memory = FrameMemory::LargePages;
+		return (uint8_t*)data;
+	}
+#endif
+#if defined(MADV_HUGEPAGE)
+	// else a huge page aligned mapping that transparent huge pages can back ("madvise" or "always" in /sys/kernel/mm/transparent_hugepage/enabled)
+	auto mapped = mmap(nullptr, rounded + pageSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (mapped == MAP_FAILED)
+		return nullptr;
+
+	auto start = (uintptr_t)mapped;
+	auto aligned = (start + pageSize - 1) & ~(uintptr_t)(pageSize - 1);
+	if (aligned > start)
+	{
+		munmap(mapped, aligned - start);
+	}
+	auto tail = start + pageSize - aligned;
+	if (tail)
+	{
+		munmap((void*)(aligned + rounded), tail);
+	}
+
+	if (madvise((void*)aligned, rounded, MADV_HUGEPAGE))
+	{
+		munmap((void*)aligned, rounded);
+		return nullptr;
+	}
+
+	size = rounded;
+	memory = FrameMemory::HugePageHint;
+	return (uint8_t*)aligned;
+#else
+	return nullptr;
+#endif
+#endif
+}
+
+static void FreeFrameMemory(uint8_t* data, size_t size, FrameMemory memory)
+{
+	if (memory == FrameMemory::Heap)
+	{
+		::operator delete(data, std::align_val_t(FRAME_BUFFER_ALIGNMENT));
+		return;
+	}
+
+#if defined(_WIN32)
+	(void)size;
+	VirtualFree(data, 0, MEM_RELEASE);
+#else
+	munmap(data, size);
+#endif
+}
+
+FrameBuffer FrameBufferPool::Acquire(size_t size)
+{
+	FrameBuffer buffer;
+	if (!size)
+		return buffer;
+
+	bool largePages;
+	{
+		// best fit, but a buffer more than 1/8 larger is left for a larger frame, unless it's one rounded up to large pages
+		std::lock_guard<std::mutex> lock(_lock);
+		uint32_t best = _freeCount;
+		for (uint32_t i = 0; i < _freeCount; i++)
+		{
+			auto freeSize = _free[i].size;
+			auto slack = _free[i].memory == FrameMemory::Heap ? size / 8 : std::max(size / 8, GetLargePageSize());
+			if (freeSize >= size && freeSize <= size + slack && (best == _freeCount || freeSize < _free[best].size))
+			{
+				best = i;
+			}
+		}
+
+		if (best < _freeCount)
+		{
+			buffer._data = _free[best].data;
+			buffer._size = _free[best].size;
+			buffer._memory = _free[best].memory;
+			buffer._pool = this;
+			_free[best] = _free[--_freeCount];
+			_stats.reused++;
+			return buffer;
+		}
+		largePages = _largePages && GetLargePageSize() && size >= GetLargePageSize();
+	}
+
+	auto allocated = size;
+	auto memory = FrameMemory::Heap;
+	uint8_t* data = nullptr;
+	if (largePages)
+	{
+		data = AllocateLargePages(allocated, memory);
+	}
+
+	if (!data)
+	{
+		allocated = size;
+		memory = FrameMemory::Heap;
+		data = (uint8_t*)::operator new(size, std::align_val_t(FRAME_BUFFER_ALIGNMENT), std::nothrow);
+		if (!data)
+			return buffer;
+	}
+
+	// fault the pages in now (when streams start) rather than while the first frames are produced
+	for (size_t offset = 0; offset < allocated; offset += FRAME_BUFFER_PREFAULT_STEP)
+	{
+		data[offset] = 0;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(_lock);
+		_stats.allocated++;
+		_stats.bytes += allocated;
+		if (memory == FrameMemory::LargePages)
+		{
+			_stats.largePages++;
+		}
+		else if (memory == FrameMemory::HugePageHint)
+		{
+			_stats.hugePageHints++;
+		}
+		else if (largePages)
+		{
+			_stats.largePageFailures++;
+		}
+	}
+
+	buffer._data = data;
+	buffer._size = allocated;
+	buffer._memory = memory;
+	buffer._pool = this;
+	return buffer;
+}
+
+void FrameBufferPool::Release(uint8_t* data, size_t size, FrameMemory memory)
+{
+	{
+		std::lock_guard<std::mutex> lock(_lock);
+		if (_freeCount < FRAME_BUFFER_POOL_MAX_FREE)
+		{
+			_free[_freeCount++] = FreeBuffer{ data, size, memory };
+			return;
+		}
+		_stats.bytes -= size;
+	}
+	FreeFrameMemory(data, size, memory);
+}
+
+void FrameBufferPool::Trim()
+{
+	std::lock_guard<std::mutex> lock(_lock);
+	for (uint32_t i = 0; i < _freeCount; i++)
+	{
+		FreeFrameMemory(_free[i].data, _free[i].size, _free[i].memory);
+		_stats.bytes -= _free[i].size;
+	}
+	_freeCount = 0;
+}
+
+uint32_t FrameBufferPool::GetFreeCount()
+{
+	std::lock_guard<std::mutex> lock(_lock);
+	return _freeCount;
+}
+
+void FrameBufferPool::SetLargePages(bool enable)
+{
+	std::lock_guard<std::mutex> lock(_lock);
+	_largePages = enable;
+}
+
+FrameBufferPoolStats FrameBufferPool::GetStats()
+{
+	std::lock_guard<std::mutex> lock(_lock);
+	return _stats;
+}
+
+FrameBufferPool& FrameBufferPool::GetShared()
+{
+	static FrameBufferPool pool;
+	return pool;
+}
\ No newline at end of file
@@ -0,0 +1,220 @@
+#pragma once
+
+// Geometry & memory of uncompressed frames: typed views of the planes of RGB32 & NV12 frames, strides padded to 64 bytes so every row starts
+// on a cache line (and full-width SIMD loads need no tail handling), and a pool of 64-byte aligned buffers recycled across streams & starts.
+// The pool can back large buffers with large pages, which cuts the TLB misses of streaming through 4K frames, falling back to normal pages.
+// Large pages are MEM_LARGE_PAGES on Windows, and reserved huge pages or else transparent huge pages on Linux.
+#include <cstdint>
+#include <cstddef>
+#include <mutex>
+
+#define FRAME_BUFFER_ALIGNMENT 64
+#define FRAME_BUFFER_POOL_MAX_FREE 32 // buffers kept for reuse, others are freed when released
+#define FRAME_BUFFER_PREFAULT_STEP 4096 // new buffers are touched every page so they're faulted in when acquired, not on the first frames
+
+enum class FrameBufferFormat
+{
+	Rgb32,
+	Nv12,
+};
+
+struct FramePlane
+{
+	uint8_t* data;
+	int32_t stride;
+	uint32_t widthInBytes;
+	uint32_t height;
+};
+
+template <FrameBufferFormat Format> struct FrameFormatTraits;
+
+template <> struct FrameFormatTraits<FrameBufferFormat::Rgb32>
+{
+	static constexpr uint32_t Planes = 1;
+	static constexpr uint32_t GetRowBytes(uint32_t, uint32_t width) { return width * 4; }
+	static constexpr uint32_t GetRows(uint32_t, uint32_t height) { return height; }
+};
+
+// luma, then interleaved UV at half height, both with the same stride like in Media Foundation's NV12 buffers
+template <> struct FrameFormatTraits<FrameBufferFormat::Nv12>
+{
+	static constexpr uint32_t Planes = 2;
+	static constexpr uint32_t GetRowBytes(uint32_t, uint32_t width) { return width; }
+	static constexpr uint32_t GetRows(uint32_t plane, uint32_t height) { return plane ? height / 2 : height; }
+};
+
+inline uint32_t AlignFrameStride(uint32_t rowBytes)
+{
+	return (rowBytes + FRAME_BUFFER_ALIGNMENT - 1) & ~(uint32_t)(FRAME_BUFFER_ALIGNMENT - 1);
+}
+
+template <FrameBufferFormat Format>
+struct FrameView
+{
+	using Traits = FrameFormatTraits<Format>;
+
+	FramePlane planes[Traits::Planes];
+	uint32_t width;
+	uint32_t height;
+
+	// smallest stride that fits the rows of all planes, padded to FRAME_BUFFER_ALIGNMENT
+	static int32_t GetAlignedStride(uint32_t width)
+	{
+		return (int32_t)AlignFrameStride(Traits::GetRowBytes(0, width));
+	}
+
+	// of the planes one after the other with the same stride
+	static size_t GetSize(int32_t stride, uint32_t height)
+	{
+		size_t rows = 0;
+		for (uint32_t i = 0; i < Traits::Planes; i++)
+		{
+			rows += Traits::GetRows(i, height);
+		}
+		return rows * (size_t)(stride < 0 ? -(int64_t)stride : stride);
+	}
+
+	// planes one after the other with the same stride, as in a locked IMF2DBuffer or a pooled buffer
+	static FrameView FromBuffer(uint8_t* data, int32_t stride, uint32_t width, uint32_t height)
+	{
+		FrameView view{};
+		view.width = width;
+		view.height = height;
+		for (uint32_t i = 0; i < Traits::Planes; i++)
+		{
+			view.planes[i] = FramePlane{ data, stride, Traits::GetRowBytes(i, width), Traits::GetRows(i, height) };
+			data += (ptrdiff_t)stride * Traits::GetRows(i, height);
+		}
+		return view;
+	}
+};
+
+using Rgb32View = FrameView<FrameBufferFormat::Rgb32>;
+using Nv12View = FrameView<FrameBufferFormat::Nv12>;
+
+// for the stages that handle both formats
+size_t GetFrameBufferSize(FrameBufferFormat format, int32_t stride, uint32_t height);
+int32_t GetAlignedFrameStride(FrameBufferFormat format, uint32_t width);
+
+// where the NV12 UV plane starts, stages handling both formats are given it for RGB32 too and ignore it
+inline uint8_t* GetFrameBufferUV(uint8_t* data, int32_t stride, uint32_t height)
+{
+	return data + (ptrdiff_t)stride * height;
+}
+
+inline const uint8_t* GetFrameBufferUV(const uint8_t* data, int32_t stride, uint32_t height)
+{
+	return data + (ptrdiff_t)stride * height;
+}
+
+enum class FrameMemory
+{
+	Heap,
+	LargePages, // VirtualAlloc MEM_LARGE_PAGES or mmap MAP_HUGETLB, always resident
+	HugePageHint, // mmap with madvise MADV_HUGEPAGE, backed by transparent huge pages when the kernel has some
+};
+
+class FrameBufferPool;
+
+// FRAME_BUFFER_ALIGNMENT aligned memory that goes back to its pool when destroyed
+class FrameBuffer
+{
+	uint8_t* _data;
+	size_t _size;
+	FrameMemory _memory;
+	FrameBufferPool* _pool;
+
+	friend class FrameBufferPool;
+
+public:
+	FrameBuffer() :
+		_data(nullptr),
+		_size(0),
+		_memory(FrameMemory::Heap),
+		_pool(nullptr)
+	{
+	}
+
+	FrameBuffer(FrameBuffer&& other) noexcept :
+		_data(other._data),
+		_size(other._size),
+		_memory(other._memory),
+		_pool(other._pool)
+	{
+		other._data = nullptr;
+		other._size = 0;
+		other._pool = nullptr;
+	}
+
+	FrameBuffer& operator=(FrameBuffer&& other) noexcept;
+	FrameBuffer(const FrameBuffer&) = delete;
+	FrameBuffer& operator=(const FrameBuffer&) = delete;
+	~FrameBuffer() { reset(); }
+
+	uint8_t* get() const { return _data; }
+	size_t size() const { return _size; } // can be more than what was asked, rounded to large pages
+	FrameMemory memory() const { return _memory; }
+	explicit operator bool() const { return _data != nullptr; }
+	void reset();
+};
+
+struct FrameBufferPoolStats
+{
+	uint64_t allocated; // buffers
+	uint64_t reused;
+	uint64_t largePages; // allocated buffers backed by large pages
+	uint64_t hugePageHints;
+	uint64_t largePageFailures; // buffers that fell back to normal pages
+	uint64_t bytes; // allocated and not freed yet, in use or kept for reuse
+};
+
+// keeps released buffers to hand them out again, so restarting a stream or starting another one of the same size doesn't allocate
+class FrameBufferPool
+{
+	struct FreeBuffer
+	{
+		uint8_t* data;
+		size_t size;
+		FrameMemory memory;
+	};
+
+	std::mutex _lock;
+	FreeBuffer _free[FRAME_BUFFER_POOL_MAX_FREE];
+	uint32_t _freeCount;
+	bool _largePages;
+	FrameBufferPoolStats _stats;
+
+	friend class FrameBuffer;
+	void Release(uint8_t* data, size_t size, FrameMemory memory);
+
+public:
+	FrameBufferPool() :
+		_free(),
+		_freeCount(0),
+		_largePages(false),
+		_stats()
+	{
+	}
+
+	~FrameBufferPool() { Trim(); }
+	FrameBufferPool(const FrameBufferPool&) = delete;
+	FrameBufferPool& operator=(const FrameBufferPool&) = delete;
+
+	// a free buffer of at least size bytes (but not much more) or a new one, empty when memory is exhausted
+	FrameBuffer Acquire(size_t size);
+
+	// frees the buffers kept for reuse
+	void Trim();
+	uint32_t GetFreeCount();
+
+	// buffers of at least a large page are then allocated with large pages when the system allows it (on Windows, the process needs
+	// SeLockMemoryPrivilege, on Linux reserved huge pages, or else transparent huge pages are asked for), buffers already kept are still reused
+	void SetLargePages(bool enable);
+	FrameBufferPoolStats GetStats();
+
+	// 0 when the system has no large pages
+	static size_t GetLargePageSize();
+
+	// buffers a stream releases are reused by the other streams and by the next starts
+	static FrameBufferPool& GetShared();
+};
\ No newline at end of file
@@ -0,0 +1,229 @@
+#include "FrameCode.h"
+#include <cstddef>
+#include <cstring>
+#include <algorithm>
+
+#define FRAME_CODE_PAYLOAD_BYTES 14 // frame, time & CRC, 7 rows of 16 bits
+#define FRAME_CODE_MIN_CONTRAST 48 // between calibration blocks, below there's no code
+#define FRAME_CODE_NV12_WHITE 235
+#define FRAME_CODE_NV12_BLACK 16
+
+struct BlockRect
+{
+	uint32_t left;
+	uint32_t top;
+	uint32_t right;
+	uint32_t bottom;
+};
+
+static BlockRect GetBlock(uint32_t width, uint32_t height, uint32_t column, uint32_t row, bool mirrored)
+{
+	BlockRect rect;
+	rect.left = (uint32_t)((uint64_t)column * width / FRAME_CODE_X_DIVISIONS);
+	rect.right = (uint32_t)((uint64_t)(column + 1) * width / FRAME_CODE_X_DIVISIONS);
+	rect.top = (uint32_t)((uint64_t)row * height / FRAME_CODE_Y_DIVISIONS);
+	rect.bottom = (uint32_t)((uint64_t)(row + 1) * height / FRAME_CODE_Y_DIVISIONS);
+	if (mirrored)
+	{
+		auto left = width - rect.right;
+		rect.right = width - rect.left;
+		rect.left = left;
+	}
+	return rect;
+}
+
+// CRC-16/CCITT-FALSE
+static uint16_t Crc16(const uint8_t* data, uint32_t size)
+{
+	uint16_t crc = 0xFFFF;
+	for (uint32_t i = 0; i < size; i++)
+	{
+		crc ^= (uint16_t)(data[i] << 8);
+		for (int bit = 0; bit < 8; bit++)
+		{
+			crc = (uint16_t)(crc & 0x8000 ? (crc << 1) ^ 0x1021 : crc << 1);
+		}
+	}
+	return crc;
+}
+
+// little endian frame, time, then the CRC of both
+static void Pack(const FrameCode& code, uint8_t payload[FRAME_CODE_PAYLOAD_BYTES])
+{
+	for (int i = 0; i < 4; i++)
+	{
+		payload[i] = (uint8_t)(code.frame >> (i * 8));
+	}
+
+	for (int i = 0; i < 8; i++)
+	{
+		payload[4 + i] = (uint8_t)(code.time >> (i * 8));
+	}
+
+	auto crc = Crc16(payload, 12);
+	payload[12] = (uint8_t)crc;
+	payload[13] = (uint8_t)(crc >> 8);
+}
+
+// white or black, the calibration row alternates starting with white, then payload bits from the least significant of each byte
+static bool IsWhite(const uint8_t payload[FRAME_CODE_PAYLOAD_BYTES], uint32_t column, uint32_t row)
+{
+	if (!row)
+		return !(column & 1);
+
+	auto bit = (row - 1) * FRAME_CODE_COLUMNS + column;
+	return (payload[bit / 8] >> (bit % 8)) & 1;
+}
+
+bool WriteFrameCode(const FrameCode& code, FrameCodeFormat format, uint8_t* output, int32_t stride, uint8_t* uv, int32_t uvStride, uint32_t width, uint32_t height)
+{
+	if (!output || !FrameCodeFits(width, height) || (format == FrameCodeFormat::Nv12 && !uv))
+		return false;
+
+	uint8_t payload[FRAME_CODE_PAYLOAD_BYTES];
+	Pack(code, payload);
+	for (uint32_t row = 0; row < FRAME_CODE_ROWS; row++)
+	{
+		for (uint32_t column = 0; column < FRAME_CODE_COLUMNS; column++)
+		{
+			auto rect = GetBlock(width, height, column, row, false);
+			auto white = IsWhite(payload, column, row);
+			for (auto y = rect.top; y < rect.bottom; y++)
+			{
+				auto line = output + (ptrdiff_t)y * stride;
+				if (format == FrameCodeFormat::Nv12)
+				{
+					memset(line + rect.left, white ? FRAME_CODE_NV12_WHITE : FRAME_CODE_NV12_BLACK, rect.right - rect.left);
+				}
+				else
+				{
+					auto pixel = white ? 0xFFFFFFFFu : 0xFF000000u;
+					for (auto x = rect.left; x < rect.right; x++)
+					{
+						memcpy(line + x * 4, &pixel, 4);
+					}
+				}
+			}
+		}
+	}
+
+	// no color in the code, chroma samples covering an odd edge are made neutral too
+	if (format == FrameCodeFormat::Nv12)
+	{
+		auto corner = GetBlock(width, height, FRAME_CODE_COLUMNS - 1, FRAME_CODE_ROWS - 1, false);
+		auto uvWidth = (corner.right + 1) & ~1u;
+		auto uvHeight = (corner.bottom + 1) / 2;
+		for (uint32_t y = 0; y < uvHeight; y++)
+		{
+			memset(uv + (ptrdiff_t)y * uvStride, 128, uvWidth);
+		}
+	}
+	return true;
+}
+
+bool GetFrameCodeBlock(const FrameCode& code, uint32_t width, uint32_t height, uint32_t column, uint32_t row, uint32_t& left, uint32_t& top, uint32_t& right, uint32_t& bottom)
+{
+	uint8_t payload[FRAME_CODE_PAYLOAD_BYTES];
+	Pack(code, payload);
+	auto rect = GetBlock(width, height, column, row, false);
+	left = rect.left;
+	top = rect.top;
+	right = rect.right;
+	bottom = rect.bottom;
+	return IsWhite(payload, column, row);
+}
+
+// average luma of the middle half of a block
+static int ReadBlock(FrameCodeFormat format, const uint8_t* input, int32_t stride, const BlockRect& rect)
+{
+	auto marginX = (rect.right - rect.left) / 4;
+	auto marginY = (rect.bottom - rect.top) / 4;
+	uint32_t sum = 0;
+	uint32_t count = 0;
+	for (auto y = rect.top + marginY; y < rect.bottom - marginY; y++)
+	{
+		auto line = input + (ptrdiff_t)y * stride;
+		for (auto x = rect.left + marginX; x < rect.right - marginX; x++)
+		{
+			if (format == FrameCodeFormat::Nv12)
+			{
+				sum += line[x];
+			}
+			else
+			{
+				auto pixel = line + x * 4;
+				sum += (pixel[0] + pixel[1] * 2 + pixel[2]) / 4;
+			}
+			count++;
+		}
+	}
+	return count ? (int)(sum / count) : 0;
+}
+
+static bool ReadCorner(FrameCodeFormat format, const uint8_t* input, int32_t stride, uint32_t width, uint32_t height, bool mirrored, FrameCode& code)
+{
+	int levels[FRAME_CODE_ROWS][FRAME_CODE_COLUMNS];
+	for (uint32_t row = 0; row < FRAME_CODE_ROWS; row++)
+	{
+		for (uint32_t column = 0; column < FRAME_CODE_COLUMNS; column++)
+		{
+			levels[row][column] = ReadBlock(format, input, stride, GetBlock(width, height, column, row, mirrored));
+		}
+	}
+
+	// the threshold is halfway between the darkest white & the brightest black calibration blocks
+	auto white = 255;
+	auto black = 0;
+	for (uint32_t column = 0; column < FRAME_CODE_COLUMNS; column++)
+	{
+		if (column & 1)
+		{
+			black = std::max(black, levels[0][column]);
+		}
+		else
+		{
+			white = std::min(white, levels[0][column]);
+		}
+	}
+
+	if (white - black < FRAME_CODE_MIN_CONTRAST)
+		return false;
+
+	auto threshold = (white + black) / 2;
+	uint8_t payload[FRAME_CODE_PAYLOAD_BYTES] = {};
+	for (uint32_t row = 1; row < FRAME_CODE_ROWS; row++)
+	{
+		for (uint32_t column = 0; column < FRAME_CODE_COLUMNS; column++)
+		{
+			if (levels[row][column] > threshold)
+			{
+				auto bit = (row - 1) * FRAME_CODE_COLUMNS + column;
+				payload[bit / 8] |= (uint8_t)(1 << (bit % 8));
+			}
+		}
+	}
+
+	if (Crc16(payload, 12) != (uint16_t)(payload[12] | (payload[13] << 8)))
+		return false;
+
+	code.frame = 0;
+	for (int i = 0; i < 4; i++)
+	{
+		code.frame |= (uint32_t)payload[i] << (i * 8);
+	}
+
+	code.time = 0;
+	for (int i = 0; i < 8; i++)
+	{
+		code.time |= (uint64_t)payload[4 + i] << (i * 8);
+	}
+	return true;
+}
+
+bool ReadFrameCode(FrameCodeFormat format, const uint8_t* input, int32_t stride, uint32_t width, uint32_t height, FrameCode& code)
+{
+	if (!input || !FrameCodeFits(width, height))
+		return false;
+
+	return ReadCorner(format, input, stride, width, height, false, code) || ReadCorner(format, input, stride, width, height, true, code);
+}
\ No newline at end of file
@@ -0,0 +1,37 @@
+#pragma once
+
+// Machine readable frame number & timestamp burnt in the top left corner of frames, and its decoder, to measure latency from captured frames.
+// The code is a grid of white & black blocks: a row of alternating blocks to calibrate the decoder, then 7 rows of 16 bits for
+// the frame number (32 bits), the timestamp (64 bits) and a CRC-16 of both. Blocks are a fixed fraction of the frame size,
+// so the decoder finds them in a scaled frame, and it reads the middle of each block only, so it withstands compression artifacts.
+#include <cstdint>
+
+#define FRAME_CODE_COLUMNS 16
+#define FRAME_CODE_ROWS 8
+#define FRAME_CODE_X_DIVISIONS 96 // a block is 1/96 of the frame width
+#define FRAME_CODE_Y_DIVISIONS 54 // and 1/54 of its height
+#define FRAME_CODE_MIN_WIDTH (FRAME_CODE_X_DIVISIONS * 2) // blocks of at least 2x2 pixels
+#define FRAME_CODE_MIN_HEIGHT (FRAME_CODE_Y_DIVISIONS * 2)
+
+enum class FrameCodeFormat
+{
+	Rgb32,
+	Nv12, // reading only needs the Y plane, so it also works with I420
+};
+
+struct FrameCode
+{
+	uint32_t frame;
+	uint64_t time; // the media source uses the sample time, 100ns units of MFGetSystemTime
+};
+
+inline bool FrameCodeFits(uint32_t width, uint32_t height) { return width >= FRAME_CODE_MIN_WIDTH && height >= FRAME_CODE_MIN_HEIGHT; }
+
+// writes the code in the top left corner, uv is the NV12 chroma plane, unused for RGB32, false if the frame is too small
+bool WriteFrameCode(const FrameCode& code, FrameCodeFormat format, uint8_t* output, int32_t stride, uint8_t* uv, int32_t uvStride, uint32_t width, uint32_t height);
+
+// block at column & row of the code in a frame of that size, true if it's white, to draw the code with other APIs
+bool GetFrameCodeBlock(const FrameCode& code, uint32_t width, uint32_t height, uint32_t column, uint32_t row, uint32_t& left, uint32_t& top, uint32_t& right, uint32_t& bottom);
+
+// reads the code from the top left corner, or the top right corner if the frame was mirrored (like a self view), false if there's no valid code
+bool ReadFrameCode(FrameCodeFormat format, const uint8_t* input, int32_t stride, uint32_t width, uint32_t height, FrameCode& code);
\ No newline at end of file
@@ -0,0 +1,315 @@
+#include "FrameCrc.h"
+#include <cstring>
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+#include <nmmintrin.h>
+#define CRC_SSE42
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define CRC_TARGET
+#else
+#include <cpuid.h>
+#define CRC_TARGET __attribute__((target("sse4.2")))
+#endif
+#elif defined(_M_ARM64) || (defined(__aarch64__) && defined(__ARM_FEATURE_CRC32))
+#define CRC_ARM
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <arm_acle.h>
+#endif
+#endif
+
+#define CRC32C_POLYNOMIAL 0x82F63B78 // reflected
+#define CRC_LANE_SIZE 256 // bytes of each of the 3 streams the CRC instruction works on at once, to hide its latency
+
+// slicing-by-8 tables, the CRCs of x^(2^n) to combine CRCs, and tables to shift a CRC by 1 & 2 lanes
+struct Crc32cTables
+{
+	uint32_t slices[8][256];
+	uint32_t powers[32];
+	uint32_t shifts[2][4][256];
+	bool sse42;
+
+	Crc32cTables() :
+		sse42(false)
+	{
+		for (uint32_t i = 0; i < 256; i++)
+		{
+			auto crc = i;
+			for (int bit = 0; bit < 8; bit++)
+			{
+				crc = crc & 1 ? (crc >> 1) ^ CRC32C_POLYNOMIAL : crc >> 1;
+			}
+			slices[0][i] = crc;
+		}
+
+		for (uint32_t i = 0; i < 256; i++)
+		{
+			for (int slice = 1; slice < 8; slice++)
+			{
+				slices[slice][i] = (slices[slice - 1][i] >> 8) ^ slices[0][slices[slice - 1][i] & 0xFF];
+			}
+		}
+
+		uint32_t power = 1u << 30; // x^1
+		powers[0] = power;
+		for (int n = 1; n < 32; n++)
+		{
+			power = MultiplyModP(power, power);
+			powers[n] = power;
+		}
+
+		for (int lanes = 0; lanes < 2; lanes++)
+		{
+			auto shift = PowerOfSize(CRC_LANE_SIZE * (lanes + 1));
+			for (int k = 0; k < 4; k++)
+			{
+				for (uint32_t i = 0; i < 256; i++)
+				{
+					shifts[lanes][k][i] = MultiplyModP(shift, i << (k * 8));
+				}
+			}
+		}
+
+#if defined(CRC_SSE42)
+#if defined(_MSC_VER)
+		int info[4];
+		__cpuid(info, 1);
+		sse42 = (info[2] & (1 << 20)) != 0;
+#else
+		unsigned int eax, ebx, ecx, edx;
+		sse42 = __get_cpuid(1, &eax, &ebx, &ecx, &edx) && (ecx & bit_SSE4_2);
+#endif
+#endif
+	}
+
+	// a * b modulo the polynomial, reflected
+	static uint32_t MultiplyModP(uint32_t a, uint32_t b)
+	{
+		uint32_t m = 1u << 31;
+		uint32_t product = 0;
+		for (;;)
+		{
+			if (a & m)
+			{
+				product ^= b;
+				if (!(a & (m - 1)))
+					break;
+			}
+			m >>= 1;
+			b = b & 1 ? (b >> 1) ^ CRC32C_POLYNOMIAL : b >> 1;
+		}
+		return product;
+	}
+
+	// x^(8 * size) modulo the polynomial, multiplying a CRC by it appends size zero bytes
+	uint32_t PowerOfSize(uint64_t size) const
+	{
+		uint32_t power = 1u << 31; // x^0
+		uint32_t n = 3; // 2^3 bits per byte
+		while (size)
+		{
+			if (size & 1)
+			{
+				power = MultiplyModP(powers[n & 31], power);
+			}
+			size >>= 1;
+			n++;
+		}
+		return power;
+	}
+
+	// multiplies the CRC state by x^(8 * CRC_LANE_SIZE * lanes)
+	uint32_t Shift(uint32_t lanes, uint32_t state) const
+	{
+		auto& t = shifts[lanes - 1];
+		return t[0][state & 0xFF] ^ t[1][(state >> 8) & 0xFF] ^ t[2][(state >> 16) & 0xFF] ^ t[3][state >> 24];
+	}
+};
+
+static const Crc32cTables& GetTables()
+{
+	static const Crc32cTables tables;
+	return tables;
+}
+
+// state is the inverted CRC
+static uint32_t UpdateSlicing(const Crc32cTables& tables, uint32_t state, const uint8_t* data, size_t size)
+{
+	auto& t = tables.slices;
+	while (size >= 8)
+	{
+		uint32_t low;
+		uint32_t high;
+		memcpy(&low, data, 4);
+		memcpy(&high, data + 4, 4);
+		low ^= state;
+		state = t[7][low & 0xFF] ^ t[6][(low >> 8) & 0xFF] ^ t[5][(low >> 16) & 0xFF] ^ t[4][low >> 24] ^
+			t[3][high & 0xFF] ^ t[2][(high >> 8) & 0xFF] ^ t[1][(high >> 16) & 0xFF] ^ t[0][high >> 24];
+		data += 8;
+		size -= 8;
+	}
+
+	while (size--)
+	{
+		state = (state >> 8) ^ t[0][(state ^ *data++) & 0xFF];
+	}
+	return state;
+}
+
+#if defined(CRC_SSE42)
+CRC_TARGET static uint32_t UpdateSse42(const Crc32cTables& tables, uint32_t state, const uint8_t* data, size_t size)
+{
+#if defined(_M_X64) || defined(__x86_64__)
+	// 3 independent streams, then the first 2 are shifted to where they end & combined with the third
+	while (size >= 3 * CRC_LANE_SIZE)
+	{
+		uint64_t lane0 = state;
+		uint64_t lane1 = 0;
+		uint64_t lane2 = 0;
+		for (size_t i = 0; i < CRC_LANE_SIZE; i += 8)
+		{
+			uint64_t value0;
+			uint64_t value1;
+			uint64_t value2;
+			memcpy(&value0, data + i, 8);
+			memcpy(&value1, data + CRC_LANE_SIZE + i, 8);
+			memcpy(&value2, data + 2 * CRC_LANE_SIZE + i, 8);
+			lane0 = _mm_crc32_u64(lane0, value0);
+			lane1 = _mm_crc32_u64(lane1, value1);
+			lane2 = _mm_crc32_u64(lane2, value2);
+		}
+		state = tables.Shift(2, (uint32_t)lane0) ^ tables.Shift(1, (uint32_t)lane1) ^ (uint32_t)lane2;
+		data += 3 * CRC_LANE_SIZE;
+		size -= 3 * CRC_LANE_SIZE;
+	}
+
+	uint64_t state64 = state;
+	while (size >= 8)
+	{
+		uint64_t value;
+		memcpy(&value, data, 8);
+		state64 = _mm_crc32_u64(state64, value);
+		data += 8;
+		size -= 8;
+	}
+	state = (uint32_t)state64;
+#else
+	(void)tables;
+#endif
+	while (size >= 4)
+	{
+		uint32_t value;
+		memcpy(&value, data, 4);
+		state = _mm_crc32_u32(state, value);
+		data += 4;
+		size -= 4;
+	}
+
+	while (size--)
+	{
+		state = _mm_crc32_u8(state, *data++);
+	}
+	return state;
+}
+#endif
+
+#if defined(CRC_ARM)
+static uint32_t UpdateArm(const Crc32cTables& tables, uint32_t state, const uint8_t* data, size_t size)
+{
+	// 3 independent streams, like SSE4.2
+	while (size >= 3 * CRC_LANE_SIZE)
+	{
+		uint32_t lane0 = state;
+		uint32_t lane1 = 0;
+		uint32_t lane2 = 0;
+		for (size_t i = 0; i < CRC_LANE_SIZE; i += 8)
+		{
+			uint64_t value0;
+			uint64_t value1;
+			uint64_t value2;
+			memcpy(&value0, data + i, 8);
+			memcpy(&value1, data + CRC_LANE_SIZE + i, 8);
+			memcpy(&value2, data + 2 * CRC_LANE_SIZE + i, 8);
+			lane0 = __crc32cd(lane0, value0);
+			lane1 = __crc32cd(lane1, value1);
+			lane2 = __crc32cd(lane2, value2);
+		}
+		state = tables.Shift(2, lane0) ^ tables.Shift(1, lane1) ^ lane2;
+		data += 3 * CRC_LANE_SIZE;
+		size -= 3 * CRC_LANE_SIZE;
+	}
+
+	while (size >= 8)
+	{
+		uint64_t value;
+		memcpy(&value, data, 8);
+		state = __crc32cd(state, value);
+		data += 8;
+		size -= 8;
+	}
+
+	while (size--)
+	{
+		state = __crc32cb(state, *data++);
+	}
+	return state;
+}
+#endif
+
+static uint32_t Update(const Crc32cTables& tables, uint32_t state, const uint8_t* data, size_t size)
+{
+#if defined(CRC_ARM)
+	return UpdateArm(tables, state, data, size);
+#else
+#if defined(CRC_SSE42)
+	if (tables.sse42)
+		return UpdateSse42(tables, state, data, size);
+#endif
+	return UpdateSlicing(tables, state, data, size);
+#endif
+}
+
+uint32_t Crc32c(const void* data, size_t size, uint32_t crc)
+{
+	return ~Update(GetTables(), ~crc, (const uint8_t*)data, size);
+}
+
+uint32_t Crc32cCombine(uint32_t crc1, uint32_t crc2, uint64_t size2)
+{
+	return Crc32cTables::MultiplyModP(GetTables().PowerOfSize(size2), crc1) ^ crc2;
+}
+
+uint32_t PlaneCrc32c(const uint8_t* plane, int32_t stride, uint32_t rowSize, uint32_t rows)
+{
+	auto& tables = GetTables();
+	uint32_t state = ~0u;
+	for (uint32_t row = 0; row < rows; row++)
+	{
+		state = Update(tables, state, plane + (ptrdiff_t)row * stride, rowSize);
+	}
+	return ~state;
+}
+
+uint32_t FrameCrc32c(FrameCrcFormat format, const uint8_t* data, int32_t stride, const uint8_t* uv, int32_t uvStride, uint32_t width, uint32_t height, uint32_t crcs[FRAME_CRC_MAX_PLANES])
+{
+	if (format == FrameCrcFormat::Rgb32)
+	{
+		crcs[0] = PlaneCrc32c(data, stride, width * 4, height);
+		return 1;
+	}
+
+	crcs[0] = PlaneCrc32c(data, stride, width, height);
+	crcs[1] = PlaneCrc32c(uv, uvStride, width, height / 2);
+	return 2;
+}
+
+bool VerifyFrameCrc32c(const uint32_t* expected, uint32_t count, FrameCrcFormat format, const uint8_t* data, int32_t stride, const uint8_t* uv, int32_t uvStride, uint32_t width, uint32_t height)
+{
+	if (!expected || !data || (format == FrameCrcFormat::Nv12 && !uv))
+		return false;
+
+	uint32_t crcs[FRAME_CRC_MAX_PLANES];
+	auto planes = FrameCrc32c(format, data, stride, uv, uvStride, width, height, crcs);
+	return count == planes && !memcmp(crcs, expected, planes * sizeof(uint32_t));
+}
\ No newline at end of file
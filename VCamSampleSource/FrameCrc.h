@@ -0,0 +1,35 @@
+#pragma once
+
+// CRC32C (Castagnoli) of frames, to tell whether a frame was corrupted after it left the media source.
+// Uses the SSE4.2 or ARMv8 CRC instructions when available, slicing-by-8 otherwise.
+// Planes are checksummed row by row without the stride padding, so the CRCs don't depend on the buffer layout.
+#include <cstdint>
+#include <cstddef>
+
+#define FRAME_CRC_MAX_PLANES 2
+
+#ifdef DEFINE_GUID
+// blob of one UINT32 CRC32C per plane of the frame as delivered: 1 for RGB32, 2 for NV12 (Y, then interleaved UV), 1 for MJPG (the encoded bytes)
+// {5E0C6A5B-2F4D-4C1E-9B8A-3D7E1F6A2C94}
+DEFINE_GUID(MFSampleExtension_VCamFrameCrc, 0x5e0c6a5b, 0x2f4d, 0x4c1e, 0x9b, 0x8a, 0x3d, 0x7e, 0x1f, 0x6a, 0x2c, 0x94);
+#endif
+
+enum class FrameCrcFormat
+{
+	Rgb32,
+	Nv12,
+};
+
+// crc is the CRC of the previous bytes, to checksum data in pieces
+uint32_t Crc32c(const void* data, size_t size, uint32_t crc = 0);
+
+// CRC of the concatenation of 2 pieces from their CRCs, size2 is the size of the second piece
+uint32_t Crc32cCombine(uint32_t crc1, uint32_t crc2, uint64_t size2);
+
+uint32_t PlaneCrc32c(const uint8_t* plane, int32_t stride, uint32_t rowSize, uint32_t rows);
+
+// returns the number of planes
+uint32_t FrameCrc32c(FrameCrcFormat format, const uint8_t* data, int32_t stride, const uint8_t* uv, int32_t uvStride, uint32_t width, uint32_t height, uint32_t crcs[FRAME_CRC_MAX_PLANES]);
+
+// checks a frame against the CRCs of the MFSampleExtension_VCamFrameCrc blob, count is the number of CRCs in the blob
+bool VerifyFrameCrc32c(const uint32_t* expected, uint32_t count, FrameCrcFormat format, const uint8_t* data, int32_t stride, const uint8_t* uv, int32_t uvStride, uint32_t width, uint32_t height);
\ No newline at end of file
@@ -0,0 +1,418 @@
+#include "pch.h"
+#include "Tools.h"
+#include "Settings.h"
+#include "FrameFilter.h"
+
+#if defined(_M_IX86) || defined(_M_X64)
+#define FILTER_SSE
+#endif
+
+#define FILTER_BAND_ROWS 32 // rows filtered per parallel task
+#define FILTER_DEFAULT_RADIUS 4
+#define FILTER_DEFAULT_AMOUNT 100 // %
+#define FILTER_MAX_AMOUNT 500
+#define FILTER_WEIGHT_ONE 16384 // Q14
+
+static inline UINT Clamp(int value, UINT count)
+{
+	return (UINT)std::min<int>(std::max<int>(value, 0), (int)count - 1);
+}
+
+static inline BYTE Unsharp(int original, int blurred, int amount)
+{
+	return (BYTE)std::min<int>(std::max<int>(((original - blurred) * amount + original * 256 + 128) >> 8, 0), 255);
+}
+
+#if defined(FILTER_SSE)
+// weighted sum of taps pairs for 16 bytes, taps[k] points to the bytes of tap k, the result is rounded & saturated
+static inline __m128i KernelBytes(const BYTE* const* taps, UINT count, const short* weights)
+{
+	auto zero = _mm_setzero_si128();
+	auto round = _mm_set1_epi32(FILTER_WEIGHT_ONE / 2);
+	__m128i sums[4] = { round, round, round, round };
+	for (UINT k = 0; k < count; k += 2)
+	{
+		auto a = _mm_loadu_si128((const __m128i*)taps[k]);
+		auto b = _mm_loadu_si128((const __m128i*)taps[k + 1]);
+		auto w = _mm_set1_epi32((int)(USHORT)weights[k] | ((int)weights[k + 1] << 16));
+		auto aLo = _mm_unpacklo_epi8(a, zero);
+		auto bLo = _mm_unpacklo_epi8(b, zero);
+		auto aHi = _mm_unpackhi_epi8(a, zero);
+		auto bHi = _mm_unpackhi_epi8(b, zero);
+		sums[0] = _mm_add_epi32(sums[0], _mm_madd_epi16(_mm_unpacklo_epi16(aLo, bLo), w));
+		sums[1] = _mm_add_epi32(sums[1], _mm_madd_epi16(_mm_unpackhi_epi16(aLo, bLo), w));
+		sums[2] = _mm_add_epi32(sums[2], _mm_madd_epi16(_mm_unpacklo_epi16(aHi, bHi), w));
+		sums[3] = _mm_add_epi32(sums[3], _mm_madd_epi16(_mm_unpackhi_epi16(aHi, bHi), w));
+	}
+	auto lo = _mm_packs_epi32(_mm_srai_epi32(sums[0], 14), _mm_srai_epi32(sums[1], 14));
+	auto hi = _mm_packs_epi32(_mm_srai_epi32(sums[2], 14), _mm_srai_epi32(sums[3], 14));
+	return _mm_packus_epi16(lo, hi);
+}
+
+// original + (original - blurred) * amount for 8 bytes in 16-bit lanes, in 32-bit lanes
+static inline __m128i UnsharpWords(__m128i original, __m128i blurred, __m128i amount)
+{
+	auto difference = _mm_sub_epi16(original, blurred);
+	auto round = _mm_set1_epi32(128);
+	auto lo = _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(difference, original), amount), round), 8);
+	auto hi = _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(_mm_unpackhi_epi16(difference, original), amount), round), 8);
+	return _mm_packs_epi32(lo, hi);
+}
+#endif
+
+void FrameFilter::Load()
+{
+	_type = FILTER_NONE;
+	auto name = GetSettingString(L"Filter");
+	if (name.empty() || !lstrcmpi(name.c_str(), L"none"))
+		return;
+
+	UINT type;
+	if (!lstrcmpi(name.c_str(), L"box"))
+	{
+		type = FILTER_BOX;
+	}
+	else if (!lstrcmpi(name.c_str(), L"gaussian"))
+	{
+		type = FILTER_GAUSSIAN;
+	}
+	else if (!lstrcmpi(name.c_str(), L"unsharp"))
+	{
+		type = FILTER_UNSHARP;
+	}
+	else
+	{
+		LOG_HR_MSG(E_INVALIDARG, "Unknown filter '%ls', frames are not filtered", name.c_str());
+		return;
+	}
+
+	auto radius = GetSettingDWORD(L"FilterRadius", FILTER_DEFAULT_RADIUS);
+	auto amount = GetSettingDWORD(L"FilterAmount", FILTER_DEFAULT_AMOUNT);
+	LOG_IF_FAILED(Set(type, radius, amount));
+	WINTRACE(L"FrameFilter::Load '%s' radius:%u amount:%u", name.c_str(), _radius, amount);
+}
+
+HRESULT FrameFilter::Set(UINT type, UINT radius, UINT amount)
+{
+	RETURN_HR_IF(E_INVALIDARG, type > FILTER_UNSHARP);
+	_type = FILTER_NONE;
+	if (type == FILTER_NONE)
+		return S_OK;
+
+	_radius = std::min<UINT>(std::max<UINT>(radius, 1), type == FILTER_BOX ? FILTER_MAX_BOX_RADIUS : FILTER_MAX_KERNEL_RADIUS);
+	_boxMultiplier = (USHORT)(65536 / (_radius * 2 + 1));
+	_amount = (int)(std::min<UINT>(amount, FILTER_MAX_AMOUNT) * 256 / 100);
+
+	_type = type;
+	if (type == FILTER_BOX)
+		return S_OK;
+
+	// the kernel covers 3 standard deviations, rounding errors go to the center weight so the weights sum to exactly one
+	ZeroMemory(_weights, sizeof(_weights));
+	auto sigma = std::max<double>(_radius / 3.0, 0.5);
+	double gauss[FILTER_MAX_TAPS]{};
+	double total = 0;
+	for (UINT k = 0; k <= _radius * 2; k++)
+	{
+		auto d = (double)k - _radius;
+		gauss[k] = exp(-d * d / (2 * sigma * sigma));
+		total += gauss[k];
+	}
+
+	auto sum = 0;
+	for (UINT k = 0; k <= _radius * 2; k++)
+	{
+		_weights[k] = (short)lround(gauss[k] * FILTER_WEIGHT_ONE / total);
+		sum += _weights[k];
+	}
+	_weights[_radius] += (short)(FILTER_WEIGHT_ONE - sum);
+	return S_OK;
+}
+
+// running sum on each channel, edges are clamped
+void FrameFilter::HorizontalBox(const BYTE* input, BYTE* output, UINT width, UINT channels) const
+{
+	auto radius = (int)_radius;
+	auto half = _radius;
+
+	// pixels whose window is inside the row add & remove without clamping
+	auto interiorFirst = std::min<UINT>(_radius + 1, width);
+	auto interiorLast = (UINT)std::max<int>((int)width - radius - 1, (int)interiorFirst);
+#if defined(FILTER_SSE)
+	if (channels == 4)
+	{
+		// the 4 channels in 16-bit lanes
+		auto zero = _mm_setzero_si128();
+		auto halves = _mm_set1_epi16((short)half);
+		auto multiplier = _mm_set1_epi16((short)_boxMultiplier);
+		auto pixel = [&](int x) { return _mm_unpacklo_epi8(_mm_cvtsi32_si128(*(const int*)(input + Clamp(x, width) * 4)), zero); };
+		auto sum = zero;
+		for (auto k = -radius; k <= radius; k++)
+		{
+			sum = _mm_add_epi16(sum, pixel(k));
+		}
+
+		auto store = [&](UINT x)
+			{
+				auto value = _mm_mulhi_epu16(_mm_add_epi16(sum, halves), multiplier);
+				*(int*)(output + x * 4) = _mm_cvtsi128_si32(_mm_packus_epi16(value, value));
+			};
+
+		UINT x = 0;
+		for (; x < interiorFirst; x++)
+		{
+			store(x);
+			sum = _mm_sub_epi16(_mm_add_epi16(sum, pixel((int)x + radius + 1)), pixel((int)x - radius));
+		}
+
+		for (; x < interiorLast; x++)
+		{
+			store(x);
+			auto add = _mm_unpacklo_epi8(_mm_cvtsi32_si128(*(const int*)(input + (x + _radius + 1) * 4)), zero);
+			auto remove = _mm_unpacklo_epi8(_mm_cvtsi32_si128(*(const int*)(input + (x - _radius) * 4)), zero);
+			sum = _mm_sub_epi16(_mm_add_epi16(sum, add), remove);
+		}
+
+		for (; x < width; x++)
+		{
+			store(x);
+			sum = _mm_sub_epi16(_mm_add_epi16(sum, pixel((int)x + radius + 1)), pixel((int)x - radius));
+		}
+		return;
+	}
+#endif
+	for (UINT c = 0; c < channels; c++)
+	{
+		auto in = input + c;
+		auto out = output + c;
+		UINT sum = 0;
+		for (auto k = -radius; k <= radius; k++)
+		{
+			sum += in[Clamp(k, width) * channels];
+		}
+
+		UINT x = 0;
+		for (; x < interiorFirst; x++)
+		{
+			out[x * channels] = (BYTE)(((sum + half) * _boxMultiplier) >> 16);
+			sum += in[Clamp((int)x + radius + 1, width) * channels];
+			sum -= in[Clamp((int)x - radius, width) * channels];
+		}
+
+		for (; x < interiorLast; x++)
+		{
+			out[x * channels] = (BYTE)(((sum + half) * _boxMultiplier) >> 16);
+			sum += in[(x + _radius + 1) * channels];
+			sum -= in[(x - _radius) * channels];
+		}
+
+		for (; x < width; x++)
+		{
+			out[x * channels] = (BYTE)(((sum + half) * _boxMultiplier) >> 16);
+			sum += in[Clamp((int)x + radius + 1, width) * channels];
+			sum -= in[Clamp((int)x - radius, width) * channels];
+		}
+	}
+}
+
+void FrameFilter::HorizontalKernel(const BYTE* input, BYTE* output, UINT width, UINT channels) const
+{
+	auto radius = (int)_radius;
+	auto rowSize = width * channels;
+	auto scalar = [&](UINT i)
+		{
+			auto pixel = (int)(i / channels);
+			auto c = i % channels;
+			auto sum = 0;
+			for (auto k = 0; k <= radius * 2; k++)
+			{
+				sum += _weights[k] * input[Clamp(pixel + k - radius, width) * channels + c];
+			}
+			output[i] = (BYTE)std::min<int>((sum + FILTER_WEIGHT_ONE / 2) >> 14, 255);
+		};
+
+	// edges are clamped, the middle is read directly (including the extra zero tap)
+	auto first = std::min<UINT>(_radius * channels, rowSize);
+	UINT i = 0;
+	for (; i < first; i++)
+	{
+		scalar(i);
+	}
+
+#if defined(FILTER_SSE)
+	// 16 bytes at a time, taps by pairs: (in[k], in[k + 1]) x (weight[k], weight[k + 1]) in 32-bit lanes
+	auto taps = _radius * 2 + 2;
+	const BYTE* pointers[FILTER_MAX_TAPS];
+	for (; i + 16 + (_radius + 1) * channels <= rowSize; i += 16)
+	{
+		for (UINT k = 0; k < taps; k++)
+		{
+			pointers[k] = input + i + k * channels - _radius * channels;
+		}
+		_mm_storeu_si128((__m128i*)(output + i), KernelBytes(pointers, taps, _weights));
+	}
+#endif
+
+	for (; i < rowSize; i++)
+	{
+		scalar(i);
+	}
+}
+
+// column running sums of the intermediate rows, kept in 16 bits
+void FrameFilter::VerticalBox(BYTE* output, LONG outputStride, UINT rowSize, UINT height, UINT top, UINT bottom, USHORT* sums) const
+{
+	auto radius = (int)_radius;
+	auto rows = _rows.get();
+	ZeroMemory(sums, rowSize * sizeof(USHORT));
+	for (auto k = -radius; k <= radius; k++)
+	{
+		auto row = rows + (SIZE_T)Clamp((int)top + k, height) * rowSize;
+		for (UINT i = 0; i < rowSize; i++)
+		{
+			sums[i] += row[i];
+		}
+	}
+
+	auto half = (USHORT)_radius;
+	for (auto y = top; y < bottom; y++)
+	{
+		auto out = output + (ptrdiff_t)y * outputStride;
+		auto add = rows + (SIZE_T)Clamp((int)y + radius + 1, height) * rowSize;
+		auto remove = rows + (SIZE_T)Clamp((int)y - radius, height) * rowSize;
+		UINT i = 0;
+#if defined(FILTER_SSE)
+		auto zero = _mm_setzero_si128();
+		auto halves = _mm_set1_epi16((short)half);
+		auto multiplier = _mm_set1_epi16((short)_boxMultiplier);
+		for (; i + 8 <= rowSize; i += 8)
+		{
+			auto sum = _mm_loadu_si128((const __m128i*)(sums + i));
+			auto value = _mm_mulhi_epu16(_mm_add_epi16(sum, halves), multiplier);
+			_mm_storel_epi64((__m128i*)(out + i), _mm_packus_epi16(value, value));
+			sum = _mm_add_epi16(sum, _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(add + i)), zero));
+			sum = _mm_sub_epi16(sum, _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(remove + i)), zero));
+			_mm_storeu_si128((__m128i*)(sums + i), sum);
+		}
+#endif
+		for (; i < rowSize; i++)
+		{
+			out[i] = (BYTE)(((UINT)(USHORT)(sums[i] + half) * _boxMultiplier) >> 16);
+			sums[i] = (USHORT)(sums[i] + add[i] - remove[i]);
+		}
+	}
+}
+
+void FrameFilter::VerticalKernel(BYTE* output, LONG outputStride, UINT rowSize, UINT height, UINT top, UINT bottom) const
+{
+	auto radius = (int)_radius;
+	auto taps = _radius * 2 + 2;
+	const BYTE* rows[FILTER_MAX_TAPS];
+	for (auto y = top; y < bottom; y++)
+	{
+		for (UINT k = 0; k < taps; k++)
+		{
+			rows[k] = _rows.get() + (SIZE_T)Clamp((int)y + (int)k - radius, height) * rowSize;
+		}
+
+		auto out = output + (ptrdiff_t)y * outputStride;
+		UINT i = 0;
+#if defined(FILTER_SSE)
+		auto zero = _mm_setzero_si128();
+		auto amount = _mm_set1_epi32((int)(USHORT)_amount | (256 << 16));
+		const BYTE* pointers[FILTER_MAX_TAPS];
+		for (; i + 16 <= rowSize; i += 16)
+		{
+			for (UINT k = 0; k < taps; k++)
+			{
+				pointers[k] = rows[k] + i;
+			}
+
+			auto blurred = KernelBytes(pointers, taps, _weights);
+			if (_type == FILTER_UNSHARP)
+			{
+				auto original = _mm_loadu_si128((const __m128i*)(out + i));
+				auto lo = UnsharpWords(_mm_unpacklo_epi8(original, zero), _mm_unpacklo_epi8(blurred, zero), amount);
+				auto hi = UnsharpWords(_mm_unpackhi_epi8(original, zero), _mm_unpackhi_epi8(blurred, zero), amount);
+				blurred = _mm_packus_epi16(lo, hi);
+			}
+			_mm_storeu_si128((__m128i*)(out + i), blurred);
+		}
+#endif
+		for (; i < rowSize; i++)
+		{
+			auto sum = FILTER_WEIGHT_ONE / 2;
+			for (UINT k = 0; k < taps; k++)
+			{
+				sum += _weights[k] * rows[k][i];
+			}
+
+			auto blurred = std::min<int>(sum >> 14, 255);
+			out[i] = _type == FILTER_UNSHARP ? Unsharp(out[i], blurred, _amount) : (BYTE)blurred;
+		}
+	}
+}
+
+HRESULT FrameFilter::Apply(REFGUID format, BYTE* output, LONG outputStride, UINT width, UINT height)
+{
+	RETURN_HR_IF(E_NOT_VALID_STATE, !IsActive());
+	RETURN_HR_IF_NULL(E_POINTER, output);
+	RETURN_HR_IF(E_INVALIDARG, !width || !height);
+
+	UINT channels;
+	if (format == MFVideoFormat_RGB32)
+	{
+		channels = 4;
+	}
+	else if (format == MFVideoFormat_NV12)
+	{
+		channels = 1;
+	}
+	else
+		RETURN_HR(E_INVALIDARG);
+
+	auto rowSize = width * channels;
+	auto size = (SIZE_T)rowSize * height;
+	if (_rowsSize < size)
+	{
+		_rows = std::make_unique<BYTE[]>(size);
+		_rowsSize = size;
+	}
+
+	auto bands = (height + FILTER_BAND_ROWS - 1) / FILTER_BAND_ROWS;
+	if (_type == FILTER_BOX && _sumsSize < (SIZE_T)bands * rowSize)
+	{
+		_sums = std::make_unique<USHORT[]>((SIZE_T)bands * rowSize);
+		_sumsSize = (SIZE_T)bands * rowSize;
+	}
+
+	// the vertical pass reads rows of the other bands, so the horizontal pass must be complete before it starts
+	RETURN_IF_FAILED(ForEachBand(height, FILTER_BAND_ROWS, [&](UINT top, UINT bottom)
+		{
+			for (auto y = top; y < bottom; y++)
+			{
+				auto in = output + (ptrdiff_t)y * outputStride;
+				auto out = _rows.get() + (SIZE_T)y * rowSize;
+				if (_type == FILTER_BOX)
+				{
+					HorizontalBox(in, out, width, channels);
+				}
+				else
+				{
+					HorizontalKernel(in, out, width, channels);
+				}
+			}
+		}));
+
+	return ForEachBand(height, FILTER_BAND_ROWS, [&](UINT top, UINT bottom)
+		{
+			if (_type == FILTER_BOX)
+			{
+				VerticalBox(output, outputStride, rowSize, height, top, bottom, _sums.get() + (SIZE_T)(top / FILTER_BAND_ROWS) * rowSize);
+			}
+			else
+			{
+				VerticalKernel(output, outputStride, rowSize, height, top, bottom);
+			}
+		});
+}
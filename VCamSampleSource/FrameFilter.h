@@ -0,0 +1,54 @@
+#pragma once
+
+#define FILTER_NONE 0
+#define FILTER_BOX 1
+#define FILTER_GAUSSIAN 2
+#define FILTER_UNSHARP 3 // sharpens by adding the difference with the gaussian blur
+
+#define FILTER_MAX_BOX_RADIUS 64 // box sums of bytes fit in 16 bits
+#define FILTER_MAX_KERNEL_RADIUS 16
+#define FILTER_MAX_TAPS (FILTER_MAX_KERNEL_RADIUS * 2 + 2) // even, taps are applied by pairs
+
+// separable convolution (blur or sharpen) of RGB32 frames on all BGRA channels, or of NV12 frames on the Y plane only
+// a horizontal pass writes to an intermediate frame, then a vertical pass writes back to the frame, both on bands of rows in parallel
+// the box blur uses running sums, so its cost doesn't depend on the radius, the gaussian and unsharp mask use a kernel of 16-bit weights
+class FrameFilter
+{
+	UINT _type;
+	UINT _radius;
+	USHORT _boxMultiplier; // 65536 / (2 * radius + 1)
+	short _weights[FILTER_MAX_TAPS]; // 2 * radius + 1 taps then 0, Q14
+	int _amount; // unsharp mask, Q8
+	std::unique_ptr<BYTE[]> _rows; // horizontal pass output
+	SIZE_T _rowsSize;
+	std::unique_ptr<USHORT[]> _sums; // box column sums, one row per band
+	SIZE_T _sumsSize;
+
+	void HorizontalBox(const BYTE* input, BYTE* output, UINT width, UINT channels) const;
+	void HorizontalKernel(const BYTE* input, BYTE* output, UINT width, UINT channels) const;
+	void VerticalBox(BYTE* output, LONG outputStride, UINT rowSize, UINT height, UINT top, UINT bottom, USHORT* sums) const;
+	void VerticalKernel(BYTE* output, LONG outputStride, UINT rowSize, UINT height, UINT top, UINT bottom) const;
+
+public:
+	FrameFilter() :
+		_type(FILTER_NONE),
+		_radius(0),
+		_boxMultiplier(0),
+		_weights(),
+		_amount(0),
+		_rowsSize(0),
+		_sumsSize(0)
+	{
+	}
+
+	// reads the FilterXXX settings
+	void Load();
+	void Reset() { _type = FILTER_NONE; }
+	bool IsActive() const { return _type != FILTER_NONE; }
+
+	// radius is in pixels, amount is the unsharp mask strength in %
+	HRESULT Set(UINT type, UINT radius, UINT amount);
+
+	// filters the RGB32 frame or the Y plane of the NV12 frame in place
+	HRESULT Apply(REFGUID format, BYTE* output, LONG outputStride, UINT width, UINT height);
+};
@@ -1,13 +1,56 @@
 #include "pch.h"
 #include "Undocumented.h"
 #include "Tools.h"
+#include "FrameBuffer.h"
+#include "TileRasterizer.h"
+#include "ColorConvert.h"
 #include "EnumNames.h"
 #include "MFTools.h"
+#include "Settings.h"
+#include "FrameSource.h"
+#include "JpegEncoder.h"
+#include "ProcAmp.h"
+#include "FrameStats.h"
+#include "FrameCrc.h"
+#include "ColorLut.h"
+#include "FrameTransform.h"
+#include "Overlay.h"
+#include "ChromaKey.h"
+#include "FrameFilter.h"
 #include "FrameGenerator.h"
+#include "FrameCode.h"
+
+#define JPEG_DEFAULT_QUALITY 85
+#define CONVERT_BAND_ROWS 32 // rows converted per parallel task, must be even for 4:2:0 formats
+#define LUT_MAX_FILE_SIZE (64 * 1024 * 1024)
+#define CRC_BAND_ROWS 64 // rows checksummed per parallel task
+#define CRC_MAX_BANDS 64
+#define PATTERN_FONT L"Segoe UI"
+#define PATTERN_FONT_SIZE 40.0f
+#define PATTERN_TEXT_MAX 127
+#define PATTERN_GLYPH_MAX_SIZE 256 // of a glyph's bitmap for the rasterizer, in pixels
+
+static FrameBufferFormat GetFrameBufferFormat(REFGUID format)
+{
+	return format == MFVideoFormat_NV12 ? FrameBufferFormat::Nv12 : FrameBufferFormat::Rgb32;
+}
 
 HRESULT FrameGenerator::EnsureRenderTarget(UINT width, UINT height)
 {
-	if (!HasD3DManager())
+	// without a GPU, the pattern is rasterized on the CPU in parallel, unless Direct2D is asked for
+	_rasterize = !HasD3DManager() && GetSettingDWORD(L"PatternRasterizer", 1) != 0;
+	if (_rasterize)
+	{
+		RETURN_IF_FAILED(CreatePatternFont());
+		RETURN_IF_FAILED(CreateRasterGlyphs());
+		_rasterStride = Rgb32View::GetAlignedStride(width);
+		_rasterFrame.reset(); // back to the pool first, so it can be reused
+		_rasterFrame = FrameBufferPool::GetShared().Acquire(Rgb32View::GetSize(_rasterStride, height));
+		RETURN_IF_NULL_ALLOC(_rasterFrame.get());
+		_width = width;
+		_height = height;
+	}
+	else if (!HasD3DManager())
 	{
 		// create a D2D1 render target from WIC bitmap
 		wil::com_ptr_nothrow<ID2D1Factory> d2d1Factory;
@@ -31,6 +74,386 @@ HRESULT FrameGenerator::EnsureRenderTarget(UINT width, UINT height)
 	return S_OK;
 }
 
+HRESULT FrameGenerator::StartFrameSource(UINT fpsNumerator, UINT fpsDenominator)
+{
+	// settings are read at each start so they can be changed without re-registering the camera
+	_source.reset();
+	auto hr = CreateFrameSource(_source);
+	if (SUCCEEDED(hr) && _source)
+	{
+		hr = _source->Start(ContentWidth(), ContentHeight(), fpsNumerator, fpsDenominator);
+	}
+
+	if (FAILED(hr))
+	{
+		// don't fail the stream, just fall back to the synthetic pattern
+		LOG_HR_MSG(hr, "Frame source cannot be started, using pattern");
+		_source.reset();
+	}
+	_sourceStartTime = MFGetSystemTime();
+	return S_OK;
+}
+
+void FrameGenerator::StopFrameSource()
+{
+	if (_source)
+	{
+		_source->Stop();
+	}
+
+	if (_keyBackground)
+	{
+		_keyBackground->Stop();
+	}
+	WINTRACE(L"FrameGenerator::StopFrameSource frames:%I64u reused:%I64u", _frame, _reusedFrames);
+}
+
+HRESULT FrameGenerator::StartJpegEncoder()
+{
+	RETURN_HR_IF(E_NOT_VALID_STATE, !_width || !_height);
+	RETURN_IF_FAILED(_jpeg.Initialize(_width, _height, GetSettingDWORD(L"JpegQuality", JPEG_DEFAULT_QUALITY)));
+	_jpegStride = Nv12View::GetAlignedStride(_width);
+	_jpegFrame.reset(); // back to the pool first, so it can be reused
+	_jpegFrame = FrameBufferPool::GetShared().Acquire(Nv12View::GetSize(_jpegStride, _height));
+	RETURN_IF_NULL_ALLOC(_jpegFrame.get());
+	return S_OK;
+}
+
+// reads a .cube file in a LUT
+static HRESULT LoadColorLut(PCWSTR path, ColorLut& lut)
+{
+	WINTRACE(L"LoadColorLut '%s'", path);
+	wil::unique_hfile file(CreateFile(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr));
+	RETURN_LAST_ERROR_IF_MSG(!file, "Cannot open '%ls'", path);
+
+	LARGE_INTEGER fileSize;
+	RETURN_IF_WIN32_BOOL_FALSE(GetFileSizeEx(file.get(), &fileSize));
+	RETURN_HR_IF_MSG(MF_E_INVALID_FILE_FORMAT, !fileSize.QuadPart || fileSize.QuadPart > LUT_MAX_FILE_SIZE, "Invalid .cube file size");
+
+	auto size = (DWORD)fileSize.QuadPart;
+	auto text = std::make_unique<char[]>((SIZE_T)size + 1);
+	DWORD read;
+	RETURN_IF_WIN32_BOOL_FALSE(ReadFile(file.get(), text.get(), size, &read, nullptr));
+	RETURN_HR_IF(MF_E_INVALID_FILE_FORMAT, read != size);
+	text[size] = 0;
+
+	UINT line;
+	auto error = lut.Parse(text.get(), size, line);
+	RETURN_HR_IF_MSG(MF_E_INVALID_FILE_FORMAT, error != nullptr, "'%ls' line %u: %hs", path, line, error);
+	WINTRACE(L"LoadColorLut size:%u", lut.GetSize());
+	return S_OK;
+}
+
+HRESULT FrameGenerator::StartColorLut()
+{
+	auto path = GetSettingString(L"LutPath");
+	if (path.empty())
+	{
+		_lut.Reset();
+		return S_OK;
+	}
+
+	// don't fail the stream, just don't grade
+	auto hr = LoadColorLut(path.c_str(), _lut);
+	if (FAILED(hr))
+	{
+		LOG_HR_MSG(hr, "Color LUT '%ls' cannot be loaded", path.c_str());
+		_lut.Reset();
+		return S_OK;
+	}
+
+	BakeColorLut(_lut, _colorAdjust);
+#if _DEBUG
+	auto maxError = _lut.ComputeMaxError(5);
+	WINTRACE(L"FrameGenerator::StartColorLut size:%u SIMD max error:%u", _lut.GetSize(), maxError);
+	assert(maxError <= 1);
+#endif
+	return S_OK;
+}
+
+// overlays are read at each start, like the other settings
+HRESULT FrameGenerator::StartOverlays()
+{
+	return _overlays.Load();
+}
+
+void FrameGenerator::StartFilter()
+{
+	_filter.Load();
+}
+
+void FrameGenerator::StartFrameStats()
+{
+	_stats.Load();
+}
+
+void FrameGenerator::StartFrameCode()
+{
+	_frameCode = GetSettingDWORD(L"FrameCode") != 0;
+	if (_frameCode && !FrameCodeFits(_width, _height))
+	{
+		LOG_HR_MSG(E_INVALIDARG, "Frame code needs at least %ux%u frames, it's not burnt in %ux%u frames", FRAME_CODE_MIN_WIDTH, FRAME_CODE_MIN_HEIGHT, _width, _height);
+		_frameCode = false;
+	}
+}
+
+// burns the frame number & sample time in the top left corner, last, so neither the filter nor overlays cover it
+HRESULT FrameGenerator::BurnFrameCode(REFGUID format, BYTE* output, LONG pitch, BYTE* uv, UINT width, UINT height, MFTIME time)
+{
+	if (!_frameCode)
+		return S_OK;
+
+	FrameCode code{ (uint32_t)_frame, (uint64_t)time };
+	RETURN_HR_IF(E_UNEXPECTED, !WriteFrameCode(code, format == MFVideoFormat_NV12 ? FrameCodeFormat::Nv12 : FrameCodeFormat::Rgb32, output, pitch, uv, pitch, width, height));
+	return S_OK;
+}
+
+void FrameGenerator::StartFrameCrc()
+{
+	_frameCrc = GetSettingDWORD(L"FrameCrc") != 0;
+}
+
+// called after the other Start methods, as the settings they read change how frames look
+HRESULT FrameGenerator::StartFrameDedup(REFGUID format)
+{
+	_dedup = GetSettingDWORD(L"FrameDedup", 1) != 0;
+	_revision++;
+	_hasLastKey = false;
+	_hasDedupFrame = false;
+	_dedupFrame.reset(); // back to the pool first, the frame size may have changed
+	_reusedFrames = 0;
+
+	// JPEG frames aren't deduplicated, others get their copy now rather than in a request
+	if (_dedup && format != MFVideoFormat_MJPG)
+	{
+		auto bufferFormat = GetFrameBufferFormat(format);
+		_dedupStride = GetAlignedFrameStride(bufferFormat, _width);
+		_dedupFrame = FrameBufferPool::GetShared().Acquire(GetFrameBufferSize(bufferFormat, _dedupStride, _height));
+		RETURN_IF_NULL_ALLOC(_dedupFrame.get());
+	}
+	return S_OK;
+}
+
+// keeps a copy of a frame whose key was repeated, it's likely to be repeated again
+HRESULT FrameGenerator::SaveDedupFrame(REFGUID format, const BYTE* output, LONG pitch)
+{
+	RETURN_HR_IF(E_NOT_VALID_STATE, !_dedupFrame);
+	auto bufferFormat = GetFrameBufferFormat(format);
+	if (bufferFormat == FrameBufferFormat::Nv12)
+	{
+		CopyFrame(Nv12View::FromBuffer((BYTE*)output, pitch, _width, _height), Nv12View::FromBuffer(_dedupFrame.get(), _dedupStride, _width, _height));
+	}
+	else
+	{
+		CopyFrame(Rgb32View::FromBuffer((BYTE*)output, pitch, _width, _height), Rgb32View::FromBuffer(_dedupFrame.get(), _dedupStride, _width, _height));
+	}
+	_hasDedupFrame = true;
+	_dedupStats = _stats.IsValid();
+	return S_OK;
+}
+
+HRESULT FrameGenerator::CopyDedupFrame(REFGUID format, BYTE* output, LONG pitch, DWORD length)
+{
+	RETURN_HR_IF(E_NOT_VALID_STATE, !_hasDedupFrame);
+	auto bufferFormat = GetFrameBufferFormat(format);
+	RETURN_HR_IF(E_UNEXPECTED, GetFrameBufferSize(bufferFormat, pitch, _height) > length);
+	if (bufferFormat == FrameBufferFormat::Nv12)
+	{
+		CopyFrame(Nv12View::FromBuffer(_dedupFrame.get(), _dedupStride, _width, _height), Nv12View::FromBuffer(output, pitch, _width, _height));
+	}
+	else
+	{
+		CopyFrame(Rgb32View::FromBuffer(_dedupFrame.get(), _dedupStride, _width, _height), Rgb32View::FromBuffer(output, pitch, _width, _height));
+	}
+
+	if (_dedupStats)
+	{
+		_stats.Repeat();
+	}
+	_reusedFrames++;
+	return S_OK;
+}
+
+// CRC32C of a plane, bands of rows are checksummed in parallel, then their CRCs are combined in order
+static HRESULT PlaneCrc(const BYTE* plane, LONG stride, UINT rowSize, UINT rows, UINT& crc)
+{
+	RETURN_HR_IF(E_INVALIDARG, !rows);
+	auto bandRows = std::max<UINT>(CRC_BAND_ROWS, (rows + CRC_MAX_BANDS - 1) / CRC_MAX_BANDS);
+	UINT crcs[CRC_MAX_BANDS];
+	RETURN_IF_FAILED(ForEachBand(rows, bandRows, [&](UINT top, UINT bottom)
+		{
+			crcs[top / bandRows] = PlaneCrc32c(plane + (ptrdiff_t)top * stride, stride, rowSize, bottom - top);
+		}));
+
+	crc = crcs[0];
+	for (UINT top = bandRows; top < rows; top += bandRows)
+	{
+		crc = Crc32cCombine(crc, crcs[top / bandRows], (ULONGLONG)rowSize * (std::min<UINT>(top + bandRows, rows) - top));
+	}
+	return S_OK;
+}
+
+// checksums the frame as delivered, after everything else, so the receiver can verify it
+HRESULT FrameGenerator::ChecksumFrame(REFGUID format, const BYTE* output, LONG pitch, UINT width, UINT height)
+{
+	if (!_frameCrc)
+		return S_OK;
+
+	if (format == MFVideoFormat_NV12)
+	{
+		RETURN_IF_FAILED(PlaneCrc(output, pitch, width, height, _crcs[0]));
+		RETURN_IF_FAILED(PlaneCrc(GetFrameBufferUV(output, pitch, height), pitch, width, height / 2, _crcs[1]));
+		_crcCount = 2;
+		return S_OK;
+	}
+
+	RETURN_IF_FAILED(PlaneCrc(output, pitch, width * 4, height, _crcs[0]));
+	_crcCount = 1;
+	return S_OK;
+}
+
+// draws the frame code on the render target, for the GPU path that doesn't bring frames back to the CPU
+HRESULT FrameGenerator::DrawFrameCode(MFTIME time)
+{
+	RETURN_HR_IF_NULL(E_NOT_VALID_STATE, _blackBrush);
+	_whiteBrush->SetColor(D2D1::ColorF(1, 1, 1, 1));
+
+	FrameCode code{ (uint32_t)_frame, (uint64_t)time };
+	for (UINT row = 0; row < FRAME_CODE_ROWS; row++)
+	{
+		for (UINT column = 0; column < FRAME_CODE_COLUMNS; column++)
+		{
+			uint32_t left, top, right, bottom;
+			auto white = GetFrameCodeBlock(code, _width, _height, column, row, left, top, right, bottom);
+			_renderTarget->FillRectangle(D2D1::Rect((FLOAT)left, (FLOAT)top, (FLOAT)right, (FLOAT)bottom), white ? _whiteBrush.get() : _blackBrush.get());
+		}
+	}
+	return S_OK;
+}
+
+HRESULT FrameGenerator::StartChromaKey(UINT fpsNumerator, UINT fpsDenominator)
+{
+	RETURN_HR_IF(E_NOT_VALID_STATE, !_width || !_height);
+	_keyBackground.reset();
+	_key.Load();
+	if (!_key.IsEnabled())
+		return S_OK;
+
+	_keyStride = Nv12View::GetAlignedStride(_width);
+	_keyFrame.reset();
+	_keyFrame = FrameBufferPool::GetShared().Acquire(Nv12View::GetSize(_keyStride, _height));
+	RETURN_IF_NULL_ALLOC(_keyFrame.get());
+	auto keyFrame = Nv12View::FromBuffer(_keyFrame.get(), _keyStride, _width, _height);
+	FillMemory(keyFrame.planes[0].data, (SIZE_T)_keyStride * keyFrame.planes[0].height, 16); // black
+	FillMemory(keyFrame.planes[1].data, (SIZE_T)_keyStride * keyFrame.planes[1].height, 128);
+
+	// the background has the stream's size, it's not transformed
+	auto hr = CreateFrameSource(L"Background", _keyBackground);
+	if (SUCCEEDED(hr) && _keyBackground)
+	{
+		hr = _keyBackground->Start(_width, _height, fpsNumerator, fpsDenominator);
+	}
+
+	if (FAILED(hr))
+	{
+		// keep keying, over black
+		LOG_HR_MSG(hr, "Chroma key background cannot be started, using black");
+		_keyBackground.reset();
+	}
+	return S_OK;
+}
+
+void FrameGenerator::BakeColorLut(ColorLut& lut, const ColorAdjust& adjust)
+{
+	ColorLutAdjust lutAdjust;
+	adjust.GetLutAdjust(lutAdjust);
+	lut.Bake(lutAdjust);
+}
+
+// lut is swapped with ours, unless another cube was loaded since it was copied (the stream was restarted), then it's baked here
+void FrameGenerator::SetProcAmp(const ColorAdjust& adjust, ColorLut& lut)
+{
+	_colorAdjust = adjust;
+	if (!lut.HasSameCube(_lut))
+	{
+		lut.CopyCube(_lut);
+		BakeColorLut(lut, adjust);
+	}
+	std::swap(_lut, lut);
+	_revision++;
+}
+
+// must be called before the frame source is started, as the frame size is swapped for 90 & 270
+void FrameGenerator::SetRotation(UINT rotation)
+{
+	_transform.SetRotation(rotation);
+	_transformFrame.reset();
+	_revision++;
+}
+
+void FrameGenerator::SetMirrorFlip(bool mirror, bool flip)
+{
+	_transform.SetMirrorFlip(mirror, flip);
+	_revision++;
+}
+
+// ProcAmp is baked in the LUT when there's one, otherwise pattern colors are adjusted when drawn
+D2D1_COLOR_F FrameGenerator::PatternColor(const D2D1_COLOR_F& color) const
+{
+	return _lut.IsLoaded() ? color : _colorAdjust.Apply(color);
+}
+
+// converts the rendered pattern to the output format, grading it if there's a LUT
+HRESULT FrameGenerator::ConvertPattern(REFGUID format, const BYTE* rgb, LONG rgbStride, BYTE* output, LONG outputStride, BYTE* uv, LONG uvStride)
+{
+	if (format == MFVideoFormat_RGB32)
+	{
+		if (_lut.IsLoaded())
+			return ForEachBand(_height, CONVERT_BAND_ROWS, [&](UINT top, UINT bottom)
+				{
+					_lut.RGB32ToRGB32(rgb + (ptrdiff_t)top * rgbStride, rgbStride, _width, bottom - top, output + (ptrdiff_t)top * outputStride, outputStride);
+				});
+
+		CopyPlane(rgb, rgbStride, _width * 4, _height, output, outputStride);
+		return S_OK;
+	}
+
+	_stats.Begin(_width, _height);
+
+	// each band is counted right after it's converted, while it's still in cache
+	return ForEachBand(_height, CONVERT_BAND_ROWS, [&](UINT top, UINT bottom)
+		{
+			auto y = output + (ptrdiff_t)top * outputStride;
+			auto bandUV = uv + (ptrdiff_t)(top / 2) * uvStride;
+			if (_lut.IsLoaded())
+			{
+				_lut.RGB32ToNV12(rgb + (ptrdiff_t)top * rgbStride, rgbStride, _width, bottom - top, y, outputStride, bandUV, uvStride);
+			}
+			else
+			{
+				RGB32ToNV12(rgb + (ptrdiff_t)top * rgbStride, rgbStride, _width, bottom - top, y, outputStride, bandUV, uvStride);
+			}
+			_stats.Add(y, outputStride, bandUV, uvStride, _width, bottom - top);
+		});
+}
+
+// the CPU path's end: converts the pattern rendered on the CPU to the sample's buffer, then filters it, composes overlays, burns the frame code & checksums it
+HRESULT FrameGenerator::FinishPattern(REFGUID format, const BYTE* rgb, LONG rgbStride, BYTE* output, LONG pitch, DWORD length, MFTIME time)
+{
+	RETURN_HR_IF(E_UNEXPECTED, GetFrameBufferSize(GetFrameBufferFormat(format), pitch, _height) > length);
+	auto uv = GetFrameBufferUV(output, pitch, _height);
+
+	// note we could use MF's converter too, but statistics are gathered while converting
+	RETURN_IF_FAILED(ConvertPattern(format, rgb, rgbStride, output, pitch, uv, pitch));
+	if (_filter.IsActive())
+	{
+		RETURN_IF_FAILED(_filter.Apply(format, output, pitch, _width, _height));
+	}
+	RETURN_IF_FAILED(_overlays.Compose(format, output, pitch, uv, pitch, _width, _height, time));
+	RETURN_IF_FAILED(BurnFrameCode(format, output, pitch, uv, _width, _height, time));
+	return ChecksumFrame(format, output, pitch, _width, _height);
+}
+
 const bool FrameGenerator::HasD3DManager() const
 {
 	return _texture != nullptr;
@@ -58,6 +481,12 @@ HRESULT FrameGenerator::SetD3DManager(IUnknown* manager, UINT width, UINT height
 		D3D11_BIND_SHADER_RESOURCE | D3D11_BIND_RENDER_TARGET
 	);
 	RETURN_IF_FAILED(device->CreateTexture2D(&desc, nullptr, &_texture));
+
+	// the GPU renders the pattern from now on, even if the stream was started without a manager
+	_rasterize = false;
+	_rasterFrame.reset();
+
+	RETURN_IF_FAILED(MFCreateDXGISurfaceBuffer(__uuidof(ID3D11Texture2D), _texture.get(), 0, 0, &_textureBuffer));
 	wil::com_ptr_nothrow<IDXGISurface> surface;
 	RETURN_IF_FAILED(_texture.copy_to(&surface));
 
@@ -101,129 +530,901 @@ HRESULT FrameGenerator::SetD3DManager(IUnknown* manager, UINT width, UINT height
 
 	// make sure the video processor works on GPU
 	RETURN_IF_FAILED(_converter->ProcessMessage(MFT_MESSAGE_SET_D3D_MANAGER, (ULONG_PTR)manager));
+
+	// the render target's texture is always the input, so the input sample is made once
+	RETURN_IF_FAILED(MFCreateSample(&_converterInput));
+	RETURN_IF_FAILED(_converterInput->AddBuffer(_textureBuffer.get()));
+	RETURN_IF_FAILED(_converter->GetOutputStreamInfo(0, &info));
+	_converterProvidesSamples = (info.dwFlags & MFT_OUTPUT_STREAM_PROVIDES_SAMPLES) != 0;
 	return S_OK;
 }
 
+// copies the GPU render target to CPU memory as RGB32 or NV12, for the encoder & the LUT
+HRESULT FrameGenerator::ReadRenderTarget(REFGUID format, BYTE* output, LONG outputStride, BYTE* uv, LONG uvStride)
+{
+	wil::com_ptr_nothrow<ID3D11Device> device;
+	RETURN_IF_FAILED(_dxgiManager->LockDevice(_deviceHandle, IID_PPV_ARGS(&device), TRUE));
+	auto unlock = wil::scope_exit([&]
+		{
+			_dxgiManager->UnlockDevice(_deviceHandle, FALSE);
+		});
+
+	if (!_stagingTexture)
+	{
+		D3D11_TEXTURE2D_DESC desc;
+		_texture->GetDesc(&desc);
+		desc.Usage = D3D11_USAGE_STAGING;
+		desc.BindFlags = 0;
+		desc.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
+		desc.MiscFlags = 0;
+		RETURN_IF_FAILED(device->CreateTexture2D(&desc, nullptr, &_stagingTexture));
+	}
+
+	wil::com_ptr_nothrow<ID3D11DeviceContext> context;
+	device->GetImmediateContext(&context);
+	context->CopyResource(_stagingTexture.get(), _texture.get());
+
+	D3D11_MAPPED_SUBRESOURCE map;
+	RETURN_IF_FAILED(context->Map(_stagingTexture.get(), 0, D3D11_MAP_READ, 0, &map));
+	auto hr = ConvertPattern(format, (const BYTE*)map.pData, map.RowPitch, output, outputStride, uv, uvStride);
+	context->Unmap(_stagingTexture.get(), 0);
+	return hr;
+}
+
 // common to CPU & GPU
 HRESULT FrameGenerator::CreateRenderTargetResources(UINT width, UINT height)
 {
 	assert(_renderTarget);
 	RETURN_IF_FAILED(_renderTarget->CreateSolidColorBrush(D2D1::ColorF(1, 1, 1, 1), &_whiteBrush));
-
-	RETURN_IF_FAILED(DWriteCreateFactory(DWRITE_FACTORY_TYPE_SHARED, __uuidof(IDWriteFactory), (IUnknown**)&_dwrite));
-	RETURN_IF_FAILED(_dwrite->CreateTextFormat(L"Segoe UI", nullptr, DWRITE_FONT_WEIGHT_NORMAL, DWRITE_FONT_STYLE_NORMAL, DWRITE_FONT_STRETCH_NORMAL, 40, L"", &_textFormat));
-	RETURN_IF_FAILED(_textFormat->SetParagraphAlignment(DWRITE_PARAGRAPH_ALIGNMENT_CENTER));
-	RETURN_IF_FAILED(_textFormat->SetTextAlignment(DWRITE_TEXT_ALIGNMENT_CENTER));
+	RETURN_IF_FAILED(_renderTarget->CreateSolidColorBrush(D2D1::ColorF(0, 0, 0, 1), &_blackBrush));
+	RETURN_IF_FAILED(_renderTarget->CreateSolidColorBrush(D2D1::ColorF(0, 0, 0, 1), &_cellBrush));
+	RETURN_IF_FAILED(CreatePatternFont());
 	_width = width;
 	_height = height;
 	return S_OK;
 }
 
-HRESULT FrameGenerator::Generate(IMFSample* sample, REFGUID format, IMFSample** outSample)
+HRESULT FrameGenerator::CreatePatternFont()
 {
-	RETURN_HR_IF_NULL(E_POINTER, sample);
-	RETURN_HR_IF_NULL(E_POINTER, outSample);
-	*outSample = nullptr;
+	if (_fontFace)
+		return S_OK;
 
-	// render something on image common to CPU & GPU
-	if (_renderTarget && _textFormat && _dwrite && _whiteBrush)
+	// the pattern's text is drawn as glyph runs from a table of the printable ASCII glyphs, as a text layout per frame allocates
+	RETURN_IF_FAILED(DWriteCreateFactory(DWRITE_FACTORY_TYPE_SHARED, __uuidof(IDWriteFactory), (IUnknown**)&_dwrite));
+	wil::com_ptr_nothrow<IDWriteFontCollection> fonts;
+	RETURN_IF_FAILED(_dwrite->GetSystemFontCollection(&fonts));
+	UINT32 family = 0;
+	BOOL exists = FALSE;
+	RETURN_IF_FAILED(fonts->FindFamilyName(PATTERN_FONT, &family, &exists));
+	wil::com_ptr_nothrow<IDWriteFontFamily> fontFamily;
+	RETURN_IF_FAILED(fonts->GetFontFamily(exists ? family : 0, &fontFamily));
+	wil::com_ptr_nothrow<IDWriteFont> font;
+	RETURN_IF_FAILED(fontFamily->GetFirstMatchingFont(DWRITE_FONT_WEIGHT_NORMAL, DWRITE_FONT_STRETCH_NORMAL, DWRITE_FONT_STYLE_NORMAL, &font));
+	RETURN_IF_FAILED(font->CreateFontFace(&_fontFace));
+
+	UINT32 codePoints[PATTERN_GLYPHS];
+	for (UINT i = 0; i < PATTERN_GLYPHS; i++)
 	{
-		_renderTarget->BeginDraw();
-		_renderTarget->Clear(D2D1::ColorF(0, 0, 1, 1));
+		codePoints[i] = L' ' + i;
+	}
+	RETURN_IF_FAILED(_fontFace->GetGlyphIndices(codePoints, PATTERN_GLYPHS, _glyphs));
 
-		// draw some HSL blocks
-		const float divisor = 20;
-		for (UINT i = 0; i < _width / divisor; i++)
-		{
-			for (UINT j = 0; j < _height / divisor; j++)
-			{
-				wil::com_ptr_nothrow<ID2D1SolidColorBrush> brush;
-				auto color = HSL2RGB((float)i / (_height / divisor), 1, ((float)j / (_width / divisor)));
-				RETURN_IF_FAILED(_renderTarget->CreateSolidColorBrush(color, &brush));
-				_renderTarget->FillRectangle(D2D1::Rect(i * divisor, j * divisor, (i + 1) * divisor, (j + 1) * divisor), brush.get());
-			}
-		}
+	DWRITE_GLYPH_METRICS glyphMetrics[PATTERN_GLYPHS];
+	RETURN_IF_FAILED(_fontFace->GetDesignGlyphMetrics(_glyphs, PATTERN_GLYPHS, glyphMetrics));
+	DWRITE_FONT_METRICS metrics;
+	_fontFace->GetMetrics(&metrics);
+	auto scale = PATTERN_FONT_SIZE / metrics.designUnitsPerEm;
+	for (UINT i = 0; i < PATTERN_GLYPHS; i++)
+	{
+		_glyphAdvances[i] = glyphMetrics[i].advanceWidth * scale;
+	}
+	_fontAscent = metrics.ascent * scale;
+	_lineHeight = (metrics.ascent + metrics.descent + metrics.lineGap) * scale;
+	return S_OK;
+}
 
-		auto radius = divisor * 2;
-		const float padding = 1;
-		_renderTarget->DrawEllipse(D2D1::Ellipse(D2D1::Point2F(radius + padding, radius + padding), radius, radius), _whiteBrush.get());
-		_renderTarget->DrawEllipse(D2D1::Ellipse(D2D1::Point2F(radius + padding, _height - radius - padding), radius, radius), _whiteBrush.get());
-		_renderTarget->DrawEllipse(D2D1::Ellipse(D2D1::Point2F(_width - radius - padding, radius + padding), radius, radius), _whiteBrush.get());
-		_renderTarget->DrawEllipse(D2D1::Ellipse(D2D1::Point2F(_width - radius - padding, _height - radius - padding), radius, radius), _whiteBrush.get());
-		_renderTarget->DrawRectangle(D2D1::Rect(radius, radius, _width - radius, _height - radius), _whiteBrush.get());
+// the rasterizer draws the pattern's glyphs from bitmaps rendered once by DirectWrite, antialiased like Direct2D's grayscale text
+HRESULT FrameGenerator::CreateRasterGlyphs()
+{
+	assert(_dwrite && _fontFace);
+	_raster = TileRasterizer(); // its glyphs can't be replaced
+	std::vector<BYTE> texture;
+	std::vector<BYTE> coverage;
+	for (UINT i = 0; i < PATTERN_GLYPHS; i++)
+	{
+		FLOAT advance = 0;
+		DWRITE_GLYPH_OFFSET offset{};
+		DWRITE_GLYPH_RUN run{};
+		run.fontFace = _fontFace.get();
+		run.fontEmSize = PATTERN_FONT_SIZE;
+		run.glyphCount = 1;
+		run.glyphIndices = &_glyphs[i];
+		run.glyphAdvances = &advance;
+		run.glyphOffsets = &offset;
 
-		// draw resolution at center
-		// note: we could optimize here and compute layout only once if text doesn't change (depending on the font, etc.)
-		wchar_t text[127];
-		wchar_t fmt[15];
-		if (format == MFVideoFormat_NV12)
-		{
-			if (HasD3DManager())
-			{
-				lstrcpy(fmt, L"NV12 (GPU)");
-			}
-			else
-			{
-				lstrcpy(fmt, L"NV12 (CPU)");
-			}
-		}
-		else
+		wil::com_ptr_nothrow<IDWriteGlyphRunAnalysis> analysis;
+		RETURN_IF_FAILED(_dwrite->CreateGlyphRunAnalysis(&run, 1, nullptr, DWRITE_RENDERING_MODE_NATURAL, DWRITE_MEASURING_MODE_NATURAL, 0, 0, &analysis));
+		RECT bounds;
+		RETURN_IF_FAILED(analysis->GetAlphaTextureBounds(DWRITE_TEXTURE_CLEARTYPE_3x1, &bounds));
+		auto width = (UINT)std::max<LONG>(bounds.right - bounds.left, 0);
+		auto height = (UINT)std::max<LONG>(bounds.bottom - bounds.top, 0);
+		RETURN_HR_IF(E_UNEXPECTED, width > PATTERN_GLYPH_MAX_SIZE || height > PATTERN_GLYPH_MAX_SIZE);
+
+		// ClearType coverage has 3 values per pixel, averaged to gray
+		coverage.resize((size_t)width * height);
+		if (!coverage.empty())
 		{
-			if (HasD3DManager())
-			{
-				lstrcpy(fmt, L"RGB32 (GPU)");
-			}
-			else
+			texture.resize(coverage.size() * 3);
+			RETURN_IF_FAILED(analysis->CreateAlphaTexture(DWRITE_TEXTURE_CLEARTYPE_3x1, &bounds, texture.data(), (UINT32)texture.size()));
+			for (size_t j = 0; j < coverage.size(); j++)
 			{
-				lstrcpy(fmt, L"RGB32 (CPU)");
+				coverage[j] = (BYTE)((texture[j * 3] + texture[j * 3 + 1] + texture[j * 3 + 2] + 1) / 3);
 			}
 		}
+		RETURN_HR_IF(E_UNEXPECTED, !_raster.SetGlyph(i, coverage.data(), (INT32)width, width, height, bounds.left, bounds.top));
+	}
+	return S_OK;
+}
 
-#define FRAMES_FOR_FPS 60 // number of frames to wait to compute fps from last measure
-#define NS_PER_MS 10000
-#define MS_PER_S 1000
-
-		if (!_fps || !(_frame % FRAMES_FOR_FPS))
-		{
-			auto time = MFGetSystemTime();
-			_fps = (UINT)(MS_PER_S * NS_PER_MS * FRAMES_FOR_FPS / (time - _prevTime));
-			_prevTime = time;
-		}
-
-		auto len = wsprintf(text, L"Format: %s\nFrame#: %I64i\nFps: %u\nResolution: %u x %u", fmt, _frame, _fps, _width, _height);
-
-		wil::com_ptr_nothrow<IDWriteTextLayout> layout;
-		RETURN_IF_FAILED(_dwrite->CreateTextLayout(text, len, _textFormat.get(), (FLOAT)_width, (FLOAT)_height, &layout));
+// copies a source frame to the output buffer, converting, color adjusting & grading it if needed, and centering it if sizes differ
+static HRESULT CopySourceFrame(const SourceFrame& frame, REFGUID format, UINT width, UINT height, BYTE* output, LONG pitch, DWORD length, const ColorAdjust& adjust, const ColorLut& lut, FrameStats* stats)
+{
+	// keep everything even so chroma planes stay aligned
+	auto w = std::min(frame.width, width) & ~1;
+	auto h = std::min(frame.height, height) & ~1;
+	auto inX = ((frame.width - w) / 2) & ~1;
+	auto inY = ((frame.height - h) / 2) & ~1;
+	auto outX = ((width - w) / 2) & ~1;
+	auto outY = ((height - h) / 2) & ~1;
+	auto fill = w != width || h != height;
 
-		_renderTarget->DrawTextLayout(D2D1::Point2F(0, 0), layout.get(), _whiteBrush.get());
-		_renderTarget->EndDraw();
+	auto inRgb = frame.planes[0] + inY * frame.strides[0] + inX * 4;
+	auto inLuma = frame.planes[0] + inY * frame.strides[0] + inX;
+	const BYTE* inU = nullptr;
+	const BYTE* inV = nullptr;
+	if (frame.format == MFVideoFormat_NV12)
+	{
+		inU = frame.planes[1] + (inY / 2) * frame.strides[1] + inX;
+		inV = inU + 1;
 	}
-
-	// build a sample using either D3D/DXGI (GPU) or WIC (CPU)
-	wil::com_ptr_nothrow<IMFMediaBuffer> mediaBuffer;
-	if (HasD3DManager())
+	else if (frame.format == MFVideoFormat_I420)
 	{
-		// remove all existing buffers
-		RETURN_IF_FAILED(sample->RemoveAllBuffers());
+		inU = frame.planes[1] + (inY / 2) * frame.strides[1] + inX / 2;
+		inV = frame.planes[2] + (inY / 2) * frame.strides[2] + inX / 2;
+	}
 
-		// create a buffer from this and add to sample
-		RETURN_IF_FAILED(MFCreateDXGISurfaceBuffer(__uuidof(ID3D11Texture2D), _texture.get(), 0, 0, &mediaBuffer));
-		RETURN_IF_FAILED(sample->AddBuffer(mediaBuffer.get()));
+	if (format == MFVideoFormat_NV12)
+	{
+		RETURN_HR_IF(E_UNEXPECTED, Nv12View::GetSize(pitch, height) > length);
+		auto y = output;
+		auto uv = GetFrameBufferUV(output, pitch, height);
+		if (fill)
+		{
+			FillMemory(y, (SIZE_T)pitch * height, 16); // black
+			FillMemory(uv, (SIZE_T)pitch * height / 2, 128);
+		}
 
-		// if we're on GPU & format is not RGB, convert using GPU
-		if (format == MFVideoFormat_NV12)
+		if (stats)
 		{
-			assert(_converter);
-			RETURN_IF_FAILED(_converter->ProcessInput(0, sample, 0));
+			stats->Begin(width, height);
+			stats->AddFill(width * height - w * h);
+		}
 
-			// let converter build the sample for us, note it works because we gave it the D3DManager
+		auto outLuma = y + outY * pitch + outX;
+		auto outUV = uv + (outY / 2) * pitch + outX;
+
+		// each band is counted right after it's converted, while it's still in cache
+		return ForEachBand(h, CONVERT_BAND_ROWS, [&](UINT top, UINT bottom)
+			{
+				auto rows = bottom - top;
+				auto bandLuma = outLuma + (ptrdiff_t)top * pitch;
+				auto bandUV = outUV + (ptrdiff_t)(top / 2) * pitch;
+				if (lut.IsLoaded())
+				{
+					// ProcAmp is baked in the LUT
+					if (frame.format == MFVideoFormat_RGB32)
+					{
+						lut.RGB32ToNV12(inRgb + (ptrdiff_t)top * frame.strides[0], frame.strides[0], w, rows, bandLuma, pitch, bandUV, pitch);
+					}
+					else
+					{
+						auto uvStep = frame.format == MFVideoFormat_NV12 ? 2 : 1;
+						auto vStride = uvStep == 2 ? frame.strides[1] : frame.strides[2];
+						lut.YUV420ToNV12(inLuma + (ptrdiff_t)top * frame.strides[0], frame.strides[0], inU + (ptrdiff_t)(top / 2) * frame.strides[1], frame.strides[1], inV + (ptrdiff_t)(top / 2) * vStride, vStride, uvStep, w, rows, bandLuma, pitch, bandUV, pitch);
+					}
+				}
+				else if (frame.format == MFVideoFormat_NV12)
+				{
+					YToY(inLuma + (ptrdiff_t)top * frame.strides[0], frame.strides[0], w, rows, bandLuma, pitch, adjust);
+					UVToNV12UV(inU + (ptrdiff_t)(top / 2) * frame.strides[1], frame.strides[1], inV + (ptrdiff_t)(top / 2) * frame.strides[1], frame.strides[1], 2, w / 2, rows / 2, bandUV, pitch, adjust);
+				}
+				else if (frame.format == MFVideoFormat_I420)
+				{
+					YToY(inLuma + (ptrdiff_t)top * frame.strides[0], frame.strides[0], w, rows, bandLuma, pitch, adjust);
+					UVToNV12UV(inU + (ptrdiff_t)(top / 2) * frame.strides[1], frame.strides[1], inV + (ptrdiff_t)(top / 2) * frame.strides[2], frame.strides[2], 1, w / 2, rows / 2, bandUV, pitch, adjust);
+				}
+				else
+				{
+					RGB32ToNV12(inRgb + (ptrdiff_t)top * frame.strides[0], frame.strides[0], w, rows, bandLuma, pitch, bandUV, pitch, adjust);
+				}
+
+				if (stats)
+				{
+					stats->Add(bandLuma, pitch, bandUV, pitch, w, rows);
+				}
+			});
+	}
+
+	RETURN_HR_IF(E_UNEXPECTED, Rgb32View::GetSize(pitch, height) > length);
+	if (fill)
+	{
+		ZeroMemory(output, (SIZE_T)pitch * height);
+	}
+
+	auto outRgb = output + outY * pitch + outX * 4;
+	if (lut.IsLoaded())
+		return ForEachBand(h, CONVERT_BAND_ROWS, [&](UINT top, UINT bottom)
+			{
+				auto bandRgb = outRgb + (ptrdiff_t)top * pitch;
+				if (frame.format == MFVideoFormat_RGB32)
+				{
+					lut.RGB32ToRGB32(inRgb + (ptrdiff_t)top * frame.strides[0], frame.strides[0], w, bottom - top, bandRgb, pitch);
+				}
+				else
+				{
+					auto uvStep = frame.format == MFVideoFormat_NV12 ? 2 : 1;
+					auto vStride = uvStep == 2 ? frame.strides[1] : frame.strides[2];
+					lut.YUV420ToRGB32(inLuma + (ptrdiff_t)top * frame.strides[0], frame.strides[0], inU + (ptrdiff_t)(top / 2) * frame.strides[1], frame.strides[1], inV + (ptrdiff_t)(top / 2) * vStride, vStride, uvStep, w, bottom - top, bandRgb, pitch);
+				}
+			});
+
+	if (frame.format == MFVideoFormat_RGB32)
+	{
+		RGB32ToRGB32(inRgb, frame.strides[0], w, h, outRgb, pitch, adjust);
+	}
+	else
+	{
+		YUV420ToRGB32(inLuma, frame.strides[0], inU, inV, frame.strides[1], frame.format == MFVideoFormat_NV12 ? 2 : 1, w, h, outRgb, pitch, adjust);
+	}
+	return S_OK;
+}
+
+// copies a source frame transformed, straight from the source planes when it needs no conversion, otherwise through an intermediate frame
+HRESULT FrameGenerator::CopyTransformedFrame(const SourceFrame& frame, REFGUID format, BYTE* output, LONG pitch, DWORD length)
+{
+	auto width = ContentWidth();
+	auto height = ContentHeight();
+	RETURN_HR_IF(E_UNEXPECTED, GetFrameBufferSize(GetFrameBufferFormat(format), pitch, _height) > length);
+	auto outputUV = GetFrameBufferUV(output, pitch, _height);
+	if (frame.format == format && frame.width == width && frame.height == height && _colorAdjust.identity && !_lut.IsLoaded())
+	{
+		RETURN_IF_FAILED(_transform.Apply(format, frame.planes[0], frame.strides[0], frame.planes[1], frame.strides[1], width, height, output, pitch, outputUV, pitch));
+		return format == MFVideoFormat_NV12 ? _stats.Gather(output, pitch, outputUV, pitch, _width, _height) : S_OK;
+	}
+
+	// sized for RGB32, so it's reused when the format changes
+	auto stride = GetAlignedFrameStride(GetFrameBufferFormat(format), width);
+	if (!_transformFrame)
+	{
+		_transformFrame = FrameBufferPool::GetShared().Acquire(Rgb32View::GetSize(Rgb32View::GetAlignedStride(width), height));
+		RETURN_IF_NULL_ALLOC(_transformFrame.get());
+	}
+
+	auto uv = GetFrameBufferUV(_transformFrame.get(), stride, height);
+	RETURN_IF_FAILED(CopySourceFrame(frame, format, width, height, _transformFrame.get(), stride, (DWORD)_transformFrame.size(), _colorAdjust, _lut, &_stats));
+	return _transform.Apply(format, _transformFrame.get(), stride, uv, stride, width, height, output, pitch, outputUV, pitch);
+}
+
+// keys an NV12 frame of the stream's size over the background source, read in place when it needs no conversion
+HRESULT FrameGenerator::KeyFrame(BYTE* y, LONG pitch, BYTE* uv, MFTIME time)
+{
+	if (!_key.IsEnabled())
+		return S_OK;
+
+	RETURN_HR_IF(E_NOT_VALID_STATE, !_keyFrame);
+	auto keyFrame = Nv12View::FromBuffer(_keyFrame.get(), _keyStride, _width, _height);
+	const BYTE* backgroundY = keyFrame.planes[0].data;
+	const BYTE* backgroundU = keyFrame.planes[1].data;
+	const BYTE* backgroundV = backgroundU + 1;
+	LONG backgroundYStride = _keyStride;
+	LONG backgroundUVStride = _keyStride;
+	UINT backgroundUVStep = 2;
+	if (_keyBackground)
+	{
+		SourceFrame frame{};
+		RETURN_IF_FAILED(_keyBackground->GetFrame(time - _sourceStartTime, MFVideoFormat_NV12, &frame));
+		// the key reads both I420 chroma planes with one stride, others are copied
+		auto inPlace = frame.width == _width && frame.height == _height && _colorAdjust.identity && !_lut.IsLoaded() &&
+			(frame.format == MFVideoFormat_NV12 || (frame.format == MFVideoFormat_I420 && frame.strides[1] == frame.strides[2]));
+		if (inPlace)
+		{
+			backgroundY = frame.planes[0];
+			backgroundYStride = frame.strides[0];
+			backgroundU = frame.planes[1];
+			backgroundUVStride = frame.strides[1];
+			if (frame.format == MFVideoFormat_NV12)
+			{
+				backgroundV = backgroundU + 1;
+			}
+			else
+			{
+				backgroundV = frame.planes[2];
+				backgroundUVStep = 1;
+			}
+		}
+		else
+		{
+			// the background is adjusted & graded like the foreground
+			RETURN_IF_FAILED(CopySourceFrame(frame, MFVideoFormat_NV12, _width, _height, _keyFrame.get(), _keyStride, (DWORD)_keyFrame.size(), _colorAdjust, _lut, nullptr));
+		}
+	}
+	return _key.Apply(y, pitch, uv, pitch, _width, _height, backgroundY, backgroundYStride, backgroundU, backgroundV, backgroundUVStride, backgroundUVStep);
+}
+
+HRESULT FrameGenerator::GenerateFromSource(IMFSample* sample, REFGUID format)
+{
+	LONGLONG time = 0;
+	RETURN_IF_FAILED(sample->GetSampleTime(&time));
+
+	SourceFrame frame{};
+	RETURN_IF_FAILED(_source->GetFrame(time - _sourceStartTime, format, &frame));
+
+	// we always write to the allocator's buffer, be it on CPU or GPU
+	wil::com_ptr_nothrow<IMFMediaBuffer> mediaBuffer;
+	RETURN_IF_FAILED(sample->GetBufferByIndex(0, &mediaBuffer));
+	wil::com_ptr_nothrow<IMF2DBuffer2> buffer2D;
+	BYTE* scanline;
+	LONG pitch;
+	BYTE* start;
+	DWORD length;
+	RETURN_IF_FAILED(mediaBuffer->QueryInterface(IID_PPV_ARGS(&buffer2D)));
+	RETURN_IF_FAILED(buffer2D->Lock2DSize(MF2DBuffer_LockFlags_Write, &scanline, &pitch, &start, &length));
+
+	// static content (a still image, a paused or slow source) is copied from the last frame instead of being converted, keyed, filtered & composed again,
+	// the frame is saved the second time a key comes so moving content doesn't pay for the copy (keying over a background source is never repeated)
+	FrameKey key{ frame.index, _overlays.GetState(time), _revision, format, _width, _height };
+	auto repeated = _dedup && _hasLastKey && key == _lastKey && !(_key.IsEnabled() && _keyBackground);
+	auto reused = repeated && _hasDedupFrame;
+	_lastKey = key;
+	_hasLastKey = true;
+
+	HRESULT hr;
+	if (reused)
+	{
+		hr = CopyDedupFrame(format, scanline, pitch, length);
+	}
+	else
+	{
+		_hasDedupFrame = false;
+		hr = _transform.IsActive() ? CopyTransformedFrame(frame, format, scanline, pitch, length) : CopySourceFrame(frame, format, _width, _height, scanline, pitch, length, _colorAdjust, _lut, &_stats);
+		if (SUCCEEDED(hr) && format == MFVideoFormat_NV12)
+		{
+			hr = KeyFrame(scanline, pitch, GetFrameBufferUV(scanline, pitch, _height), time);
+		}
+
+		if (SUCCEEDED(hr) && _filter.IsActive())
+		{
+			hr = _filter.Apply(format, scanline, pitch, _width, _height);
+		}
+
+		if (SUCCEEDED(hr))
+		{
+			hr = _overlays.Compose(format, scanline, pitch, GetFrameBufferUV(scanline, pitch, _height), pitch, _width, _height, time);
+		}
+
+		if (SUCCEEDED(hr) && repeated)
+		{
+			hr = SaveDedupFrame(format, scanline, pitch);
+		}
+	}
+
+	if (SUCCEEDED(hr))
+	{
+		hr = BurnFrameCode(format, scanline, pitch, GetFrameBufferUV(scanline, pitch, _height), _width, _height, time);
+	}
+
+	if (SUCCEEDED(hr))
+	{
+		// without a frame code, a reused frame has the same CRCs as the saved one
+		if (reused && !_frameCode)
+		{
+			_crcCount = _dedupCrcCount;
+		}
+		else
+		{
+			hr = ChecksumFrame(format, scanline, pitch, _width, _height);
+			_dedupCrcCount = _crcCount;
+		}
+	}
+	buffer2D->Unlock2D();
+
+	if (FAILED(hr))
+	{
+		_hasLastKey = false;
+		_hasDedupFrame = false;
+	}
+	return hr;
+}
+
+HRESULT FrameGenerator::GenerateJpeg(IMFSample* sample)
+{
+	RETURN_HR_IF(E_NOT_VALID_STATE, !_jpegFrame);
+
+	LONGLONG time = 0;
+	RETURN_IF_FAILED(sample->GetSampleTime(&time));
+
+	// the encoder reads NV12 or I420 planes, straight from the frame source when possible (same size, no color adjustment, no LUT, no transform, no overlay, no chroma key, no filter & no frame code)
+	auto jpegFrame = Nv12View::FromBuffer(_jpegFrame.get(), _jpegStride, _width, _height);
+	auto y = jpegFrame.planes[0].data;
+	auto uv = jpegFrame.planes[1].data;
+	const BYTE* inY = y;
+	const BYTE* inU = uv;
+	const BYTE* inV = uv + 1;
+	LONG yStride = _jpegStride;
+	LONG uvStride = _jpegStride;
+	UINT uvStep = 2;
+	if (_source)
+	{
+		SourceFrame frame{};
+		RETURN_IF_FAILED(_source->GetFrame(time - _sourceStartTime, MFVideoFormat_NV12, &frame));
+		auto sameSize = frame.width == _width && frame.height == _height && _colorAdjust.identity && !_lut.IsLoaded() && !_transform.IsActive() && !_overlays.HasLayers() && !_key.IsEnabled() && !_filter.IsActive() && !_frameCode;
+		if (sameSize && frame.format == MFVideoFormat_NV12)
+		{
+			inY = frame.planes[0];
+			yStride = frame.strides[0];
+			inU = frame.planes[1];
+			inV = inU + 1;
+			uvStride = frame.strides[1];
+			RETURN_IF_FAILED(_stats.Gather(inY, yStride, inU, uvStride, _width, _height));
+		}
+		else if (sameSize && frame.format == MFVideoFormat_I420 && frame.strides[1] == frame.strides[2])
+		{
+			inY = frame.planes[0];
+			yStride = frame.strides[0];
+			inU = frame.planes[1];
+			inV = frame.planes[2];
+			uvStride = frame.strides[1];
+			uvStep = 1;
+			RETURN_IF_FAILED(_stats.Gather(inY, yStride, inU, inV, uvStride, _width, _height));
+		}
+		else if (_transform.IsActive())
+		{
+			RETURN_IF_FAILED(CopyTransformedFrame(frame, MFVideoFormat_NV12, y, _jpegStride, (DWORD)_jpegFrame.size()));
+		}
+		else
+		{
+			RETURN_IF_FAILED(CopySourceFrame(frame, MFVideoFormat_NV12, _width, _height, y, _jpegStride, (DWORD)_jpegFrame.size(), _colorAdjust, _lut, &_stats));
+		}
+		RETURN_IF_FAILED(KeyFrame(y, _jpegStride, uv, time));
+	}
+	else
+	{
+		RETURN_IF_FAILED(RenderPattern(MFVideoFormat_MJPG, time));
+		if (HasD3DManager())
+		{
+			RETURN_IF_FAILED(ReadRenderTarget(MFVideoFormat_NV12, y, _jpegStride, uv, _jpegStride));
+		}
+		else if (_rasterize)
+		{
+			RETURN_IF_FAILED(ConvertPattern(MFVideoFormat_NV12, _rasterFrame.get(), _rasterStride, y, _jpegStride, uv, _jpegStride));
+		}
+		else
+		{
+			wil::com_ptr_nothrow<IWICBitmapLock> lock;
+			RETURN_IF_FAILED(_bitmap->Lock(nullptr, WICBitmapLockRead, &lock));
+			UINT wicStride;
+			RETURN_IF_FAILED(lock->GetStride(&wicStride));
+			UINT wicSize;
+			WICInProcPointer wicPointer;
+			RETURN_IF_FAILED(lock->GetDataPointer(&wicSize, &wicPointer));
+			RETURN_HR_IF_NULL(E_UNEXPECTED, wicPointer);
+			RETURN_IF_FAILED(ConvertPattern(MFVideoFormat_NV12, wicPointer, wicStride, y, _jpegStride, uv, _jpegStride));
+		}
+	}
+
+	if (_filter.IsActive())
+	{
+		RETURN_IF_FAILED(_filter.Apply(MFVideoFormat_NV12, y, _jpegStride, _width, _height));
+	}
+	RETURN_IF_FAILED(_overlays.Compose(MFVideoFormat_NV12, y, _jpegStride, uv, _jpegStride, _width, _height, time));
+	RETURN_IF_FAILED(BurnFrameCode(MFVideoFormat_NV12, y, _jpegStride, uv, _width, _height, time));
+	RETURN_IF_FAILED(_jpeg.Encode(inY, yStride, inU, inV, uvStride, uvStep));
+
+	// pooled samples have a buffer that's reused, it's only replaced by a larger one when the frame doesn't fit
+	auto size = (DWORD)_jpeg.GetEncodedSize();
+	DWORD bufferCount;
+	RETURN_IF_FAILED(sample->GetBufferCount(&bufferCount));
+	wil::com_ptr_nothrow<IMFMediaBuffer> buffer;
+	DWORD maxLength = 0;
+	if (bufferCount)
+	{
+		RETURN_IF_FAILED(sample->GetBufferByIndex(0, &buffer));
+		RETURN_IF_FAILED(buffer->GetMaxLength(&maxLength));
+	}
+
+	if (maxLength < size)
+	{
+		buffer.reset();
+		RETURN_IF_FAILED(sample->RemoveAllBuffers());
+		RETURN_IF_FAILED(MFCreateMemoryBuffer(size + size / 4, &buffer)); // with some room, the next frames are likely as large
+		RETURN_IF_FAILED(sample->AddBuffer(buffer.get()));
+	}
+
+	BYTE* data;
+	RETURN_IF_FAILED(buffer->Lock(&data, nullptr, nullptr));
+	_jpeg.CopyEncoded(data);
+	if (_frameCrc)
+	{
+		_crcs[0] = Crc32c(data, size);
+		_crcCount = 1;
+	}
+	RETURN_IF_FAILED(buffer->Unlock());
+	RETURN_IF_FAILED(buffer->SetCurrentLength(size));
+	return S_OK;
+}
+
+HRESULT FrameGenerator::RenderPattern(REFGUID format, MFTIME time)
+{
+	wchar_t text[PATTERN_TEXT_MAX];
+	if (_rasterize)
+	{
+		FormatPatternText(format, text);
+		return RasterizePattern(text);
+	}
+
+	// render something on image common to CPU & GPU
+	if (_renderTarget && _fontFace && _whiteBrush && _cellBrush)
+	{
+		// the pattern is color adjusted and transformed when drawn, as the GPU path converts it with the video processor
+		auto width = ContentWidth();
+		auto height = ContentHeight();
+		_renderTarget->BeginDraw();
+		_renderTarget->SetTransform(_transform.GetMatrix(width, height));
+		_renderTarget->Clear(PatternColor(D2D1::ColorF(0, 0, 1, 1)));
+		_whiteBrush->SetColor(PatternColor(D2D1::ColorF(1, 1, 1, 1)));
+
+		// draw some HSL blocks
+		const float divisor = 20;
+		for (UINT i = 0; i < width / divisor; i++)
+		{
+			for (UINT j = 0; j < height / divisor; j++)
+			{
+				auto color = HSL2RGB((float)i / (height / divisor), 1, ((float)j / (width / divisor)));
+				_cellBrush->SetColor(PatternColor(color));
+				_renderTarget->FillRectangle(D2D1::Rect(i * divisor, j * divisor, (i + 1) * divisor, (j + 1) * divisor), _cellBrush.get());
+			}
+		}
+
+		auto radius = divisor * 2;
+		const float padding = 1;
+		_renderTarget->DrawEllipse(D2D1::Ellipse(D2D1::Point2F(radius + padding, radius + padding), radius, radius), _whiteBrush.get());
+		_renderTarget->DrawEllipse(D2D1::Ellipse(D2D1::Point2F(radius + padding, height - radius - padding), radius, radius), _whiteBrush.get());
+		_renderTarget->DrawEllipse(D2D1::Ellipse(D2D1::Point2F(width - radius - padding, radius + padding), radius, radius), _whiteBrush.get());
+		_renderTarget->DrawEllipse(D2D1::Ellipse(D2D1::Point2F(width - radius - padding, height - radius - padding), radius, radius), _whiteBrush.get());
+		_renderTarget->DrawRectangle(D2D1::Rect(radius, radius, width - radius, height - radius), _whiteBrush.get());
+
+		// draw resolution at center
+		FormatPatternText(format, text);
+		DrawPatternText(text, width, height);
+
+		// the GPU path doesn't bring frames back to the CPU, so overlays are drawn by D2D, untransformed
+		if (HasD3DManager() && !ReadsBackPattern() && format != MFVideoFormat_MJPG)
+		{
+			_renderTarget->SetTransform(D2D1::Matrix3x2F::Identity());
+			RETURN_IF_FAILED(_overlays.Draw(_renderTarget.get(), _width, time));
+			if (_frameCode)
+			{
+				RETURN_IF_FAILED(DrawFrameCode(time));
+			}
+		}
+		_renderTarget->EndDraw();
+	}
+	return S_OK;
+}
+
+static UINT32 RasterColor(const D2D1_COLOR_F& color)
+{
+	auto component = [](FLOAT value) { return (UINT32)(std::min<FLOAT>(std::max<FLOAT>(value, 0), 1) * 255 + 0.5f); };
+	return 0xFF000000 | component(color.r) << 16 | component(color.g) << 8 | component(color.b);
+}
+
+// records the same pattern as Direct2D draws and renders it to the pattern frame, the tiles in parallel, transformed after if needed
+HRESULT FrameGenerator::RasterizePattern(PCWSTR text)
+{
+	RETURN_HR_IF(E_NOT_VALID_STATE, !_rasterFrame);
+	auto width = ContentWidth();
+	auto height = ContentHeight();
+	if (_raster.GetWidth() != width || _raster.GetHeight() != height)
+	{
+		RETURN_HR_IF(E_INVALIDARG, !_raster.Start(width, height));
+	}
+
+	_raster.Begin(RasterColor(PatternColor(D2D1::ColorF(0, 0, 1, 1))));
+	const float divisor = 20;
+	for (UINT i = 0; i < width / divisor; i++)
+	{
+		for (UINT j = 0; j < height / divisor; j++)
+		{
+			auto color = HSL2RGB((float)i / (height / divisor), 1, ((float)j / (width / divisor)));
+			_raster.FillRectangle(i * divisor, j * divisor, (i + 1) * divisor, (j + 1) * divisor, RasterColor(PatternColor(color)));
+		}
+	}
+
+	auto white = RasterColor(PatternColor(D2D1::ColorF(1, 1, 1, 1)));
+	auto radius = divisor * 2;
+	const float padding = 1;
+	_raster.DrawEllipse(radius + padding, radius + padding, radius, radius, 1, white);
+	_raster.DrawEllipse(radius + padding, height - radius - padding, radius, radius, 1, white);
+	_raster.DrawEllipse(width - radius - padding, radius + padding, radius, radius, 1, white);
+	_raster.DrawEllipse(width - radius - padding, height - radius - padding, radius, radius, 1, white);
+	_raster.DrawRectangle(radius, radius, width - radius, height - radius, 1, white);
+	DrawPatternText(text, width, height);
+
+	// a transformed pattern is rendered to the intermediate frame, sized for RGB32 like for source frames
+	auto output = _rasterFrame.get();
+	auto stride = _rasterStride;
+	if (_transform.IsActive())
+	{
+		stride = Rgb32View::GetAlignedStride(width);
+		if (!_transformFrame)
+		{
+			_transformFrame = FrameBufferPool::GetShared().Acquire(Rgb32View::GetSize(stride, height));
+			RETURN_IF_NULL_ALLOC(_transformFrame.get());
+		}
+		output = _transformFrame.get();
+	}
+
+	try
+	{
+		_raster.Render(output, stride, &TaskScheduler::GetShared());
+	}
+	CATCH_RETURN();
+	return _transform.IsActive() ? _transform.Apply(MFVideoFormat_RGB32, output, stride, nullptr, 0, width, height, _rasterFrame.get(), _rasterStride, nullptr, 0) : S_OK;
+}
+
+// the pattern's text, with the frame rate measured every FRAMES_FOR_FPS frames
+void FrameGenerator::FormatPatternText(REFGUID format, PWSTR text)
+{
+	wchar_t fmt[15];
+	if (format == MFVideoFormat_NV12)
+	{
+		if (HasD3DManager())
+		{
+			lstrcpy(fmt, L"NV12 (GPU)");
+		}
+		else
+		{
+			lstrcpy(fmt, L"NV12 (CPU)");
+		}
+	}
+	else if (format == MFVideoFormat_MJPG)
+	{
+		if (HasD3DManager())
+		{
+			lstrcpy(fmt, L"MJPG (GPU)");
+		}
+		else
+		{
+			lstrcpy(fmt, L"MJPG (CPU)");
+		}
+	}
+	else
+	{
+		if (HasD3DManager())
+		{
+			lstrcpy(fmt, L"RGB32 (GPU)");
+		}
+		else
+		{
+			lstrcpy(fmt, L"RGB32 (CPU)");
+		}
+	}
+
+#define FRAMES_FOR_FPS 60 // number of frames to wait to compute fps from last measure
+#define NS_PER_MS 10000
+#define MS_PER_S 1000
+
+	if (!_fps || !(_frame % FRAMES_FOR_FPS))
+	{
+		auto time = MFGetSystemTime();
+		_fps = (UINT)(MS_PER_S * NS_PER_MS * FRAMES_FOR_FPS / (time - _prevTime));
+		_prevTime = time;
+	}
+
+	wsprintf(text, L"Format: %s\nFrame#: %I64i\nFps: %u\nResolution: %u x %u", fmt, _frame, _fps, _width, _height);
+}
+
+// draws lines of printable ASCII centered like the text format used to, without shaping (kerning, ligatures) that the pattern doesn't need,
+// with Direct2D or the rasterizer
+void FrameGenerator::DrawPatternText(PCWSTR text, UINT width, UINT height)
+{
+	UINT lines = 1;
+	for (auto c = text; *c; c++)
+	{
+		if (*c == L'\n')
+		{
+			lines++;
+		}
+	}
+
+	UINT16 glyphs[PATTERN_TEXT_MAX];
+	BYTE indices[PATTERN_TEXT_MAX];
+	FLOAT advances[PATTERN_TEXT_MAX];
+	auto white = _rasterize ? RasterColor(PatternColor(D2D1::ColorF(1, 1, 1, 1))) : 0;
+	auto baseline = (height - lines * _lineHeight) / 2 + _fontAscent;
+	auto line = text;
+	while (*line)
+	{
+		UINT32 count = 0;
+		FLOAT lineWidth = 0;
+		for (; line[count] && line[count] != L'\n' && count < PATTERN_TEXT_MAX; count++)
+		{
+			auto c = line[count];
+			auto index = c >= L' ' && c < L' ' + PATTERN_GLYPHS ? c - L' ' : L'?' - L' ';
+			glyphs[count] = _glyphs[index];
+			indices[count] = (BYTE)index;
+			advances[count] = _glyphAdvances[index];
+			lineWidth += advances[count];
+		}
+
+		if (count && _rasterize)
+		{
+			auto x = (width - lineWidth) / 2;
+			for (UINT32 i = 0; i < count; i++)
+			{
+				_raster.DrawGlyph(indices[i], x, baseline, white);
+				x += advances[i];
+			}
+		}
+		else if (count)
+		{
+			DWRITE_GLYPH_RUN run{};
+			run.fontFace = _fontFace.get();
+			run.fontEmSize = PATTERN_FONT_SIZE;
+			run.glyphCount = count;
+			run.glyphIndices = glyphs;
+			run.glyphAdvances = advances;
+			_renderTarget->DrawGlyphRun(D2D1::Point2F((width - lineWidth) / 2, baseline), &run, _whiteBrush.get());
+		}
+
+		line += count;
+		if (*line == L'\n')
+		{
+			line++;
+		}
+		baseline += _lineHeight;
+	}
+}
+
+HRESULT FrameGenerator::Generate(IMFSample* sample, REFGUID format, IMFSample** outSample)
+{
+	RETURN_HR_IF_NULL(E_POINTER, sample);
+	RETURN_HR_IF_NULL(E_POINTER, outSample);
+	*outSample = nullptr;
+	_stats.Invalidate();
+	_crcCount = 0;
+
+	// compressed samples are built from NV12, from the frame source or the pattern
+	if (format == MFVideoFormat_MJPG)
+	{
+		RETURN_IF_FAILED(GenerateJpeg(sample));
+		_frame++;
+		sample->AddRef();
+		*outSample = sample;
+		return S_OK;
+	}
+
+	// a frame source replaces the synthetic pattern
+	if (_source)
+	{
+		RETURN_IF_FAILED(GenerateFromSource(sample, format));
+		_frame++;
+		sample->AddRef();
+		*outSample = sample;
+		return S_OK;
+	}
+
+	LONGLONG time = 0;
+	RETURN_IF_FAILED(sample->GetSampleTime(&time));
+	RETURN_IF_FAILED(RenderPattern(format, time));
+
+	// build a sample using either D3D/DXGI (GPU) or WIC (CPU)
+	wil::com_ptr_nothrow<IMFMediaBuffer> mediaBuffer;
+	if (HasD3DManager() && ReadsBackPattern())
+	{
+		// grading & filtering are done on the CPU, so the pattern is read back and converted in the allocator's buffer
+		RETURN_IF_FAILED(sample->GetBufferByIndex(0, &mediaBuffer));
+		wil::com_ptr_nothrow<IMF2DBuffer2> buffer2D;
+		BYTE* scanline;
+		LONG pitch;
+		BYTE* start;
+		DWORD length;
+		RETURN_IF_FAILED(mediaBuffer->QueryInterface(IID_PPV_ARGS(&buffer2D)));
+		RETURN_IF_FAILED(buffer2D->Lock2DSize(MF2DBuffer_LockFlags_Write, &scanline, &pitch, &start, &length));
+		auto hr = GetFrameBufferSize(GetFrameBufferFormat(format), pitch, _height) > length ? E_UNEXPECTED : S_OK;
+		if (SUCCEEDED(hr))
+		{
+			hr = ReadRenderTarget(format, scanline, pitch, GetFrameBufferUV(scanline, pitch, _height), pitch);
+		}
+
+		if (SUCCEEDED(hr) && _filter.IsActive())
+		{
+			hr = _filter.Apply(format, scanline, pitch, _width, _height);
+		}
+
+		if (SUCCEEDED(hr))
+		{
+			hr = _overlays.Compose(format, scanline, pitch, GetFrameBufferUV(scanline, pitch, _height), pitch, _width, _height, time);
+		}
+
+		if (SUCCEEDED(hr))
+		{
+			hr = BurnFrameCode(format, scanline, pitch, GetFrameBufferUV(scanline, pitch, _height), _width, _height, time);
+		}
+
+		if (SUCCEEDED(hr))
+		{
+			hr = ChecksumFrame(format, scanline, pitch, _width, _height);
+		}
+		buffer2D->Unlock2D();
+		RETURN_IF_FAILED(hr);
+
+		_frame++;
+		sample->AddRef();
+		*outSample = sample;
+		return S_OK;
+	}
+
+	if (HasD3DManager())
+	{
+		// if we're on GPU & format is not RGB, convert using GPU
+		if (format == MFVideoFormat_NV12)
+		{
+			assert(_converter);
+			LONGLONG duration = 0;
+			RETURN_IF_FAILED(sample->GetSampleDuration(&duration));
+			RETURN_IF_FAILED(_converterInput->SetSampleTime(time));
+			RETURN_IF_FAILED(_converterInput->SetSampleDuration(duration));
+			RETURN_IF_FAILED(_converter->ProcessInput(0, _converterInput.get(), 0));
+
+			// the converter writes to the allocator's NV12 texture, so no sample is made per frame
 			MFT_OUTPUT_DATA_BUFFER buffer = {};
 			DWORD status = 0;
+			if (!_converterProvidesSamples)
+			{
+				buffer.pSample = sample;
+				auto hr = _converter->ProcessOutput(0, 1, &buffer, &status);
+				if (buffer.pEvents)
+				{
+					buffer.pEvents->Release();
+				}
+
+				if (SUCCEEDED(hr))
+				{
+					_frame++;
+					sample->AddRef();
+					*outSample = sample;
+					return S_OK;
+				}
+
+				// the allocator's textures may not be usable as video processor output, the converter then builds the samples, note it works because we gave it the D3DManager
+				LOG_HR_MSG(hr, "Converter cannot write to the allocator's sample, it will provide its own");
+				_converterProvidesSamples = true;
+				buffer = {};
+			}
+
 			RETURN_IF_FAILED(_converter->ProcessOutput(0, 1, &buffer, &status));
+			if (buffer.pEvents)
+			{
+				buffer.pEvents->Release();
+			}
 			*outSample = buffer.pSample;
 		}
 		else
 		{
+			// the render target's texture replaces the allocator's buffer
+			RETURN_IF_FAILED(sample->RemoveAllBuffers());
+			RETURN_IF_FAILED(sample->AddBuffer(_textureBuffer.get()));
 			sample->AddRef();
 			*outSample = sample;
 		}
@@ -241,54 +1442,50 @@ HRESULT FrameGenerator::Generate(IMFSample* sample, REFGUID format, IMFSample**
 	RETURN_IF_FAILED(mediaBuffer->QueryInterface(IID_PPV_ARGS(&buffer2D)));
 	RETURN_IF_FAILED(buffer2D->Lock2DSize(MF2DBuffer_LockFlags_Write, &scanline, &pitch, &start, &length));
 
-	wil::com_ptr_nothrow<IWICBitmapLock> lock;
-	auto hr = _bitmap->Lock(nullptr, WICBitmapLockRead, &lock);
-	// now we're using regular COM macros because we want to be sure to unlock (or we could use try/catch)
-	if (SUCCEEDED(hr))
+	HRESULT hr;
+	if (_rasterize)
 	{
-		UINT w, h;
-		hr = lock->GetSize(&w, &h);
+		hr = FinishPattern(format, _rasterFrame.get(), _rasterStride, scanline, pitch, length, time);
+	}
+	else
+	{
+		wil::com_ptr_nothrow<IWICBitmapLock> lock;
+		hr = _bitmap->Lock(nullptr, WICBitmapLockRead, &lock);
+		// now we're using regular COM macros because we want to be sure to unlock (or we could use try/catch)
 		if (SUCCEEDED(hr))
 		{
-			UINT wicStride;
-			hr = lock->GetStride(&wicStride);
+			UINT w, h;
+			hr = lock->GetSize(&w, &h);
 			if (SUCCEEDED(hr))
 			{
-				UINT wicSize;
-				WICInProcPointer wicPointer;
-				hr = lock->GetDataPointer(&wicSize, &wicPointer);
+				UINT wicStride;
+				hr = lock->GetStride(&wicStride);
 				if (SUCCEEDED(hr))
 				{
-					WINTRACE(L"WIC stride:%u WIC size:%u MF pitch:%u MF length:%u frame:%u format:%s", wicStride, wicSize, pitch, length, _frame, GUID_ToStringW(format).c_str());
-					if (format == MFVideoFormat_NV12)
-					{
-						// note we could use MF's converter too
-						hr = RGB32ToNV12(wicPointer, wicSize, wicStride, w, h, scanline, length, pitch);
-					}
-					else
+					UINT wicSize;
+					WICInProcPointer wicPointer;
+					hr = lock->GetDataPointer(&wicSize, &wicPointer);
+					if (SUCCEEDED(hr))
 					{
-						hr = (wicSize != length || wicStride != pitch) ? E_FAIL : S_OK;
+						WINTRACE(L"WIC stride:%u WIC size:%u MF pitch:%u MF length:%u frame:%I64u format:0x%08X", wicStride, wicSize, pitch, length, _frame, format.Data1);
+						hr = ((ULONGLONG)wicStride * h > wicSize || w != _width || h != _height || !wicPointer) ? E_FAIL : S_OK; // WIC annotation is currently wrong on GetDataPointer wicPointer arg
 						if (SUCCEEDED(hr))
 						{
-							if (assert_true(wicPointer)) // WIC annotation is currently wrong on GetDataPointer wicPointer arg
-							{
-								CopyMemory(scanline, wicPointer, length);
-							}
+							hr = FinishPattern(format, wicPointer, wicStride, scanline, pitch, length, time);
 						}
 					}
-
-					if (SUCCEEDED(hr))
-					{
-						_frame++;
-						sample->AddRef();
-						*outSample = sample;
-					}
 				}
 			}
+			lock.reset();
 		}
-		lock.reset();
 	}
 
+	if (SUCCEEDED(hr))
+	{
+		_frame++;
+		sample->AddRef();
+		*outSample = sample;
+	}
 	buffer2D->Unlock2D();
 	return hr;
 }
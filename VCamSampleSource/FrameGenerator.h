@@ -1,5 +1,36 @@
 #pragma once
 
+#include "FrameBuffer.h"
+#include "TileRasterizer.h"
+#include "FrameSource.h"
+#include "JpegEncoder.h"
+#include "ProcAmp.h"
+#include "FrameStats.h"
+#include "FrameCrc.h"
+#include "ColorLut.h"
+#include "FrameTransform.h"
+#include "Overlay.h"
+#include "ChromaKey.h"
+#include "FrameFilter.h"
+
+#define PATTERN_GLYPHS 95 // printable ASCII, from space to ~
+
+// what a frame built from the frame source depends on, frames with the same key are identical (but for the frame code)
+struct FrameKey
+{
+	ULONGLONG sourceIndex;
+	ULONGLONG overlayState;
+	UINT revision;
+	GUID format;
+	UINT width;
+	UINT height;
+
+	bool operator==(const FrameKey& other) const
+	{
+		return sourceIndex == other.sourceIndex && overlayState == other.overlayState && revision == other.revision && format == other.format && width == other.width && height == other.height;
+	}
+};
+
 class FrameGenerator
 {
 	UINT _width;
@@ -11,13 +42,83 @@ class FrameGenerator
 	wil::com_ptr_nothrow<ID3D11Texture2D> _texture;
 	wil::com_ptr_nothrow<ID2D1RenderTarget> _renderTarget;
 	wil::com_ptr_nothrow<ID2D1SolidColorBrush> _whiteBrush;
-	wil::com_ptr_nothrow<IDWriteTextFormat> _textFormat;
+	wil::com_ptr_nothrow<ID2D1SolidColorBrush> _blackBrush;
+	wil::com_ptr_nothrow<ID2D1SolidColorBrush> _cellBrush; // recolored for each block of the pattern
 	wil::com_ptr_nothrow<IDWriteFactory> _dwrite;
+	wil::com_ptr_nothrow<IDWriteFontFace> _fontFace;
+	UINT16 _glyphs[PATTERN_GLYPHS];
+	FLOAT _glyphAdvances[PATTERN_GLYPHS];
+	FLOAT _fontAscent;
+	FLOAT _lineHeight;
 	wil::com_ptr_nothrow<IMFTransform> _converter;
+	wil::com_ptr_nothrow<IMFSample> _converterInput; // holds a buffer of the render target's texture
+	bool _converterProvidesSamples; // otherwise it writes to the allocator's samples
+	wil::com_ptr_nothrow<IMFMediaBuffer> _textureBuffer;
 	wil::com_ptr_nothrow<IWICBitmap> _bitmap;
+	TileRasterizer _raster; // replaces Direct2D on the WIC bitmap when there's no GPU
+	bool _rasterize;
+	FrameBuffer _rasterFrame; // the rasterized pattern, RGB32 of the stream's size
+	LONG _rasterStride;
 	wil::com_ptr_nothrow<IMFDXGIDeviceManager> _dxgiManager;
+	wil::com_ptr_nothrow<ID3D11Texture2D> _stagingTexture;
+	std::unique_ptr<FrameSource> _source;
+	MFTIME _sourceStartTime;
+	JpegEncoder _jpeg;
+	FrameBuffer _jpegFrame; // NV12
+	LONG _jpegStride;
+	ColorAdjust _colorAdjust;
+	ColorLut _lut;
+	FrameTransform _transform;
+	FrameBuffer _transformFrame; // source frame or rasterized pattern before it's transformed, RGB32 or NV12
+	OverlayCompositor _overlays;
+	ChromaKey _key;
+	std::unique_ptr<FrameSource> _keyBackground;
+	FrameBuffer _keyFrame; // NV12 background when it can't be read in place, black when there's no background source
+	LONG _keyStride;
+	FrameFilter _filter;
+	FrameStats _stats; // of the last frame
+	bool _frameCode; // frame number & time burnt in
+	bool _frameCrc;
+	UINT _crcs[FRAME_CRC_MAX_PLANES]; // of the last frame
+	UINT _crcCount;
+	bool _dedup; // frames with the same key as the previous one are copied instead of being built again
+	UINT _revision; // incremented when a setting changes how frames look
+	FrameKey _lastKey;
+	bool _hasLastKey;
+	FrameBuffer _dedupFrame; // last repeated frame before the frame code, RGB32 or NV12
+	LONG _dedupStride;
+	bool _hasDedupFrame;
+	bool _dedupStats; // whether the repeated frame had statistics
+	UINT _dedupCrcCount;
+	ULONGLONG _reusedFrames;
+
+	// size of what's drawn or read from the frame source, before the transform
+	UINT ContentWidth() const { return _transform.SwapsSize() ? _height : _width; }
+	UINT ContentHeight() const { return _transform.SwapsSize() ? _width : _height; }
+
+	// the pattern rendered on the GPU comes back to the CPU to be graded or filtered
+	bool ReadsBackPattern() const { return _lut.IsLoaded() || _filter.IsActive(); }
 
 	HRESULT CreateRenderTargetResources(UINT width, UINT height);
+	HRESULT CreatePatternFont();
+	HRESULT CreateRasterGlyphs();
+	HRESULT RenderPattern(REFGUID format, MFTIME time);
+	HRESULT RasterizePattern(PCWSTR text);
+	void FormatPatternText(REFGUID format, PWSTR text);
+	void DrawPatternText(PCWSTR text, UINT width, UINT height);
+	HRESULT ReadRenderTarget(REFGUID format, BYTE* output, LONG outputStride, BYTE* uv, LONG uvStride);
+	HRESULT ConvertPattern(REFGUID format, const BYTE* rgb, LONG rgbStride, BYTE* output, LONG outputStride, BYTE* uv, LONG uvStride);
+	HRESULT FinishPattern(REFGUID format, const BYTE* rgb, LONG rgbStride, BYTE* output, LONG pitch, DWORD length, MFTIME time);
+	D2D1_COLOR_F PatternColor(const D2D1_COLOR_F& color) const;
+	HRESULT CopyTransformedFrame(const SourceFrame& frame, REFGUID format, BYTE* output, LONG pitch, DWORD length);
+	HRESULT KeyFrame(BYTE* y, LONG pitch, BYTE* uv, MFTIME time);
+	HRESULT DrawFrameCode(MFTIME time);
+	HRESULT BurnFrameCode(REFGUID format, BYTE* output, LONG pitch, BYTE* uv, UINT width, UINT height, MFTIME time);
+	HRESULT ChecksumFrame(REFGUID format, const BYTE* output, LONG pitch, UINT width, UINT height);
+	HRESULT SaveDedupFrame(REFGUID format, const BYTE* output, LONG pitch);
+	HRESULT CopyDedupFrame(REFGUID format, BYTE* output, LONG pitch, DWORD length);
+	HRESULT GenerateFromSource(IMFSample* sample, REFGUID format);
+	HRESULT GenerateJpeg(IMFSample* sample);
 
 public:
 	FrameGenerator() :
@@ -26,7 +127,30 @@ public:
 		_frame(0),
 		_fps(0),
 		_deviceHandle(nullptr),
-		_prevTime(MFGetSystemTime())
+		_prevTime(MFGetSystemTime()),
+		_glyphs(),
+		_glyphAdvances(),
+		_fontAscent(0),
+		_lineHeight(0),
+		_converterProvidesSamples(true),
+		_rasterize(false),
+		_rasterStride(0),
+		_sourceStartTime(0),
+		_jpegStride(0),
+		_keyStride(0),
+		_frameCode(false),
+		_frameCrc(false),
+		_crcs(),
+		_crcCount(0),
+		_dedup(false),
+		_revision(0),
+		_lastKey(),
+		_hasLastKey(false),
+		_hasDedupFrame(false),
+		_dedupStride(0),
+		_dedupStats(false),
+		_dedupCrcCount(0),
+		_reusedFrames(0)
 	{
 
 	}
@@ -46,5 +170,35 @@ public:
 	HRESULT SetD3DManager(IUnknown* manager, UINT width, UINT height);
 	const bool HasD3DManager() const;
 	HRESULT EnsureRenderTarget(UINT width, UINT height);
+	HRESULT StartFrameSource(UINT fpsNumerator, UINT fpsDenominator);
+	void StopFrameSource();
+	HRESULT StartJpegEncoder();
+	HRESULT StartColorLut();
+	HRESULT StartOverlays();
+	HRESULT StartChromaKey(UINT fpsNumerator, UINT fpsDenominator);
+	void StartFilter();
+	void StartFrameStats();
+	void StartFrameCode();
+	void StartFrameCrc();
+	HRESULT StartFrameDedup(REFGUID format);
+
+	// ProcAmp values are baked in a copy of the LUT, which takes a while with large cubes, so it can be done outside of the stream's lock
+	// (see MediaStream::SetProcAmp), then the copy is swapped in, and lut gets the previous one
+	void CopyColorLut(ColorLut& lut) const { lut.CopyCube(_lut); }
+	static void BakeColorLut(ColorLut& lut, const ColorAdjust& adjust);
+	void SetProcAmp(const ColorAdjust& adjust, ColorLut& lut);
+
+	void SetRotation(UINT rotation);
+	void SetMirrorFlip(bool mirror, bool flip);
 	HRESULT Generate(IMFSample* sample, REFGUID format, IMFSample** outSample);
+
+	// statistics of the last generated frame, false when it has none (RGB32 or converted on the GPU)
+	bool GetFrameStats(VCAM_FRAME_STATS& stats) const { return _stats.Get(stats); }
+
+	// CRC32C of the planes of the last generated frame, returns 0 when it has none (disabled or converted on the GPU)
+	UINT GetFrameCrcs(UINT crcs[FRAME_CRC_MAX_PLANES]) const
+	{
+		CopyMemory(crcs, _crcs, sizeof(_crcs));
+		return _crcCount;
+	}
 };
\ No newline at end of file
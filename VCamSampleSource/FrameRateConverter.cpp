@@ -0,0 +1,124 @@
+#include "pch.h"
+#include "Tools.h"
+#include "FrameSource.h"
+#include "FrameRateConverter.h"
+
+#define TRACE_FRAMES 300 // counts are traced every n frames served
+
+HRESULT FrameRateConverter::Start(UINT width, UINT height, UINT fpsNumerator, UINT fpsDenominator)
+{
+	RETURN_HR_IF_NULL(E_UNEXPECTED, _source);
+	RETURN_HR_IF(E_INVALIDARG, !fpsNumerator || !fpsDenominator);
+
+	_hasFrame = false;
+	_position = 0;
+	_frames = 0;
+	_duplicates = 0;
+	_drops = 0;
+	if (!_source->GetFrameRate(&_sourceFpsNumerator, &_sourceFpsDenominator) || !_sourceFpsNumerator || !_sourceFpsDenominator)
+	{
+		_sourceFpsNumerator = 0;
+		_sourceFpsDenominator = 0;
+	}
+
+	// a source with its own rate is driven at that rate, the others at the stream's rate
+	WINTRACE(L"FrameRateConverter::Start stream fps:%u/%u source fps:%u/%u", fpsNumerator, fpsDenominator, _sourceFpsNumerator, _sourceFpsDenominator);
+	if (_sourceFpsNumerator)
+		return _source->Start(width, height, _sourceFpsNumerator, _sourceFpsDenominator);
+
+	return _source->Start(width, height, fpsNumerator, fpsDenominator);
+}
+
+HRESULT FrameRateConverter::GetFrame(MFTIME time, REFGUID preferredFormat, SourceFrame* frame)
+{
+	RETURN_HR_IF_NULL(E_POINTER, frame);
+	RETURN_HR_IF_NULL(E_UNEXPECTED, _source);
+
+	if (_sourceFpsNumerator)
+	{
+		// the source frame to show at that time, same as the one we hold means a duplicate, and the source is not even called
+		auto position = (ULONGLONG)std::max<MFTIME>(time, 0) * _sourceFpsNumerator / (_sourceFpsDenominator * 10000000ull);
+		if (_hasFrame && position == _position)
+		{
+			_duplicates++;
+		}
+		else
+		{
+			RETURN_IF_FAILED(_source->GetFrame(time, preferredFormat, &_frame));
+			if (_hasFrame && position > _position + 1)
+			{
+				_drops += position - _position - 1;
+			}
+			_position = position;
+			_hasFrame = true;
+		}
+	}
+	else
+	{
+		// the source decides what the latest frame is (for example an external producer), we only count
+		auto previousIndex = _frame.index;
+		RETURN_IF_FAILED(_source->GetFrame(time, preferredFormat, &_frame));
+		if (_hasFrame)
+		{
+			if (_frame.index == previousIndex)
+			{
+				_duplicates++;
+			}
+			else if (_frame.index > previousIndex + 1)
+			{
+				_drops += _frame.index - previousIndex - 1;
+			}
+		}
+		_hasFrame = true;
+	}
+
+	*frame = _frame;
+	_frames++;
+	if (!(_frames % TRACE_FRAMES))
+	{
+		Trace(L"GetFrame");
+	}
+	return S_OK;
+}
+
+void FrameRateConverter::Stop()
+{
+	Trace(L"Stop");
+	_hasFrame = false;
+	if (_source)
+	{
+		_source->Stop();
+	}
+}
+
+bool FrameRateConverter::GetFrameRate(UINT* numerator, UINT* denominator)
+{
+	// the converter follows the stream's rate
+	UNREFERENCED_PARAMETER(numerator);
+	UNREFERENCED_PARAMETER(denominator);
+	return false;
+}
+
+void FrameRateConverter::GetCounts(ULONGLONG* frames, ULONGLONG* duplicates, ULONGLONG* drops) const
+{
+	if (frames)
+	{
+		*frames = _frames;
+	}
+
+	if (duplicates)
+	{
+		*duplicates = _duplicates;
+	}
+
+	if (drops)
+	{
+		*drops = _drops;
+	}
+}
+
+void FrameRateConverter::Trace(PCWSTR context) const
+{
+	UNREFERENCED_PARAMETER(context);
+	WINTRACE(L"FrameRateConverter::%s frames:%I64u duplicates:%I64u drops:%I64u", context, _frames, _duplicates, _drops);
+}
\ No newline at end of file
@@ -0,0 +1,41 @@
+#pragma once
+
+// serves a source at the stream's rate, whatever the source's own rate
+// the latest source frame is held and served again (duplicated) or skipped (dropped) by reference, pixels are never copied here
+class FrameRateConverter : public FrameSource
+{
+	std::unique_ptr<FrameSource> _source;
+	SourceFrame _frame; // latest source frame
+	bool _hasFrame;
+	UINT _sourceFpsNumerator; // 0 if the source has no rate, duplicates & drops are then detected from frame indices
+	UINT _sourceFpsDenominator;
+	ULONGLONG _position; // source frame number of _frame, computed from time, it doesn't wrap when the source loops
+	ULONGLONG _frames;
+	ULONGLONG _duplicates;
+	ULONGLONG _drops;
+
+	void Trace(PCWSTR context) const;
+
+public:
+	FrameRateConverter(std::unique_ptr<FrameSource> source) :
+		_source(std::move(source)),
+		_frame({}),
+		_hasFrame(false),
+		_sourceFpsNumerator(0),
+		_sourceFpsDenominator(0),
+		_position(0),
+		_frames(0),
+		_duplicates(0),
+		_drops(0)
+	{
+	}
+
+	// counts since Start, frames is the number of frames served
+	void GetCounts(ULONGLONG* frames, ULONGLONG* duplicates, ULONGLONG* drops) const;
+
+	// FrameSource
+	HRESULT Start(UINT width, UINT height, UINT fpsNumerator, UINT fpsDenominator);
+	HRESULT GetFrame(MFTIME time, REFGUID preferredFormat, SourceFrame* frame);
+	void Stop();
+	bool GetFrameRate(UINT* numerator, UINT* denominator);
+};
\ No newline at end of file
@@ -0,0 +1,275 @@
+#pragma once
+
+// Shared memory frame ring, used by external producer processes (see VCamProducer) to feed frames to the media source.
+// This file is shared with the producer library which builds on Windows & POSIX, so it must only depend on the C++ standard library.
+//
+// Memory layout: a FrameRingHeader followed by slotCount slots of slotSize bytes, each slot being a FrameRingSlot followed by pixels.
+// There's one producer & one consumer, and no lock:
+// - the producer writes frames in any slot that is neither the last published one nor the one held by the consumer,
+//   then publishes it by storing (frame number, slot) in the header's "published" index.
+// - the consumer takes the last published slot and holds it by storing its number in the header's "consumerSlot" index,
+//   so it can read the pixels in place (no copy) until it takes another one.
+// - each slot has a sequence counter, odd while the producer writes it, which lets both sides detect the race where the
+//   producer claims a slot at the same time the consumer takes it (both sides store then load, so one always sees the other).
+// The producer can write the whole memory at any time, so the consumer copies the geometry once when it validates the ring
+// (FrameRingLayout) and never reads it from the header again, and the slot indices it reads are checked against its copy.
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <new>
+
+#define FRAME_RING_MAGIC 0x474E5246 // 'FRNG'
+#define FRAME_RING_VERSION 1
+#define FRAME_RING_MAX_SLOTS 8
+#define FRAME_RING_NO_SLOT 0xFFFFFFFF
+#define FRAME_RING_ALIGNMENT 64
+
+// name of the shared memory object, must be global since the consumer runs in a service
+#define FRAME_RING_WINDOWS_NAME L"Global\\VCamSampleFrameRing"
+#define FRAME_RING_POSIX_NAME "/VCamSampleFrameRing"
+
+#define FRAME_RING_FORMAT_BGRA 0x41524742 // 'BGRA'
+#define FRAME_RING_FORMAT_NV12 0x3231564E // 'NV12'
+#define FRAME_RING_FORMAT_I420 0x30323449 // 'I420'
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "64-bit atomics must be lock free to be shared between processes");
+
+struct FrameRingHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t headerSize;
+	uint32_t slotCount;
+	uint32_t slotSize; // FrameRingSlot + pixels, aligned
+	uint32_t format; // FRAME_RING_FORMAT_XXX
+	uint32_t width;
+	uint32_t height;
+	uint32_t stride; // luma (or BGRA) plane stride, chroma planes stride is deduced from it
+	uint32_t fpsNumerator; // producer's nominal frame rate, informational
+	uint32_t fpsDenominator;
+	alignas(FRAME_RING_ALIGNMENT) std::atomic<uint64_t> published; // (frame number << 8) | slot, 0 if nothing was published yet
+	alignas(FRAME_RING_ALIGNMENT) std::atomic<uint32_t> consumerSlot; // slot held by the consumer or FRAME_RING_NO_SLOT
+};
+
+// geometry of a validated ring, as the consumer copied it
+struct FrameRingLayout
+{
+	uint32_t headerSize;
+	uint32_t slotCount;
+	uint32_t slotSize;
+	uint32_t format;
+	uint32_t width;
+	uint32_t height;
+	uint32_t stride;
+};
+
+struct alignas(FRAME_RING_ALIGNMENT) FrameRingSlot
+{
+	std::atomic<uint64_t> sequence; // even when stable, odd while written
+	std::atomic<uint64_t> frameNumber; // 1-based
+	int64_t timestamp; // producer's time in 100ns units
+};
+
+inline uint32_t FrameRingAlign(uint32_t size)
+{
+	return (size + FRAME_RING_ALIGNMENT - 1) & ~(FRAME_RING_ALIGNMENT - 1);
+}
+
+inline uint32_t FrameRingFrameSize(uint32_t format, uint32_t stride, uint32_t height)
+{
+	if (format == FRAME_RING_FORMAT_BGRA)
+		return stride * height;
+
+	return stride * height + stride * (height / 2); // NV12: UV plane has the Y stride, I420: U & V planes have half the Y stride
+}
+
+inline size_t FrameRingSize(uint32_t slotCount, uint32_t slotSize)
+{
+	return FrameRingAlign(sizeof(FrameRingHeader)) + (size_t)slotCount * slotSize;
+}
+
+// initializes a ring in zeroed memory, returns false if parameters are invalid
+inline bool FrameRingInitialize(void* memory, size_t size, uint32_t slotCount, uint32_t format, uint32_t width, uint32_t height, uint32_t fpsNumerator, uint32_t fpsDenominator)
+{
+	if (!memory || slotCount < 3 || slotCount > FRAME_RING_MAX_SLOTS || !width || !height)
+		return false;
+
+	if (format != FRAME_RING_FORMAT_BGRA && format != FRAME_RING_FORMAT_NV12 && format != FRAME_RING_FORMAT_I420)
+		return false;
+
+	if (format != FRAME_RING_FORMAT_BGRA && ((width & 1) || (height & 1)))
+		return false;
+
+	auto stride = FrameRingAlign(format == FRAME_RING_FORMAT_BGRA ? width * 4 : width);
+	auto slotSize = FrameRingAlign(sizeof(FrameRingSlot) + FrameRingFrameSize(format, stride, height));
+	if (FrameRingSize(slotCount, slotSize) > size)
+		return false;
+
+	auto header = new (memory) FrameRingHeader();
+	header->version = FRAME_RING_VERSION;
+	header->headerSize = FrameRingAlign(sizeof(FrameRingHeader));
+	header->slotCount = slotCount;
+	header->slotSize = slotSize;
+	header->format = format;
+	header->width = width;
+	header->height = height;
+	header->stride = stride;
+	header->fpsNumerator = fpsNumerator;
+	header->fpsDenominator = fpsDenominator;
+	header->published.store(0);
+	header->consumerSlot.store(FRAME_RING_NO_SLOT);
+	for (uint32_t i = 0; i < slotCount; i++)
+	{
+		new ((uint8_t*)memory + header->headerSize + (size_t)i * slotSize) FrameRingSlot();
+	}
+
+	// magic is written last so the other side never sees a partially initialized header
+	std::atomic_thread_fence(std::memory_order_release);
+	header->magic = FRAME_RING_MAGIC;
+	return true;
+}
+
+// returns the header if memory contains a valid ring and copies its geometry to layout, nullptr otherwise
+inline FrameRingHeader* FrameRingValidate(void* memory, size_t size, FrameRingLayout* layout = nullptr)
+{
+	if (!memory || size < sizeof(FrameRingHeader))
+		return nullptr;
+
+	auto header = (FrameRingHeader*)memory;
+	if (header->magic != FRAME_RING_MAGIC || header->version != FRAME_RING_VERSION)
+		return nullptr;
+
+	// each field is read once, the checks are made on the copy
+	std::atomic_thread_fence(std::memory_order_acquire);
+	auto source = (const volatile FrameRingHeader*)header;
+	FrameRingLayout copy;
+	copy.headerSize = source->headerSize;
+	copy.slotCount = source->slotCount;
+	copy.slotSize = source->slotSize;
+	copy.format = source->format;
+	copy.width = source->width;
+	copy.height = source->height;
+	copy.stride = source->stride;
+	if (copy.slotCount < 3 || copy.slotCount > FRAME_RING_MAX_SLOTS || copy.headerSize != FrameRingAlign(sizeof(FrameRingHeader)) || copy.slotSize % FRAME_RING_ALIGNMENT)
+		return nullptr;
+
+	if (!copy.width || !copy.height)
+		return nullptr;
+
+	// rows must fit in the stride, chroma rows of I420 in half of it
+	uint64_t frameSize;
+	if (copy.format == FRAME_RING_FORMAT_BGRA)
+	{
+		if (copy.stride < (uint64_t)copy.width * 4)
+			return nullptr;
+
+		frameSize = (uint64_t)copy.stride * copy.height;
+	}
+	else if (copy.format == FRAME_RING_FORMAT_NV12 || copy.format == FRAME_RING_FORMAT_I420)
+	{
+		if ((copy.width & 1) || (copy.height & 1) || copy.stride < copy.width)
+			return nullptr;
+
+		frameSize = (uint64_t)copy.stride * copy.height + (uint64_t)copy.stride * (copy.height / 2);
+	}
+	else
+		return nullptr;
+
+	if (sizeof(FrameRingSlot) + frameSize > copy.slotSize || copy.headerSize + (uint64_t)copy.slotCount * copy.slotSize > size)
+		return nullptr;
+
+	if (layout)
+	{
+		*layout = copy;
+	}
+	return header;
+}
+
+inline FrameRingSlot* FrameRingGetSlot(FrameRingHeader* header, uint32_t slot)
+{
+	return (FrameRingSlot*)((uint8_t*)header + header->headerSize + (size_t)slot * header->slotSize);
+}
+
+// consumer side: same but with the geometry copied by FrameRingValidate
+inline FrameRingSlot* FrameRingGetSlot(FrameRingHeader* header, const FrameRingLayout& layout, uint32_t slot)
+{
+	return (FrameRingSlot*)((uint8_t*)header + layout.headerSize + (size_t)slot * layout.slotSize);
+}
+
+inline uint8_t* FrameRingGetPixels(FrameRingSlot* slot)
+{
+	return (uint8_t*)slot + sizeof(FrameRingSlot);
+}
+
+// producer side: claims a slot to write the next frame, returns FRAME_RING_NO_SLOT if none is available (can't happen with 3+ slots)
+inline uint32_t FrameRingBeginWrite(FrameRingHeader* header, uint32_t previousSlot)
+{
+	auto publishedSlot = (uint32_t)(header->published.load() & 0xFF);
+	auto hasPublished = header->published.load() != 0;
+	for (uint32_t i = 1; i <= header->slotCount; i++)
+	{
+		auto candidate = (previousSlot + i) % header->slotCount;
+		if (hasPublished && candidate == publishedSlot)
+			continue;
+
+		if (header->consumerSlot.load() == candidate)
+			continue;
+
+		// claim: make the sequence odd, then check the consumer didn't take it in between
+		auto slot = FrameRingGetSlot(header, candidate);
+		auto sequence = slot->sequence.load();
+		slot->sequence.store(sequence + 1);
+		if (header->consumerSlot.load() == candidate)
+		{
+			slot->sequence.store(sequence);
+			continue;
+		}
+		return candidate;
+	}
+	return FRAME_RING_NO_SLOT;
+}
+
+// producer side: publishes a slot claimed with FrameRingBeginWrite
+inline void FrameRingEndWrite(FrameRingHeader* header, uint32_t slotIndex, uint64_t frameNumber, int64_t timestamp)
+{
+	auto slot = FrameRingGetSlot(header, slotIndex);
+	slot->frameNumber.store(frameNumber);
+	slot->timestamp = timestamp;
+	slot->sequence.store(slot->sequence.load() + 1); // even again
+	header->published.store((frameNumber << 8) | slotIndex);
+}
+
+// consumer side: takes the last published frame and holds it until the next call or FrameRingRelease
+// returns nullptr if nothing was published yet, if the published slot isn't one of the ring, or if it never becomes stable
+// (a producer that died while writing it, or publishes a frame number the slot doesn't have)
+inline FrameRingSlot* FrameRingAcquire(FrameRingHeader* header, const FrameRingLayout& layout)
+{
+	for (uint32_t retry = 0; retry < layout.slotCount * 4; retry++)
+	{
+		auto published = header->published.load();
+		if (!published)
+			return nullptr;
+
+		auto index = (uint32_t)(published & 0xFF);
+		if (index >= layout.slotCount)
+			return nullptr;
+
+		auto slot = FrameRingGetSlot(header, layout, index);
+		header->consumerSlot.store(index);
+
+		// the producer may have claimed this slot before it saw our store, in this case the sequence is odd or the frame is newer
+		auto sequence = slot->sequence.load();
+		if (!(sequence & 1) && slot->frameNumber.load() == (published >> 8))
+			return slot;
+
+		// a newer frame has been or is being published, take that one
+		header->consumerSlot.store(FRAME_RING_NO_SLOT);
+	}
+	return nullptr;
+}
+
+// consumer side: releases the held slot
+inline void FrameRingRelease(FrameRingHeader* header)
+{
+	header->consumerSlot.store(FRAME_RING_NO_SLOT);
+}
@@ -0,0 +1,89 @@
+#include "pch.h"
+#include "Tools.h"
+#include "Settings.h"
+#include "FrameSource.h"
+#include "FileFrameSource.h"
+#include "FrameRateConverter.h"
+#include "ImageFrameSource.h"
+#include "FrameRing.h"
+#include "RingFrameSource.h"
+#include "FrameBuffer.h"
+#include "PipCompositor.h"
+#include "PipFrameSource.h"
+
+#define PIP_DEFAULT_INSET_WIDTH 320
+#define PIP_DEFAULT_INSET_HEIGHT 180
+
+HRESULT CreateFrameSource(PCWSTR prefix, std::unique_ptr<FrameSource>& source)
+{
+	source.reset();
+	auto setting = [&](PCWSTR name) { return std::wstring(prefix) + name; };
+	auto type = GetSettingString(setting(L"Source").c_str());
+	if (type.empty() || !lstrcmpi(type.c_str(), L"pattern"))
+		return S_OK;
+
+	if (!lstrcmpi(type.c_str(), L"file"))
+	{
+		auto file = std::make_unique<FileFrameSource>();
+		RETURN_IF_FAILED(file->Open(GetSettingString(setting(L"SourcePath").c_str()).c_str(), GetSettingString(setting(L"SourceFormat").c_str()).c_str(), GetSettingDWORD(setting(L"SourceWidth").c_str()), GetSettingDWORD(setting(L"SourceHeight").c_str()), GetSettingDWORD(setting(L"SourceFrameRate").c_str())));
+		source = std::make_unique<FrameRateConverter>(std::move(file));
+		return S_OK;
+	}
+
+	if (!lstrcmpi(type.c_str(), L"image"))
+	{
+		auto image = std::make_unique<ImageFrameSource>();
+		RETURN_IF_FAILED(image->Open(GetSettingString(setting(L"SourcePath").c_str()).c_str()));
+		source = std::move(image);
+		return S_OK;
+	}
+
+	if (!lstrcmpi(type.c_str(), L"ring"))
+	{
+		// the ring name is fixed, so only one source can be a ring
+		auto ring = std::make_unique<RingFrameSource>();
+		RETURN_IF_FAILED(ring->Open(GetSettingString(setting(L"SourceFormat").c_str()).c_str(), GetSettingDWORD(setting(L"SourceWidth").c_str()), GetSettingDWORD(setting(L"SourceHeight").c_str()), GetSettingDWORD(setting(L"RingSlots").c_str())));
+		source = std::make_unique<FrameRateConverter>(std::move(ring));
+		return S_OK;
+	}
+
+	RETURN_HR_MSG(E_INVALIDARG, "Unknown %lsSource type '%ls'", prefix, type.c_str());
+}
+
+HRESULT CreateFrameSource(std::unique_ptr<FrameSource>& source)
+{
+	RETURN_IF_FAILED(CreateFrameSource(L"", source));
+
+	// insets make a picture-in-picture source, where the pattern is drawn on CPU by the compositor
+	std::unique_ptr<PipFrameSource> pip;
+	for (UINT i = 1; i <= PIP_MAX_INSETS; i++)
+	{
+		auto prefix = std::format(L"Inset{}", i);
+		auto setting = [&](PCWSTR name) { return prefix + name; };
+		if (GetSettingString(setting(L"Source").c_str()).empty())
+			continue;
+
+		std::unique_ptr<FrameSource> insetSource;
+		auto hr = CreateFrameSource(prefix.c_str(), insetSource);
+		if (FAILED(hr))
+		{
+			// a bad inset doesn't prevent the main source
+			LOG_HR_MSG(hr, "Inset %u cannot be created, skipped", i);
+			continue;
+		}
+
+		if (!pip)
+		{
+			pip = source ? std::make_unique<PipFrameSource>(std::make_unique<PipSourceAdapter>(std::move(source))) : std::make_unique<PipFrameSource>(std::make_unique<PipPatternSource>());
+		}
+
+		auto inset = insetSource ? std::unique_ptr<PipSource>(std::make_unique<PipSourceAdapter>(std::move(insetSource))) : std::unique_ptr<PipSource>(std::make_unique<PipPatternSource>());
+		LOG_IF_FAILED(pip->AddInset(std::move(inset), (LONG)GetSettingDWORD(setting(L"X").c_str()), (LONG)GetSettingDWORD(setting(L"Y").c_str()), GetSettingDWORD(setting(L"Width").c_str(), PIP_DEFAULT_INSET_WIDTH), GetSettingDWORD(setting(L"Height").c_str(), PIP_DEFAULT_INSET_HEIGHT)));
+	}
+
+	if (pip)
+	{
+		source = std::move(pip);
+	}
+	return S_OK;
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+// a frame served by a frame source
+// memory is owned by the source and stays valid until the next GetFrame call or until the source is stopped
+struct SourceFrame
+{
+	GUID format; // MFVideoFormat_RGB32, MFVideoFormat_NV12 or MFVideoFormat_I420
+	UINT width;
+	UINT height;
+	const BYTE* planes[3];
+	LONG strides[3];
+	ULONGLONG index; // frame number in the source, same index means same content
+};
+
+class FrameSource
+{
+public:
+	virtual ~FrameSource() {}
+
+	// called when the stream starts, with the stream's frame size and negotiated frame rate
+	virtual HRESULT Start(UINT width, UINT height, UINT fpsNumerator, UINT fpsDenominator) = 0;
+
+	// time is relative to Start, in 100ns units. preferredFormat is the stream's output format, a source may ignore it
+	virtual HRESULT GetFrame(MFTIME time, REFGUID preferredFormat, SourceFrame* frame) = 0;
+	virtual void Stop() = 0;
+
+	// the rate the source content was produced at, returns false if the source has none and just follows the stream's rate
+	virtual bool GetFrameRate(UINT* numerator, UINT* denominator)
+	{
+		UNREFERENCED_PARAMETER(numerator);
+		UNREFERENCED_PARAMETER(denominator);
+		return false;
+	}
+};
+
+// creates the frame source configured in settings, returns S_OK and an empty source if the synthetic pattern must be used
+HRESULT CreateFrameSource(std::unique_ptr<FrameSource>& source);
+
+// same for the source configured by the settings that start with prefix (for example BackgroundSource, BackgroundSourcePath, etc.), without insets
+HRESULT CreateFrameSource(PCWSTR prefix, std::unique_ptr<FrameSource>& source);
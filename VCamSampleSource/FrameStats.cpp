@@ -0,0 +1,259 @@
+#include "pch.h"
+#include "Tools.h"
+#include "Settings.h"
+#include "FrameStats.h"
+
+#define STATS_BAND_ROWS 32 // rows counted per parallel task by Gather
+
+// 4 histograms for luma & 2 for each chroma channel, consecutive samples increment different counters so they don't wait on each other's store
+struct BandHistograms
+{
+	UINT y[4][256];
+	UINT u[2][256];
+	UINT v[2][256];
+};
+
+static void CountLuma(const BYTE* row, UINT width, BandHistograms& counts)
+{
+	UINT w = 0;
+	for (; w + 8 <= width; w += 8)
+	{
+		UINT64 bytes;
+		memcpy(&bytes, row + w, sizeof(bytes));
+		counts.y[0][(BYTE)bytes]++;
+		counts.y[1][(BYTE)(bytes >> 8)]++;
+		counts.y[2][(BYTE)(bytes >> 16)]++;
+		counts.y[3][(BYTE)(bytes >> 24)]++;
+		counts.y[0][(BYTE)(bytes >> 32)]++;
+		counts.y[1][(BYTE)(bytes >> 40)]++;
+		counts.y[2][(BYTE)(bytes >> 48)]++;
+		counts.y[3][(BYTE)(bytes >> 56)]++;
+	}
+
+	for (; w < width; w++)
+	{
+		counts.y[0][row[w]]++;
+	}
+}
+
+// interleaved U & V, width is in luma pixels so there are width / 2 pairs
+static void CountChroma(const BYTE* row, UINT width, BandHistograms& counts)
+{
+	UINT w = 0;
+	for (; w + 8 <= width; w += 8)
+	{
+		UINT64 bytes;
+		memcpy(&bytes, row + w, sizeof(bytes));
+		counts.u[0][(BYTE)bytes]++;
+		counts.v[0][(BYTE)(bytes >> 8)]++;
+		counts.u[1][(BYTE)(bytes >> 16)]++;
+		counts.v[1][(BYTE)(bytes >> 24)]++;
+		counts.u[0][(BYTE)(bytes >> 32)]++;
+		counts.v[0][(BYTE)(bytes >> 40)]++;
+		counts.u[1][(BYTE)(bytes >> 48)]++;
+		counts.v[1][(BYTE)(bytes >> 56)]++;
+	}
+
+	for (; w + 1 < width; w += 2)
+	{
+		counts.u[0][row[w]]++;
+		counts.v[0][row[w + 1]]++;
+	}
+}
+
+// one row of each I420 chroma plane, width is in luma pixels so there are width / 2 samples in each
+static void CountPlanarChroma(const BYTE* rowU, const BYTE* rowV, UINT width, BandHistograms& counts)
+{
+	auto samples = width / 2;
+	UINT w = 0;
+	for (; w + 8 <= samples; w += 8)
+	{
+		UINT64 bytesU;
+		UINT64 bytesV;
+		memcpy(&bytesU, rowU + w, sizeof(bytesU));
+		memcpy(&bytesV, rowV + w, sizeof(bytesV));
+		for (UINT i = 0; i < 64; i += 16)
+		{
+			counts.u[0][(BYTE)(bytesU >> i)]++;
+			counts.v[0][(BYTE)(bytesV >> i)]++;
+			counts.u[1][(BYTE)(bytesU >> (i + 8))]++;
+			counts.v[1][(BYTE)(bytesV >> (i + 8))]++;
+		}
+	}
+
+	for (; w < samples; w++)
+	{
+		counts.u[0][rowU[w]]++;
+		counts.v[0][rowV[w]]++;
+	}
+}
+
+void FrameStats::Load()
+{
+	_enabled = GetSettingDWORD(L"FrameStats", 1) != 0;
+	_valid = false;
+}
+
+void FrameStats::Begin(UINT width, UINT height)
+{
+	_valid = _enabled;
+	if (!_valid)
+		return;
+
+	_width = width;
+	_height = height;
+	ZeroMemory(_histograms, sizeof(_histograms));
+}
+
+void FrameStats::AddFill(UINT pixels)
+{
+	if (!_valid)
+		return;
+
+	winrt::slim_lock_guard lock(_lock);
+	_histograms[0][16] += pixels;
+	_histograms[1][128] += pixels / 4;
+	_histograms[2][128] += pixels / 4;
+}
+
+void FrameStats::Add(const BYTE* y, LONG yStride, const BYTE* uv, LONG uvStride, UINT width, UINT height)
+{
+	if (!_valid)
+		return;
+
+	BandHistograms counts{};
+	for (UINT h = 0; h < height; h++)
+	{
+		CountLuma(y + (ptrdiff_t)h * yStride, width, counts);
+	}
+
+	for (UINT h = 0; h < height / 2; h++)
+	{
+		CountChroma(uv + (ptrdiff_t)h * uvStride, width, counts);
+	}
+	Merge(counts);
+}
+
+void FrameStats::Add(const BYTE* y, LONG yStride, const BYTE* u, const BYTE* v, LONG uvStride, UINT width, UINT height)
+{
+	if (!_valid)
+		return;
+
+	BandHistograms counts{};
+	for (UINT h = 0; h < height; h++)
+	{
+		CountLuma(y + (ptrdiff_t)h * yStride, width, counts);
+	}
+
+	for (UINT h = 0; h < height / 2; h++)
+	{
+		CountPlanarChroma(u + (ptrdiff_t)h * uvStride, v + (ptrdiff_t)h * uvStride, width, counts);
+	}
+	Merge(counts);
+}
+
+void FrameStats::Merge(const BandHistograms& counts)
+{
+	winrt::slim_lock_guard lock(_lock);
+	for (UINT i = 0; i < 256; i++)
+	{
+		_histograms[0][i] += counts.y[0][i] + counts.y[1][i] + counts.y[2][i] + counts.y[3][i];
+		_histograms[1][i] += counts.u[0][i] + counts.u[1][i];
+		_histograms[2][i] += counts.v[0][i] + counts.v[1][i];
+	}
+}
+
+HRESULT FrameStats::Gather(const BYTE* y, LONG yStride, const BYTE* uv, LONG uvStride, UINT width, UINT height)
+{
+	Begin(width, height);
+	if (!_valid)
+		return S_OK;
+
+	auto hr = ForEachBand(height, STATS_BAND_ROWS, [&](UINT top, UINT bottom)
+		{
+			Add(y + (ptrdiff_t)top * yStride, yStride, uv + (ptrdiff_t)(top / 2) * uvStride, uvStride, width, bottom - top);
+		});
+	if (FAILED(hr))
+	{
+		_valid = false;
+	}
+	return hr;
+}
+
+HRESULT FrameStats::Gather(const BYTE* y, LONG yStride, const BYTE* u, const BYTE* v, LONG uvStride, UINT width, UINT height)
+{
+	Begin(width, height);
+	if (!_valid)
+		return S_OK;
+
+	auto hr = ForEachBand(height, STATS_BAND_ROWS, [&](UINT top, UINT bottom)
+		{
+			auto offset = (ptrdiff_t)(top / 2) * uvStride;
+			Add(y + (ptrdiff_t)top * yStride, yStride, u + offset, v + offset, uvStride, width, bottom - top);
+		});
+	if (FAILED(hr))
+	{
+		_valid = false;
+	}
+	return hr;
+}
+
+bool FrameStats::Get(VCAM_FRAME_STATS& stats) const
+{
+	if (!_valid)
+		return false;
+
+	ZeroMemory(&stats, sizeof(stats));
+	stats.size = sizeof(stats);
+	stats.width = _width;
+	stats.height = _height;
+	CopyMemory(stats.histogram, _histograms[0], sizeof(stats.histogram));
+	for (UINT c = 0; c < 3; c++)
+	{
+		auto& histogram = _histograms[c];
+		UINT count = 0;
+		ULONGLONG sum = 0;
+		stats.minimum[c] = 255;
+		for (UINT i = 0; i < 256; i++)
+		{
+			if (!histogram[i])
+				continue;
+
+			stats.minimum[c] = std::min<BYTE>(stats.minimum[c], (BYTE)i);
+			stats.maximum[c] = (BYTE)i;
+			count += histogram[i];
+			sum += (ULONGLONG)histogram[i] * i;
+		}
+
+		if (!count)
+			return false;
+
+		stats.mean[c] = (float)((double)sum / count);
+		if (c == 0)
+		{
+			stats.pixels = count;
+			for (UINT i = 0; i <= FRAME_STATS_BLACK; i++)
+			{
+				stats.clippedBlack += histogram[i];
+			}
+
+			for (UINT i = FRAME_STATS_WHITE; i < 256; i++)
+			{
+				stats.clippedWhite += histogram[i];
+			}
+		}
+		else
+		{
+			for (UINT i = 0; i <= FRAME_STATS_CHROMA_MIN; i++)
+			{
+				stats.clippedChroma += histogram[i];
+			}
+
+			for (UINT i = FRAME_STATS_CHROMA_MAX; i < 256; i++)
+			{
+				stats.clippedChroma += histogram[i];
+			}
+		}
+	}
+	return true;
+}
\ No newline at end of file
@@ -0,0 +1,80 @@
+#pragma once
+
+#define FRAME_STATS_BLACK 16 // luma at or below is clipped black
+#define FRAME_STATS_WHITE 235 // luma at or above is clipped white
+#define FRAME_STATS_CHROMA_MIN 16
+#define FRAME_STATS_CHROMA_MAX 240
+
+// blob of a VCAM_FRAME_STATS structure, set on NV12 & MJPG output samples when the frame went through the CPU
+// {30AC0378-00D9-499F-B505-11B8034D9C7F}
+DEFINE_GUID(MFSampleExtension_VCamFrameStats, 0x30ac0378, 0x00d9, 0x499f, 0xb5, 0x05, 0x11, 0xb8, 0x03, 0x4d, 0x9c, 0x7f);
+
+// statistics of the camera content (source or pattern, after ProcAmp & LUT, before chroma key, filter & overlays)
+struct VCAM_FRAME_STATS
+{
+	UINT size; // of the structure
+	UINT width; // of the counted frame, before rotation
+	UINT height;
+	UINT pixels; // luma samples, width * height
+	BYTE minimum[3]; // Y, U, V
+	BYTE maximum[3];
+	float mean[3];
+	UINT clippedBlack; // luma samples at or below FRAME_STATS_BLACK
+	UINT clippedWhite; // luma samples at or above FRAME_STATS_WHITE
+	UINT clippedChroma; // U & V samples at or outside FRAME_STATS_CHROMA_MIN & FRAME_STATS_CHROMA_MAX
+	UINT histogram[256]; // luma
+};
+
+struct BandHistograms;
+
+// gathers histograms of the Y, U & V planes of NV12 (or I420) frames, band by band while they're converted, so rows are counted while still in cache
+// minimum, maximum, mean & clipped counts are all derived from the histograms, once per frame
+class FrameStats
+{
+	bool _enabled;
+	bool _valid;
+	UINT _width;
+	UINT _height;
+	UINT _histograms[3][256]; // Y, U, V
+	winrt::slim_mutex _lock; // bands are merged from parallel tasks
+
+	void Merge(const BandHistograms& counts);
+
+public:
+	FrameStats() :
+		_enabled(false),
+		_valid(false),
+		_width(0),
+		_height(0),
+		_histograms()
+	{
+	}
+
+	// reads the FrameStats setting
+	void Load();
+	bool IsEnabled() const { return _enabled; }
+
+	// starts a frame, all calls do nothing when disabled
+	void Begin(UINT width, UINT height);
+	void Invalidate() { _valid = false; }
+	bool IsValid() const { return _valid; }
+
+	// the frame is identical to the last one, so are its statistics
+	void Repeat() { _valid = _enabled; }
+
+	// counts black pixels around a smaller content (4 luma samples for each U & V sample)
+	void AddFill(UINT pixels);
+
+	// counts a band of NV12 rows, uv points to the band's first chroma row, thread safe
+	void Add(const BYTE* y, LONG yStride, const BYTE* uv, LONG uvStride, UINT width, UINT height);
+
+	// same for I420 rows, u & v point to the band's first rows of their planes, which share a stride
+	void Add(const BYTE* y, LONG yStride, const BYTE* u, const BYTE* v, LONG uvStride, UINT width, UINT height);
+
+	// starts a frame & counts all of it, for frames that went through no conversion
+	HRESULT Gather(const BYTE* y, LONG yStride, const BYTE* uv, LONG uvStride, UINT width, UINT height);
+	HRESULT Gather(const BYTE* y, LONG yStride, const BYTE* u, const BYTE* v, LONG uvStride, UINT width, UINT height);
+
+	// false when the last frame has no statistics
+	bool Get(VCAM_FRAME_STATS& stats) const;
+};
\ No newline at end of file
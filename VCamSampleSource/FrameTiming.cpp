@@ -0,0 +1,167 @@
+#include "FrameTiming.h"
+#include <cstdio>
+#include <algorithm>
+
+static const char* const _stageNames[(int)FrameStage::Count] = { "AllocateSample", "Generate", "SetAttributes", "QueueEvent", "RequestSample" };
+
+const char* GetFrameStageName(FrameStage stage)
+{
+	return stage < FrameStage::Count ? _stageNames[(int)stage] : "?";
+}
+
+// 0 to 3us have a bucket each, then 4 buckets per power of 2
+static uint32_t GetBucket(uint64_t us)
+{
+	if (us < FRAME_TIMING_SUB_BUCKETS)
+		return (uint32_t)us;
+
+	uint32_t octave = 0;
+	for (auto value = us; value > 1; value >>= 1)
+	{
+		octave++;
+	}
+	auto sub = (uint32_t)(us >> (octave - 2)) & (FRAME_TIMING_SUB_BUCKETS - 1);
+	return std::min<uint32_t>((octave - 1) * FRAME_TIMING_SUB_BUCKETS + sub, FRAME_TIMING_BUCKETS - 1);
+}
+
+static uint64_t GetBucketLowerBound(uint32_t bucket)
+{
+	if (bucket < FRAME_TIMING_SUB_BUCKETS)
+		return bucket;
+
+	auto octave = bucket / FRAME_TIMING_SUB_BUCKETS + 1;
+	return (uint64_t)(FRAME_TIMING_SUB_BUCKETS + bucket % FRAME_TIMING_SUB_BUCKETS) << (octave - 2);
+}
+
+void FrameTimingHistogram::Reset()
+{
+	for (auto& bucket : _buckets)
+	{
+		bucket.store(0, std::memory_order_relaxed);
+	}
+	_count.store(0, std::memory_order_relaxed);
+	_sum.store(0, std::memory_order_relaxed);
+	_maximum.store(0, std::memory_order_relaxed);
+	_overBudget.store(0, std::memory_order_relaxed);
+}
+
+void FrameTimingHistogram::Add(uint64_t us, uint64_t budgetUs)
+{
+	_buckets[GetBucket(us)].fetch_add(1, std::memory_order_relaxed);
+	_count.fetch_add(1, std::memory_order_relaxed);
+	_sum.fetch_add(us, std::memory_order_relaxed);
+	if (budgetUs && us > budgetUs)
+	{
+		_overBudget.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	auto maximum = _maximum.load(std::memory_order_relaxed);
+	while (us > maximum && !_maximum.compare_exchange_weak(maximum, us, std::memory_order_relaxed))
+	{
+	}
+}
+
+uint64_t FrameTimingHistogram::GetMean() const
+{
+	auto count = GetCount();
+	return count ? _sum.load(std::memory_order_relaxed) / count : 0;
+}
+
+uint64_t FrameTimingHistogram::GetPercentile(double percentile) const
+{
+	// buckets are read one by one while frames may be added, so the total is what the buckets add up to
+	uint32_t counts[FRAME_TIMING_BUCKETS];
+	uint64_t total = 0;
+	for (uint32_t i = 0; i < FRAME_TIMING_BUCKETS; i++)
+	{
+		counts[i] = _buckets[i].load(std::memory_order_relaxed);
+		total += counts[i];
+	}
+
+	if (!total)
+		return 0;
+
+	auto rank = (uint64_t)(std::min(std::max(percentile, 0.0), 100.0) * total / 100);
+	uint64_t seen = 0;
+	for (uint32_t i = 0; i < FRAME_TIMING_BUCKETS; i++)
+	{
+		seen += counts[i];
+		if (seen > rank)
+			return GetBucketLowerBound(i);
+	}
+	return GetMaximum();
+}
+
+void FrameTiming::Reset(uint64_t budgetUs, uint64_t traceFirstFrame, uint32_t traceFrames)
+{
+	for (auto& histogram : _histograms)
+	{
+		histogram.Reset();
+	}
+	_budgetUs = budgetUs;
+	_frame = 0;
+	_traceFirstFrame = traceFirstFrame;
+	_traceFrames = std::min<uint32_t>(traceFrames, FRAME_TIMING_MAX_TRACE_FRAMES);
+	_recorded = 0;
+	_current = nullptr;
+
+	// allocated once, so recording allocates nothing per frame
+	_records.reset(_traceFrames ? new FrameTimingRecord[_traceFrames] : nullptr);
+}
+
+void FrameTiming::BeginFrame()
+{
+	_current = nullptr;
+	if (_frame >= _traceFirstFrame && _recorded < _traceFrames)
+	{
+		_current = &_records[_recorded];
+		*_current = {};
+		_current->frame = _frame;
+	}
+}
+
+void FrameTiming::AddStage(FrameStage stage, Clock::time_point start, Clock::time_point end)
+{
+	auto duration = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+	_histograms[(int)stage].Add((uint64_t)std::max<int64_t>(duration, 0) / 1000, _budgetUs);
+	if (_current)
+	{
+		_current->starts[(int)stage] = std::chrono::duration_cast<std::chrono::nanoseconds>(start.time_since_epoch()).count();
+		_current->durations[(int)stage] = duration;
+	}
+}
+
+void FrameTiming::EndFrame(Clock::time_point start)
+{
+	AddStage(FrameStage::Request, start, Clock::now());
+	if (_current)
+	{
+		_recorded++;
+		_current = nullptr;
+	}
+	_frame++;
+}
+
+std::string FrameTiming::GetChromeTrace(uint32_t pid, uint32_t tid, const char* name) const
+{
+	// complete ("X") events in microseconds, each stage nested in its request
+	std::string json = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+	char event[256];
+	snprintf(event, sizeof(event), "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%u,\"tid\":%u,\"args\":{\"name\":\"%s\"}}", pid, tid, name ? name : "");
+	json += event;
+	for (uint32_t i = 0; i < _recorded; i++)
+	{
+		auto& record = _records[i];
+		for (int stage = 0; stage < (int)FrameStage::Count; stage++)
+		{
+			if (!record.starts[stage])
+				continue;
+
+			snprintf(event, sizeof(event), ",\n{\"name\":\"%s\",\"cat\":\"frame\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%u,\"tid\":%u,\"args\":{\"frame\":%llu}}",
+				_stageNames[stage], record.starts[stage] / 1000.0, record.durations[stage] / 1000.0, pid, tid, (unsigned long long)record.frame);
+			json += event;
+		}
+	}
+	json += "\n]}\n";
+	return json;
+}
\ No newline at end of file
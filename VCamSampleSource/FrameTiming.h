@@ -0,0 +1,144 @@
+#pragma once
+
+// Per-stream timing of the stages of each sample request, to find which stage blew the frame budget when frames stutter.
+// Durations go to lock-free histograms that can be read while frames are timed, and a window of frames can be recorded & exported as
+// Chrome trace-event JSON (chrome://tracing, ui.perfetto.dev).
+#include <cstdint>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+
+#define FRAME_TIMING_SUB_BUCKETS 4 // per power of 2, so a bucket is at most 25% wide
+#define FRAME_TIMING_BUCKETS 100 // 1us to 33s
+#define FRAME_TIMING_MAX_TRACE_FRAMES 36000
+
+enum class FrameStage
+{
+	Allocate, // AllocateSample
+	Generate,
+	Attributes, // SetUnknown & the other sample attributes
+	Queue, // QueueEventParamUnk
+	Request, // the whole request
+	Count,
+};
+
+const char* GetFrameStageName(FrameStage stage);
+
+// durations in microseconds, in log-linear buckets
+class FrameTimingHistogram
+{
+	std::atomic<uint32_t> _buckets[FRAME_TIMING_BUCKETS];
+	std::atomic<uint64_t> _count;
+	std::atomic<uint64_t> _sum;
+	std::atomic<uint64_t> _maximum;
+	std::atomic<uint64_t> _overBudget;
+
+public:
+	FrameTimingHistogram() { Reset(); }
+
+	void Reset();
+	void Add(uint64_t us, uint64_t budgetUs);
+	uint64_t GetCount() const { return _count.load(std::memory_order_relaxed); }
+	uint64_t GetMean() const;
+	uint64_t GetMaximum() const { return _maximum.load(std::memory_order_relaxed); }
+	uint64_t GetOverBudget() const { return _overBudget.load(std::memory_order_relaxed); }
+
+	// lower bound of the bucket holding that percentile (0 to 100)
+	uint64_t GetPercentile(double percentile) const;
+};
+
+struct FrameTimingRecord
+{
+	uint64_t frame;
+	int64_t starts[(int)FrameStage::Count]; // ns of the steady clock, 0 when the stage didn't run
+	int64_t durations[(int)FrameStage::Count];
+};
+
+// one per stream, frames are timed from one thread at a time (the stream's lock), histograms can be read from any thread
+class FrameTiming
+{
+	FrameTimingHistogram _histograms[(int)FrameStage::Count];
+	uint64_t _budgetUs;
+	uint64_t _frame;
+	std::unique_ptr<FrameTimingRecord[]> _records;
+	uint64_t _traceFirstFrame;
+	uint32_t _traceFrames;
+	uint32_t _recorded;
+	FrameTimingRecord* _current; // record of the frame being timed, if it's in the window
+
+public:
+	using Clock = std::chrono::steady_clock;
+
+	FrameTiming() :
+		_budgetUs(0),
+		_frame(0),
+		_traceFirstFrame(0),
+		_traceFrames(0),
+		_recorded(0),
+		_current(nullptr)
+	{
+	}
+
+	// budgetUs is the frame duration, traceFrames frames from traceFirstFrame (counted from 0 at each reset) are recorded for the trace
+	void Reset(uint64_t budgetUs, uint64_t traceFirstFrame = 0, uint32_t traceFrames = 0);
+
+	void BeginFrame();
+	void AddStage(FrameStage stage, Clock::time_point start, Clock::time_point end);
+	void EndFrame(Clock::time_point start);
+
+	const FrameTimingHistogram& GetHistogram(FrameStage stage) const { return _histograms[(int)stage]; }
+	uint64_t GetFrameCount() const { return _frame; }
+	uint32_t GetRecordedFrames() const { return _recorded; }
+	bool IsTraceComplete() const { return _traceFrames && _recorded == _traceFrames; }
+
+	// trace events of the recorded frames, pid & tid group them in the viewer, name labels the tid
+	std::string GetChromeTrace(uint32_t pid, uint32_t tid, const char* name) const;
+};
+
+// times a whole request until it goes out of scope, stages are timed inside it
+class FrameRequestTimer
+{
+	FrameTiming& _timing;
+	FrameTiming::Clock::time_point _start;
+
+public:
+	FrameRequestTimer(FrameTiming& timing) :
+		_timing(timing),
+		_start(FrameTiming::Clock::now())
+	{
+		_timing.BeginFrame();
+	}
+
+	~FrameRequestTimer()
+	{
+		_timing.EndFrame(_start);
+	}
+
+	FrameRequestTimer(const FrameRequestTimer&) = delete;
+	FrameRequestTimer& operator=(const FrameRequestTimer&) = delete;
+};
+
+// times a stage until it goes out of scope
+class FrameStageTimer
+{
+	FrameTiming& _timing;
+	FrameStage _stage;
+	FrameTiming::Clock::time_point _start;
+
+public:
+	FrameStageTimer(FrameTiming& timing, FrameStage stage) :
+		_timing(timing),
+		_stage(stage),
+		_start(FrameTiming::Clock::now())
+	{
+	}
+
+	~FrameStageTimer()
+	{
+		_timing.AddStage(_stage, _start, FrameTiming::Clock::now());
+	}
+
+	FrameStageTimer(const FrameStageTimer&) = delete;
+	FrameStageTimer& operator=(const FrameStageTimer&) = delete;
+};
\ No newline at end of file
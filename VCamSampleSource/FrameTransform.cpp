@@ -0,0 +1,356 @@
+#include "pch.h"
+#include "Tools.h"
+#include "FrameTransform.h"
+
+#if defined(_M_IX86) || defined(_M_X64)
+#define TRANSFORM_SSE
+#endif
+
+#define TRANSFORM_TILE 64 // elements, tiles are transposed while they're in the cache
+#define TRANSFORM_BAND_ROWS 32 // rows copied per parallel task
+
+// 8 x 8 blocks for bytes & 16-bit elements, 4 x 4 for 32-bit, so a block row is at most a register
+template<typename T> constexpr UINT BlockSize()
+{
+	return sizeof(T) == 4 ? 4 : 8;
+}
+
+template<typename T> static inline T* Element(BYTE* plane, LONG stride, UINT x, UINT y)
+{
+	return (T*)(plane + (ptrdiff_t)y * stride) + x;
+}
+
+template<typename T> static inline const T* Element(const BYTE* plane, LONG stride, UINT x, UINT y)
+{
+	return (const T*)(plane + (ptrdiff_t)y * stride) + x;
+}
+
+#if defined(TRANSFORM_SSE)
+// reverses the elements of a register
+static inline __m128i Reverse(__m128i v, UINT)
+{
+	return _mm_shuffle_epi32(v, _MM_SHUFFLE(0, 1, 2, 3));
+}
+
+static inline __m128i Reverse(__m128i v, USHORT)
+{
+	v = _mm_shufflelo_epi16(v, _MM_SHUFFLE(0, 1, 2, 3));
+	v = _mm_shufflehi_epi16(v, _MM_SHUFFLE(0, 1, 2, 3));
+	return _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2));
+}
+
+static inline __m128i Reverse(__m128i v, BYTE)
+{
+	return Reverse(_mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8)), USHORT());
+}
+
+static inline void TransposeBlock(BYTE, const BYTE* input, LONG inputStride, BYTE* output, LONG outputStride)
+{
+	__m128i r[8];
+	for (UINT i = 0; i < 8; i++)
+	{
+		r[i] = _mm_loadl_epi64((const __m128i*)(input + (ptrdiff_t)i * inputStride));
+	}
+
+	auto a0 = _mm_unpacklo_epi8(r[0], r[1]);
+	auto a1 = _mm_unpacklo_epi8(r[2], r[3]);
+	auto a2 = _mm_unpacklo_epi8(r[4], r[5]);
+	auto a3 = _mm_unpacklo_epi8(r[6], r[7]);
+	auto b0 = _mm_unpacklo_epi16(a0, a1);
+	auto b1 = _mm_unpackhi_epi16(a0, a1);
+	auto b2 = _mm_unpacklo_epi16(a2, a3);
+	auto b3 = _mm_unpackhi_epi16(a2, a3);
+	__m128i c[4] = { _mm_unpacklo_epi32(b0, b2), _mm_unpackhi_epi32(b0, b2), _mm_unpacklo_epi32(b1, b3), _mm_unpackhi_epi32(b1, b3) };
+	for (UINT i = 0; i < 4; i++)
+	{
+		_mm_storel_epi64((__m128i*)(output + (ptrdiff_t)(i * 2) * outputStride), c[i]);
+		_mm_storel_epi64((__m128i*)(output + (ptrdiff_t)(i * 2 + 1) * outputStride), _mm_unpackhi_epi64(c[i], c[i]));
+	}
+}
+
+static inline void TransposeBlock(USHORT, const BYTE* input, LONG inputStride, BYTE* output, LONG outputStride)
+{
+	__m128i r[8];
+	for (UINT i = 0; i < 8; i++)
+	{
+		r[i] = _mm_loadu_si128((const __m128i*)(input + (ptrdiff_t)i * inputStride));
+	}
+
+	auto a0 = _mm_unpacklo_epi16(r[0], r[1]);
+	auto a1 = _mm_unpackhi_epi16(r[0], r[1]);
+	auto a2 = _mm_unpacklo_epi16(r[2], r[3]);
+	auto a3 = _mm_unpackhi_epi16(r[2], r[3]);
+	auto a4 = _mm_unpacklo_epi16(r[4], r[5]);
+	auto a5 = _mm_unpackhi_epi16(r[4], r[5]);
+	auto a6 = _mm_unpacklo_epi16(r[6], r[7]);
+	auto a7 = _mm_unpackhi_epi16(r[6], r[7]);
+	auto b0 = _mm_unpacklo_epi32(a0, a2);
+	auto b1 = _mm_unpackhi_epi32(a0, a2);
+	auto b2 = _mm_unpacklo_epi32(a1, a3);
+	auto b3 = _mm_unpackhi_epi32(a1, a3);
+	auto b4 = _mm_unpacklo_epi32(a4, a6);
+	auto b5 = _mm_unpackhi_epi32(a4, a6);
+	auto b6 = _mm_unpacklo_epi32(a5, a7);
+	auto b7 = _mm_unpackhi_epi32(a5, a7);
+	__m128i c[8] =
+	{
+		_mm_unpacklo_epi64(b0, b4), _mm_unpackhi_epi64(b0, b4), _mm_unpacklo_epi64(b1, b5), _mm_unpackhi_epi64(b1, b5),
+		_mm_unpacklo_epi64(b2, b6), _mm_unpackhi_epi64(b2, b6), _mm_unpacklo_epi64(b3, b7), _mm_unpackhi_epi64(b3, b7)
+	};
+	for (UINT i = 0; i < 8; i++)
+	{
+		_mm_storeu_si128((__m128i*)(output + (ptrdiff_t)i * outputStride), c[i]);
+	}
+}
+
+static inline void TransposeBlock(UINT, const BYTE* input, LONG inputStride, BYTE* output, LONG outputStride)
+{
+	auto r0 = _mm_loadu_si128((const __m128i*)input);
+	auto r1 = _mm_loadu_si128((const __m128i*)(input + inputStride));
+	auto r2 = _mm_loadu_si128((const __m128i*)(input + (ptrdiff_t)2 * inputStride));
+	auto r3 = _mm_loadu_si128((const __m128i*)(input + (ptrdiff_t)3 * inputStride));
+	auto t0 = _mm_unpacklo_epi32(r0, r1);
+	auto t1 = _mm_unpacklo_epi32(r2, r3);
+	auto t2 = _mm_unpackhi_epi32(r0, r1);
+	auto t3 = _mm_unpackhi_epi32(r2, r3);
+	_mm_storeu_si128((__m128i*)output, _mm_unpacklo_epi64(t0, t1));
+	_mm_storeu_si128((__m128i*)(output + outputStride), _mm_unpackhi_epi64(t0, t1));
+	_mm_storeu_si128((__m128i*)(output + (ptrdiff_t)2 * outputStride), _mm_unpacklo_epi64(t2, t3));
+	_mm_storeu_si128((__m128i*)(output + (ptrdiff_t)3 * outputStride), _mm_unpackhi_epi64(t2, t3));
+}
+#else
+template<typename T> static inline void TransposeBlock(T, const BYTE* input, LONG inputStride, BYTE* output, LONG outputStride)
+{
+	const auto size = BlockSize<T>();
+	for (UINT y = 0; y < size; y++)
+	{
+		for (UINT x = 0; x < size; x++)
+		{
+			*Element<T>(output, outputStride, y, x) = *Element<T>(input, inputStride, x, y);
+		}
+	}
+}
+#endif
+
+// copies a row of elements in reverse order
+template<typename T> static void ReverseRow(const T* input, T* output, UINT width)
+{
+	UINT x = 0;
+#if defined(TRANSFORM_SSE)
+	const UINT count = 16 / sizeof(T);
+	for (; x + count <= width; x += count)
+	{
+		auto v = _mm_loadu_si128((const __m128i*)(input + width - x - count));
+		_mm_storeu_si128((__m128i*)(output + x), Reverse(v, T()));
+	}
+#endif
+	for (; x < width; x++)
+	{
+		output[x] = input[width - 1 - x];
+	}
+}
+
+// output(x, y) = input(y, x), width & height are the input's
+template<typename T> static HRESULT TransposePlane(const BYTE* input, LONG inputStride, UINT width, UINT height, BYTE* output, LONG outputStride)
+{
+	const auto block = BlockSize<T>();
+	return ForEachTile(width, height, TRANSFORM_TILE, TRANSFORM_TILE, [&](UINT left, UINT top, UINT right, UINT bottom)
+		{
+			auto blockBottom = top + (bottom - top) / block * block;
+			auto blockRight = left + (right - left) / block * block;
+			for (UINT y = top; y < blockBottom; y += block)
+			{
+				for (UINT x = left; x < blockRight; x += block)
+				{
+					TransposeBlock(T(), (const BYTE*)Element<T>(input, inputStride, x, y), inputStride, (BYTE*)Element<T>(output, outputStride, y, x), outputStride);
+				}
+			}
+
+			// right & bottom edges of the tile
+			for (UINT y = top; y < bottom; y++)
+			{
+				for (UINT x = y < blockBottom ? blockRight : left; x < right; x++)
+				{
+					*Element<T>(output, outputStride, y, x) = *Element<T>(input, inputStride, x, y);
+				}
+			}
+		});
+}
+
+// every transform is a copy of the input rows in some order, possibly mirrored or transposed
+template<typename T> static HRESULT TransformPlane(const BYTE* input, LONG inputStride, UINT width, UINT height, BYTE* output, LONG outputStride, bool transpose, bool flipX, bool flipY)
+{
+	if (flipY)
+	{
+		input += (ptrdiff_t)(height - 1) * inputStride;
+		inputStride = -inputStride;
+	}
+
+	if (transpose)
+	{
+		// mirroring a transposed frame is flipping the output
+		if (flipX)
+		{
+			output += (ptrdiff_t)(width - 1) * outputStride;
+			outputStride = -outputStride;
+		}
+		return TransposePlane<T>(input, inputStride, width, height, output, outputStride);
+	}
+
+	return ForEachBand(height, TRANSFORM_BAND_ROWS, [&](UINT top, UINT bottom)
+		{
+			for (UINT y = top; y < bottom; y++)
+			{
+				auto in = Element<T>(input, inputStride, 0, y);
+				auto out = Element<T>(output, outputStride, 0, y);
+				if (flipX)
+				{
+					ReverseRow(in, out, width);
+				}
+				else
+				{
+					CopyMemory(out, in, width * sizeof(T));
+				}
+			}
+		});
+}
+
+HRESULT FrameTransform::Apply(REFGUID format, const BYTE* input, LONG inputStride, const BYTE* uv, LONG uvStride, UINT width, UINT height, BYTE* output, LONG outputStride, BYTE* outputUV, LONG outputUVStride) const
+{
+	RETURN_HR_IF_NULL(E_POINTER, input);
+	RETURN_HR_IF_NULL(E_POINTER, output);
+
+	// rotations are transpositions of the mirrored and/or flipped frame
+	bool transpose, flipX, flipY;
+	switch (_rotation)
+	{
+	case 90:
+		transpose = true;
+		flipX = _mirror;
+		flipY = !_flip;
+		break;
+
+	case 180:
+		transpose = false;
+		flipX = !_mirror;
+		flipY = !_flip;
+		break;
+
+	case 270:
+		transpose = true;
+		flipX = !_mirror;
+		flipY = _flip;
+		break;
+
+	default:
+		transpose = false;
+		flipX = _mirror;
+		flipY = _flip;
+		break;
+	}
+
+	if (format == MFVideoFormat_RGB32)
+		return TransformPlane<UINT>(input, inputStride, width, height, output, outputStride, transpose, flipX, flipY);
+
+	RETURN_HR_IF(E_INVALIDARG, format != MFVideoFormat_NV12);
+	RETURN_HR_IF_NULL(E_POINTER, uv);
+	RETURN_HR_IF_NULL(E_POINTER, outputUV);
+
+	// NV12 chroma is transformed as 16-bit U & V pairs
+	RETURN_IF_FAILED(TransformPlane<BYTE>(input, inputStride, width, height, output, outputStride, transpose, flipX, flipY));
+	return TransformPlane<USHORT>(uv, uvStride, width / 2, height / 2, outputUV, outputUVStride, transpose, flipX, flipY);
+}
+
+D2D1_MATRIX_3X2_F FrameTransform::GetMatrix(UINT width, UINT height) const
+{
+	auto w = (FLOAT)width;
+	auto h = (FLOAT)height;
+	auto matrix = D2D1::Matrix3x2F(_mirror ? -1.0f : 1.0f, 0, 0, _flip ? -1.0f : 1.0f, _mirror ? w : 0, _flip ? h : 0);
+	switch (_rotation)
+	{
+	case 90:
+		matrix = matrix * D2D1::Matrix3x2F(0, 1, -1, 0, h, 0);
+		break;
+
+	case 180:
+		matrix = matrix * D2D1::Matrix3x2F(-1, 0, 0, -1, w, h);
+		break;
+
+	case 270:
+		matrix = matrix * D2D1::Matrix3x2F(0, -1, 1, 0, 0, w);
+		break;
+	}
+	return matrix;
+}
+
+HRESULT VideoControlKsProperty(LONG& mode, UINT streamCount, PKSPROPERTY property, ULONG length, LPVOID data, ULONG dataLength, ULONG* bytesReturned, bool& changed)
+{
+	RETURN_HR_IF_NULL(E_POINTER, property);
+	RETURN_HR_IF_NULL(E_POINTER, bytesReturned);
+	RETURN_HR_IF(E_INVALIDARG, length < sizeof(KSPROPERTY));
+	changed = false;
+	*bytesReturned = 0;
+
+	const LONG caps = KS_VideoControlFlag_FlipHorizontal | KS_VideoControlFlag_FlipVertical;
+	ULONG accessFlags;
+	if (property->Id == KSPROPERTY_VIDEOCONTROL_CAPS)
+	{
+		accessFlags = KSPROPERTY_TYPE_GET;
+	}
+	else if (property->Id == KSPROPERTY_VIDEOCONTROL_MODE)
+	{
+		accessFlags = KSPROPERTY_TYPE_GET | KSPROPERTY_TYPE_SET;
+	}
+	else
+		return HRESULT_FROM_WIN32(ERROR_NOT_FOUND);
+
+	if (property->Flags & KSPROPERTY_TYPE_BASICSUPPORT)
+	{
+		if (dataLength == sizeof(ULONG))
+			return KsReply(&accessFlags, sizeof(ULONG), data, dataLength, bytesReturned);
+
+		KSPROPERTY_DESCRIPTION description{};
+		description.AccessFlags = accessFlags;
+		description.DescriptionSize = sizeof(description);
+		description.PropTypeSet.Set = KSPROPTYPESETID_General;
+		description.PropTypeSet.Id = VT_I4;
+		return KsReply(&description, sizeof(description), data, dataLength, bytesReturned);
+	}
+
+	// both properties are per stream, the caps & mode structures start the same way
+	RETURN_HR_IF(HRESULT_FROM_WIN32(ERROR_INSUFFICIENT_BUFFER), length < sizeof(KSPROPERTY_VIDEOCONTROL_MODE_S));
+	auto streamIndex = ((const KSPROPERTY_VIDEOCONTROL_MODE_S*)property)->StreamIndex;
+	RETURN_HR_IF_MSG(E_INVALIDARG, streamIndex >= streamCount, "Invalid stream index %u", streamIndex);
+
+	if (property->Id == KSPROPERTY_VIDEOCONTROL_CAPS)
+	{
+		RETURN_HR_IF(HRESULT_FROM_WIN32(ERROR_NOT_SUPPORTED), !(property->Flags & KSPROPERTY_TYPE_GET));
+		KSPROPERTY_VIDEOCONTROL_CAPS_S reply{};
+		reply.Property = *property;
+		reply.StreamIndex = streamIndex;
+		reply.VideoControlCaps = caps;
+		return KsReply(&reply, sizeof(reply), data, dataLength, bytesReturned);
+	}
+
+	if (property->Flags & KSPROPERTY_TYPE_GET)
+	{
+		KSPROPERTY_VIDEOCONTROL_MODE_S reply{};
+		reply.Property = *property;
+		reply.StreamIndex = streamIndex;
+		reply.Mode = mode;
+		return KsReply(&reply, sizeof(reply), data, dataLength, bytesReturned);
+	}
+
+	if (property->Flags & KSPROPERTY_TYPE_SET)
+	{
+		RETURN_HR_IF(HRESULT_FROM_WIN32(ERROR_INSUFFICIENT_BUFFER), !data || dataLength < sizeof(KSPROPERTY_VIDEOCONTROL_MODE_S));
+		auto request = (const KSPROPERTY_VIDEOCONTROL_MODE_S*)data;
+		RETURN_HR_IF_MSG(E_INVALIDARG, request->Mode & ~caps, "Unsupported video control mode 0x%08X", request->Mode);
+		WINTRACE(L"VideoControlKsProperty set mode:0x%08X", request->Mode);
+		changed = mode != request->Mode;
+		mode = request->Mode;
+		return S_OK;
+	}
+
+	return HRESULT_FROM_WIN32(ERROR_NOT_SUPPORTED);
+}
\ No newline at end of file
@@ -0,0 +1,33 @@
+#pragma once
+
+// mirror, flip & rotation of the frames the camera emits
+// the input is mirrored (horizontally) and flipped (vertically) first, then rotated clockwise
+class FrameTransform
+{
+	UINT _rotation; // 0, 90, 180 or 270 degrees
+	bool _mirror;
+	bool _flip;
+
+public:
+	FrameTransform() :
+		_rotation(0),
+		_mirror(false),
+		_flip(false)
+	{
+	}
+
+	void SetRotation(UINT rotation) { _rotation = rotation; }
+	void SetMirrorFlip(bool mirror, bool flip) { _mirror = mirror; _flip = flip; }
+	bool IsActive() const { return _rotation || _mirror || _flip; }
+	bool SwapsSize() const { return _rotation == 90 || _rotation == 270; }
+
+	// for drawing content of that size directly transformed
+	D2D1_MATRIX_3X2_F GetMatrix(UINT width, UINT height) const;
+
+	// width & height are the input's, output is the transformed frame, RGB32 or NV12 (where uv & outputUV are the chroma planes)
+	HRESULT Apply(REFGUID format, const BYTE* input, LONG inputStride, const BYTE* uv, LONG uvStride, UINT width, UINT height, BYTE* output, LONG outputStride, BYTE* outputUV, LONG outputUVStride) const;
+};
+
+// handles PROPSETID_VIDCAP_VIDEOCONTROL requests, mode is a combination of KS_VideoControlFlag_FlipHorizontal & KS_VideoControlFlag_FlipVertical
+// changed is set if the mode was set
+HRESULT VideoControlKsProperty(LONG& mode, UINT streamCount, PKSPROPERTY property, ULONG length, LPVOID data, ULONG dataLength, ULONG* bytesReturned, bool& changed);
\ No newline at end of file
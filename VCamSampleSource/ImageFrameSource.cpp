@@ -0,0 +1,276 @@
+#include "pch.h"
+#include "Tools.h"
+#include "FrameBuffer.h"
+#include "ColorConvert.h"
+#include "FrameSource.h"
+#include "ImageFrameSource.h"
+
+#define IMAGE_CACHE_SIZE 4 // number of pre-converted images kept, so restarting the stream doesn't decode again
+#define PPM_MAX_SIZE (256 * 1024 * 1024)
+
+// shared by all sources of the process
+static winrt::slim_mutex _imageCacheLock;
+static std::shared_ptr<const ImageFrames> _imageCache[IMAGE_CACHE_SIZE];
+
+HRESULT ImageFrameSource::Open(PCWSTR path)
+{
+	RETURN_HR_IF_NULL(E_POINTER, path);
+	RETURN_HR_IF_MSG(E_INVALIDARG, !*path, "Image sources need a path");
+
+	// the last write time is part of the cache key, so an updated image is picked up at next start
+	WIN32_FILE_ATTRIBUTE_DATA data;
+	RETURN_IF_WIN32_BOOL_FALSE_MSG(GetFileAttributesEx(path, GetFileExInfoStandard, &data), "Cannot open '%ls'", path);
+	_path = path;
+	_lastWriteTime = data.ftLastWriteTime;
+	WINTRACE(L"ImageFrameSource::Open '%s'", path);
+	return S_OK;
+}
+
+HRESULT ImageFrameSource::Start(UINT width, UINT height, UINT fpsNumerator, UINT fpsDenominator)
+{
+	UNREFERENCED_PARAMETER(fpsNumerator);
+	UNREFERENCED_PARAMETER(fpsDenominator);
+	RETURN_HR_IF(E_INVALIDARG, !width || !height || (width & 1) || (height & 1));
+	_frames.reset();
+
+	{
+		winrt::slim_lock_guard lock(_imageCacheLock);
+		for (auto& entry : _imageCache)
+		{
+			if (entry && entry->width == width && entry->height == height && !CompareFileTime(&entry->lastWriteTime, &_lastWriteTime) && !lstrcmpi(entry->path.c_str(), _path.c_str()))
+			{
+				WINTRACE(L"ImageFrameSource::Start '%s' size:%u x %u from cache", _path.c_str(), width, height);
+				_frames = entry;
+				return S_OK;
+			}
+		}
+	}
+
+	// decode & convert outside of the lock, it can take a while for big images
+	std::shared_ptr<const ImageFrames> frames;
+	RETURN_IF_FAILED(CreateFrames(_path.c_str(), _lastWriteTime, width, height, frames));
+
+	winrt::slim_lock_guard lock(_imageCacheLock);
+	std::move_backward(_imageCache, _imageCache + IMAGE_CACHE_SIZE - 1, _imageCache + IMAGE_CACHE_SIZE);
+	_imageCache[0] = frames;
+	_frames = frames;
+	return S_OK;
+}
+
+HRESULT ImageFrameSource::GetFrame(MFTIME time, REFGUID preferredFormat, SourceFrame* frame)
+{
+	UNREFERENCED_PARAMETER(time);
+	RETURN_HR_IF_NULL(E_POINTER, frame);
+	RETURN_HR_IF_NULL(MF_E_NOT_INITIALIZED, _frames);
+
+	ZeroMemory(frame, sizeof(SourceFrame));
+	frame->width = _frames->width;
+	frame->height = _frames->height;
+	frame->index = 0; // always the same content
+	if (preferredFormat == MFVideoFormat_NV12)
+	{
+		frame->format = MFVideoFormat_NV12;
+		frame->planes[0] = _frames->nv12.get();
+		frame->strides[0] = _frames->width;
+		frame->planes[1] = _frames->nv12.get() + (SIZE_T)_frames->width * _frames->height;
+		frame->strides[1] = _frames->width;
+	}
+	else
+	{
+		frame->format = MFVideoFormat_RGB32;
+		frame->planes[0] = _frames->rgb32.get();
+		frame->strides[0] = _frames->width * 4;
+	}
+	return S_OK;
+}
+
+void ImageFrameSource::Stop()
+{
+	// the cache keeps the frames alive
+	_frames.reset();
+}
+
+HRESULT ImageFrameSource::CreateFrames(PCWSTR path, const FILETIME& lastWriteTime, UINT width, UINT height, std::shared_ptr<const ImageFrames>& frames)
+{
+	UINT imageWidth = 0;
+	UINT imageHeight = 0;
+	std::unique_ptr<BYTE[]> pixels;
+	RETURN_IF_FAILED(Decode(path, imageWidth, imageHeight, pixels));
+	WINTRACE(L"ImageFrameSource::CreateFrames '%s' image:%u x %u size:%u x %u", path, imageWidth, imageHeight, width, height);
+
+	auto result = std::make_shared<ImageFrames>();
+	result->path = path;
+	result->lastWriteTime = lastWriteTime;
+	result->width = width;
+	result->height = height;
+
+	// letterbox in opaque black
+	auto stride = width * 4;
+	result->rgb32 = std::make_unique<BYTE[]>((SIZE_T)stride * height);
+	auto rgb32 = result->rgb32.get();
+	std::fill_n((UINT32*)rgb32, (SIZE_T)width * height, 0xFF000000);
+
+	// keep the aspect ratio
+	auto scaledWidth = width;
+	auto scaledHeight = std::max<UINT>(1, (UINT)((ULONGLONG)imageHeight * width / imageWidth));
+	if (scaledHeight > height)
+	{
+		scaledHeight = height;
+		scaledWidth = std::max<UINT>(1, (UINT)((ULONGLONG)imageWidth * height / imageHeight));
+	}
+	auto x = (width - scaledWidth) / 2;
+	auto y = (height - scaledHeight) / 2;
+	auto output = rgb32 + (SIZE_T)y * stride + x * 4;
+	auto outputSize = (UINT)((height - y) * stride - x * 4);
+
+	wil::com_ptr_nothrow<IWICImagingFactory> wicFactory;
+	RETURN_IF_FAILED(CoCreateInstance(CLSID_WICImagingFactory, nullptr, CLSCTX_ALL, IID_PPV_ARGS(&wicFactory)));
+
+	wil::com_ptr_nothrow<IWICBitmap> bitmap;
+	RETURN_IF_FAILED(wicFactory->CreateBitmapFromMemory(imageWidth, imageHeight, GUID_WICPixelFormat32bppPBGRA, imageWidth * 4, imageWidth * 4 * imageHeight, pixels.get(), &bitmap));
+	WICRect rc{ 0, 0, (INT)scaledWidth, (INT)scaledHeight };
+	if (scaledWidth == imageWidth && scaledHeight == imageHeight)
+	{
+		RETURN_IF_FAILED(bitmap->CopyPixels(&rc, stride, outputSize, output));
+	}
+	else
+	{
+		wil::com_ptr_nothrow<IWICBitmapScaler> scaler;
+		RETURN_IF_FAILED(wicFactory->CreateBitmapScaler(&scaler));
+		RETURN_IF_FAILED(scaler->Initialize(bitmap.get(), scaledWidth, scaledHeight, WICBitmapInterpolationModeHighQualityCubic));
+		RETURN_IF_FAILED(scaler->CopyPixels(&rc, stride, outputSize, output));
+	}
+	pixels.reset();
+
+	// pixels are premultiplied so transparent parts are already composed over black, we just need opaque alpha
+	for (UINT i = 0; i < scaledHeight; i++)
+	{
+		auto line = output + (SIZE_T)i * stride;
+		for (UINT j = 0; j < scaledWidth; j++)
+		{
+			line[j * 4 + 3] = 0xFF;
+		}
+	}
+
+	result->nv12 = std::make_unique<BYTE[]>((SIZE_T)width * height * 3 / 2);
+	auto nv12 = result->nv12.get();
+	RGB32ToNV12(rgb32, stride, width, height, nv12, width, nv12 + (SIZE_T)width * height, width);
+	frames = result;
+	return S_OK;
+}
+
+HRESULT ImageFrameSource::Decode(PCWSTR path, UINT& width, UINT& height, std::unique_ptr<BYTE[]>& pixels)
+{
+	// WIC has no PPM codec
+	auto len = lstrlen(path);
+	if (len > 4 && (!lstrcmpi(path + len - 4, L".ppm") || !lstrcmpi(path + len - 4, L".pgm") || !lstrcmpi(path + len - 4, L".pnm")))
+		return DecodePPM(path, width, height, pixels);
+
+	wil::com_ptr_nothrow<IWICImagingFactory> wicFactory;
+	RETURN_IF_FAILED(CoCreateInstance(CLSID_WICImagingFactory, nullptr, CLSCTX_ALL, IID_PPV_ARGS(&wicFactory)));
+
+	wil::com_ptr_nothrow<IWICBitmapDecoder> decoder;
+	RETURN_IF_FAILED_MSG(wicFactory->CreateDecoderFromFilename(path, nullptr, GENERIC_READ, WICDecodeMetadataCacheOnDemand, &decoder), "Cannot decode '%ls'", path);
+
+	wil::com_ptr_nothrow<IWICBitmapFrameDecode> frame;
+	RETURN_IF_FAILED(decoder->GetFrame(0, &frame));
+
+	// premultiplied so transparent images (PNG) are composed over black
+	wil::com_ptr_nothrow<IWICBitmapSource> converted;
+	RETURN_IF_FAILED(WICConvertBitmapSource(GUID_WICPixelFormat32bppPBGRA, frame.get(), &converted));
+	RETURN_IF_FAILED(converted->GetSize(&width, &height));
+	RETURN_HR_IF_MSG(E_INVALIDARG, !width || !height || (ULONGLONG)width * height * 4 > UINT_MAX, "Invalid image size %u x %u", width, height);
+
+	auto size = width * height * 4;
+	pixels = std::make_unique<BYTE[]>(size);
+	RETURN_IF_FAILED(converted->CopyPixels(nullptr, width * 4, size, pixels.get()));
+	return S_OK;
+}
+
+HRESULT ImageFrameSource::DecodePPM(PCWSTR path, UINT& width, UINT& height, std::unique_ptr<BYTE[]>& pixels)
+{
+	wil::unique_hfile file(CreateFile(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr));
+	RETURN_LAST_ERROR_IF_MSG(!file, "Cannot open '%ls'", path);
+
+	LARGE_INTEGER fileSize;
+	RETURN_IF_WIN32_BOOL_FALSE(GetFileSizeEx(file.get(), &fileSize));
+	RETURN_HR_IF_MSG(MF_E_INVALID_FILE_FORMAT, fileSize.QuadPart < 3 || fileSize.QuadPart > PPM_MAX_SIZE, "Invalid PPM file size");
+
+	auto size = (DWORD)fileSize.QuadPart;
+	auto data = std::make_unique<BYTE[]>(size);
+	DWORD read;
+	RETURN_IF_WIN32_BOOL_FALSE(ReadFile(file.get(), data.get(), size, &read, nullptr));
+	RETURN_HR_IF(MF_E_INVALID_FILE_FORMAT, read != size);
+
+	// P6 (RGB) or P5 (gray), binary: magic, width, height, max value separated by whitespace, with # comments, then one whitespace & samples
+	auto p = data.get();
+	auto end = p + size;
+	RETURN_HR_IF_MSG(MF_E_INVALID_FILE_FORMAT, p[0] != 'P' || (p[1] != '6' && p[1] != '5'), "Unsupported PPM format");
+	auto channels = p[1] == '6' ? 3 : 1;
+	p += 2;
+
+	UINT values[3]{};
+	for (auto& value : values)
+	{
+		while (p < end && (isspace(*p) || *p == '#'))
+		{
+			if (*p == '#')
+			{
+				while (p < end && *p != '\n')
+				{
+					p++;
+				}
+			}
+			else
+			{
+				p++;
+			}
+		}
+		RETURN_HR_IF_MSG(MF_E_INVALID_FILE_FORMAT, p == end || !isdigit(*p), "Invalid PPM header");
+
+		while (p < end && isdigit(*p) && value < 0x10000000)
+		{
+			value = value * 10 + (*p - '0');
+			p++;
+		}
+	}
+	RETURN_HR_IF_MSG(MF_E_INVALID_FILE_FORMAT, p == end || !isspace(*p), "Invalid PPM header");
+	p++;
+
+	width = values[0];
+	height = values[1];
+	auto maxValue = values[2];
+	RETURN_HR_IF_MSG(MF_E_INVALID_FILE_FORMAT, !width || !height || !maxValue || maxValue > 0xFFFF, "Invalid PPM header");
+
+	auto sampleSize = maxValue > 0xFF ? 2 : 1;
+	RETURN_HR_IF_MSG(MF_E_INVALID_FILE_FORMAT, (ULONGLONG)width * height * channels * sampleSize > (ULONGLONG)(end - p), "PPM file is truncated");
+
+	pixels = std::make_unique<BYTE[]>((SIZE_T)width * height * 4);
+	auto output = pixels.get();
+	for (UINT i = 0; i < width * height; i++)
+	{
+		BYTE rgb[3];
+		for (auto c = 0; c < channels; c++)
+		{
+			UINT sample = *p++;
+			if (sampleSize == 2)
+			{
+				sample = (sample << 8) | *p++; // big endian
+			}
+			rgb[c] = (BYTE)((std::min(sample, maxValue) * 255 + maxValue / 2) / maxValue);
+		}
+
+		if (channels == 1)
+		{
+			rgb[1] = rgb[0];
+			rgb[2] = rgb[0];
+		}
+
+		output[0] = rgb[2];
+		output[1] = rgb[1];
+		output[2] = rgb[0];
+		output[3] = 0xFF;
+		output += 4;
+	}
+	return S_OK;
+}
\ No newline at end of file
@@ -0,0 +1,40 @@
+#pragma once
+
+// an image pre-scaled & pre-converted to all the stream formats for a given frame size
+struct ImageFrames
+{
+	std::wstring path;
+	FILETIME lastWriteTime;
+	UINT width;
+	UINT height;
+	std::unique_ptr<BYTE[]> rgb32;
+	std::unique_ptr<BYTE[]> nv12;
+};
+
+// serves a still image (BMP, PNG, PPM or anything WIC can decode)
+// the image is decoded, scaled & converted once at start, so serving a frame is just a copy
+class ImageFrameSource : public FrameSource
+{
+	std::wstring _path;
+	FILETIME _lastWriteTime;
+	std::shared_ptr<const ImageFrames> _frames;
+
+	static HRESULT DecodePPM(PCWSTR path, UINT& width, UINT& height, std::unique_ptr<BYTE[]>& pixels);
+	static HRESULT CreateFrames(PCWSTR path, const FILETIME& lastWriteTime, UINT width, UINT height, std::shared_ptr<const ImageFrames>& frames);
+
+public:
+	ImageFrameSource() :
+		_lastWriteTime({})
+	{
+	}
+
+	HRESULT Open(PCWSTR path);
+
+	// decodes an image file to premultiplied BGRA, width * 4 bytes per row
+	static HRESULT Decode(PCWSTR path, UINT& width, UINT& height, std::unique_ptr<BYTE[]>& pixels);
+
+	// FrameSource
+	HRESULT Start(UINT width, UINT height, UINT fpsNumerator, UINT fpsDenominator);
+	HRESULT GetFrame(MFTIME time, REFGUID preferredFormat, SourceFrame* frame);
+	void Stop();
+};
\ No newline at end of file
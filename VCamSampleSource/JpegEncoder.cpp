@@ -0,0 +1,670 @@
+#include "pch.h"
+#include "JpegEncoder.h"
+
+#if defined(_M_IX86) || defined(_M_X64)
+#define JPEG_SSE
+#elif defined(_M_ARM64)
+#define JPEG_NEON
+#endif
+
+#define JPEG_MAX_RESTART_INTERVAL 65535
+#define JPEG_STRIPS_PER_PROCESSOR 2 // more strips than threads so they balance better
+#define JPEG_MAX_MCU_SIZE (6 * 64 * 27 * 2 / 8) // 6 blocks of 64 coefficients, 27 bits max each, x2 for 0xFF stuffing
+#define JPEG_INITIAL_MCU_SIZE 256 // strips grow on demand from there
+
+// ITU T.81 Annex K
+static const BYTE _lumaQuantization[64] =
+{
+	16, 11, 10, 16, 24, 40, 51, 61,
+	12, 12, 14, 19, 26, 58, 60, 55,
+	14, 13, 16, 24, 40, 57, 69, 56,
+	14, 17, 22, 29, 51, 87, 80, 62,
+	18, 22, 37, 56, 68, 109, 103, 77,
+	24, 35, 55, 64, 81, 104, 113, 92,
+	49, 64, 78, 87, 103, 121, 120, 101,
+	72, 92, 95, 98, 112, 100, 103, 99
+};
+
+static const BYTE _chromaQuantization[64] =
+{
+	17, 18, 24, 47, 99, 99, 99, 99,
+	18, 21, 26, 66, 99, 99, 99, 99,
+	24, 26, 56, 99, 99, 99, 99, 99,
+	47, 66, 99, 99, 99, 99, 99, 99,
+	99, 99, 99, 99, 99, 99, 99, 99,
+	99, 99, 99, 99, 99, 99, 99, 99,
+	99, 99, 99, 99, 99, 99, 99, 99,
+	99, 99, 99, 99, 99, 99, 99, 99
+};
+
+static const BYTE _dcLumaBits[16] = { 0, 1, 5, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0 };
+static const BYTE _dcChromaBits[16] = { 0, 3, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0 };
+static const BYTE _dcValues[12] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11 };
+
+static const BYTE _acLumaBits[16] = { 0, 2, 1, 3, 3, 2, 4, 3, 5, 5, 4, 4, 0, 0, 1, 0x7d };
+static const BYTE _acLumaValues[162] =
+{
+	0x01, 0x02, 0x03, 0x00, 0x04, 0x11, 0x05, 0x12, 0x21, 0x31, 0x41, 0x06, 0x13, 0x51, 0x61, 0x07,
+	0x22, 0x71, 0x14, 0x32, 0x81, 0x91, 0xa1, 0x08, 0x23, 0x42, 0xb1, 0xc1, 0x15, 0x52, 0xd1, 0xf0,
+	0x24, 0x33, 0x62, 0x72, 0x82, 0x09, 0x0a, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x25, 0x26, 0x27, 0x28,
+	0x29, 0x2a, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49,
+	0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69,
+	0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89,
+	0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7,
+	0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3, 0xc4, 0xc5,
+	0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda, 0xe1, 0xe2,
+	0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+	0xf9, 0xfa
+};
+
+static const BYTE _acChromaBits[16] = { 0, 2, 1, 2, 4, 4, 3, 4, 7, 5, 4, 4, 0, 1, 2, 0x77 };
+static const BYTE _acChromaValues[162] =
+{
+	0x00, 0x01, 0x02, 0x03, 0x11, 0x04, 0x05, 0x21, 0x31, 0x06, 0x12, 0x41, 0x51, 0x07, 0x61, 0x71,
+	0x13, 0x22, 0x32, 0x81, 0x08, 0x14, 0x42, 0x91, 0xa1, 0xb1, 0xc1, 0x09, 0x23, 0x33, 0x52, 0xf0,
+	0x15, 0x62, 0x72, 0xd1, 0x0a, 0x16, 0x24, 0x34, 0xe1, 0x25, 0xf1, 0x17, 0x18, 0x19, 0x1a, 0x26,
+	0x27, 0x28, 0x29, 0x2a, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48,
+	0x49, 0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68,
+	0x69, 0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87,
+	0x88, 0x89, 0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5,
+	0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3,
+	0xc4, 0xc5, 0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda,
+	0xe2, 0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+	0xf9, 0xfa
+};
+
+// zigzag index => natural (row major) index
+static const BYTE _zigzag[64] =
+{
+	0, 1, 8, 16, 9, 2, 3, 10,
+	17, 24, 32, 25, 18, 11, 4, 5,
+	12, 19, 26, 33, 40, 48, 41, 34,
+	27, 20, 13, 6, 7, 14, 21, 28,
+	35, 42, 49, 56, 57, 50, 43, 36,
+	29, 22, 15, 23, 30, 37, 44, 51,
+	58, 59, 52, 45, 38, 31, 39, 46,
+	53, 60, 61, 54, 47, 55, 62, 63
+};
+
+// AAN DCT output scale factors, cos(k * pi / 16) * sqrt(2), 1 for k = 0
+static const double _aanScale[8] = { 1.0, 1.387039845, 1.306562965, 1.175875602, 1.0, 0.785694958, 0.541196100, 0.275899379 };
+
+// the DCT is done as two vertical passes with a transposition in between, so its output is transposed
+static inline UINT TransposedIndex(UINT index)
+{
+	return (index & 7) * 8 + (index >> 3);
+}
+
+struct HuffmanTable
+{
+	USHORT codes[256];
+	BYTE sizes[256];
+
+	void Build(const BYTE* bits, const BYTE* values)
+	{
+		UINT code = 0;
+		UINT k = 0;
+		for (UINT length = 1; length <= 16; length++)
+		{
+			for (UINT i = 0; i < bits[length - 1]; i++)
+			{
+				codes[values[k]] = (USHORT)code;
+				sizes[values[k]] = (BYTE)length;
+				code++;
+				k++;
+			}
+			code <<= 1;
+		}
+	}
+};
+
+struct HuffmanTables
+{
+	HuffmanTable dcLuma;
+	HuffmanTable acLuma;
+	HuffmanTable dcChroma;
+	HuffmanTable acChroma;
+	BYTE zigzag[64]; // zigzag index => index in the DCT output
+
+	HuffmanTables() :
+		dcLuma(),
+		acLuma(),
+		dcChroma(),
+		acChroma(),
+		zigzag()
+	{
+		dcLuma.Build(_dcLumaBits, _dcValues);
+		acLuma.Build(_acLumaBits, _acLumaValues);
+		dcChroma.Build(_dcChromaBits, _dcValues);
+		acChroma.Build(_acChromaBits, _acChromaValues);
+		for (UINT i = 0; i < 64; i++)
+		{
+			zigzag[i] = (BYTE)TransposedIndex(_zigzag[i]);
+		}
+	}
+};
+
+static const HuffmanTables& GetHuffmanTables()
+{
+	static const HuffmanTables tables;
+	return tables;
+}
+
+// writes entropy coded bits, with 0xFF stuffing
+struct BitWriter
+{
+	BYTE* output;
+	UINT64 bits;
+	UINT count;
+
+	inline void Put(UINT value, UINT size)
+	{
+		bits = (bits << size) | value;
+		count += size;
+		while (count >= 8)
+		{
+			count -= 8;
+			auto b = (BYTE)(bits >> count);
+			*output++ = b;
+			if (b == 0xFF)
+			{
+				*output++ = 0;
+			}
+		}
+	}
+
+	// pads the last byte with 1 bits
+	void Flush()
+	{
+		if (count)
+		{
+			Put((1 << (8 - count)) - 1, 8 - count);
+		}
+	}
+};
+
+static inline UINT BitSize(UINT value)
+{
+	if (!value)
+		return 0;
+
+	unsigned long index;
+	_BitScanReverse(&index, value);
+	return index + 1;
+}
+
+#if defined(JPEG_SSE)
+#define VECTOR_WIDTH 4
+typedef __m128 Vector;
+static inline Vector VLoad(const float* p) { return _mm_load_ps(p); }
+static inline void VStore(float* p, Vector v) { _mm_store_ps(p, v); }
+static inline Vector VAdd(Vector a, Vector b) { return _mm_add_ps(a, b); }
+static inline Vector VSub(Vector a, Vector b) { return _mm_sub_ps(a, b); }
+static inline Vector VMul(Vector a, float b) { return _mm_mul_ps(a, _mm_set1_ps(b)); }
+#elif defined(JPEG_NEON)
+#define VECTOR_WIDTH 4
+typedef float32x4_t Vector;
+static inline Vector VLoad(const float* p) { return vld1q_f32(p); }
+static inline void VStore(float* p, Vector v) { vst1q_f32(p, v); }
+static inline Vector VAdd(Vector a, Vector b) { return vaddq_f32(a, b); }
+static inline Vector VSub(Vector a, Vector b) { return vsubq_f32(a, b); }
+static inline Vector VMul(Vector a, float b) { return vmulq_n_f32(a, b); }
+#else
+#define VECTOR_WIDTH 1
+typedef float Vector;
+static inline Vector VLoad(const float* p) { return *p; }
+static inline void VStore(float* p, Vector v) { *p = v; }
+static inline Vector VAdd(Vector a, Vector b) { return a + b; }
+static inline Vector VSub(Vector a, Vector b) { return a - b; }
+static inline Vector VMul(Vector a, float b) { return a * b; }
+#endif
+
+// gathers an 8x8 block of samples, level shifted, replicating the last row & column when the block crosses the plane's edges
+static void LoadBlock(const BYTE* plane, LONG stride, UINT step, UINT x, UINT y, UINT width, UINT height, float* block)
+{
+	alignas(16) BYTE samples[64];
+	if (x + 8 <= width && y + 8 <= height)
+	{
+		auto row = plane + (SIZE_T)y * stride + (SIZE_T)x * step;
+		for (UINT i = 0; i < 8; i++)
+		{
+			if (step == 1)
+			{
+				CopyMemory(samples + i * 8, row, 8);
+			}
+			else
+			{
+				for (UINT j = 0; j < 8; j++)
+				{
+					samples[i * 8 + j] = row[j * step];
+				}
+			}
+			row += stride;
+		}
+	}
+	else
+	{
+		for (UINT i = 0; i < 8; i++)
+		{
+			auto row = plane + (SIZE_T)std::min(y + i, height - 1) * stride;
+			for (UINT j = 0; j < 8; j++)
+			{
+				samples[i * 8 + j] = row[(SIZE_T)std::min(x + j, width - 1) * step];
+			}
+		}
+	}
+
+#if defined(JPEG_SSE)
+	auto zero = _mm_setzero_si128();
+	auto offset = _mm_set1_ps(128);
+	for (UINT i = 0; i < 64; i += 16)
+	{
+		auto v = _mm_load_si128((const __m128i*)(samples + i));
+		auto lo = _mm_unpacklo_epi8(v, zero);
+		auto hi = _mm_unpackhi_epi8(v, zero);
+		_mm_store_ps(block + i, _mm_sub_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(lo, zero)), offset));
+		_mm_store_ps(block + i + 4, _mm_sub_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(lo, zero)), offset));
+		_mm_store_ps(block + i + 8, _mm_sub_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(hi, zero)), offset));
+		_mm_store_ps(block + i + 12, _mm_sub_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(hi, zero)), offset));
+	}
+#else
+	for (UINT i = 0; i < 64; i++)
+	{
+		block[i] = samples[i] - 128.0f;
+	}
+#endif
+}
+
+// one dimension AAN float DCT (as in libjpeg's jfdctflt.c) on the rows of the block, VECTOR_WIDTH columns at a time
+static void FdctPass(float* block)
+{
+	for (UINT c = 0; c < 8; c += VECTOR_WIDTH)
+	{
+		auto d0 = VLoad(block + c);
+		auto d1 = VLoad(block + 8 + c);
+		auto d2 = VLoad(block + 16 + c);
+		auto d3 = VLoad(block + 24 + c);
+		auto d4 = VLoad(block + 32 + c);
+		auto d5 = VLoad(block + 40 + c);
+		auto d6 = VLoad(block + 48 + c);
+		auto d7 = VLoad(block + 56 + c);
+
+		auto tmp0 = VAdd(d0, d7);
+		auto tmp7 = VSub(d0, d7);
+		auto tmp1 = VAdd(d1, d6);
+		auto tmp6 = VSub(d1, d6);
+		auto tmp2 = VAdd(d2, d5);
+		auto tmp5 = VSub(d2, d5);
+		auto tmp3 = VAdd(d3, d4);
+		auto tmp4 = VSub(d3, d4);
+
+		// even part
+		auto tmp10 = VAdd(tmp0, tmp3);
+		auto tmp13 = VSub(tmp0, tmp3);
+		auto tmp11 = VAdd(tmp1, tmp2);
+		auto tmp12 = VSub(tmp1, tmp2);
+
+		VStore(block + c, VAdd(tmp10, tmp11));
+		VStore(block + 32 + c, VSub(tmp10, tmp11));
+
+		auto z1 = VMul(VAdd(tmp12, tmp13), 0.707106781f);
+		VStore(block + 16 + c, VAdd(tmp13, z1));
+		VStore(block + 48 + c, VSub(tmp13, z1));
+
+		// odd part
+		tmp10 = VAdd(tmp4, tmp5);
+		tmp11 = VAdd(tmp5, tmp6);
+		tmp12 = VAdd(tmp6, tmp7);
+
+		auto z5 = VMul(VSub(tmp10, tmp12), 0.382683433f);
+		auto z2 = VAdd(VMul(tmp10, 0.541196100f), z5);
+		auto z4 = VAdd(VMul(tmp12, 1.306562965f), z5);
+		auto z3 = VMul(tmp11, 0.707106781f);
+
+		auto z11 = VAdd(tmp7, z3);
+		auto z13 = VSub(tmp7, z3);
+
+		VStore(block + 40 + c, VAdd(z13, z2));
+		VStore(block + 24 + c, VSub(z13, z2));
+		VStore(block + 8 + c, VAdd(z11, z4));
+		VStore(block + 56 + c, VSub(z11, z4));
+	}
+}
+
+static void Transpose(float* block)
+{
+#if defined(JPEG_SSE)
+	auto a0 = _mm_load_ps(block);
+	auto a1 = _mm_load_ps(block + 8);
+	auto a2 = _mm_load_ps(block + 16);
+	auto a3 = _mm_load_ps(block + 24);
+	auto b0 = _mm_load_ps(block + 4);
+	auto b1 = _mm_load_ps(block + 12);
+	auto b2 = _mm_load_ps(block + 20);
+	auto b3 = _mm_load_ps(block + 28);
+	auto c0 = _mm_load_ps(block + 32);
+	auto c1 = _mm_load_ps(block + 40);
+	auto c2 = _mm_load_ps(block + 48);
+	auto c3 = _mm_load_ps(block + 56);
+	auto d0 = _mm_load_ps(block + 36);
+	auto d1 = _mm_load_ps(block + 44);
+	auto d2 = _mm_load_ps(block + 52);
+	auto d3 = _mm_load_ps(block + 60);
+	_MM_TRANSPOSE4_PS(a0, a1, a2, a3);
+	_MM_TRANSPOSE4_PS(b0, b1, b2, b3);
+	_MM_TRANSPOSE4_PS(c0, c1, c2, c3);
+	_MM_TRANSPOSE4_PS(d0, d1, d2, d3);
+
+	// top right & bottom left quadrants swap
+	_mm_store_ps(block, a0);
+	_mm_store_ps(block + 8, a1);
+	_mm_store_ps(block + 16, a2);
+	_mm_store_ps(block + 24, a3);
+	_mm_store_ps(block + 4, c0);
+	_mm_store_ps(block + 12, c1);
+	_mm_store_ps(block + 20, c2);
+	_mm_store_ps(block + 28, c3);
+	_mm_store_ps(block + 32, b0);
+	_mm_store_ps(block + 40, b1);
+	_mm_store_ps(block + 48, b2);
+	_mm_store_ps(block + 56, b3);
+	_mm_store_ps(block + 36, d0);
+	_mm_store_ps(block + 44, d1);
+	_mm_store_ps(block + 52, d2);
+	_mm_store_ps(block + 60, d3);
+#else
+	for (UINT i = 0; i < 8; i++)
+	{
+		for (UINT j = i + 1; j < 8; j++)
+		{
+			std::swap(block[i * 8 + j], block[j * 8 + i]);
+		}
+	}
+#endif
+}
+
+// scale includes the AAN scale factors
+static void Quantize(const float* block, const float* scale, short* coefficients)
+{
+#if defined(JPEG_SSE)
+	for (UINT i = 0; i < 64; i += 8)
+	{
+		auto lo = _mm_cvtps_epi32(_mm_mul_ps(_mm_load_ps(block + i), _mm_loadu_ps(scale + i)));
+		auto hi = _mm_cvtps_epi32(_mm_mul_ps(_mm_load_ps(block + i + 4), _mm_loadu_ps(scale + i + 4)));
+		_mm_store_si128((__m128i*)(coefficients + i), _mm_packs_epi32(lo, hi));
+	}
+#elif defined(JPEG_NEON)
+	for (UINT i = 0; i < 64; i += 4)
+	{
+		vst1_s16(coefficients + i, vqmovn_s32(vcvtnq_s32_f32(vmulq_f32(vld1q_f32(block + i), vld1q_f32(scale + i)))));
+	}
+#else
+	for (UINT i = 0; i < 64; i++)
+	{
+		coefficients[i] = (short)lrintf(block[i] * scale[i]);
+	}
+#endif
+}
+
+static void EncodeBlock(BitWriter& writer, const short* coefficients, int& dc, const HuffmanTable& dcTable, const HuffmanTable& acTable, const BYTE* zigzag)
+{
+	auto diff = coefficients[0] - dc;
+	dc = coefficients[0];
+
+	auto size = BitSize(abs(diff));
+	writer.Put(dcTable.codes[size], dcTable.sizes[size]);
+	if (size)
+	{
+		// negative values are written as value - 1 in size bits
+		writer.Put((diff < 0 ? diff - 1 : diff) & ((1 << size) - 1), size);
+	}
+
+	UINT run = 0;
+	for (UINT k = 1; k < 64; k++)
+	{
+		int value = coefficients[zigzag[k]];
+		if (!value)
+		{
+			run++;
+			continue;
+		}
+
+		while (run > 15)
+		{
+			writer.Put(acTable.codes[0xF0], acTable.sizes[0xF0]); // ZRL
+			run -= 16;
+		}
+
+		size = BitSize(abs(value));
+		auto symbol = (run << 4) | size;
+		writer.Put(acTable.codes[symbol], acTable.sizes[symbol]);
+		writer.Put((value < 0 ? value - 1 : value) & ((1 << size) - 1), size);
+		run = 0;
+	}
+
+	if (run)
+	{
+		writer.Put(acTable.codes[0], acTable.sizes[0]); // EOB
+	}
+}
+
+static BYTE* WriteMarker(BYTE* p, BYTE marker, USHORT length)
+{
+	*p++ = 0xFF;
+	*p++ = marker;
+	if (length)
+	{
+		*p++ = (BYTE)(length >> 8);
+		*p++ = (BYTE)length;
+	}
+	return p;
+}
+
+static BYTE* WriteHuffmanTable(BYTE* p, BYTE classAndId, const BYTE* bits, const BYTE* values, UINT count)
+{
+	*p++ = classAndId;
+	CopyMemory(p, bits, 16);
+	p += 16;
+	CopyMemory(p, values, count);
+	return p + count;
+}
+
+HRESULT JpegEncoder::Initialize(UINT width, UINT height, UINT quality)
+{
+	RETURN_HR_IF(E_INVALIDARG, !width || !height || width > 0xFFFF || height > 0xFFFF || (width & 1) || (height & 1));
+	quality = std::min<UINT>(std::max<UINT>(quality, 1), 100);
+
+	_width = width;
+	_height = height;
+	_mcusPerRow = (width + 15) / 16;
+	_mcuRows = (height + 15) / 16;
+
+	// one strip per restart interval, all intervals but the last must have the same number of MCUs
+	auto strips = std::max<UINT>(1, GetActiveProcessorCount(ALL_PROCESSOR_GROUPS) * JPEG_STRIPS_PER_PROCESSOR);
+	_rowsPerStrip = std::min<UINT>((_mcuRows + strips - 1) / strips, JPEG_MAX_RESTART_INTERVAL / _mcusPerRow);
+	_stripCount = (_mcuRows + _rowsPerStrip - 1) / _rowsPerStrip;
+	_strips = std::make_unique<Strip[]>(_stripCount);
+	for (UINT i = 0; i < _stripCount; i++)
+	{
+		_strips[i].capacity = (SIZE_T)_rowsPerStrip * _mcusPerRow * JPEG_INITIAL_MCU_SIZE + JPEG_MAX_MCU_SIZE;
+		_strips[i].data = std::make_unique<BYTE[]>(_strips[i].capacity);
+		_strips[i].size = 0;
+	}
+
+	// libjpeg's quality scaling
+	auto scale = quality < 50 ? 5000 / quality : 200 - quality * 2;
+	BYTE luma[64];
+	BYTE chroma[64];
+	for (UINT i = 0; i < 64; i++)
+	{
+		luma[i] = (BYTE)std::min<UINT>(std::max<UINT>((_lumaQuantization[i] * scale + 50) / 100, 1), 255);
+		chroma[i] = (BYTE)std::min<UINT>(std::max<UINT>((_chromaQuantization[i] * scale + 50) / 100, 1), 255);
+	}
+
+	for (UINT i = 0; i < 64; i++)
+	{
+		auto natural = TransposedIndex(i);
+		auto aan = _aanScale[natural >> 3] * _aanScale[natural & 7] * 8;
+		_lumaScale[i] = (float)(1.0 / (luma[natural] * aan));
+		_chromaScale[i] = (float)(1.0 / (chroma[natural] * aan));
+	}
+
+	// everything before the entropy coded data never changes
+	_header = std::make_unique<BYTE[]>(1024);
+	auto p = _header.get();
+	p = WriteMarker(p, 0xD8, 0); // SOI
+
+	p = WriteMarker(p, 0xE0, 16); // APP0 JFIF 1.1, no density
+	const BYTE jfif[] = { 'J', 'F', 'I', 'F', 0, 1, 1, 0, 0, 1, 0, 1, 0, 0 };
+	CopyMemory(p, jfif, sizeof(jfif));
+	p += sizeof(jfif);
+
+	p = WriteMarker(p, 0xDB, 2 + 2 * 65); // DQT
+	*p++ = 0;
+	for (UINT i = 0; i < 64; i++)
+	{
+		*p++ = luma[_zigzag[i]];
+	}
+	*p++ = 1;
+	for (UINT i = 0; i < 64; i++)
+	{
+		*p++ = chroma[_zigzag[i]];
+	}
+
+	p = WriteMarker(p, 0xC0, 17); // SOF0, Y 2x2, Cb & Cr 1x1
+	const BYTE frame[] = { 8, (BYTE)(height >> 8), (BYTE)height, (BYTE)(width >> 8), (BYTE)width, 3, 1, 0x22, 0, 2, 0x11, 1, 3, 0x11, 1 };
+	CopyMemory(p, frame, sizeof(frame));
+	p += sizeof(frame);
+
+	p = WriteMarker(p, 0xC4, 2 + 4 * 17 + 2 * sizeof(_dcValues) + sizeof(_acLumaValues) + sizeof(_acChromaValues)); // DHT
+	p = WriteHuffmanTable(p, 0x00, _dcLumaBits, _dcValues, sizeof(_dcValues));
+	p = WriteHuffmanTable(p, 0x10, _acLumaBits, _acLumaValues, sizeof(_acLumaValues));
+	p = WriteHuffmanTable(p, 0x01, _dcChromaBits, _dcValues, sizeof(_dcValues));
+	p = WriteHuffmanTable(p, 0x11, _acChromaBits, _acChromaValues, sizeof(_acChromaValues));
+
+	if (_stripCount > 1)
+	{
+		p = WriteMarker(p, 0xDD, 4); // DRI
+		auto interval = _rowsPerStrip * _mcusPerRow;
+		*p++ = (BYTE)(interval >> 8);
+		*p++ = (BYTE)interval;
+	}
+
+	p = WriteMarker(p, 0xDA, 12); // SOS
+	const BYTE scan[] = { 3, 1, 0x00, 2, 0x11, 3, 0x11, 0, 63, 0 };
+	CopyMemory(p, scan, sizeof(scan));
+	p += sizeof(scan);
+
+	_headerSize = p - _header.get();
+	WINTRACE(L"JpegEncoder::Initialize size:%u x %u quality:%u strips:%u restart interval:%u", width, height, quality, _stripCount, _rowsPerStrip * _mcusPerRow);
+	return S_OK;
+}
+
+void JpegEncoder::EncodeStrip(UINT index, const BYTE* y, LONG yStride, const BYTE* u, const BYTE* v, LONG uvStride, UINT uvStep)
+{
+	auto& tables = GetHuffmanTables();
+	auto& strip = _strips[index];
+	auto chromaWidth = _width / 2;
+	auto chromaHeight = _height / 2;
+	alignas(16) float block[64];
+	alignas(16) short coefficients[64];
+
+	// each strip is a restart interval, so it starts with fresh DC predictions
+	int dcY = 0;
+	int dcU = 0;
+	int dcV = 0;
+	BitWriter writer{ strip.data.get(), 0, 0 };
+	auto lastRow = std::min(_mcuRows, (index + 1) * _rowsPerStrip);
+	for (auto row = index * _rowsPerStrip; row < lastRow; row++)
+	{
+		for (UINT col = 0; col < _mcusPerRow; col++)
+		{
+			// strips only grow, so once the steady state is reached there's no allocation
+			auto used = (SIZE_T)(writer.output - strip.data.get());
+			if (strip.capacity - used < JPEG_MAX_MCU_SIZE)
+			{
+				auto capacity = strip.capacity * 2;
+				auto data = std::make_unique<BYTE[]>(capacity);
+				CopyMemory(data.get(), strip.data.get(), used);
+				strip.data = std::move(data);
+				strip.capacity = capacity;
+				writer.output = strip.data.get() + used;
+			}
+
+			for (UINT i = 0; i < 4; i++)
+			{
+				LoadBlock(y, yStride, 1, col * 16 + (i & 1) * 8, row * 16 + (i >> 1) * 8, _width, _height, block);
+				FdctPass(block);
+				Transpose(block);
+				FdctPass(block);
+				Quantize(block, _lumaScale, coefficients);
+				EncodeBlock(writer, coefficients, dcY, tables.dcLuma, tables.acLuma, tables.zigzag);
+			}
+
+			LoadBlock(u, uvStride, uvStep, col * 8, row * 8, chromaWidth, chromaHeight, block);
+			FdctPass(block);
+			Transpose(block);
+			FdctPass(block);
+			Quantize(block, _chromaScale, coefficients);
+			EncodeBlock(writer, coefficients, dcU, tables.dcChroma, tables.acChroma, tables.zigzag);
+
+			LoadBlock(v, uvStride, uvStep, col * 8, row * 8, chromaWidth, chromaHeight, block);
+			FdctPass(block);
+			Transpose(block);
+			FdctPass(block);
+			Quantize(block, _chromaScale, coefficients);
+			EncodeBlock(writer, coefficients, dcV, tables.dcChroma, tables.acChroma, tables.zigzag);
+		}
+	}
+
+	writer.Flush();
+	strip.size = writer.output - strip.data.get();
+}
+
+HRESULT JpegEncoder::Encode(const BYTE* y, LONG yStride, const BYTE* u, const BYTE* v, LONG uvStride, UINT uvStep)
+{
+	RETURN_HR_IF(E_NOT_VALID_STATE, !_strips);
+	RETURN_HR_IF_NULL(E_POINTER, y);
+	RETURN_HR_IF_NULL(E_POINTER, u);
+	RETURN_HR_IF_NULL(E_POINTER, v);
+	RETURN_HR_IF(E_INVALIDARG, uvStep != 1 && uvStep != 2);
+
+	try
+	{
+		TaskScheduler::GetShared().ParallelFor(_stripCount, 1, [&](UINT first, UINT last)
+			{
+				for (auto i = first; i < last; i++)
+				{
+					EncodeStrip(i, y, yStride, u, v, uvStride, uvStep);
+				}
+			});
+	}
+	CATCH_RETURN();
+	return S_OK;
+}
+
+SIZE_T JpegEncoder::GetEncodedSize() const
+{
+	auto size = _headerSize + (SIZE_T)(_stripCount - 1) * 2 + 2; // RSTn between strips, EOI
+	for (UINT i = 0; i < _stripCount; i++)
+	{
+		size += _strips[i].size;
+	}
+	return size;
+}
+
+void JpegEncoder::CopyEncoded(BYTE* output) const
+{
+	CopyMemory(output, _header.get(), _headerSize);
+	output += _headerSize;
+	for (UINT i = 0; i < _stripCount; i++)
+	{
+		CopyMemory(output, _strips[i].data.get(), _strips[i].size);
+		output += _strips[i].size;
+		if (i + 1 < _stripCount)
+		{
+			output = WriteMarker(output, (BYTE)(0xD0 + (i & 7)), 0); // RSTn
+		}
+	}
+	WriteMarker(output, 0xD9, 0); // EOI
+}
\ No newline at end of file
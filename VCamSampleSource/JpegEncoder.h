@@ -0,0 +1,51 @@
+#pragma once
+
+// baseline JPEG (4:2:0) encoder working directly from YUV 4:2:0 planes
+// the image is split in horizontal strips encoded in parallel, separated by restart markers
+class JpegEncoder
+{
+	struct Strip
+	{
+		std::unique_ptr<BYTE[]> data;
+		SIZE_T size;
+		SIZE_T capacity;
+	};
+
+	UINT _width;
+	UINT _height;
+	UINT _mcusPerRow;
+	UINT _mcuRows;
+	UINT _rowsPerStrip;
+	UINT _stripCount;
+	std::unique_ptr<Strip[]> _strips;
+	std::unique_ptr<BYTE[]> _header;
+	SIZE_T _headerSize;
+	float _lumaScale[64]; // reciprocal quantization factors, in the DCT output layout
+	float _chromaScale[64];
+
+	void EncodeStrip(UINT index, const BYTE* y, LONG yStride, const BYTE* u, const BYTE* v, LONG uvStride, UINT uvStep);
+
+public:
+	JpegEncoder() :
+		_width(0),
+		_height(0),
+		_mcusPerRow(0),
+		_mcuRows(0),
+		_rowsPerStrip(0),
+		_stripCount(0),
+		_headerSize(0),
+		_lumaScale(),
+		_chromaScale()
+	{
+	}
+
+	// quality is 1-100, like libjpeg's
+	HRESULT Initialize(UINT width, UINT height, UINT quality);
+
+	// u & v are the chroma planes, uvStep is 2 for NV12 (interleaved) or 1 for I420
+	HRESULT Encode(const BYTE* y, LONG yStride, const BYTE* u, const BYTE* v, LONG uvStride, UINT uvStep);
+
+	// size & copy of the last encoded image
+	SIZE_T GetEncodedSize() const;
+	void CopyEncoded(BYTE* output) const;
+};
\ No newline at end of file
@@ -3,6 +3,8 @@
 #include "Tools.h"
 #include "EnumNames.h"
 #include "MFTools.h"
+#include "ProcAmp.h"
+#include "FrameTiming.h"
 #include "FrameGenerator.h"
 #include "MediaStream.h"
 #include "MediaSource.h"
@@ -245,7 +247,7 @@ STDMETHODIMP MediaSource::Stop()
 	wil::unique_prop_variant time;
 	RETURN_IF_FAILED(InitPropVariantFromInt64(MFGetSystemTime(), &time));
 
-	for (DWORD i = 0; i < _streams.size(); i++)
+	for (uint32_t i = 0; i < _streams.size(); i++)
 	{
 		RETURN_IF_FAILED(_streams[i]->Stop());
 		RETURN_IF_FAILED(_descriptor->DeselectStream(i));
@@ -295,7 +297,7 @@ STDMETHODIMP MediaSource::SetD3DManager(IUnknown* pManager)
 	RETURN_HR_IF_NULL(E_POINTER, pManager);
 	winrt::slim_lock_guard lock(_lock);
 
-	for (DWORD i = 0; i < _streams.size(); i++)
+	for (uint32_t i = 0; i < _streams.size(); i++)
 	{
 		RETURN_IF_FAILED(_streams[i]->SetD3DManager(pManager));
 	}
@@ -352,9 +354,39 @@ STDMETHODIMP_(NTSTATUS) MediaSource::KsProperty(PKSPROPERTY property, ULONG leng
 
 	WINTRACE(L"MediaSource::KsProperty prop:%s", PKSIDENTIFIER_ToString(property, length).c_str());
 
-	// right now, we don't expose any property, but this is where we'll typically be asked for
+	// video ProcAmp values are applied by the streams' frame generators
+	if (property->Set == PROPSETID_VIDCAP_VIDEOPROCAMP)
+	{
+		auto changed = false;
+		auto hr = ProcAmpKsProperty(_procAmp, property, length, data, dataLength, bytesReturned, changed);
+		if (SUCCEEDED(hr) && changed)
+		{
+			for (uint32_t i = 0; i < _streams.size(); i++)
+			{
+				_streams[i]->SetProcAmp(_procAmp);
+			}
+		}
+		return hr;
+	}
+
+	// mirror & flip, applied by the streams' frame generators too
+	if (property->Set == PROPSETID_VIDCAP_VIDEOCONTROL)
+	{
+		auto changed = false;
+		auto hr = VideoControlKsProperty(_videoControlMode, (UINT)_streams.size(), property, length, data, dataLength, bytesReturned, changed);
+		if (SUCCEEDED(hr) && changed)
+		{
+			for (uint32_t i = 0; i < _streams.size(); i++)
+			{
+				_streams[i]->SetVideoControlMode(_videoControlMode);
+			}
+		}
+		return hr;
+	}
+
+	// this is where we'll typically be asked for other properties
 	// 
-	// KSPROPSETID_Pin, KSPROPSETID_Topology, PROPSETID_VIDCAP_CAMERACONTROL, PROPSETID_VIDCAP_VIDEOPROCAMP
+	// KSPROPSETID_Pin, KSPROPSETID_Topology, PROPSETID_VIDCAP_CAMERACONTROL
 	// PROPSETID_VIDCAP_CAMERACONTROL_REGION_OF_INTEREST, KSPROPERTYSETID_PerFrameSettingControl, KSPROPERTYSETID_ExtendedCameraControl
 	// 
 	// etc
@@ -41,7 +41,8 @@ public:
 
 public:
 	MediaSource() :
-		_streams(_numStreams)
+		_streams(_numStreams),
+		_videoControlMode(0)
 	{
 		SetBaseAttributesTraceName(L"MediaSourceAtts");
 		for (auto i = 0; i < _numStreams; i++)
@@ -83,5 +84,7 @@ private:
 	winrt::com_array<wil::com_ptr_nothrow<MediaStream>> _streams;
 	wil::com_ptr_nothrow<IMFMediaEventQueue> _queue;
 	wil::com_ptr_nothrow<IMFPresentationDescriptor> _descriptor;
+	ProcAmpSettings _procAmp;
+	LONG _videoControlMode; // shared by all streams (there's only one)
 };
 
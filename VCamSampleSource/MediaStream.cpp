@@ -3,6 +3,14 @@
 #include "Tools.h"
 #include "EnumNames.h"
 #include "MFTools.h"
+#include "Settings.h"
+#include "ProcAmp.h"
+#include "FrameStats.h"
+#include "FrameCrc.h"
+#include "ColorLut.h"
+#include "FrameBuffer.h"
+#include "FrameTiming.h"
+#include "AllocationCounter.h"
 #include "FrameGenerator.h"
 #include "MediaStream.h"
 #include "MediaSource.h"
@@ -18,24 +26,43 @@ HRESULT MediaStream::Initialize(IMFMediaSource* source, int index)
 	RETURN_IF_FAILED(SetUINT32(MF_DEVICESTREAM_FRAMESERVER_SHARED, 1));
 	RETURN_IF_FAILED(SetUINT32(MF_DEVICESTREAM_ATTRIBUTE_FRAMESOURCE_TYPES, MFFrameSourceTypes::MFFrameSourceTypes_Color));
 
+	// ask the device proxy to pass MJPG samples through instead of decoding them in the frame server
+	RETURN_IF_FAILED(SetUINT32(MF_DEVPROXY_COMPRESSED_MEDIATYPE_PASSTHROUGH_MODE, TRUE));
+
 	RETURN_IF_FAILED(MFCreateEventQueue(&_queue));
 
-	// set 1 here to force RGB32 only
-	auto types = wil::make_unique_cotaskmem_array<wil::com_ptr_nothrow<IMFMediaType>>(2);
+	// set 1 here to force RGB32 only, 2 for RGB32 & NV12 only
+	auto types = wil::make_unique_cotaskmem_array<wil::com_ptr_nothrow<IMFMediaType>>(3);
 
 #define NUM_IMAGE_COLS 1280 // 640
 #define NUM_IMAGE_ROWS 960 //480
 
+	// rotation changes the frame size, so it's a setting (read when the camera is created), while mirror & flip are controls
+	_rotation = GetSettingDWORD(L"Rotation", 0);
+	if (_rotation != 0 && _rotation != 90 && _rotation != 180 && _rotation != 270)
+	{
+		LOG_HR_MSG(E_INVALIDARG, "Invalid rotation %u, must be 0, 90, 180 or 270", _rotation);
+		_rotation = 0;
+	}
+
+	_width = NUM_IMAGE_COLS;
+	_height = NUM_IMAGE_ROWS;
+	if (_rotation == 90 || _rotation == 270)
+	{
+		_width = NUM_IMAGE_ROWS;
+		_height = NUM_IMAGE_COLS;
+	}
+
 	wil::com_ptr_nothrow<IMFMediaType> rgbType;
 	RETURN_IF_FAILED(MFCreateMediaType(&rgbType));
 	rgbType->SetGUID(MF_MT_MAJOR_TYPE, MFMediaType_Video);
 	rgbType->SetGUID(MF_MT_SUBTYPE, MFVideoFormat_RGB32);
-	MFSetAttributeSize(rgbType.get(), MF_MT_FRAME_SIZE, NUM_IMAGE_COLS, NUM_IMAGE_ROWS);
-	rgbType->SetUINT32(MF_MT_DEFAULT_STRIDE, NUM_IMAGE_COLS * 4);
+	MFSetAttributeSize(rgbType.get(), MF_MT_FRAME_SIZE, _width, _height);
+	rgbType->SetUINT32(MF_MT_DEFAULT_STRIDE, _width * 4);
 	rgbType->SetUINT32(MF_MT_INTERLACE_MODE, MFVideoInterlace_Progressive);
 	rgbType->SetUINT32(MF_MT_ALL_SAMPLES_INDEPENDENT, TRUE);
 	MFSetAttributeRatio(rgbType.get(), MF_MT_FRAME_RATE, 30, 1);
-	auto bitrate = (uint32_t)(NUM_IMAGE_COLS * NUM_IMAGE_ROWS * 4 * 8 * 30);
+	auto bitrate = (uint32_t)(Rgb32View::GetSize(_width * 4, _height) * 8 * 30);
 	rgbType->SetUINT32(MF_MT_AVG_BITRATE, bitrate);
 	MFSetAttributeRatio(rgbType.get(), MF_MT_PIXEL_ASPECT_RATIO, 1, 1);
 	types[0] = rgbType.detach();
@@ -48,16 +75,34 @@ HRESULT MediaStream::Initialize(IMFMediaSource* source, int index)
 		nv12Type->SetGUID(MF_MT_SUBTYPE, MFVideoFormat_NV12);
 		nv12Type->SetUINT32(MF_MT_INTERLACE_MODE, MFVideoInterlace_Progressive);
 		nv12Type->SetUINT32(MF_MT_ALL_SAMPLES_INDEPENDENT, TRUE);
-		MFSetAttributeSize(nv12Type.get(), MF_MT_FRAME_SIZE, NUM_IMAGE_COLS, NUM_IMAGE_ROWS);
-		nv12Type->SetUINT32(MF_MT_DEFAULT_STRIDE, (UINT)(NUM_IMAGE_COLS * 1.5));
+		MFSetAttributeSize(nv12Type.get(), MF_MT_FRAME_SIZE, _width, _height);
+		nv12Type->SetUINT32(MF_MT_DEFAULT_STRIDE, _width); // of the luma plane, the UV plane has the same stride
 		MFSetAttributeRatio(nv12Type.get(), MF_MT_FRAME_RATE, 30, 1);
 		// frame size * pixel bit size * framerate
-		bitrate = (uint32_t)(NUM_IMAGE_COLS * 1.5 * NUM_IMAGE_ROWS * 8 * 30);
+		bitrate = (uint32_t)(Nv12View::GetSize(_width, _height) * 8 * 30);
 		nv12Type->SetUINT32(MF_MT_AVG_BITRATE, bitrate);
 		MFSetAttributeRatio(nv12Type.get(), MF_MT_PIXEL_ASPECT_RATIO, 1, 1);
 		types[1] = nv12Type.detach();
 	}
 
+	if (types.size() > 2)
+	{
+		wil::com_ptr_nothrow<IMFMediaType> mjpgType;
+		RETURN_IF_FAILED(MFCreateMediaType(&mjpgType));
+		mjpgType->SetGUID(MF_MT_MAJOR_TYPE, MFMediaType_Video);
+		mjpgType->SetGUID(MF_MT_SUBTYPE, MFVideoFormat_MJPG);
+		mjpgType->SetUINT32(MF_MT_INTERLACE_MODE, MFVideoInterlace_Progressive);
+		mjpgType->SetUINT32(MF_MT_ALL_SAMPLES_INDEPENDENT, TRUE);
+		mjpgType->SetUINT32(MF_MT_COMPRESSED, TRUE);
+		MFSetAttributeSize(mjpgType.get(), MF_MT_FRAME_SIZE, _width, _height);
+		MFSetAttributeRatio(mjpgType.get(), MF_MT_FRAME_RATE, 30, 1);
+		// rough estimate, about 1/10 of NV12
+		bitrate = (uint32_t)(Nv12View::GetSize(_width, _height) * 8 * 30 / 10);
+		mjpgType->SetUINT32(MF_MT_AVG_BITRATE, bitrate);
+		MFSetAttributeRatio(mjpgType.get(), MF_MT_PIXEL_ASPECT_RATIO, 1, 1);
+		types[2] = mjpgType.detach();
+	}
+
 	RETURN_IF_FAILED_MSG(MFCreateStreamDescriptor(_index, (DWORD)types.size(), types.get(), &_descriptor), "MFCreateStreamDescriptor failed");
 
 	wil::com_ptr_nothrow<IMFMediaTypeHandler> handler;
@@ -75,24 +120,156 @@ HRESULT MediaStream::Start(IMFMediaType* type)
 	if (type)
 	{
 		RETURN_IF_FAILED(type->GetGUID(MF_MT_SUBTYPE, &_format));
-		WINTRACE(L"MediaStream::Start format: %s", GUID_ToStringW(_format).c_str());
+		if (FAILED(MFGetAttributeRatio(type, MF_MT_FRAME_RATE, &_fpsNumerator, &_fpsDenominator)) || !_fpsNumerator || !_fpsDenominator)
+		{
+			_fpsNumerator = 30;
+			_fpsDenominator = 1;
+		}
+		WINTRACE(L"MediaStream::Start format: %s fps: %u/%u", GUID_ToStringW(_format).c_str(), _fpsNumerator, _fpsDenominator);
+	}
+
+	// frame buffers the generator acquires from now on can be large pages, they're faulted in here and recycled when the stream restarts
+	FrameBufferPool::GetShared().SetLargePages(GetSettingDWORD(L"LargePages") != 0);
+
+	// the parallel parts of the frame path of all streams run on the shared scheduler's workers, their policy is the last started stream's
+	auto& scheduler = TaskScheduler::GetShared();
+	if (!scheduler.SetAffinity(GetSettingDWORD(L"SchedulerAffinityMask")))
+	{
+		LOG_HR_MSG(E_INVALIDARG, "Scheduler affinity mask 0x%08X cannot be set", GetSettingDWORD(L"SchedulerAffinityMask"));
+	}
+
+	if (!scheduler.SetPriority((ThreadPriority)std::min<DWORD>(GetSettingDWORD(L"SchedulerPriority"), (DWORD)ThreadPriority::RealTime)))
+	{
+		LOG_HR_MSG(E_ACCESSDENIED, "Scheduler priority cannot be set");
+	}
+	WINTRACE(L"MediaStream::Start stream:%i scheduler workers:%u", _index, scheduler.GetWorkerCount());
+
+	// requests run on the frame server's threads, which get the producer policy while they generate a frame, pinned to a processor of the mask
+	// that no other busy stream has if there's one
+	_producerPriority = (ThreadPriority)std::min<DWORD>(GetSettingDWORD(L"ProducerPriority"), (DWORD)ThreadPriority::RealTime);
+	_producerPolicyLogged = false;
+	ReleaseProducerProcessor();
+	auto producerMask = GetSettingDWORD(L"ProducerAffinityMask");
+	if (producerMask)
+	{
+		_producerProcessor = ProcessorReservations::GetShared().Reserve(producerMask);
+		if (_producerProcessor == THREAD_POLICY_NO_PROCESSOR)
+		{
+			LOG_HR_MSG(E_INVALIDARG, "Producer affinity mask 0x%08X has no processor of the process", producerMask);
+		}
 	}
+	WINTRACE(L"MediaStream::Start stream:%i producer priority:%u processor:%i", _index, (UINT)_producerPriority, (int)_producerProcessor);
 
 	// at this point, set D3D manager may have not been called
 	// so we want to create a D2D1 renter target anyway
-	RETURN_IF_FAILED(_generator.EnsureRenderTarget(NUM_IMAGE_COLS, NUM_IMAGE_ROWS));
-
-	RETURN_IF_FAILED(_allocator->InitializeSampleAllocator(10, type));
+	RETURN_IF_FAILED(_generator.EnsureRenderTarget(_width, _height));
+	_generator.SetRotation(_rotation);
+	RETURN_IF_FAILED(_generator.StartFrameSource(_fpsNumerator, _fpsDenominator));
+	RETURN_IF_FAILED(_generator.StartColorLut());
+	RETURN_IF_FAILED(_generator.StartOverlays());
+	RETURN_IF_FAILED(_generator.StartChromaKey(_fpsNumerator, _fpsDenominator));
+	_generator.StartFilter();
+	_generator.StartFrameStats();
+	_generator.StartFrameCode();
+	_generator.StartFrameCrc();
+	RETURN_IF_FAILED(_generator.StartFrameDedup(_format));
+
+	// a window of frames is recorded for a trace only when there's a directory to write it to (the frame server service must be able to write there)
+	_timingTraceDirectory = GetSettingString(L"TimingTraceDirectory");
+	_timing.Reset(1000000ull * _fpsDenominator / _fpsNumerator, GetSettingDWORD(L"TimingTraceFirstFrame"), _timingTraceDirectory.empty() ? 0 : GetSettingDWORD(L"TimingTraceFrames", 300));
+
+	// once the caches, pools & converters are warm, a request allocates nothing
+	_allocationWarmupFrames = GetSettingDWORD(L"AllocationWarmupFrames", 30);
+	_requests = 0;
+	_allocatingFrames = 0;
+	_frameAllocations = 0;
+
+	if (_format == MFVideoFormat_MJPG)
+	{
+		// the allocator only handles uncompressed video, compressed samples come from our pool, their buffers start at the bitrate's
+		// estimate of a frame and grow when one doesn't fit
+		RETURN_IF_FAILED(_generator.StartJpegEncoder());
+		if (!_jpegSamples)
+		{
+			_jpegSamples = winrt::make_self<SamplePool>();
+		}
+		RETURN_IF_FAILED(_jpegSamples->Initialize(10, (DWORD)Nv12View::GetSize(_width, _height) / 10));
+	}
+	else
+	{
+		// on the GPU, NV12 samples are the video processor's output, so their textures must be render targets
+		wil::com_ptr_nothrow<IMFAttributes> attributes;
+		RETURN_IF_FAILED(MFCreateAttributes(&attributes, 1));
+		RETURN_IF_FAILED(attributes->SetUINT32(MF_SA_D3D11_BINDFLAGS, D3D11_BIND_SHADER_RESOURCE | D3D11_BIND_RENDER_TARGET));
+		auto hr = _allocator->InitializeSampleAllocatorEx(10, 10, attributes.get(), type);
+		if (FAILED(hr))
+		{
+			LOG_HR_MSG(hr, "Cannot allocate render target samples");
+			RETURN_IF_FAILED(_allocator->InitializeSampleAllocator(10, type));
+		}
+	}
 	RETURN_IF_FAILED(_queue->QueueEventParamVar(MEStreamStarted, GUID_NULL, S_OK, nullptr));
 	_state = MF_STREAM_STATE_RUNNING;
 	return S_OK;
 }
 
+// writes the recorded frames as Chrome trace-event JSON, one file per process & stream, to open in chrome://tracing or ui.perfetto.dev
+static HRESULT WriteTimingTrace(const std::wstring& path, const std::string& json)
+{
+	wil::unique_hfile file(CreateFile(path.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr));
+	RETURN_LAST_ERROR_IF_MSG(!file, "Cannot create '%ls'", path.c_str());
+
+	DWORD written;
+	RETURN_IF_WIN32_BOOL_FALSE(WriteFile(file.get(), json.data(), (DWORD)json.size(), &written, nullptr));
+	WINTRACE(L"WriteTimingTrace '%s' bytes:%u", path.c_str(), written);
+	return S_OK;
+}
+
 HRESULT MediaStream::Stop()
 {
 	RETURN_HR_IF(MF_E_SHUTDOWN, !_queue || !_allocator);
 
-	RETURN_IF_FAILED(_allocator->UninitializeSampleAllocator());
+	std::wstring tracePath;
+	std::string trace;
+	{
+		// RequestSample reads the source's frames under the lock, so it's stopped (and its memory freed) under it too
+		winrt::slim_lock_guard lock(_lock);
+		_generator.StopFrameSource();
+		ReleaseProducerProcessor();
+
+		// a partial window is written too
+		TraceTiming();
+		WINTRACE(L"MediaStream::Stop stream:%i requests:%I64u warm-up:%u allocating:%I64u allocations:%I64u", _index, _requests, _allocationWarmupFrames, _allocatingFrames, _frameAllocations);
+#if _DEBUG
+		auto pool = FrameBufferPool::GetShared().GetStats();
+		WINTRACE(L"MediaStream::Stop stream:%i frame buffers allocated:%I64u reused:%I64u large pages:%I64u huge page hints:%I64u large page failures:%I64u bytes:%I64u", _index, pool.allocated, pool.reused, pool.largePages, pool.hugePageHints, pool.largePageFailures, pool.bytes);
+		auto tasks = TaskScheduler::GetShared().GetStats();
+		WINTRACE(L"MediaStream::Stop stream:%i scheduler loops:%I64u ranges:%I64u steals:%I64u", _index, tasks.loops, tasks.ranges, tasks.steals);
+#endif
+
+		// the file is written once the lock is released, requests never wait for file I/O
+		if (_timing.GetRecordedFrames())
+		{
+			auto pid = GetCurrentProcessId();
+			tracePath = _timingTraceDirectory + L"\\VCamTiming-" + std::to_wstring(pid) + L"-" + std::to_wstring(_index) + L".json";
+			trace = _timing.GetChromeTrace(pid, _index, ("Stream " + std::to_string(_index)).c_str());
+			WINTRACE(L"MediaStream::Stop stream:%i timing trace frames:%u", _index, _timing.GetRecordedFrames());
+		}
+	}
+
+	if (!trace.empty())
+	{
+		LOG_IF_FAILED(WriteTimingTrace(tracePath, trace));
+	}
+
+	if (_format != MFVideoFormat_MJPG)
+	{
+		RETURN_IF_FAILED(_allocator->UninitializeSampleAllocator());
+	}
+	else if (_jpegSamples)
+	{
+		_jpegSamples->Uninitialize();
+	}
 	RETURN_IF_FAILED(_queue->QueueEventParamVar(MEStreamStopped, GUID_NULL, S_OK, nullptr));
 	_state = MF_STREAM_STATE_STOPPED;
 	return S_OK;
@@ -116,7 +293,7 @@ HRESULT MediaStream::SetD3DManager(IUnknown* manager)
 
 	// comment these 2 lines to force CPU usage
 	RETURN_IF_FAILED(_allocator->SetDirectXManager(manager));
-	RETURN_IF_FAILED(_generator.SetD3DManager(manager, NUM_IMAGE_COLS, NUM_IMAGE_ROWS));
+	RETURN_IF_FAILED(_generator.SetD3DManager(manager, _width, _height));
 	return S_OK;
 }
 
@@ -131,6 +308,29 @@ void MediaStream::Shutdown()
 	_descriptor.reset();
 	_source.reset();
 	_attributes.reset();
+	ReleaseProducerProcessor();
+}
+
+// the LUT is baked outside of the lock so frame requests don't wait for it, and the previous one is freed after it's released
+void MediaStream::SetProcAmp(const ProcAmpSettings& settings)
+{
+	ColorAdjust adjust;
+	adjust.Update(settings);
+	ColorLut lut;
+	{
+		winrt::slim_lock_guard lock(_lock);
+		_generator.CopyColorLut(lut);
+	}
+
+	FrameGenerator::BakeColorLut(lut, adjust);
+	winrt::slim_lock_guard lock(_lock);
+	_generator.SetProcAmp(adjust, lut);
+}
+
+void MediaStream::SetVideoControlMode(LONG mode)
+{
+	winrt::slim_lock_guard lock(_lock);
+	_generator.SetMirrorFlip((mode & KS_VideoControlFlag_FlipHorizontal) != 0, (mode & KS_VideoControlFlag_FlipVertical) != 0);
 }
 
 // IMFMediaEventGenerator
@@ -208,23 +408,104 @@ STDMETHODIMP MediaStream::RequestSample(IUnknown* pToken)
 	winrt::slim_lock_guard lock(_lock);
 	RETURN_HR_IF(MF_E_SHUTDOWN, !_allocator || !_queue);
 
+	// the thread isn't ours, its priority & affinity are restored when the request returns
+	ThreadPolicyScope policy(_producerPriority, _producerProcessor != THREAD_POLICY_NO_PROCESSOR ? 1ull << _producerProcessor : 0);
+	if (!policy.IsApplied() && !_producerPolicyLogged)
+	{
+		LOG_HR_MSG(E_ACCESSDENIED, "Stream %i producer priority %u or processor %i cannot be set", _index, (UINT)_producerPriority, (int)_producerProcessor);
+		_producerPolicyLogged = true;
+	}
+
+	AllocationScope allocations;
+	auto checkAllocations = wil::scope_exit([&]
+		{
+			CheckAllocations(allocations.GetAllocations());
+		});
+
+	FrameRequestTimer requestTimer(_timing);
 	wil::com_ptr_nothrow<IMFSample> sample;
-	RETURN_IF_FAILED(_allocator->AllocateSample(&sample));
+	{
+		FrameStageTimer timer(_timing, FrameStage::Allocate);
+		if (_format == MFVideoFormat_MJPG)
+		{
+			RETURN_IF_FAILED(_jpegSamples->AllocateSample(&sample));
+		}
+		else
+		{
+			RETURN_IF_FAILED(_allocator->AllocateSample(&sample));
+		}
+	}
 	RETURN_IF_FAILED(sample->SetSampleTime(MFGetSystemTime()));
-	RETURN_IF_FAILED(sample->SetSampleDuration(333333));
+	RETURN_IF_FAILED(sample->SetSampleDuration(10000000ll * _fpsDenominator / _fpsNumerator));
 
 	// generate frame
 	wil::com_ptr_nothrow<IMFSample> outSample;
-	RETURN_IF_FAILED(_generator.Generate(sample.get(), _format, &outSample));
+	{
+		FrameStageTimer timer(_timing, FrameStage::Generate);
+		RETURN_IF_FAILED(_generator.Generate(sample.get(), _format, &outSample));
+	}
 
-	if (pToken)
 	{
-		RETURN_IF_FAILED(outSample->SetUnknown(MFSampleExtension_Token, pToken));
+		FrameStageTimer timer(_timing, FrameStage::Attributes);
+		if (pToken)
+		{
+			RETURN_IF_FAILED(outSample->SetUnknown(MFSampleExtension_Token, pToken));
+		}
+
+		VCAM_FRAME_STATS stats;
+		if (_generator.GetFrameStats(stats))
+		{
+			RETURN_IF_FAILED(outSample->SetBlob(MFSampleExtension_VCamFrameStats, (const UINT8*)&stats, sizeof(stats)));
+		}
+
+		UINT crcs[FRAME_CRC_MAX_PLANES];
+		auto crcCount = _generator.GetFrameCrcs(crcs);
+		if (crcCount)
+		{
+			RETURN_IF_FAILED(outSample->SetBlob(MFSampleExtension_VCamFrameCrc, (const UINT8*)crcs, crcCount * sizeof(UINT)));
+		}
 	}
+
+	FrameStageTimer timer(_timing, FrameStage::Queue);
 	RETURN_IF_FAILED(_queue->QueueEventParamUnk(MEMediaSample, GUID_NULL, S_OK, outSample.get()));
 	return S_OK;
 }
 
+// the global operators of this module only count its own allocations, not those of Media Foundation or Direct2D
+void MediaStream::CheckAllocations(ULONGLONG allocations)
+{
+	_requests++;
+	if (!_allocationWarmupFrames || _requests <= _allocationWarmupFrames || !allocations)
+		return;
+
+	if (!_allocatingFrames)
+	{
+		LOG_HR_MSG(E_UNEXPECTED, "Stream %i request %I64u allocated %I64u time(s) after %u warm-up requests", _index, _requests, allocations, _allocationWarmupFrames);
+	}
+	_allocatingFrames++;
+	_frameAllocations += allocations;
+}
+
+void MediaStream::ReleaseProducerProcessor()
+{
+	ProcessorReservations::GetShared().Release(_producerProcessor);
+	_producerProcessor = THREAD_POLICY_NO_PROCESSOR;
+}
+
+// durations in microseconds, over is the number of requests longer than a frame
+void MediaStream::TraceTiming() const
+{
+	for (int i = 0; i < (int)FrameStage::Count; i++)
+	{
+		auto& histogram = _timing.GetHistogram((FrameStage)i);
+		if (!histogram.GetCount())
+			continue;
+
+		WINTRACE(L"MediaStream::TraceTiming stream:%i %S count:%I64u mean:%I64u p50:%I64u p99:%I64u max:%I64u over:%I64u", _index, GetFrameStageName((FrameStage)i),
+			histogram.GetCount(), histogram.GetMean(), histogram.GetPercentile(50), histogram.GetPercentile(99), histogram.GetMaximum(), histogram.GetOverBudget());
+	}
+}
+
 // IMFMediaStream2
 STDMETHODIMP MediaStream::SetStreamState(MF_STREAM_STATE value)
 {
@@ -1,5 +1,7 @@
 #pragma once
 
+#include "SamplePool.h"
+
 struct MediaStream : winrt::implements<MediaStream, CBaseAttributes<IMFAttributes>, IMFMediaStream2, IKsControl>
 {
 public:
@@ -27,7 +29,19 @@ public:
 	MediaStream() :
 		_index(0),
 		_state(MF_STREAM_STATE_STOPPED),
-		_format(GUID_NULL)
+		_format(GUID_NULL),
+		_fpsNumerator(30),
+		_fpsDenominator(1),
+		_rotation(0),
+		_width(0),
+		_height(0),
+		_allocationWarmupFrames(0),
+		_requests(0),
+		_allocatingFrames(0),
+		_frameAllocations(0),
+		_producerPriority(ThreadPriority::Normal),
+		_producerProcessor(THREAD_POLICY_NO_PROCESSOR),
+		_producerPolicyLogged(false)
 	{
 		SetBaseAttributesTraceName(L"MediaStreamAtts");
 	}
@@ -39,8 +53,14 @@ public:
 	HRESULT Start(IMFMediaType* type);
 	HRESULT Stop();
 	void Shutdown();
+	void SetProcAmp(const ProcAmpSettings& settings);
+	void SetVideoControlMode(LONG mode); // KS_VideoControlFlag_FlipHorizontal & KS_VideoControlFlag_FlipVertical
 
 private:
+	void TraceTiming() const;
+	void CheckAllocations(ULONGLONG allocations);
+	void ReleaseProducerProcessor();
+
 #if _DEBUG
 	int32_t query_interface_tearoff(winrt::guid const& id, void** object) const noexcept override
 	{
@@ -52,9 +72,24 @@ private:
 	MF_STREAM_STATE _state;
 	FrameGenerator _generator;
 	GUID _format;
+	UINT32 _fpsNumerator;
+	UINT32 _fpsDenominator;
+	DWORD _rotation;
+	UINT _width; // of the emitted frames, rotated
+	UINT _height;
 	wil::com_ptr_nothrow<IMFStreamDescriptor> _descriptor;
 	wil::com_ptr_nothrow<IMFMediaEventQueue> _queue;
 	wil::com_ptr_nothrow<IMFMediaSource> _source;
 	wil::com_ptr_nothrow<IMFVideoSampleAllocatorEx> _allocator;
+	winrt::com_ptr<SamplePool> _jpegSamples; // the allocator only handles uncompressed video
 	int _index;
+	FrameTiming _timing; // of the stages of RequestSample
+	std::wstring _timingTraceDirectory;
+	UINT _allocationWarmupFrames; // requests after these must not allocate, 0 doesn't check
+	ULONGLONG _requests;
+	ULONGLONG _allocatingFrames; // after the warm-up
+	ULONGLONG _frameAllocations;
+	ThreadPriority _producerPriority; // of the frame server's thread while it requests a sample
+	UINT _producerProcessor; // reserved for this stream, THREAD_POLICY_NO_PROCESSOR when requests aren't pinned
+	bool _producerPolicyLogged; // the system refused the policy
 };
\ No newline at end of file
@@ -0,0 +1,376 @@
+#include "pch.h"
+#include "Tools.h"
+#include "FrameBuffer.h"
+#include "ColorConvert.h"
+#include "Settings.h"
+#include "FrameSource.h"
+#include "ImageFrameSource.h"
+#include "Overlay.h"
+
+#if defined(_M_IX86) || defined(_M_X64)
+#define OVERLAY_SSE
+#endif
+
+#define OVERLAY_MAX_SIZE 8192
+#define OVERLAY_SETTING_NAME_SIZE 32
+#define HNS_PER_S 10000000
+
+// value / 255 rounded, exact for products of two bytes
+static inline UINT Div255(UINT value)
+{
+	value += 128;
+	return (value + (value >> 8)) >> 8;
+}
+
+#if defined(OVERLAY_SSE)
+// value * factor / 255 rounded, on 16-bit lanes holding bytes
+static inline __m128i MulDiv255(__m128i value, __m128i factor)
+{
+	auto product = _mm_add_epi16(_mm_mullo_epi16(value, factor), _mm_set1_epi16(128));
+	return _mm_srli_epi16(_mm_add_epi16(product, _mm_srli_epi16(product, 8)), 8);
+}
+#endif
+
+// dst = src + dst * (1 - alpha), for planes where each byte has its own alpha (luma & interleaved chroma)
+static void BlendRow(const BYTE* src, const BYTE* alpha, BYTE* dst, UINT count)
+{
+	UINT i = 0;
+#if defined(OVERLAY_SSE)
+	auto zero = _mm_setzero_si128();
+	auto full = _mm_set1_epi16(255);
+	for (; i + 16 <= count; i += 16)
+	{
+		auto a = _mm_loadu_si128((const __m128i*)(alpha + i));
+		auto d = _mm_loadu_si128((const __m128i*)(dst + i));
+		auto lo = MulDiv255(_mm_unpacklo_epi8(d, zero), _mm_sub_epi16(full, _mm_unpacklo_epi8(a, zero)));
+		auto hi = MulDiv255(_mm_unpackhi_epi8(d, zero), _mm_sub_epi16(full, _mm_unpackhi_epi8(a, zero)));
+		_mm_storeu_si128((__m128i*)(dst + i), _mm_adds_epu8(_mm_loadu_si128((const __m128i*)(src + i)), _mm_packus_epi16(lo, hi)));
+	}
+#endif
+	for (; i < count; i++)
+	{
+		dst[i] = (BYTE)std::min<UINT>(255, src[i] + Div255(dst[i] * (255 - alpha[i])));
+	}
+}
+
+// same for BGRA pixels, where alpha is the 4th byte of each pixel
+static void BlendRowBGRA(const BYTE* src, BYTE* dst, UINT count)
+{
+	UINT i = 0;
+#if defined(OVERLAY_SSE)
+	auto zero = _mm_setzero_si128();
+	auto full = _mm_set1_epi16(255);
+	for (; i + 4 <= count; i += 4)
+	{
+		auto s = _mm_loadu_si128((const __m128i*)(src + i * 4));
+		auto d = _mm_loadu_si128((const __m128i*)(dst + i * 4));
+		auto sl = _mm_unpacklo_epi8(s, zero);
+		auto sh = _mm_unpackhi_epi8(s, zero);
+		auto al = _mm_shufflehi_epi16(_mm_shufflelo_epi16(sl, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+		auto ah = _mm_shufflehi_epi16(_mm_shufflelo_epi16(sh, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+		auto lo = MulDiv255(_mm_unpacklo_epi8(d, zero), _mm_sub_epi16(full, al));
+		auto hi = MulDiv255(_mm_unpackhi_epi8(d, zero), _mm_sub_epi16(full, ah));
+		_mm_storeu_si128((__m128i*)(dst + i * 4), _mm_adds_epu8(s, _mm_packus_epi16(lo, hi)));
+	}
+#endif
+	for (; i < count; i++)
+	{
+		auto inverse = 255 - src[i * 4 + 3];
+		for (UINT c = 0; c < 4; c++)
+		{
+			dst[i * 4 + c] = (BYTE)std::min<UINT>(255, src[i * 4 + c] + Div255(dst[i * 4 + c] * inverse));
+		}
+	}
+}
+
+HRESULT OverlayCompositor::Load()
+{
+	Reset();
+	for (UINT i = 1; i <= OVERLAY_MAX_LAYERS; i++)
+	{
+		wchar_t name[OVERLAY_SETTING_NAME_SIZE];
+		wsprintf(name, L"Overlay%u", i);
+		auto path = GetSettingString(name);
+		if (path.empty())
+			continue;
+
+		wsprintf(name, L"Overlay%uX", i);
+		auto x = (LONG)GetSettingDWORD(name);
+		wsprintf(name, L"Overlay%uY", i);
+		auto y = (LONG)GetSettingDWORD(name);
+		wsprintf(name, L"Overlay%uScroll", i);
+		auto scrollSpeed = GetSettingDWORD(name);
+
+		// don't fail the stream, just skip the layer
+		UINT width, height;
+		std::unique_ptr<BYTE[]> pixels;
+		auto hr = ImageFrameSource::Decode(path.c_str(), width, height, pixels);
+		if (SUCCEEDED(hr))
+		{
+			hr = AddLayer(pixels.get(), width, height, x, y, scrollSpeed);
+		}
+
+		if (FAILED(hr))
+		{
+			LOG_HR_MSG(hr, "Overlay '%ls' cannot be loaded", path.c_str());
+			continue;
+		}
+		WINTRACE(L"OverlayCompositor::Load '%s' %u x %u at %i,%i scroll:%u", path.c_str(), width, height, x, y, scrollSpeed);
+	}
+
+	_startTime = MFGetSystemTime();
+	return S_OK;
+}
+
+void OverlayCompositor::Reset()
+{
+	for (auto& layer : _layers)
+	{
+		layer = OverlayLayer();
+	}
+	_count = 0;
+}
+
+HRESULT OverlayCompositor::AddLayer(const BYTE* bgra, UINT width, UINT height, LONG x, LONG y, UINT scrollSpeed)
+{
+	RETURN_HR_IF_NULL(E_POINTER, bgra);
+	RETURN_HR_IF_MSG(E_INVALIDARG, !width || !height || width > OVERLAY_MAX_SIZE || height > OVERLAY_MAX_SIZE, "Invalid overlay size %u x %u", width, height);
+	RETURN_HR_IF_MSG(E_NOT_VALID_STATE, _count == OVERLAY_MAX_LAYERS, "Too many overlays");
+
+	// even sizes & positions keep NV12 chroma aligned
+	OverlayLayer layer;
+	layer.width = (width + 1) & ~1;
+	layer.height = (height + 1) & ~1;
+	layer.x = x & ~1;
+	layer.y = y & ~1;
+	layer.scrollSpeed = scrollSpeed;
+
+	auto w = layer.width;
+	auto h = layer.height;
+	layer.bgra = std::make_unique<BYTE[]>((SIZE_T)w * h * 4); // zeroed, so padding is transparent
+	CopyPlane(bgra, width * 4, width * 4, height, layer.bgra.get(), w * 4);
+
+	// classify tiles once, so transparent areas cost nothing & opaque areas are just copied
+	layer.tilesX = (w + OVERLAY_TILE - 1) / OVERLAY_TILE;
+	layer.tilesY = (h + OVERLAY_TILE - 1) / OVERLAY_TILE;
+	layer.tiles = std::make_unique<BYTE[]>((SIZE_T)layer.tilesX * layer.tilesY);
+	for (UINT ty = 0; ty < layer.tilesY; ty++)
+	{
+		for (UINT tx = 0; tx < layer.tilesX; tx++)
+		{
+			// premultiplied pixels with a zero alpha but some color add light, they're not transparent
+			auto empty = true;
+			auto opaque = true;
+			for (UINT py = ty * OVERLAY_TILE; py < std::min<UINT>((ty + 1) * OVERLAY_TILE, h); py++)
+			{
+				auto pixel = (const UINT*)(layer.bgra.get() + (SIZE_T)py * w * 4);
+				for (UINT px = tx * OVERLAY_TILE; px < std::min<UINT>((tx + 1) * OVERLAY_TILE, w); px++)
+				{
+					empty &= pixel[px] == 0;
+					opaque &= (pixel[px] >> 24) == 0xFF;
+				}
+			}
+			layer.tiles[ty * layer.tilesX + tx] = empty ? OVERLAY_TILE_EMPTY : (opaque ? OVERLAY_TILE_OPAQUE : OVERLAY_TILE_PARTIAL);
+		}
+	}
+
+	// premultiplied BT.601 limited range: offsets are scaled by alpha like the colors, so transparent pixels are all zeros
+	layer.luma = std::make_unique<BYTE[]>((SIZE_T)w * h);
+	layer.lumaAlpha = std::make_unique<BYTE[]>((SIZE_T)w * h);
+	layer.chroma = std::make_unique<BYTE[]>((SIZE_T)w * h / 2);
+	layer.chromaAlpha = std::make_unique<BYTE[]>((SIZE_T)w * h / 2);
+	for (UINT py = 0; py < h; py += 2)
+	{
+		for (UINT px = 0; px < w; px += 2)
+		{
+			int r = 0, g = 0, b = 0, a = 0;
+			for (UINT i = 0; i < 4; i++)
+			{
+				auto offset = (SIZE_T)(py + i / 2) * w + px + i % 2;
+				auto pixel = layer.bgra.get() + offset * 4;
+				layer.luma[offset] = (BYTE)std::min<UINT>(255, ((66 * pixel[2] + 129 * pixel[1] + 25 * pixel[0] + 128) >> 8) + Div255(16 * pixel[3]));
+				layer.lumaAlpha[offset] = pixel[3];
+				b += pixel[0];
+				g += pixel[1];
+				r += pixel[2];
+				a += pixel[3];
+			}
+
+			r = (r + 2) / 4;
+			g = (g + 2) / 4;
+			b = (b + 2) / 4;
+			a = (a + 2) / 4;
+			auto uv = (SIZE_T)(py / 2) * w + px;
+			layer.chroma[uv] = (BYTE)std::clamp<int>(((-38 * r - 74 * g + 112 * b + 128) >> 8) + (int)Div255(128 * a), 0, 255);
+			layer.chroma[uv + 1] = (BYTE)std::clamp<int>(((112 * r - 94 * g - 18 * b + 128) >> 8) + (int)Div255(128 * a), 0, 255);
+			layer.chromaAlpha[uv] = (BYTE)a;
+			layer.chromaAlpha[uv + 1] = (BYTE)a;
+		}
+	}
+
+	_layers[_count++] = std::move(layer);
+	return S_OK;
+}
+
+// scrolling layers (tickers) move right to left, and repeat from their position to the right edge of the frame
+LONG OverlayCompositor::GetFirstX(const OverlayLayer& layer, MFTIME time) const
+{
+	if (!layer.scrollSpeed)
+		return layer.x;
+
+	auto elapsed = (ULONGLONG)std::max<MFTIME>(time - _startTime, 0);
+	auto offset = (LONG)((elapsed * layer.scrollSpeed / HNS_PER_S) % layer.width) & ~1;
+	return layer.x - offset;
+}
+
+// FNV-1a of the scroll offsets
+ULONGLONG OverlayCompositor::GetState(MFTIME time) const
+{
+	ULONGLONG state = 0xCBF29CE484222325;
+	for (UINT i = 0; i < _count; i++)
+	{
+		if (_layers[i].scrollSpeed)
+		{
+			state = (state ^ (ULONG)GetFirstX(_layers[i], time)) * 0x100000001B3;
+		}
+	}
+	return state;
+}
+
+HRESULT OverlayCompositor::Compose(REFGUID format, BYTE* output, LONG outputStride, BYTE* uv, LONG uvStride, UINT width, UINT height, MFTIME time) const
+{
+	RETURN_HR_IF_NULL(E_POINTER, output);
+	RETURN_HR_IF(E_INVALIDARG, format != MFVideoFormat_RGB32 && format != MFVideoFormat_NV12);
+	RETURN_HR_IF(E_POINTER, format == MFVideoFormat_NV12 && !uv);
+	for (UINT i = 0; i < _count; i++)
+	{
+		auto& layer = _layers[i];
+		auto clipLeft = layer.scrollSpeed ? layer.x : 0;
+		for (auto x = GetFirstX(layer, time); x < (LONG)width; x += (LONG)layer.width)
+		{
+			RETURN_IF_FAILED(ComposeLayer(layer, format, output, outputStride, uv, uvStride, width, height, x, clipLeft));
+			if (!layer.scrollSpeed)
+				break;
+		}
+	}
+	return S_OK;
+}
+
+HRESULT OverlayCompositor::ComposeLayer(const OverlayLayer& layer, REFGUID format, BYTE* output, LONG outputStride, BYTE* uv, LONG uvStride, UINT width, UINT height, LONG x, LONG clipLeft) const
+{
+	// visible part, in layer coordinates, all even
+	auto left = (UINT)std::max<LONG>(std::max<LONG>(clipLeft, 0) - x, 0);
+	auto right = (UINT)std::max<LONG>(std::min<LONG>((LONG)width - x, (LONG)layer.width), 0);
+	auto top = (UINT)std::max<LONG>(-layer.y, 0);
+	auto bottom = (UINT)std::max<LONG>(std::min<LONG>((LONG)height - layer.y, (LONG)layer.height), 0);
+	if (left >= right || top >= bottom)
+		return S_OK;
+
+	auto nv12 = format == MFVideoFormat_NV12;
+	auto firstTileY = top / OVERLAY_TILE;
+	return ForEachBand((bottom - 1) / OVERLAY_TILE + 1 - firstTileY, 1, [&](UINT band, UINT)
+		{
+			auto ty = firstTileY + band;
+			auto rowTop = std::max<UINT>(ty * OVERLAY_TILE, top);
+			auto rowBottom = std::min<UINT>((ty + 1) * OVERLAY_TILE, bottom);
+			auto tiles = layer.tiles.get() + (SIZE_T)ty * layer.tilesX;
+
+			// consecutive tiles of the same kind are processed as one run
+			for (auto tx = left / OVERLAY_TILE; tx <= (right - 1) / OVERLAY_TILE;)
+			{
+				auto state = tiles[tx];
+				auto first = tx;
+				while (tx <= (right - 1) / OVERLAY_TILE && tiles[tx] == state)
+				{
+					tx++;
+				}
+
+				if (state == OVERLAY_TILE_EMPTY)
+					continue;
+
+				auto runLeft = std::max<UINT>(first * OVERLAY_TILE, left);
+				auto runRight = std::min<UINT>(tx * OVERLAY_TILE, right);
+				auto count = runRight - runLeft;
+				auto outX = x + (LONG)runLeft;
+				if (!nv12)
+				{
+					for (auto py = rowTop; py < rowBottom; py++)
+					{
+						auto src = layer.bgra.get() + ((SIZE_T)py * layer.width + runLeft) * 4;
+						auto dst = output + (ptrdiff_t)(layer.y + (LONG)py) * outputStride + (ptrdiff_t)outX * 4;
+						if (state == OVERLAY_TILE_OPAQUE)
+						{
+							CopyMemory(dst, src, (SIZE_T)count * 4);
+						}
+						else
+						{
+							BlendRowBGRA(src, dst, count);
+						}
+					}
+					continue;
+				}
+
+				for (auto py = rowTop; py < rowBottom; py++)
+				{
+					auto offset = (SIZE_T)py * layer.width + runLeft;
+					auto dst = output + (ptrdiff_t)(layer.y + (LONG)py) * outputStride + outX;
+					if (state == OVERLAY_TILE_OPAQUE)
+					{
+						CopyMemory(dst, layer.luma.get() + offset, count);
+					}
+					else
+					{
+						BlendRow(layer.luma.get() + offset, layer.lumaAlpha.get() + offset, dst, count);
+					}
+				}
+
+				// chroma rows hold count / 2 U & V pairs, so count bytes
+				for (auto py = rowTop / 2; py < rowBottom / 2; py++)
+				{
+					auto offset = (SIZE_T)py * layer.width + runLeft;
+					auto dst = uv + (ptrdiff_t)(layer.y / 2 + (LONG)py) * uvStride + outX;
+					if (state == OVERLAY_TILE_OPAQUE)
+					{
+						CopyMemory(dst, layer.chroma.get() + offset, count);
+					}
+					else
+					{
+						BlendRow(layer.chroma.get() + offset, layer.chromaAlpha.get() + offset, dst, count);
+					}
+				}
+			}
+		});
+}
+
+HRESULT OverlayCompositor::Draw(ID2D1RenderTarget* target, UINT width, MFTIME time)
+{
+	RETURN_HR_IF_NULL(E_POINTER, target);
+	for (UINT i = 0; i < _count; i++)
+	{
+		auto& layer = _layers[i];
+		if (!layer.bitmap)
+		{
+			auto props = D2D1::BitmapProperties(D2D1::PixelFormat(DXGI_FORMAT_B8G8R8A8_UNORM, D2D1_ALPHA_MODE_PREMULTIPLIED));
+			RETURN_IF_FAILED(target->CreateBitmap(D2D1::SizeU(layer.width, layer.height), layer.bgra.get(), layer.width * 4, props, &layer.bitmap));
+		}
+
+		if (layer.scrollSpeed)
+		{
+			target->PushAxisAlignedClip(D2D1::RectF((FLOAT)layer.x, (FLOAT)layer.y, (FLOAT)width, (FLOAT)(layer.y + (LONG)layer.height)), D2D1_ANTIALIAS_MODE_ALIASED);
+		}
+
+		for (auto x = GetFirstX(layer, time); x < (LONG)width; x += (LONG)layer.width)
+		{
+			auto rect = D2D1::RectF((FLOAT)x, (FLOAT)layer.y, (FLOAT)(x + (LONG)layer.width), (FLOAT)(layer.y + (LONG)layer.height));
+			target->DrawBitmap(layer.bitmap.get(), rect, 1, D2D1_BITMAP_INTERPOLATION_MODE_NEAREST_NEIGHBOR);
+			if (!layer.scrollSpeed)
+				break;
+		}
+
+		if (layer.scrollSpeed)
+		{
+			target->PopAxisAlignedClip();
+		}
+	}
+	return S_OK;
+}
\ No newline at end of file
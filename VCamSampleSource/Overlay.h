@@ -0,0 +1,74 @@
+#pragma once
+
+#define OVERLAY_MAX_LAYERS 8
+#define OVERLAY_TILE 32 // pixels, a multiple of 2 so NV12 chroma tiles are whole
+
+#define OVERLAY_TILE_EMPTY 0 // all pixels are fully transparent, the tile is skipped
+#define OVERLAY_TILE_PARTIAL 1 // blended
+#define OVERLAY_TILE_OPAQUE 2 // copied
+
+// a premultiplied BGRA image (logo, lower third, ticker) blended over the frames
+// it's pre-converted to premultiplied NV12 planes so it's blended in the frame's format, and it's split in tiles that are classified once
+struct OverlayLayer
+{
+	UINT width; // even, odd images are padded with transparent pixels
+	UINT height;
+	LONG x; // position in the frame, even
+	LONG y;
+	UINT scrollSpeed; // pixels per second, right to left, 0 for a still layer
+	UINT tilesX;
+	UINT tilesY;
+	std::unique_ptr<BYTE[]> tiles; // OVERLAY_TILE_XXX, tilesX per row
+	std::unique_ptr<BYTE[]> bgra; // premultiplied, width * 4 bytes per row
+	std::unique_ptr<BYTE[]> luma; // premultiplied, width bytes per row
+	std::unique_ptr<BYTE[]> lumaAlpha;
+	std::unique_ptr<BYTE[]> chroma; // premultiplied interleaved U & V, width bytes per row, height / 2 rows
+	std::unique_ptr<BYTE[]> chromaAlpha; // same layout as chroma, the alpha of each 2x2 block is repeated for U & V
+	wil::com_ptr_nothrow<ID2D1Bitmap> bitmap; // when drawn by D2D
+
+	OverlayLayer() :
+		width(0),
+		height(0),
+		x(0),
+		y(0),
+		scrollSpeed(0),
+		tilesX(0),
+		tilesY(0)
+	{
+	}
+};
+
+// blends overlay layers over the frames with the "over" operator, the cost is proportional to the area the layers cover, not to the frame size
+class OverlayCompositor
+{
+	OverlayLayer _layers[OVERLAY_MAX_LAYERS];
+	UINT _count;
+	MFTIME _startTime;
+
+	LONG GetFirstX(const OverlayLayer& layer, MFTIME time) const;
+	HRESULT ComposeLayer(const OverlayLayer& layer, REFGUID format, BYTE* output, LONG outputStride, BYTE* uv, LONG uvStride, UINT width, UINT height, LONG x, LONG clipLeft) const;
+
+public:
+	OverlayCompositor() :
+		_count(0),
+		_startTime(0)
+	{
+	}
+
+	// loads the layers configured in settings, layers that cannot be loaded are skipped
+	HRESULT Load();
+	void Reset();
+	bool HasLayers() const { return _count != 0; }
+
+	// changes when the layers move at that time, still layers always compose the same
+	ULONGLONG GetState(MFTIME time) const;
+
+	// bgra is premultiplied, width * 4 bytes per row
+	HRESULT AddLayer(const BYTE* bgra, UINT width, UINT height, LONG x, LONG y, UINT scrollSpeed);
+
+	// blends all layers over an RGB32 or NV12 frame (where uv is the chroma plane), time is the sample time
+	HRESULT Compose(REFGUID format, BYTE* output, LONG outputStride, BYTE* uv, LONG uvStride, UINT width, UINT height, MFTIME time) const;
+
+	// draws all layers with D2D, between BeginDraw & EndDraw, for frames that never come back to the CPU
+	HRESULT Draw(ID2D1RenderTarget* target, UINT width, MFTIME time);
+};
\ No newline at end of file
@@ -0,0 +1,569 @@
+#include "PipCompositor.h"
+#include <cstring>
+#include <algorithm>
+#if defined(_M_IX86) || defined(_M_X64) || defined(__SSE2__)
+#include <emmintrin.h>
+#define PIP_SSE
+#endif
+
+#define PIP_BAND_ROWS 16 // rows of the main frame composed at once, while they're in the cache
+#define PIP_PATTERN_PERIOD 40000000 // 100ns units for the bars to scroll a whole width
+#define PIP_MAX_SIZE 8192
+
+// BT.601 limited range, same as the media source conversions
+static inline uint8_t Clamp255(int value)
+{
+	return (uint8_t)(value < 0 ? 0 : (value > 255 ? 255 : value));
+}
+
+static inline uint8_t RgbToY(int r, int g, int b)
+{
+	return (uint8_t)(((66 * r + 129 * g + 25 * b + 128) >> 8) + 16);
+}
+
+static inline uint8_t RgbToU(int r, int g, int b)
+{
+	return (uint8_t)(((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128);
+}
+
+static inline uint8_t RgbToV(int r, int g, int b)
+{
+	return (uint8_t)(((112 * r - 94 * g - 18 * b + 128) >> 8) + 128);
+}
+
+static void Rgb32ToNv12(const uint8_t* input, uint32_t width, uint32_t height, uint8_t* y, uint8_t* uv)
+{
+	for (uint32_t row = 0; row < height; row++)
+	{
+		auto rgb = input + (size_t)row * width * 4;
+		auto luma = y + (size_t)row * width;
+		for (uint32_t x = 0; x < width; x++)
+		{
+			luma[x] = RgbToY(rgb[x * 4 + 2], rgb[x * 4 + 1], rgb[x * 4]);
+		}
+
+		// chroma of the top left pixel of each 2x2 block
+		if (!(row & 1))
+		{
+			auto chroma = uv + (size_t)(row / 2) * width;
+			for (uint32_t x = 0; x < width; x += 2)
+			{
+				chroma[x] = RgbToU(rgb[x * 4 + 2], rgb[x * 4 + 1], rgb[x * 4]);
+				chroma[x + 1] = RgbToV(rgb[x * 4 + 2], rgb[x * 4 + 1], rgb[x * 4]);
+			}
+		}
+	}
+}
+
+static void Nv12ToRgb32(const uint8_t* y, const uint8_t* uv, uint32_t width, uint32_t height, uint8_t* output)
+{
+	for (uint32_t row = 0; row < height; row++)
+	{
+		auto luma = y + (size_t)row * width;
+		auto chroma = uv + (size_t)(row / 2) * width;
+		auto rgb = output + (size_t)row * width * 4;
+		for (uint32_t x = 0; x < width; x++)
+		{
+			auto c = 298 * (luma[x] - 16);
+			auto d = chroma[x & ~1u] - 128;
+			auto e = chroma[x | 1u] - 128;
+			rgb[x * 4] = Clamp255((c + 516 * d + 128) >> 8);
+			rgb[x * 4 + 1] = Clamp255((c - 100 * d - 208 * e + 128) >> 8);
+			rgb[x * 4 + 2] = Clamp255((c + 409 * e + 128) >> 8);
+			rgb[x * 4 + 3] = 0xFF;
+		}
+	}
+}
+
+static void InterleaveRow(const uint8_t* u, const uint8_t* v, uint32_t width, uint8_t* uv)
+{
+	for (uint32_t x = 0; x < width; x++)
+	{
+		uv[x * 2] = u[x];
+		uv[x * 2 + 1] = v[x];
+	}
+}
+
+bool PipPatternSource::Start(uint32_t width, uint32_t height, uint32_t fpsNumerator, uint32_t fpsDenominator)
+{
+	(void)fpsNumerator;
+	(void)fpsDenominator;
+	if (!width || !height || (width & 1) || (height & 1) || width > PIP_MAX_SIZE || height > PIP_MAX_SIZE)
+		return false;
+
+	_width = width;
+	_height = height;
+	_frame.reset(new (std::nothrow) uint8_t[(size_t)width * height * 4]);
+	return _frame != nullptr;
+}
+
+bool PipPatternSource::GetFrame(int64_t time, PipFormat preferredFormat, PipFrame& frame)
+{
+	if (!_frame)
+		return false;
+
+	// all rows are the same, so the first one is built and copied
+	auto offset = (uint64_t)std::max<int64_t>(time, 0) % PIP_PATTERN_PERIOD * _width / PIP_PATTERN_PERIOD;
+	auto bar = [&](uint32_t x)
+		{
+			auto index = (uint32_t)((x + offset) * 8 / _width % 8);
+			return (uint32_t)(((index & 4) ? 0xFF0000 : 0) | ((index & 2) ? 0xFF00 : 0) | ((index & 1) ? 0xFF : 0)); // RGB
+		};
+
+	auto pixels = _frame.get();
+	frame = {};
+	frame.width = _width;
+	frame.height = _height;
+	if (preferredFormat == PipFormat::Rgb32)
+	{
+		for (uint32_t x = 0; x < _width; x++)
+		{
+			auto rgb = bar(x);
+			pixels[x * 4] = (uint8_t)rgb;
+			pixels[x * 4 + 1] = (uint8_t)(rgb >> 8);
+			pixels[x * 4 + 2] = (uint8_t)(rgb >> 16);
+			pixels[x * 4 + 3] = 0xFF;
+		}
+
+		for (uint32_t y = 1; y < _height; y++)
+		{
+			memcpy(pixels + (size_t)y * _width * 4, pixels, (size_t)_width * 4);
+		}
+
+		frame.format = PipFormat::Rgb32;
+		frame.planes[0] = pixels;
+		frame.strides[0] = (int32_t)(_width * 4);
+		return true;
+	}
+
+	auto uv = pixels + (size_t)_width * _height;
+	for (uint32_t x = 0; x < _width; x++)
+	{
+		auto rgb = bar(x);
+		int r = (rgb >> 16) & 0xFF, g = (rgb >> 8) & 0xFF, b = rgb & 0xFF;
+		pixels[x] = RgbToY(r, g, b);
+		uv[x] = (x & 1) ? RgbToV(r, g, b) : RgbToU(r, g, b);
+	}
+
+	for (uint32_t y = 1; y < _height; y++)
+	{
+		memcpy(pixels + (size_t)y * _width, pixels, _width);
+	}
+
+	for (uint32_t y = 1; y < _height / 2; y++)
+	{
+		memcpy(uv + (size_t)y * _width, uv, _width);
+	}
+
+	frame.format = PipFormat::Nv12;
+	frame.planes[0] = pixels;
+	frame.planes[1] = uv;
+	frame.strides[0] = (int32_t)_width;
+	frame.strides[1] = (int32_t)_width;
+	return true;
+}
+
+void PipPatternSource::Stop()
+{
+	_frame.reset();
+}
+
+bool PlaneScaler::Initialize(uint32_t inputWidth, uint32_t inputHeight, uint32_t outputWidth, uint32_t outputHeight, uint32_t channels)
+{
+	if (!inputWidth || !inputHeight || !outputWidth || !outputHeight || (channels != 1 && channels != 2 && channels != 4))
+		return false;
+
+	if (inputWidth == _inputWidth && inputHeight == _inputHeight && outputWidth == _outputWidth && outputHeight == _outputHeight && channels == _channels)
+		return true;
+
+	_xOffsets.reset(new (std::nothrow) uint32_t[(size_t)outputWidth * 2]);
+	_xWeights.reset(new (std::nothrow) uint16_t[outputWidth]);
+	_rows.reset(new (std::nothrow) uint8_t[(size_t)outputWidth * channels * 2]);
+	if (!_xOffsets || !_xWeights || !_rows)
+		return false;
+
+	// pixel centers are aligned, as in most scalers, in 16.16 fixed point
+	auto step = ((uint64_t)inputWidth << 16) / outputWidth;
+	for (uint32_t x = 0; x < outputWidth; x++)
+	{
+		auto position = std::max<int64_t>((int64_t)(x * step + step / 2) - 0x8000, 0);
+		auto left = std::min<uint32_t>((uint32_t)(position >> 16), inputWidth - 1);
+		_xOffsets[x * 2] = left * channels;
+		_xOffsets[x * 2 + 1] = std::min<uint32_t>(left + 1, inputWidth - 1) * channels;
+		_xWeights[x] = (uint16_t)(((position & 0xFFFF) + 0x80) >> 8);
+	}
+
+	_inputWidth = inputWidth;
+	_inputHeight = inputHeight;
+	_outputWidth = outputWidth;
+	_outputHeight = outputHeight;
+	_channels = channels;
+	return true;
+}
+
+void PlaneScaler::ScaleRow(const uint8_t* input, uint8_t* output) const
+{
+	uint32_t x = 0;
+#if defined(PIP_SSE)
+	if (_channels == 4)
+	{
+		// both pixels are loaded at once when they're adjacent, then weighted in 16-bit lanes
+		auto zero = _mm_setzero_si128();
+		auto round = _mm_set1_epi16(128);
+		for (; x < _outputWidth; x++)
+		{
+			uint32_t left, right;
+			memcpy(&left, input + _xOffsets[x * 2], 4);
+			memcpy(&right, input + _xOffsets[x * 2 + 1], 4);
+			auto pixels = _mm_unpacklo_epi8(_mm_unpacklo_epi32(_mm_cvtsi32_si128((int)left), _mm_cvtsi32_si128((int)right)), zero);
+			auto weight = _xWeights[x];
+			auto weights = _mm_set_epi16(weight, weight, weight, weight, 256 - weight, 256 - weight, 256 - weight, 256 - weight);
+			auto products = _mm_mullo_epi16(pixels, weights);
+			auto sum = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(products, _mm_srli_si128(products, 8)), round), 8);
+			auto value = _mm_cvtsi128_si32(_mm_packus_epi16(sum, zero));
+			memcpy(output + x * 4, &value, 4);
+		}
+		return;
+	}
+#endif
+	for (; x < _outputWidth; x++)
+	{
+		auto left = input + _xOffsets[x * 2];
+		auto right = input + _xOffsets[x * 2 + 1];
+		auto weight = _xWeights[x];
+		for (uint32_t c = 0; c < _channels; c++)
+		{
+			output[x * _channels + c] = (uint8_t)((left[c] * (256 - weight) + right[c] * weight + 128) >> 8);
+		}
+	}
+}
+
+void PlaneScaler::Scale(const uint8_t* input, int32_t inputStride, uint8_t* output, int32_t outputStride)
+{
+	auto rowSize = _outputWidth * _channels;
+	_rowIndices[0] = UINT32_MAX;
+	_rowIndices[1] = UINT32_MAX;
+	auto step = ((uint64_t)_inputHeight << 16) / _outputHeight;
+	for (uint32_t y = 0; y < _outputHeight; y++)
+	{
+		auto position = std::max<int64_t>((int64_t)(y * step + step / 2) - 0x8000, 0);
+		uint32_t indices[2];
+		indices[0] = std::min<uint32_t>((uint32_t)(position >> 16), _inputHeight - 1);
+		indices[1] = std::min<uint32_t>(indices[0] + 1, _inputHeight - 1);
+		auto weight = (uint32_t)(((position & 0xFFFF) + 0x80) >> 8);
+
+		// horizontally scaled rows are kept while consecutive output rows use them
+		auto find = [&](uint32_t index) { return _rowIndices[0] == index ? 0 : (_rowIndices[1] == index ? 1 : -1); };
+		auto topSlot = find(indices[0]);
+		if (topSlot < 0)
+		{
+			topSlot = find(indices[1]) == 0 ? 1 : 0;
+			ScaleRow(input + (ptrdiff_t)indices[0] * inputStride, _rows.get() + (size_t)topSlot * rowSize);
+			_rowIndices[topSlot] = indices[0];
+		}
+
+		auto bottomSlot = find(indices[1]);
+		if (bottomSlot < 0)
+		{
+			bottomSlot = 1 - topSlot;
+			ScaleRow(input + (ptrdiff_t)indices[1] * inputStride, _rows.get() + (size_t)bottomSlot * rowSize);
+			_rowIndices[bottomSlot] = indices[1];
+		}
+
+		auto top = _rows.get() + (size_t)topSlot * rowSize;
+		auto bottom = _rows.get() + (size_t)bottomSlot * rowSize;
+		auto out = output + (ptrdiff_t)y * outputStride;
+		uint32_t x = 0;
+#if defined(PIP_SSE)
+		auto zero = _mm_setzero_si128();
+		auto topWeight = _mm_set1_epi16((short)(256 - weight));
+		auto bottomWeight = _mm_set1_epi16((short)weight);
+		auto round = _mm_set1_epi16(128);
+		for (; x + 16 <= rowSize; x += 16)
+		{
+			auto t = _mm_loadu_si128((const __m128i*)(top + x));
+			auto b = _mm_loadu_si128((const __m128i*)(bottom + x));
+			auto lo = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(t, zero), topWeight), _mm_mullo_epi16(_mm_unpacklo_epi8(b, zero), bottomWeight));
+			auto hi = _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(t, zero), topWeight), _mm_mullo_epi16(_mm_unpackhi_epi8(b, zero), bottomWeight));
+			lo = _mm_srli_epi16(_mm_add_epi16(lo, round), 8);
+			hi = _mm_srli_epi16(_mm_add_epi16(hi, round), 8);
+			_mm_storeu_si128((__m128i*)(out + x), _mm_packus_epi16(lo, hi));
+		}
+#endif
+		for (; x < rowSize; x++)
+		{
+			out[x] = (uint8_t)((top[x] * (256 - weight) + bottom[x] * weight + 128) >> 8);
+		}
+	}
+}
+
+bool PipCompositor::AddInset(std::unique_ptr<PipSource> source, int32_t x, int32_t y, uint32_t width, uint32_t height)
+{
+	if (!source || _started || _count == PIP_MAX_INSETS || width < 2 || height < 2 || width > PIP_MAX_SIZE || height > PIP_MAX_SIZE)
+		return false;
+
+	// even positions & sizes keep NV12 chroma aligned
+	auto inset = std::unique_ptr<Inset>(new (std::nothrow) Inset());
+	if (!inset)
+		return false;
+
+	inset->source = std::move(source);
+	inset->x = x & ~1;
+	inset->y = y & ~1;
+	inset->width = width & ~1u;
+	inset->height = height & ~1u;
+	auto size = (size_t)inset->width * inset->height * 4;
+	inset->front.reset(new (std::nothrow) uint8_t[size]);
+	inset->back.reset(new (std::nothrow) uint8_t[size]);
+	inset->scratch.reset(new (std::nothrow) uint8_t[size * 2]);
+	if (!inset->front || !inset->back || !inset->scratch)
+		return false;
+
+	_insets[_count++] = std::move(inset);
+	return true;
+}
+
+bool PipCompositor::Start(uint32_t fpsNumerator, uint32_t fpsDenominator)
+{
+	Stop();
+	for (uint32_t i = 0; i < _count; i++)
+	{
+		auto& inset = *_insets[i];
+		if (!inset.source->Start(inset.width, inset.height, fpsNumerator, fpsDenominator))
+		{
+			Stop();
+			return false;
+		}
+
+		inset.stop = false;
+		inset.requested = false;
+		inset.busy = false;
+		inset.hasFront = false;
+		inset.rendered = 0;
+		inset.reused = 0;
+		inset.worker = std::thread(Run, &inset);
+	}
+	_started = true;
+	return true;
+}
+
+void PipCompositor::Stop()
+{
+	for (uint32_t i = 0; i < _count; i++)
+	{
+		auto& inset = *_insets[i];
+		if (inset.worker.joinable())
+		{
+			{
+				std::lock_guard<std::mutex> lock(inset.lock);
+				inset.stop = true;
+			}
+			inset.wake.notify_one();
+			inset.worker.join();
+		}
+
+		if (_started)
+		{
+			inset.source->Stop();
+		}
+	}
+	_started = false;
+}
+
+void PipCompositor::Run(Inset* inset)
+{
+	std::unique_lock<std::mutex> lock(inset->lock);
+	for (;;)
+	{
+		inset->wake.wait(lock, [&] { return inset->stop || inset->requested; });
+		if (inset->stop)
+			break;
+
+		auto time = inset->time;
+		auto format = inset->format;
+		inset->requested = false;
+
+		// the source & the scaling run unlocked, the compositor keeps using the front frame meanwhile
+		lock.unlock();
+		PipFrame frame{};
+		auto rendered = inset->source->GetFrame(time, format, frame) && Render(*inset, frame, format);
+		lock.lock();
+
+		if (rendered)
+		{
+			std::swap(inset->front, inset->back);
+			inset->frontFormat = format;
+			inset->hasFront = true;
+			inset->rendered++;
+		}
+		inset->busy = false;
+	}
+}
+
+// scales an inset source frame to the inset size in the back buffer, in format (RGB32 or NV12)
+bool PipCompositor::Render(Inset& inset, const PipFrame& frame, PipFormat format)
+{
+	if (!frame.width || !frame.height || (frame.format != PipFormat::Rgb32 && ((frame.width | frame.height) & 1)))
+		return false;
+
+	auto width = inset.width;
+	auto height = inset.height;
+	auto lumaSize = (size_t)width * height;
+
+	// YUV frames are scaled as NV12 then converted to RGB32 if needed, RGB32 frames are scaled then converted to NV12 if needed, so the conversion runs at the inset size
+	if (frame.format == PipFormat::Rgb32)
+	{
+		if (!inset.scalers[0].Initialize(frame.width, frame.height, width, height, 4))
+			return false;
+
+		if (format == PipFormat::Rgb32)
+		{
+			inset.scalers[0].Scale(frame.planes[0], frame.strides[0], inset.back.get(), (int32_t)(width * 4));
+			return true;
+		}
+
+		inset.scalers[0].Scale(frame.planes[0], frame.strides[0], inset.scratch.get(), (int32_t)(width * 4));
+		Rgb32ToNv12(inset.scratch.get(), width, height, inset.back.get(), inset.back.get() + lumaSize);
+		return true;
+	}
+
+	auto nv12 = format == PipFormat::Nv12 ? inset.back.get() : inset.scratch.get();
+	if (!inset.scalers[0].Initialize(frame.width, frame.height, width, height, 1))
+		return false;
+
+	inset.scalers[0].Scale(frame.planes[0], frame.strides[0], nv12, (int32_t)width);
+	if (frame.format == PipFormat::Nv12)
+	{
+		if (!inset.scalers[1].Initialize(frame.width / 2, frame.height / 2, width / 2, height / 2, 2))
+			return false;
+
+		inset.scalers[1].Scale(frame.planes[1], frame.strides[1], nv12 + lumaSize, (int32_t)width);
+	}
+	else
+	{
+		// I420 planes are scaled separately then interleaved
+		if (!inset.scalers[1].Initialize(frame.width / 2, frame.height / 2, width / 2, height / 2, 1))
+			return false;
+
+		auto u = inset.scratch.get() + lumaSize * 4;
+		auto v = u + lumaSize / 4;
+		inset.scalers[1].Scale(frame.planes[1], frame.strides[1], u, (int32_t)(width / 2));
+		inset.scalers[1].Scale(frame.planes[2], frame.strides[2], v, (int32_t)(width / 2));
+		for (uint32_t y = 0; y < height / 2; y++)
+		{
+			InterleaveRow(u + (size_t)y * (width / 2), v + (size_t)y * (width / 2), width / 2, nv12 + lumaSize + (size_t)y * width);
+		}
+	}
+
+	if (format == PipFormat::Rgb32)
+	{
+		Nv12ToRgb32(nv12, nv12 + lumaSize, width, height, inset.back.get());
+	}
+	return true;
+}
+
+bool PipCompositor::Compose(const PipFrame& main, int64_t time, uint8_t* output, int32_t outputStride, uint8_t* uv, int32_t uvStride)
+{
+	if (!output || !main.width || !main.height)
+		return false;
+
+	auto format = main.format == PipFormat::Rgb32 ? PipFormat::Rgb32 : PipFormat::Nv12;
+	if (format == PipFormat::Nv12 && (!uv || ((main.width | main.height) & 1)))
+		return false;
+
+	// ask for new inset frames, unless the worker is still busy with a previous one, and hold the front frames for the whole composition
+	std::unique_lock<std::mutex> locks[PIP_MAX_INSETS];
+	for (uint32_t i = 0; i < _count; i++)
+	{
+		auto& inset = *_insets[i];
+		locks[i] = std::unique_lock<std::mutex>(inset.lock);
+		if (!_started)
+			continue;
+
+		if (inset.busy)
+		{
+			inset.reused++;
+			continue;
+		}
+
+		inset.time = time;
+		inset.format = format;
+		inset.requested = true;
+		inset.busy = true;
+		inset.wake.notify_one();
+	}
+
+	// the main frame is copied a band at a time and the insets are copied over each band while it's in the cache
+	auto pixelSize = format == PipFormat::Rgb32 ? 4 : 1;
+	for (uint32_t top = 0; top < main.height; top += PIP_BAND_ROWS)
+	{
+		auto bottom = std::min<uint32_t>(top + PIP_BAND_ROWS, main.height);
+		for (auto y = top; y < bottom; y++)
+		{
+			memcpy(output + (ptrdiff_t)y * outputStride, main.planes[0] + (ptrdiff_t)y * main.strides[0], (size_t)main.width * pixelSize);
+		}
+
+		if (format == PipFormat::Nv12)
+		{
+			for (auto y = top / 2; y < bottom / 2; y++)
+			{
+				auto out = uv + (ptrdiff_t)y * uvStride;
+				if (main.format == PipFormat::Nv12)
+				{
+					memcpy(out, main.planes[1] + (ptrdiff_t)y * main.strides[1], main.width);
+				}
+				else
+				{
+					InterleaveRow(main.planes[1] + (ptrdiff_t)y * main.strides[1], main.planes[2] + (ptrdiff_t)y * main.strides[2], main.width / 2, out);
+				}
+			}
+		}
+
+		for (uint32_t i = 0; i < _count; i++)
+		{
+			auto& inset = *_insets[i];
+			if (!inset.hasFront || inset.frontFormat != format)
+				continue;
+
+			// visible part of the inset in this band, in frame coordinates, all even
+			auto left = std::max<int32_t>(inset.x, 0);
+			auto right = std::min<int32_t>(inset.x + (int32_t)inset.width, (int32_t)main.width);
+			auto bandTop = std::max<int32_t>(inset.y, (int32_t)top);
+			auto bandBottom = std::min<int32_t>(inset.y + (int32_t)inset.height, (int32_t)bottom);
+			if (left >= right || bandTop >= bandBottom)
+				continue;
+
+			auto count = (size_t)(right - left);
+			auto front = inset.front.get();
+			auto insetStride = (size_t)inset.width * pixelSize;
+			for (auto y = bandTop; y < bandBottom; y++)
+			{
+				auto in = front + (size_t)(y - inset.y) * insetStride + (size_t)(left - inset.x) * pixelSize;
+				memcpy(output + (ptrdiff_t)y * outputStride + (ptrdiff_t)left * pixelSize, in, count * pixelSize);
+			}
+
+			if (format == PipFormat::Nv12)
+			{
+				auto chroma = front + (size_t)inset.width * inset.height;
+				for (auto y = bandTop / 2; y < bandBottom / 2; y++)
+				{
+					auto in = chroma + (size_t)(y - inset.y / 2) * inset.width + (size_t)(left - inset.x);
+					memcpy(uv + (ptrdiff_t)y * uvStride + left, in, count);
+				}
+			}
+		}
+	}
+	return true;
+}
+
+void PipCompositor::GetInsetStats(uint32_t index, uint64_t& rendered, uint64_t& reused)
+{
+	rendered = 0;
+	reused = 0;
+	if (index >= _count)
+		return;
+
+	std::lock_guard<std::mutex> lock(_insets[index]->lock);
+	rendered = _insets[index]->rendered;
+	reused = _insets[index]->reused;
+}
\ No newline at end of file
@@ -0,0 +1,173 @@
+#pragma once
+
+// Picture-in-picture compositor: a main frame with inset frames pulled asynchronously from other sources, scaled and composed in one pass.
+// Scaling uses SSE2 when available.
+#include <cstdint>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+
+#define PIP_MAX_INSETS 4
+
+enum class PipFormat
+{
+	Rgb32,
+	Nv12,
+	I420,
+};
+
+// a frame, its memory is owned by whoever provides it
+struct PipFrame
+{
+	PipFormat format;
+	uint32_t width;
+	uint32_t height;
+	const uint8_t* planes[3];
+	int32_t strides[3];
+};
+
+class PipSource
+{
+public:
+	virtual ~PipSource() {}
+
+	virtual bool Start(uint32_t width, uint32_t height, uint32_t fpsNumerator, uint32_t fpsDenominator) = 0;
+
+	// time is relative to Start, in 100ns units, the frame stays valid until the next GetFrame or Stop call
+	virtual bool GetFrame(int64_t time, PipFormat preferredFormat, PipFrame& frame) = 0;
+	virtual void Stop() = 0;
+};
+
+// moving color bars, a source that needs no file, RGB32 or NV12
+class PipPatternSource : public PipSource
+{
+	uint32_t _width;
+	uint32_t _height;
+	std::unique_ptr<uint8_t[]> _frame;
+
+public:
+	PipPatternSource() :
+		_width(0),
+		_height(0)
+	{
+	}
+
+	bool Start(uint32_t width, uint32_t height, uint32_t fpsNumerator, uint32_t fpsDenominator);
+	bool GetFrame(int64_t time, PipFormat preferredFormat, PipFrame& frame);
+	void Stop();
+};
+
+// bilinear scaler for a plane of 1 (luma), 2 (interleaved chroma) or 4 (BGRA) bytes per pixel
+class PlaneScaler
+{
+	uint32_t _inputWidth;
+	uint32_t _inputHeight;
+	uint32_t _outputWidth;
+	uint32_t _outputHeight;
+	uint32_t _channels;
+	std::unique_ptr<uint32_t[]> _xOffsets; // byte offsets of the left & right input pixels, for each output pixel
+	std::unique_ptr<uint16_t[]> _xWeights; // weight of the right pixel, 0 to 256
+	std::unique_ptr<uint8_t[]> _rows; // 2 horizontally scaled input rows
+	uint32_t _rowIndices[2]; // input rows held in _rows
+
+	void ScaleRow(const uint8_t* input, uint8_t* output) const;
+
+public:
+	PlaneScaler() :
+		_inputWidth(0),
+		_inputHeight(0),
+		_outputWidth(0),
+		_outputHeight(0),
+		_channels(0),
+		_rowIndices()
+	{
+	}
+
+	// does nothing if sizes are the same as the last call
+	bool Initialize(uint32_t inputWidth, uint32_t inputHeight, uint32_t outputWidth, uint32_t outputHeight, uint32_t channels);
+	void Scale(const uint8_t* input, int32_t inputStride, uint8_t* output, int32_t outputStride);
+};
+
+class PipCompositor
+{
+	// each inset has a worker thread that pulls & scales its frames, the compositor only takes the latest complete one
+	struct Inset
+	{
+		std::unique_ptr<PipSource> source;
+		int32_t x; // even
+		int32_t y;
+		uint32_t width; // even
+		uint32_t height;
+		std::thread worker;
+		std::mutex lock;
+		std::condition_variable wake;
+		bool stop;
+		bool requested;
+		bool busy;
+		int64_t time; // requested
+		PipFormat format; // requested, RGB32 or NV12
+		PipFormat frontFormat;
+		bool hasFront;
+		std::unique_ptr<uint8_t[]> front; // latest complete frame, inset size, read by the compositor
+		std::unique_ptr<uint8_t[]> back; // written by the worker
+		std::unique_ptr<uint8_t[]> scratch;
+		PlaneScaler scalers[3];
+		uint64_t rendered;
+		uint64_t reused; // frames composed while the worker was still busy with a previous request
+
+		Inset() :
+			x(0),
+			y(0),
+			width(0),
+			height(0),
+			stop(false),
+			requested(false),
+			busy(false),
+			time(0),
+			format(PipFormat::Nv12),
+			frontFormat(PipFormat::Nv12),
+			hasFront(false),
+			rendered(0),
+			reused(0)
+		{
+		}
+	};
+
+	std::unique_ptr<Inset> _insets[PIP_MAX_INSETS];
+	uint32_t _count;
+	bool _started;
+
+	static void Run(Inset* inset);
+	static bool Render(Inset& inset, const PipFrame& frame, PipFormat format);
+
+public:
+	PipCompositor() :
+		_count(0),
+		_started(false)
+	{
+	}
+
+	~PipCompositor()
+	{
+		Stop();
+	}
+
+	PipCompositor(const PipCompositor&) = delete;
+	PipCompositor& operator=(const PipCompositor&) = delete;
+
+	// the inset is placed at x, y in the main frame, and its frames are scaled to width x height
+	bool AddInset(std::unique_ptr<PipSource> source, int32_t x, int32_t y, uint32_t width, uint32_t height);
+	uint32_t GetInsetCount() const { return _count; }
+
+	// starts the inset sources & their workers
+	bool Start(uint32_t fpsNumerator, uint32_t fpsDenominator);
+	void Stop();
+
+	// composes main & the latest inset frames into output, RGB32 if main is RGB32, otherwise NV12 (where uv is the chroma plane), the size of main
+	// asks insets for a new frame at time, but never waits for them: a slow inset just shows its previous frame
+	bool Compose(const PipFrame& main, int64_t time, uint8_t* output, int32_t outputStride, uint8_t* uv, int32_t uvStride);
+
+	void GetInsetStats(uint32_t index, uint64_t& rendered, uint64_t& reused);
+};
\ No newline at end of file
@@ -0,0 +1,131 @@
+#include "pch.h"
+#include "Tools.h"
+#include "FrameSource.h"
+#include "FrameBuffer.h"
+#include "PipCompositor.h"
+#include "PipFrameSource.h"
+
+#define TRACE_FRAMES 300 // inset counts are traced every n frames served
+
+bool PipSourceAdapter::Start(uint32_t width, uint32_t height, uint32_t fpsNumerator, uint32_t fpsDenominator)
+{
+	return SUCCEEDED(LOG_IF_FAILED(_source->Start(width, height, fpsNumerator, fpsDenominator)));
+}
+
+bool PipSourceAdapter::GetFrame(int64_t time, PipFormat preferredFormat, PipFrame& frame)
+{
+	SourceFrame source{};
+	if (FAILED(LOG_IF_FAILED(_source->GetFrame(time, preferredFormat == PipFormat::Rgb32 ? MFVideoFormat_RGB32 : MFVideoFormat_NV12, &source))))
+		return false;
+
+	if (source.format == MFVideoFormat_RGB32)
+	{
+		frame.format = PipFormat::Rgb32;
+	}
+	else if (source.format == MFVideoFormat_NV12)
+	{
+		frame.format = PipFormat::Nv12;
+	}
+	else if (source.format == MFVideoFormat_I420)
+	{
+		frame.format = PipFormat::I420;
+	}
+	else
+		return false;
+
+	frame.width = source.width;
+	frame.height = source.height;
+	for (auto i = 0; i < 3; i++)
+	{
+		frame.planes[i] = source.planes[i];
+		frame.strides[i] = source.strides[i];
+	}
+	return true;
+}
+
+void PipSourceAdapter::Stop()
+{
+	_source->Stop();
+}
+
+HRESULT PipFrameSource::AddInset(std::unique_ptr<PipSource> source, LONG x, LONG y, UINT width, UINT height)
+{
+	RETURN_HR_IF_NULL(E_POINTER, source);
+	RETURN_HR_IF_MSG(E_INVALIDARG, !_compositor.AddInset(std::move(source), x, y, width, height), "Inset %ux%u at %i,%i cannot be added", width, height, x, y);
+	return S_OK;
+}
+
+HRESULT PipFrameSource::Start(UINT width, UINT height, UINT fpsNumerator, UINT fpsDenominator)
+{
+	RETURN_HR_IF_NULL(E_UNEXPECTED, _main);
+	RETURN_HR_IF(E_INVALIDARG, !width || !height);
+
+	// the composed frame has the main frame's size, which is the stream's size for all sources, an RGB32 buffer fits an NV12 frame too
+	_frame.reset();
+	_frame = FrameBufferPool::GetShared().Acquire(Rgb32View::GetSize(Rgb32View::GetAlignedStride(width), height));
+	RETURN_IF_NULL_ALLOC(_frame.get());
+	_width = width;
+	_height = height;
+	_index = 0;
+	_frames = 0;
+	RETURN_HR_IF_MSG(E_FAIL, !_main->Start(width, height, fpsNumerator, fpsDenominator), "Main source cannot be started");
+	if (!_compositor.Start(fpsNumerator, fpsDenominator))
+	{
+		_main->Stop();
+		RETURN_HR_MSG(E_FAIL, "Inset sources cannot be started");
+	}
+
+	WINTRACE(L"PipFrameSource::Start %ux%u insets:%u", width, height, _compositor.GetInsetCount());
+	return S_OK;
+}
+
+HRESULT PipFrameSource::GetFrame(MFTIME time, REFGUID preferredFormat, SourceFrame* frame)
+{
+	RETURN_HR_IF_NULL(E_POINTER, frame);
+	RETURN_HR_IF(E_NOT_VALID_STATE, !_frame);
+
+	PipFrame main{};
+	RETURN_HR_IF_MSG(E_FAIL, !_main->GetFrame(time, preferredFormat == MFVideoFormat_RGB32 ? PipFormat::Rgb32 : PipFormat::Nv12, main), "Main source has no frame");
+	RETURN_HR_IF_MSG(E_UNEXPECTED, main.width > _width || main.height > _height, "Main frame %ux%u is larger than %ux%u", main.width, main.height, _width, _height);
+
+	auto rgb = main.format == PipFormat::Rgb32;
+	auto stride = (LONG)GetAlignedFrameStride(rgb ? FrameBufferFormat::Rgb32 : FrameBufferFormat::Nv12, main.width);
+	auto uv = GetFrameBufferUV(_frame.get(), stride, main.height);
+	RETURN_HR_IF_MSG(E_FAIL, !_compositor.Compose(main, time, _frame.get(), stride, uv, stride), "Frame cannot be composed");
+
+	*frame = {};
+	frame->format = rgb ? MFVideoFormat_RGB32 : MFVideoFormat_NV12;
+	frame->width = main.width;
+	frame->height = main.height;
+	frame->planes[0] = _frame.get();
+	frame->strides[0] = stride;
+	if (!rgb)
+	{
+		frame->planes[1] = uv;
+		frame->strides[1] = stride;
+	}
+
+	// insets change on their own, so each composed frame is new content
+	frame->index = _index++;
+	_frames++;
+	if (!(_frames % TRACE_FRAMES))
+	{
+		for (UINT i = 0; i < _compositor.GetInsetCount(); i++)
+		{
+			uint64_t rendered, reused;
+			_compositor.GetInsetStats(i, rendered, reused);
+			WINTRACE(L"PipFrameSource::GetFrame frames:%I64u inset:%u rendered:%I64u reused:%I64u", _frames, i, rendered, reused);
+		}
+	}
+	return S_OK;
+}
+
+void PipFrameSource::Stop()
+{
+	_compositor.Stop();
+	if (_main)
+	{
+		_main->Stop();
+	}
+	_frame.reset();
+}
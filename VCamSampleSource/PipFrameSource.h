@@ -0,0 +1,49 @@
+#pragma once
+
+// exposes a frame source to the picture-in-picture compositor
+class PipSourceAdapter : public PipSource
+{
+	std::unique_ptr<FrameSource> _source;
+
+public:
+	PipSourceAdapter(std::unique_ptr<FrameSource> source) :
+		_source(std::move(source))
+	{
+	}
+
+	// PipSource
+	bool Start(uint32_t width, uint32_t height, uint32_t fpsNumerator, uint32_t fpsDenominator);
+	bool GetFrame(int64_t time, PipFormat preferredFormat, PipFrame& frame);
+	void Stop();
+};
+
+// serves a main source with inset sources composed over it
+// insets are pulled by their own threads, a slow inset never delays the stream, it just shows its previous frame
+class PipFrameSource : public FrameSource
+{
+	std::unique_ptr<PipSource> _main;
+	PipCompositor _compositor;
+	FrameBuffer _frame; // composed, RGB32 or NV12, with aligned strides
+	UINT _width;
+	UINT _height;
+	ULONGLONG _index;
+	ULONGLONG _frames;
+
+public:
+	PipFrameSource(std::unique_ptr<PipSource> main) :
+		_main(std::move(main)),
+		_width(0),
+		_height(0),
+		_index(0),
+		_frames(0)
+	{
+	}
+
+	// must be called before Start, the inset's frames are scaled to width x height and placed at x, y
+	HRESULT AddInset(std::unique_ptr<PipSource> source, LONG x, LONG y, UINT width, UINT height);
+
+	// FrameSource
+	HRESULT Start(UINT width, UINT height, UINT fpsNumerator, UINT fpsDenominator);
+	HRESULT GetFrame(MFTIME time, REFGUID preferredFormat, SourceFrame* frame);
+	void Stop();
+};
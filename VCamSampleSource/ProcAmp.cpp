@@ -0,0 +1,386 @@
+#include "pch.h"
+#include "Tools.h"
+#include "FrameBuffer.h"
+#include "ColorConvert.h"
+#include "ColorLut.h"
+#include "ProcAmp.h"
+
+#define COLOR_ADJUST_ROUND (1 << (COLOR_ADJUST_SHIFT - 1))
+
+struct ProcAmpRange
+{
+	ULONG id;
+	size_t offset;
+	LONG minimum;
+	LONG maximum;
+	LONG step;
+	LONG defaultValue;
+};
+
+static const ProcAmpRange _procAmpRanges[] =
+{
+	{ KSPROPERTY_VIDEOPROCAMP_BRIGHTNESS, offsetof(ProcAmpSettings, brightness), -100, 100, 1, 0 },
+	{ KSPROPERTY_VIDEOPROCAMP_CONTRAST, offsetof(ProcAmpSettings, contrast), 0, 200, 1, 100 },
+	{ KSPROPERTY_VIDEOPROCAMP_HUE, offsetof(ProcAmpSettings, hue), -180, 180, 1, 0 },
+	{ KSPROPERTY_VIDEOPROCAMP_SATURATION, offsetof(ProcAmpSettings, saturation), 0, 200, 1, 100 },
+	{ KSPROPERTY_VIDEOPROCAMP_GAMMA, offsetof(ProcAmpSettings, gamma), 10, 500, 1, 100 },
+};
+
+// BT.601 limited range, same coefficients as Tools.cpp conversions
+static const double _rgbToYuv[9] =
+{
+	66 / 256.0, 129 / 256.0, 25 / 256.0,
+	-38 / 256.0, -74 / 256.0, 112 / 256.0,
+	112 / 256.0, -94 / 256.0, -18 / 256.0
+};
+
+static const double _yuvToRgb[9] =
+{
+	298 / 256.0, 0, 409 / 256.0,
+	298 / 256.0, -100 / 256.0, -208 / 256.0,
+	298 / 256.0, 516 / 256.0, 0
+};
+
+static inline BYTE Clamp(int value)
+{
+	return (BYTE)(value < 0 ? 0 : (value > 255 ? 255 : value));
+}
+
+static inline int ToFixed(double value)
+{
+	return (int)lround(value * (1 << COLOR_ADJUST_SHIFT));
+}
+
+// brightness, contrast & gamma on a 0-1 value
+static double AdjustLevel(double value, double brightness, double contrast, double gamma)
+{
+	value = pow(std::min(std::max(value, 0.0), 1.0), 1 / gamma);
+	return (value - 0.5) * contrast + 0.5 + brightness;
+}
+
+void ColorAdjust::Update(const ProcAmpSettings& settings)
+{
+	identity = settings.brightness == 0 && settings.contrast == 100 && settings.hue == 0 && settings.saturation == 100 && settings.gamma == 100;
+
+	auto brightness = settings.brightness / 255.0;
+	auto contrast = settings.contrast / 100.0;
+	auto gamma = std::max<LONG>(settings.gamma, 1) / 100.0;
+	for (UINT i = 0; i < 256; i++)
+	{
+		rgbLut[i] = Clamp((int)lround(AdjustLevel(i / 255.0, brightness, contrast, gamma) * 255));
+		yLut[i] = Clamp((int)lround(AdjustLevel((i - 16) / 219.0, brightness, contrast, gamma) * 219 + 16));
+	}
+
+	// hue rotates & saturation scales the (U, V) vector
+	auto angle = settings.hue * 3.14159265358979323846 / 180;
+	auto saturation = settings.saturation / 100.0;
+	double uv[4] =
+	{
+		saturation * cos(angle), -saturation * sin(angle),
+		saturation * sin(angle), saturation * cos(angle)
+	};
+
+	double yuv[9];
+	for (UINT i = 0; i < 3; i++)
+	{
+		yuv[i] = _rgbToYuv[i];
+		yuv[3 + i] = uv[0] * _rgbToYuv[3 + i] + uv[1] * _rgbToYuv[6 + i];
+		yuv[6 + i] = uv[2] * _rgbToYuv[3 + i] + uv[3] * _rgbToYuv[6 + i];
+	}
+
+	for (UINT i = 0; i < 9; i++)
+	{
+		rgbToYuv[i] = ToFixed(yuv[i]);
+	}
+
+	// back to RGB, Y offsets cancel out, only the change is converted so the matrix is exactly identity at defaults
+	for (UINT i = 0; i < 3; i++)
+	{
+		for (UINT j = 0; j < 3; j++)
+		{
+			auto change = _yuvToRgb[i * 3 + 1] * (yuv[3 + j] - _rgbToYuv[3 + j]) + _yuvToRgb[i * 3 + 2] * (yuv[6 + j] - _rgbToYuv[6 + j]);
+			rgbMatrix[i * 3 + j] = ToFixed((i == j ? 1 : 0) + change);
+		}
+	}
+
+	for (UINT i = 0; i < 4; i++)
+	{
+		uvMatrix[i] = ToFixed(uv[i]);
+	}
+}
+
+D2D1_COLOR_F ColorAdjust::Apply(const D2D1_COLOR_F& color) const
+{
+	if (identity)
+		return color;
+
+	int r = rgbLut[Clamp((int)lround(color.r * 255))];
+	int g = rgbLut[Clamp((int)lround(color.g * 255))];
+	int b = rgbLut[Clamp((int)lround(color.b * 255))];
+	D2D1_COLOR_F adjusted;
+	adjusted.r = Clamp((rgbMatrix[0] * r + rgbMatrix[1] * g + rgbMatrix[2] * b + COLOR_ADJUST_ROUND) >> COLOR_ADJUST_SHIFT) / 255.0f;
+	adjusted.g = Clamp((rgbMatrix[3] * r + rgbMatrix[4] * g + rgbMatrix[5] * b + COLOR_ADJUST_ROUND) >> COLOR_ADJUST_SHIFT) / 255.0f;
+	adjusted.b = Clamp((rgbMatrix[6] * r + rgbMatrix[7] * g + rgbMatrix[8] * b + COLOR_ADJUST_ROUND) >> COLOR_ADJUST_SHIFT) / 255.0f;
+	adjusted.a = color.a;
+	return adjusted;
+}
+
+void ColorAdjust::GetLutAdjust(ColorLutAdjust& adjust) const
+{
+	static_assert(COLOR_LUT_SHIFT == COLOR_ADJUST_SHIFT, "LUT matrices must have the same fixed point as ours");
+	std::copy(rgbLut, rgbLut + 256, adjust.rgbCurve);
+	std::copy(yLut, yLut + 256, adjust.yCurve);
+	std::copy(rgbMatrix, rgbMatrix + 9, adjust.rgbMatrix);
+	std::copy(uvMatrix, uvMatrix + 4, adjust.uvMatrix);
+}
+
+HRESULT ProcAmpKsProperty(ProcAmpSettings& settings, PKSPROPERTY property, ULONG length, LPVOID data, ULONG dataLength, ULONG* bytesReturned, bool& changed)
+{
+	RETURN_HR_IF_NULL(E_POINTER, property);
+	RETURN_HR_IF_NULL(E_POINTER, bytesReturned);
+	RETURN_HR_IF(E_INVALIDARG, length < sizeof(KSPROPERTY));
+	changed = false;
+	*bytesReturned = 0;
+
+	const ProcAmpRange* range = nullptr;
+	for (auto& r : _procAmpRanges)
+	{
+		if (r.id == property->Id)
+		{
+			range = &r;
+			break;
+		}
+	}
+
+	// apps ask for all properties, not finding one is expected
+	if (!range)
+		return HRESULT_FROM_WIN32(ERROR_NOT_FOUND);
+
+	auto value = (LONG*)((BYTE*)&settings + range->offset);
+	const ULONG accessFlags = KSPROPERTY_TYPE_GET | KSPROPERTY_TYPE_SET | KSPROPERTY_TYPE_DEFAULTVALUES;
+	if (property->Flags & KSPROPERTY_TYPE_BASICSUPPORT)
+	{
+		// callers can ask for the access flags only
+		if (dataLength == sizeof(ULONG))
+			return KsReply(&accessFlags, sizeof(ULONG), data, dataLength, bytesReturned);
+
+		struct
+		{
+			KSPROPERTY_DESCRIPTION description;
+			KSPROPERTY_MEMBERSHEADER header;
+			KSPROPERTY_STEPPING_LONG stepping;
+		} support{};
+		support.description.AccessFlags = accessFlags;
+		support.description.DescriptionSize = sizeof(support);
+		support.description.PropTypeSet.Set = KSPROPTYPESETID_General;
+		support.description.PropTypeSet.Id = VT_I4;
+		support.description.MembersListCount = 1;
+		support.header.MembersFlags = KSPROPERTY_MEMBER_STEPPEDRANGES;
+		support.header.MembersSize = sizeof(KSPROPERTY_STEPPING_LONG);
+		support.header.MembersCount = 1;
+		support.stepping.SteppingDelta = range->step;
+		support.stepping.Bounds.SignedMinimum = range->minimum;
+		support.stepping.Bounds.SignedMaximum = range->maximum;
+
+		if (dataLength == sizeof(KSPROPERTY_DESCRIPTION))
+			return KsReply(&support.description, sizeof(KSPROPERTY_DESCRIPTION), data, dataLength, bytesReturned);
+
+		return KsReply(&support, sizeof(support), data, dataLength, bytesReturned);
+	}
+
+	if (property->Flags & KSPROPERTY_TYPE_DEFAULTVALUES)
+	{
+		struct
+		{
+			KSPROPERTY_DESCRIPTION description;
+			KSPROPERTY_MEMBERSHEADER header;
+			LONG value;
+		} defaults{};
+		defaults.description.AccessFlags = accessFlags;
+		defaults.description.DescriptionSize = sizeof(defaults);
+		defaults.description.PropTypeSet.Set = KSPROPTYPESETID_General;
+		defaults.description.PropTypeSet.Id = VT_I4;
+		defaults.description.MembersListCount = 1;
+		defaults.header.MembersFlags = KSPROPERTY_MEMBER_VALUES;
+		defaults.header.MembersSize = sizeof(LONG);
+		defaults.header.MembersCount = 1;
+		defaults.header.Flags = KSPROPERTY_MEMBER_FLAG_DEFAULT;
+		defaults.value = range->defaultValue;
+		return KsReply(&defaults, sizeof(defaults), data, dataLength, bytesReturned);
+	}
+
+	if (property->Flags & KSPROPERTY_TYPE_GET)
+	{
+		KSPROPERTY_VIDEOPROCAMP_S reply{};
+		reply.Property = *property;
+		reply.Value = *value;
+		reply.Flags = KSPROPERTY_VIDEOPROCAMP_FLAGS_MANUAL;
+		reply.Capabilities = KSPROPERTY_VIDEOPROCAMP_FLAGS_MANUAL;
+		return KsReply(&reply, sizeof(reply), data, dataLength, bytesReturned);
+	}
+
+	if (property->Flags & KSPROPERTY_TYPE_SET)
+	{
+		RETURN_HR_IF(HRESULT_FROM_WIN32(ERROR_INSUFFICIENT_BUFFER), !data || dataLength < sizeof(KSPROPERTY_VIDEOPROCAMP_S));
+		auto request = (const KSPROPERTY_VIDEOPROCAMP_S*)data;
+		RETURN_HR_IF_MSG(E_INVALIDARG, request->Value < range->minimum || request->Value > range->maximum, "ProcAmp property %u value %d is out of range", property->Id, request->Value);
+		WINTRACE(L"ProcAmpKsProperty set id:%u value:%d", property->Id, request->Value);
+		changed = *value != request->Value;
+		*value = request->Value;
+		return S_OK;
+	}
+
+	return HRESULT_FROM_WIN32(ERROR_NOT_SUPPORTED);
+}
+
+void RGB32ToNV12(const BYTE* input, LONG inputStride, UINT width, UINT height, BYTE* y, LONG yStride, BYTE* uv, LONG uvStride, const ColorAdjust& adjust)
+{
+	if (adjust.identity)
+	{
+		RGB32ToNV12(input, inputStride, width, height, y, yStride, uv, uvStride);
+		return;
+	}
+
+	auto lut = adjust.rgbLut;
+	auto m = adjust.rgbToYuv;
+	for (UINT h = 0; h + 1 < height; h += 2)
+	{
+		auto rgb1 = input + h * inputStride;
+		auto rgb2 = rgb1 + inputStride;
+		auto y1 = y + h * yStride;
+		auto y2 = y1 + yStride;
+		auto puv = uv + (h / 2) * uvStride;
+		for (UINT w = 0; w + 1 < width; w += 2)
+		{
+			// chroma is sampled from one pixel, not averaged, like the non adjusted version
+			int r = lut[rgb1[2]];
+			int g = lut[rgb1[1]];
+			int b = lut[rgb1[0]];
+			y1[0] = Clamp(((m[0] * r + m[1] * g + m[2] * b + COLOR_ADJUST_ROUND) >> COLOR_ADJUST_SHIFT) + 16);
+			puv[0] = Clamp(((m[3] * r + m[4] * g + m[5] * b + COLOR_ADJUST_ROUND) >> COLOR_ADJUST_SHIFT) + 128);
+			puv[1] = Clamp(((m[6] * r + m[7] * g + m[8] * b + COLOR_ADJUST_ROUND) >> COLOR_ADJUST_SHIFT) + 128);
+			y1[1] = Clamp(((m[0] * lut[rgb1[6]] + m[1] * lut[rgb1[5]] + m[2] * lut[rgb1[4]] + COLOR_ADJUST_ROUND) >> COLOR_ADJUST_SHIFT) + 16);
+			y2[0] = Clamp(((m[0] * lut[rgb2[2]] + m[1] * lut[rgb2[1]] + m[2] * lut[rgb2[0]] + COLOR_ADJUST_ROUND) >> COLOR_ADJUST_SHIFT) + 16);
+			y2[1] = Clamp(((m[0] * lut[rgb2[6]] + m[1] * lut[rgb2[5]] + m[2] * lut[rgb2[4]] + COLOR_ADJUST_ROUND) >> COLOR_ADJUST_SHIFT) + 16);
+			rgb1 += 8;
+			rgb2 += 8;
+			y1 += 2;
+			y2 += 2;
+			puv += 2;
+		}
+	}
+}
+
+void RGB32ToRGB32(const BYTE* input, LONG inputStride, UINT width, UINT height, BYTE* output, LONG outputStride, const ColorAdjust& adjust)
+{
+	if (adjust.identity)
+	{
+		CopyPlane(input, inputStride, width * 4, height, output, outputStride);
+		return;
+	}
+
+	auto lut = adjust.rgbLut;
+	auto m = adjust.rgbMatrix;
+	for (UINT h = 0; h < height; h++)
+	{
+		auto in = input + h * inputStride;
+		auto out = output + h * outputStride;
+		for (UINT w = 0; w < width; w++)
+		{
+			int r = lut[in[2]];
+			int g = lut[in[1]];
+			int b = lut[in[0]];
+			out[0] = Clamp((m[6] * r + m[7] * g + m[8] * b + COLOR_ADJUST_ROUND) >> COLOR_ADJUST_SHIFT);
+			out[1] = Clamp((m[3] * r + m[4] * g + m[5] * b + COLOR_ADJUST_ROUND) >> COLOR_ADJUST_SHIFT);
+			out[2] = Clamp((m[0] * r + m[1] * g + m[2] * b + COLOR_ADJUST_ROUND) >> COLOR_ADJUST_SHIFT);
+			out[3] = in[3];
+			in += 4;
+			out += 4;
+		}
+	}
+}
+
+void YToY(const BYTE* input, LONG inputStride, UINT width, UINT height, BYTE* output, LONG outputStride, const ColorAdjust& adjust)
+{
+	if (adjust.identity)
+	{
+		CopyPlane(input, inputStride, width, height, output, outputStride);
+		return;
+	}
+
+	auto lut = adjust.yLut;
+	for (UINT h = 0; h < height; h++)
+	{
+		auto in = input + h * inputStride;
+		auto out = output + h * outputStride;
+		for (UINT w = 0; w < width; w++)
+		{
+			out[w] = lut[in[w]];
+		}
+	}
+}
+
+// U & V come from NV12 (uvStep = 2) or I420 (uvStep = 1) planes, width & height are the chroma plane's
+void UVToNV12UV(const BYTE* u, LONG uStride, const BYTE* v, LONG vStride, UINT uvStep, UINT width, UINT height, BYTE* uv, LONG uvStride, const ColorAdjust& adjust)
+{
+	if (adjust.identity)
+	{
+		if (uvStep == 2)
+		{
+			CopyPlane(u, uStride, width * 2, height, uv, uvStride);
+		}
+		else
+		{
+			I420ToNV12UV(u, uStride, v, vStride, width, height, uv, uvStride);
+		}
+		return;
+	}
+
+	auto m = adjust.uvMatrix;
+	for (UINT h = 0; h < height; h++)
+	{
+		auto pu = u + h * uStride;
+		auto pv = v + h * vStride;
+		auto out = uv + h * uvStride;
+		for (UINT w = 0; w < width; w++)
+		{
+			int d = pu[w * uvStep] - 128;
+			int e = pv[w * uvStep] - 128;
+			out[0] = Clamp(((m[0] * d + m[1] * e + COLOR_ADJUST_ROUND) >> COLOR_ADJUST_SHIFT) + 128);
+			out[1] = Clamp(((m[2] * d + m[3] * e + COLOR_ADJUST_ROUND) >> COLOR_ADJUST_SHIFT) + 128);
+			out += 2;
+		}
+	}
+}
+
+void YUV420ToRGB32(const BYTE* y, LONG yStride, const BYTE* u, const BYTE* v, LONG uvStride, UINT uvStep, UINT width, UINT height, BYTE* output, LONG outputStride, const ColorAdjust& adjust)
+{
+	if (adjust.identity)
+	{
+		YUV420ToRGB32(y, yStride, u, v, uvStride, uvStep, width, height, output, outputStride);
+		return;
+	}
+
+	auto lut = adjust.yLut;
+	auto m = adjust.uvMatrix;
+	for (UINT h = 0; h < height; h++)
+	{
+		auto py = y + h * yStride;
+		auto pu = u + (h / 2) * uvStride;
+		auto pv = v + (h / 2) * uvStride;
+		auto rgb = output + h * outputStride;
+		for (UINT w = 0; w < width; w++)
+		{
+			auto c = 298 * (lut[py[w]] - 16);
+			int d0 = pu[(w / 2) * uvStep] - 128;
+			int e0 = pv[(w / 2) * uvStep] - 128;
+			auto d = (m[0] * d0 + m[1] * e0 + COLOR_ADJUST_ROUND) >> COLOR_ADJUST_SHIFT;
+			auto e = (m[2] * d0 + m[3] * e0 + COLOR_ADJUST_ROUND) >> COLOR_ADJUST_SHIFT;
+			rgb[0] = Clamp((c + 516 * d + 128) >> 8);
+			rgb[1] = Clamp((c - 100 * d - 208 * e + 128) >> 8);
+			rgb[2] = Clamp((c + 409 * e + 128) >> 8);
+			rgb[3] = 0xFF;
+			rgb += 4;
+		}
+	}
+}
\ No newline at end of file
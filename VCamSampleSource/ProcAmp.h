@@ -0,0 +1,57 @@
+#pragma once
+
+// video ProcAmp values, in KS units
+struct ProcAmpSettings
+{
+	LONG brightness; // -100 to 100, in 8-bit levels
+	LONG contrast; // 0 to 200, percent
+	LONG hue; // -180 to 180, degrees
+	LONG saturation; // 0 to 200, percent
+	LONG gamma; // 10 to 500, gamma x 100
+
+	ProcAmpSettings() :
+		brightness(0),
+		contrast(100),
+		hue(0),
+		saturation(100),
+		gamma(100)
+	{
+	}
+};
+
+// ProcAmp settings precomputed as LUTs & matrices, so they're fused in the color conversions and don't cost an extra pass
+// matrices are fixed point, COLOR_ADJUST_SHIFT bits
+#define COLOR_ADJUST_SHIFT 14
+
+struct ColorLutAdjust;
+
+struct ColorAdjust
+{
+	bool identity;
+	BYTE rgbLut[256]; // brightness, contrast & gamma on full range R, G & B
+	BYTE yLut[256]; // same on limited range Y
+	int rgbToYuv[9]; // BT.601 limited range RGB => YUV with hue & saturation, U & V rows are centered on 0
+	int rgbMatrix[9]; // hue & saturation on RGB
+	int uvMatrix[4]; // hue & saturation on U - 128 & V - 128
+
+	ColorAdjust()
+	{
+		Update(ProcAmpSettings());
+	}
+
+	void Update(const ProcAmpSettings& settings);
+	D2D1_COLOR_F Apply(const D2D1_COLOR_F& color) const;
+
+	// the curves & matrices to bake in a LUT (see ColorLut.h)
+	void GetLutAdjust(ColorLutAdjust& adjust) const;
+};
+
+// handles PROPSETID_VIDCAP_VIDEOPROCAMP requests, changed is set if a value was set
+HRESULT ProcAmpKsProperty(ProcAmpSettings& settings, PKSPROPERTY property, ULONG length, LPVOID data, ULONG dataLength, ULONG* bytesReturned, bool& changed);
+
+// conversions with adjustments, same as the ones in Tools.h when adjust is identity
+void RGB32ToNV12(const BYTE* input, LONG inputStride, UINT width, UINT height, BYTE* y, LONG yStride, BYTE* uv, LONG uvStride, const ColorAdjust& adjust);
+void RGB32ToRGB32(const BYTE* input, LONG inputStride, UINT width, UINT height, BYTE* output, LONG outputStride, const ColorAdjust& adjust);
+void YToY(const BYTE* input, LONG inputStride, UINT width, UINT height, BYTE* output, LONG outputStride, const ColorAdjust& adjust);
+void UVToNV12UV(const BYTE* u, LONG uStride, const BYTE* v, LONG vStride, UINT uvStep, UINT width, UINT height, BYTE* uv, LONG uvStride, const ColorAdjust& adjust);
+void YUV420ToRGB32(const BYTE* y, LONG yStride, const BYTE* u, const BYTE* v, LONG uvStride, UINT uvStep, UINT width, UINT height, BYTE* output, LONG outputStride, const ColorAdjust& adjust);
\ No newline at end of file
@@ -0,0 +1,173 @@
+#include "pch.h"
+#include "Tools.h"
+#include "FrameSource.h"
+#include "FrameRing.h"
+#include "RingFrameSource.h"
+
+// the ring is created in the frame server service, so we must explicitly allow interactive users' producers to write in it
+#define FRAME_RING_SDDL L"D:P(A;;GA;;;SY)(A;;GA;;;LS)(A;;GA;;;BA)(A;;GRGW;;;IU)"
+
+HRESULT RingFrameSource::Open(PCWSTR format, UINT width, UINT height, UINT slotCount)
+{
+	if (format && *format)
+	{
+		if (!lstrcmpi(format, L"NV12"))
+		{
+			_format = MFVideoFormat_NV12;
+		}
+		else if (!lstrcmpi(format, L"I420") || !lstrcmpi(format, L"IYUV"))
+		{
+			_format = MFVideoFormat_I420;
+		}
+		else if (!lstrcmpi(format, L"BGRA") || !lstrcmpi(format, L"RGB32"))
+		{
+			_format = MFVideoFormat_RGB32;
+		}
+		else
+		{
+			RETURN_HR_MSG(E_INVALIDARG, "Unsupported ring format '%ls'", format);
+		}
+	}
+
+	_width = width;
+	_height = height;
+	if (slotCount)
+	{
+		RETURN_HR_IF_MSG(E_INVALIDARG, slotCount < 3 || slotCount > FRAME_RING_MAX_SLOTS, "Invalid ring slot count %u", slotCount);
+		_slotCount = slotCount;
+	}
+	return S_OK;
+}
+
+HRESULT RingFrameSource::CreateRing(UINT width, UINT height)
+{
+	auto format = _format == MFVideoFormat_RGB32 ? FRAME_RING_FORMAT_BGRA : (_format == MFVideoFormat_I420 ? FRAME_RING_FORMAT_I420 : FRAME_RING_FORMAT_NV12);
+	auto stride = FrameRingAlign(format == FRAME_RING_FORMAT_BGRA ? width * 4 : width);
+	auto slotSize = FrameRingAlign(sizeof(FrameRingSlot) + FrameRingFrameSize(format, stride, height));
+	auto size = (ULONGLONG)FrameRingSize(_slotCount, slotSize);
+
+	wil::unique_hlocal_security_descriptor sd;
+	RETURN_IF_WIN32_BOOL_FALSE(ConvertStringSecurityDescriptorToSecurityDescriptor(FRAME_RING_SDDL, SDDL_REVISION_1, wil::out_param_ptr<PSECURITY_DESCRIPTOR*>(sd), nullptr));
+	SECURITY_ATTRIBUTES sa{};
+	sa.nLength = sizeof(sa);
+	sa.lpSecurityDescriptor = sd.get();
+
+	// if the producer (or a previous stream) already created the ring, this opens it
+	_mapping.reset(CreateFileMapping(INVALID_HANDLE_VALUE, &sa, PAGE_READWRITE, (DWORD)(size >> 32), (DWORD)size, FRAME_RING_WINDOWS_NAME));
+	RETURN_LAST_ERROR_IF_NULL(_mapping);
+	auto exists = GetLastError() == ERROR_ALREADY_EXISTS;
+
+	_view.reset((BYTE*)MapViewOfFile(_mapping.get(), FILE_MAP_READ | FILE_MAP_WRITE, 0, 0, 0));
+	RETURN_LAST_ERROR_IF_NULL(_view);
+
+	MEMORY_BASIC_INFORMATION mbi{};
+	RETURN_LAST_ERROR_IF(!VirtualQuery(_view.get(), &mbi, sizeof(mbi)));
+	_viewSize = mbi.RegionSize;
+
+	if (!exists)
+	{
+		RETURN_HR_IF_MSG(E_INVALIDARG, !FrameRingInitialize(_view.get(), _viewSize, _slotCount, format, width, height, 0, 0), "Invalid ring parameters %u x %u", width, height);
+	}
+
+	// may be null if the producer created it but hasn't initialized it yet, we'll check again later
+	_header = FrameRingValidate(_view.get(), _viewSize, &_layout);
+	WINTRACE(L"RingFrameSource::CreateRing exists:%u size:%I64u valid:%u", exists, size, _header != nullptr);
+	return S_OK;
+}
+
+HRESULT RingFrameSource::Start(UINT width, UINT height, UINT fpsNumerator, UINT fpsDenominator)
+{
+	UNREFERENCED_PARAMETER(fpsNumerator);
+	UNREFERENCED_PARAMETER(fpsDenominator);
+	RETURN_HR_IF(E_INVALIDARG, !width || !height);
+
+	if (!_mapping)
+	{
+		RETURN_IF_FAILED(CreateRing(_width ? _width : width, _height ? _height : height));
+	}
+
+	// black NV12 frame of the stream's size, it can be converted to RGB32 too
+	_black = std::make_unique<BYTE[]>((SIZE_T)width * height * 3 / 2);
+	FillMemory(_black.get(), (SIZE_T)width * height, 16);
+	FillMemory(_black.get() + (SIZE_T)width * height, (SIZE_T)width * height / 2, 128);
+	_width = width;
+	_height = height;
+	return S_OK;
+}
+
+void RingFrameSource::ServeBlack(SourceFrame* frame)
+{
+	frame->format = MFVideoFormat_NV12;
+	frame->width = _width;
+	frame->height = _height;
+	frame->planes[0] = _black.get();
+	frame->strides[0] = _width;
+	frame->planes[1] = _black.get() + (SIZE_T)_width * _height;
+	frame->strides[1] = _width;
+	frame->planes[2] = nullptr;
+	frame->strides[2] = 0;
+	frame->index = 0;
+}
+
+HRESULT RingFrameSource::GetFrame(MFTIME time, REFGUID preferredFormat, SourceFrame* frame)
+{
+	UNREFERENCED_PARAMETER(time);
+	UNREFERENCED_PARAMETER(preferredFormat);
+	RETURN_HR_IF_NULL(E_POINTER, frame);
+	RETURN_HR_IF(E_UNEXPECTED, !_view || !_black);
+
+	if (!_header)
+	{
+		_header = FrameRingValidate(_view.get(), _viewSize, &_layout);
+	}
+
+	auto slot = _header ? FrameRingAcquire(_header, _layout) : nullptr;
+	if (!slot)
+	{
+		ServeBlack(frame);
+		return S_OK;
+	}
+
+	auto pixels = FrameRingGetPixels(slot);
+	frame->width = _layout.width;
+	frame->height = _layout.height;
+	frame->index = slot->frameNumber.load();
+	frame->planes[0] = pixels;
+	frame->strides[0] = _layout.stride;
+	switch (_layout.format)
+	{
+	case FRAME_RING_FORMAT_BGRA:
+		frame->format = MFVideoFormat_RGB32;
+		frame->planes[1] = nullptr;
+		frame->strides[1] = 0;
+		frame->planes[2] = nullptr;
+		frame->strides[2] = 0;
+		break;
+
+	case FRAME_RING_FORMAT_NV12:
+		frame->format = MFVideoFormat_NV12;
+		frame->planes[1] = pixels + (SIZE_T)_layout.stride * _layout.height;
+		frame->strides[1] = _layout.stride;
+		frame->planes[2] = nullptr;
+		frame->strides[2] = 0;
+		break;
+
+	default:
+		frame->format = MFVideoFormat_I420;
+		frame->planes[1] = pixels + (SIZE_T)_layout.stride * _layout.height;
+		frame->strides[1] = _layout.stride / 2;
+		frame->planes[2] = frame->planes[1] + (SIZE_T)(_layout.stride / 2) * (_layout.height / 2);
+		frame->strides[2] = _layout.stride / 2;
+		break;
+	}
+	return S_OK;
+}
+
+void RingFrameSource::Stop()
+{
+	if (_header)
+	{
+		FrameRingRelease(_header);
+	}
+	_black.reset();
+}
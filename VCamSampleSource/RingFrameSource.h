@@ -0,0 +1,40 @@
+#pragma once
+
+// serves frames written by an external producer process in a shared memory frame ring (see FrameRing.h)
+// frames are served in place from the shared memory, the slot being held until the next frame is requested
+class RingFrameSource : public FrameSource
+{
+	wil::unique_handle _mapping;
+	wil::unique_mapview_ptr<BYTE> _view;
+	SIZE_T _viewSize;
+	FrameRingHeader* _header;
+	FrameRingLayout _layout; // copied when the ring is validated, the producer can change the header at any time
+	GUID _format;
+	UINT _width;
+	UINT _height;
+	UINT _slotCount;
+	std::unique_ptr<BYTE[]> _black; // served until the producer publishes something
+
+	HRESULT CreateRing(UINT width, UINT height);
+	void ServeBlack(SourceFrame* frame);
+
+public:
+	RingFrameSource() :
+		_viewSize(0),
+		_header(nullptr),
+		_layout(),
+		_format(MFVideoFormat_NV12),
+		_width(0),
+		_height(0),
+		_slotCount(4)
+	{
+	}
+
+	// format, width & height are only used if the ring doesn't exist yet, 0 means the stream's size
+	HRESULT Open(PCWSTR format, UINT width, UINT height, UINT slotCount);
+
+	// FrameSource
+	HRESULT Start(UINT width, UINT height, UINT fpsNumerator, UINT fpsDenominator);
+	HRESULT GetFrame(MFTIME time, REFGUID preferredFormat, SourceFrame* frame);
+	void Stop();
+};
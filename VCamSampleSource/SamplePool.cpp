@@ -0,0 +1,84 @@
+#include "pch.h"
+#include "SamplePool.h"
+
+STDMETHODIMP SamplePool::GetParameters(DWORD* pdwFlags, DWORD* pdwQueue)
+{
+	UNREFERENCED_PARAMETER(pdwFlags);
+	UNREFERENCED_PARAMETER(pdwQueue);
+	return E_NOTIMPL;
+}
+
+STDMETHODIMP SamplePool::Invoke(IMFAsyncResult* pResult)
+{
+	RETURN_HR_IF_NULL(E_POINTER, pResult);
+	wil::com_ptr_nothrow<IUnknown> object;
+	RETURN_IF_FAILED(pResult->GetObject(&object));
+	wil::com_ptr_nothrow<IMFSample> sample;
+	RETURN_IF_FAILED(object->QueryInterface(&sample));
+
+	// samples of a previous start are dropped, the vector never grows past the pool's size so this doesn't allocate
+	winrt::slim_lock_guard lock(_lock);
+	if (_initialized && _samples.size() < _samples.capacity())
+	{
+		_samples.push_back(std::move(sample));
+	}
+	return S_OK;
+}
+
+HRESULT SamplePool::Initialize(UINT count, DWORD bufferSize)
+{
+	WINTRACE(L"SamplePool::Initialize count:%u bufferSize:%u", count, bufferSize);
+	Uninitialize();
+
+	std::vector<wil::com_ptr_nothrow<IMFSample>> samples;
+	samples.reserve(count);
+	for (UINT i = 0; i < count; i++)
+	{
+		wil::com_ptr_nothrow<IMFTrackedSample> tracked;
+		RETURN_IF_FAILED(MFCreateTrackedSample(&tracked));
+		auto sample = tracked.try_query<IMFSample>();
+		RETURN_HR_IF_NULL(E_NOINTERFACE, sample);
+
+		wil::com_ptr_nothrow<IMFMediaBuffer> buffer;
+		RETURN_IF_FAILED(MFCreateMemoryBuffer(bufferSize, &buffer));
+		RETURN_IF_FAILED(sample->AddBuffer(buffer.get()));
+		samples.push_back(std::move(sample));
+	}
+
+	winrt::slim_lock_guard lock(_lock);
+	_samples = std::move(samples);
+	_initialized = true;
+	return S_OK;
+}
+
+void SamplePool::Uninitialize()
+{
+	// released once the lock is
+	std::vector<wil::com_ptr_nothrow<IMFSample>> samples;
+	winrt::slim_lock_guard lock(_lock);
+	_initialized = false;
+	_samples.swap(samples);
+}
+
+HRESULT SamplePool::AllocateSample(IMFSample** sample)
+{
+	RETURN_HR_IF_NULL(E_POINTER, sample);
+	*sample = nullptr;
+
+	wil::com_ptr_nothrow<IMFSample> free;
+	{
+		winrt::slim_lock_guard lock(_lock);
+		RETURN_HR_IF(MF_E_NOT_INITIALIZED, !_initialized);
+		RETURN_HR_IF(MF_E_SAMPLEALLOCATOR_EMPTY, _samples.empty());
+		free = std::move(_samples.back());
+		_samples.pop_back();
+	}
+
+	// the buffer is kept, the generator sets its length
+	RETURN_IF_FAILED(free->DeleteAllItems());
+	auto tracked = free.try_query<IMFTrackedSample>();
+	RETURN_HR_IF_NULL(E_NOINTERFACE, tracked);
+	RETURN_IF_FAILED(tracked->SetAllocator(this, nullptr));
+	*sample = free.detach();
+	return S_OK;
+}
\ No newline at end of file
@@ -0,0 +1,29 @@
+#pragma once
+
+// Samples for the formats the sample allocator doesn't handle (MJPG): a fixed set of tracked samples, each with a memory buffer, that come back
+// to the pool when the pipeline releases them, like the allocator's, so steady-state requests create no samples or buffers
+struct SamplePool : winrt::implements<SamplePool, IMFAsyncCallback>
+{
+public:
+	// IMFAsyncCallback, invoked when the pipeline releases a sample
+	STDMETHOD(GetParameters)(DWORD* pdwFlags, DWORD* pdwQueue);
+	STDMETHOD(Invoke)(IMFAsyncResult* pResult);
+
+	SamplePool() :
+		_initialized(false)
+	{
+	}
+
+	HRESULT Initialize(UINT count, DWORD bufferSize);
+
+	// samples still in the pipeline are released when they come back
+	void Uninitialize();
+
+	// without the attributes of its previous use, MF_E_SAMPLEALLOCATOR_EMPTY when all samples are in the pipeline
+	HRESULT AllocateSample(IMFSample** sample);
+
+private:
+	winrt::slim_mutex _lock;
+	std::vector<wil::com_ptr_nothrow<IMFSample>> _samples; // free ones, its capacity is the pool's size
+	bool _initialized;
+};
\ No newline at end of file
@@ -0,0 +1,29 @@
+#include "pch.h"
+#include "Tools.h"
+#include "Settings.h"
+
+const std::wstring GetSettingString(PCWSTR name, PCWSTR defaultValue)
+{
+	registry_key key;
+	if (RegOpenKeyEx(HKEY_LOCAL_MACHINE, VCAM_SETTINGS_KEY, 0, KEY_READ, key.put()) != ERROR_SUCCESS)
+		return defaultValue;
+
+	std::wstring value;
+	if (RegReadValue(key.get(), name, value) != ERROR_SUCCESS)
+		return defaultValue;
+
+	return value;
+}
+
+const DWORD GetSettingDWORD(PCWSTR name, DWORD defaultValue)
+{
+	registry_key key;
+	if (RegOpenKeyEx(HKEY_LOCAL_MACHINE, VCAM_SETTINGS_KEY, 0, KEY_READ, key.put()) != ERROR_SUCCESS)
+		return defaultValue;
+
+	DWORD value;
+	if (RegReadValue(key.get(), name, value) != ERROR_SUCCESS)
+		return defaultValue;
+
+	return value;
+}
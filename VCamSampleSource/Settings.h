@@ -0,0 +1,7 @@
+#pragma once
+
+// settings are read from HKLM since the frame server services (Local Service/Local System) cannot see the user's hive
+#define VCAM_SETTINGS_KEY L"Software\\VCamSample"
+
+const std::wstring GetSettingString(PCWSTR name, PCWSTR defaultValue = L"");
+const DWORD GetSettingDWORD(PCWSTR name, DWORD defaultValue = 0);
@@ -0,0 +1,315 @@
+#include "ThreadPolicy.h"
+#include "TaskScheduler.h"
+#include <cstring>
+
+#define TASK_DEQUE_CAPACITY 64 // ranges, binary splitting pushes about log2(count / grain) per loop, a full deque's owner runs ranges without splitting
+#define TASK_EXTERNAL_DEQUES 16 // for the threads that aren't workers (the frame server's), shared when there are more
+#define TASK_SPIN_ROUNDS 64 // an idle worker yields that many times looking for work before it sleeps, loops come in bursts
+
+// a worker's or other threads' ranges, the owner pushes & takes at the bottom, thieves take from the top where the largest ranges are
+struct alignas(64) TaskScheduler::Deque
+{
+	std::mutex lock;
+	Range ranges[TASK_DEQUE_CAPACITY];
+	uint32_t count = 0;
+};
+
+static thread_local TaskScheduler* _workerScheduler = nullptr;
+static thread_local uint32_t _workerIndex = 0;
+static std::atomic<uint32_t> _externalThreads{ 0 };
+
+TaskScheduler::TaskScheduler(uint32_t workers) :
+	_workerCount(workers ? workers : std::max<uint32_t>(std::thread::hardware_concurrency(), 1) - 1),
+	_started(false),
+	_queued(0),
+	_sleepers(0),
+	_stopping(false),
+	_affinity(0),
+	_priority(ThreadPriority::Normal),
+	_loops(0),
+	_ranges(0),
+	_steals(0)
+{
+	_workerCount = std::min<uint32_t>(_workerCount, TASK_SCHEDULER_MAX_WORKERS);
+	_workers = std::make_unique<Worker[]>(_workerCount);
+	_deques = std::make_unique<Deque[]>(_workerCount + TASK_EXTERNAL_DEQUES);
+}
+
+TaskScheduler::~TaskScheduler()
+{
+	Stop();
+}
+
+TaskSchedulerStats TaskScheduler::GetStats() const
+{
+	return TaskSchedulerStats{ _loops.load(std::memory_order_relaxed), _ranges.load(std::memory_order_relaxed), _steals.load(std::memory_order_relaxed) };
+}
+
+void TaskScheduler::Start()
+{
+	std::lock_guard<std::mutex> lock(_startLock);
+	if (_started.load(std::memory_order_acquire))
+		return;
+
+	_stopping = false;
+	for (uint32_t i = 0; i < _workerCount; i++)
+	{
+		_workers[i].id = 0;
+		_workers[i].thread = std::thread(&TaskScheduler::RunWorker, this, i);
+	}
+	_started.store(true, std::memory_order_release);
+}
+
+void TaskScheduler::Stop()
+{
+	std::lock_guard<std::mutex> lock(_startLock);
+	if (!_started.load(std::memory_order_acquire))
+		return;
+
+	{
+		std::lock_guard<std::mutex> sleepLock(_sleepLock);
+		_stopping = true;
+	}
+	_wake.notify_all();
+	for (uint32_t i = 0; i < _workerCount; i++)
+	{
+		_workers[i].thread.join();
+	}
+	_started.store(false, std::memory_order_release);
+}
+
+bool TaskScheduler::SetAffinity(uint64_t mask)
+{
+	std::lock_guard<std::mutex> lock(_startLock);
+	std::lock_guard<std::mutex> policyLock(_policyLock);
+	_affinity = mask;
+	if (!_started.load(std::memory_order_acquire))
+		return true;
+
+	auto applied = true;
+	for (uint32_t i = 0; i < _workerCount; i++)
+	{
+		auto priority = true;
+		ApplyPolicy(_workers[i].thread.native_handle(), _workers[i].id, applied, priority);
+	}
+	return applied;
+}
+
+bool TaskScheduler::SetPriority(ThreadPriority priority)
+{
+	std::lock_guard<std::mutex> lock(_startLock);
+	std::lock_guard<std::mutex> policyLock(_policyLock);
+	_priority = priority;
+	if (!_started.load(std::memory_order_acquire))
+		return true;
+
+	auto applied = true;
+	for (uint32_t i = 0; i < _workerCount; i++)
+	{
+		auto affinity = true;
+		ApplyPolicy(_workers[i].thread.native_handle(), _workers[i].id, affinity, applied);
+	}
+	return applied;
+}
+
+// sets a worker's affinity & priority, the flags are cleared when the system refuses them
+void TaskScheduler::ApplyPolicy(std::thread::native_handle_type thread, uint64_t id, bool& affinity, bool& priority)
+{
+	PolicyThread policyThread{ thread, id };
+	if (!SetPolicyThreadAffinity(policyThread, _affinity))
+	{
+		affinity = false;
+	}
+
+	if (!SetPolicyThreadPriority(policyThread, _priority))
+	{
+		priority = false;
+	}
+}
+
+TaskScheduler::Deque& TaskScheduler::GetCallerDeque()
+{
+	if (_workerScheduler == this)
+		return _deques[_workerIndex];
+
+	static thread_local uint32_t external = _externalThreads.fetch_add(1, std::memory_order_relaxed) % TASK_EXTERNAL_DEQUES;
+	return _deques[_workerCount + external];
+}
+
+bool TaskScheduler::Push(Deque& deque, const Range& range)
+{
+	{
+		std::lock_guard<std::mutex> lock(deque.lock);
+		if (deque.count == TASK_DEQUE_CAPACITY)
+			return false;
+
+		deque.ranges[deque.count++] = range;
+
+		// a worker going to sleep increments the sleepers before checking the queued ranges, so one of the two sees the other
+		_queued.fetch_add(1);
+	}
+
+	_ranges.fetch_add(1, std::memory_order_relaxed);
+	if (_sleepers.load())
+	{
+		std::lock_guard<std::mutex> lock(_sleepLock);
+		_wake.notify_one();
+	}
+	return true;
+}
+
+// the range nearest the top or the bottom, of the loop if there's one (a thread waiting for its loop only helps that loop)
+bool TaskScheduler::Take(Deque& deque, const Loop* loop, bool top, Range& range)
+{
+	std::lock_guard<std::mutex> lock(deque.lock);
+	for (uint32_t n = 0; n < deque.count; n++)
+	{
+		auto i = top ? n : deque.count - 1 - n;
+		if (loop && deque.ranges[i].loop != loop)
+			continue;
+
+		range = deque.ranges[i];
+		memmove(deque.ranges + i, deque.ranges + i + 1, (deque.count - i - 1) * sizeof(Range));
+		deque.count--;
+		_queued.fetch_sub(1);
+		return true;
+	}
+	return false;
+}
+
+bool TaskScheduler::Steal(uint32_t first, const Loop* loop, Range& range)
+{
+	auto count = _workerCount + TASK_EXTERNAL_DEQUES;
+	for (uint32_t n = 0; n < count; n++)
+	{
+		if (Take(_deques[(first + n) % count], loop, true, range))
+		{
+			_steals.fetch_add(1, std::memory_order_relaxed);
+			return true;
+		}
+	}
+	return false;
+}
+
+// splits the range down to the loop's grain, pushing the upper halves for others to steal, then runs what's left
+void TaskScheduler::RunRange(Deque& deque, Range range)
+{
+	auto loop = range.loop;
+	while (range.end - range.begin > loop->grain)
+	{
+		auto middle = range.begin + (range.end - range.begin) / 2;
+		if (!Push(deque, Range{ loop, middle, range.end }))
+			break;
+
+		range.end = middle;
+	}
+
+	if (!loop->failed.load(std::memory_order_relaxed))
+	{
+		try
+		{
+			loop->invoke(loop->function, range.begin, range.end);
+		}
+		catch (...)
+		{
+			if (!loop->failed.exchange(true))
+			{
+				loop->exception = std::current_exception();
+			}
+		}
+	}
+
+	// the loop may be gone as soon as its last items are counted
+	loop->remaining.fetch_sub(range.end - range.begin, std::memory_order_acq_rel);
+}
+
+void TaskScheduler::Run(Loop& loop, uint32_t count)
+{
+	if (count <= loop.grain || !_workerCount)
+	{
+		loop.invoke(loop.function, 0, count);
+		return;
+	}
+
+	if (!_started.load(std::memory_order_acquire))
+	{
+		Start();
+	}
+
+	_loops.fetch_add(1, std::memory_order_relaxed);
+	loop.remaining.store(count, std::memory_order_relaxed);
+	loop.failed.store(false, std::memory_order_relaxed);
+	auto& deque = GetCallerDeque();
+	RunRange(deque, Range{ &loop, 0, count });
+
+	// helps with what's left of the loop, what was stolen finishes on other threads
+	auto first = (uint32_t)(&deque - _deques.get()) + 1;
+	while (loop.remaining.load(std::memory_order_acquire))
+	{
+		Range range;
+		if (Take(deque, &loop, false, range) || Steal(first, &loop, range))
+		{
+			RunRange(deque, range);
+		}
+		else
+		{
+			std::this_thread::yield();
+		}
+	}
+
+	if (loop.failed.load(std::memory_order_relaxed))
+	{
+		std::rethrow_exception(loop.exception);
+	}
+}
+
+void TaskScheduler::RunWorker(uint32_t index)
+{
+	_workerScheduler = this;
+	_workerIndex = index;
+	{
+		// the thread object may not be assigned yet, the worker applies the policy to itself
+		std::lock_guard<std::mutex> lock(_policyLock);
+		auto thread = PolicyThread::GetCurrent();
+		_workers[index].id = thread.id;
+		auto affinity = true;
+		auto priority = true;
+		ApplyPolicy(thread.handle, thread.id, affinity, priority);
+	}
+
+	auto& deque = _deques[index];
+	auto victim = index + 1;
+	uint32_t idle = 0;
+	for (;;)
+	{
+		Range range;
+		if (Take(deque, nullptr, false, range) || Steal(victim++, nullptr, range))
+		{
+			RunRange(deque, range);
+			idle = 0;
+			continue;
+		}
+
+		if (++idle < TASK_SPIN_ROUNDS)
+		{
+			std::this_thread::yield();
+			continue;
+		}
+
+		std::unique_lock<std::mutex> lock(_sleepLock);
+		_sleepers.fetch_add(1);
+		_wake.wait(lock, [&] { return _stopping || _queued.load(); });
+		_sleepers.fetch_sub(1);
+		if (_stopping)
+			return;
+
+		idle = 0;
+	}
+}
+
+TaskScheduler& TaskScheduler::GetShared()
+{
+	// never destroyed: at process exit its workers are gone already, a module is stopped before it's unloaded
+	static auto scheduler = new TaskScheduler();
+	return *scheduler;
+}
\ No newline at end of file
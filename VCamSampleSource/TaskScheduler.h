@@ -0,0 +1,138 @@
+#pragma once
+
+// A work-stealing task scheduler for the parallel loops of the frame path (bands of rows, tiles), shared by all the streams & cameras of the
+// process so they share the machine's cores instead of each spinning up threads. It has one worker per hardware thread but one, since the thread
+// calling ParallelFor works too. A loop's range is split in halves pushed to the calling thread's deque, idle workers steal the oldest (largest)
+// halves from the top of other deques and split them again, so a fork/join costs microseconds and allocates nothing.
+// The workers' affinity & priority are set with ThreadPolicy.
+#include <cstdint>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+
+#define TASK_SCHEDULER_MAX_WORKERS 64
+
+enum class ThreadPriority;
+
+struct TaskSchedulerStats
+{
+	uint64_t loops; // run in parallel, smaller ones run on the calling thread
+	uint64_t ranges; // parts of loops pushed to deques
+	uint64_t steals; // ranges taken from another thread's deque
+};
+
+class TaskScheduler
+{
+public:
+	// a loop in progress, lives on the stack of the thread that runs it
+	struct Loop
+	{
+		void (*invoke)(void* function, uint32_t begin, uint32_t end);
+		void* function;
+		uint32_t grain;
+		std::atomic<uint32_t> remaining; // items not run yet
+		std::atomic<bool> failed;
+		std::exception_ptr exception; // the first thrown, set by the thread that set failed
+	};
+
+	struct Range
+	{
+		Loop* loop;
+		uint32_t begin;
+		uint32_t end;
+	};
+
+	struct Deque;
+
+private:
+	struct Worker
+	{
+		std::thread thread;
+		uint64_t id; // the kernel's thread id on Linux, for its priority
+	};
+
+	uint32_t _workerCount;
+	std::unique_ptr<Worker[]> _workers;
+	std::unique_ptr<Deque[]> _deques; // the workers', then those shared by the other threads
+	std::atomic<bool> _started;
+	std::mutex _startLock;
+	std::mutex _policyLock; // of the affinity, priority & workers' ids, workers take it when they start, Stop holds the start lock
+	std::mutex _sleepLock;
+	std::condition_variable _wake;
+	std::atomic<uint32_t> _queued; // ranges in all deques
+	std::atomic<uint32_t> _sleepers;
+	bool _stopping;
+	uint64_t _affinity;
+	ThreadPriority _priority;
+	std::atomic<uint64_t> _loops;
+	std::atomic<uint64_t> _ranges;
+	std::atomic<uint64_t> _steals;
+
+	void Start();
+	void RunWorker(uint32_t index);
+	void ApplyPolicy(std::thread::native_handle_type thread, uint64_t id, bool& affinity, bool& priority);
+	Deque& GetCallerDeque();
+	bool Push(Deque& deque, const Range& range);
+	bool Take(Deque& deque, const Loop* loop, bool top, Range& range);
+	bool Steal(uint32_t first, const Loop* loop, Range& range);
+	void RunRange(Deque& deque, Range range);
+	void Run(Loop& loop, uint32_t count);
+
+public:
+	// 0 workers: one per hardware thread but one
+	explicit TaskScheduler(uint32_t workers = 0);
+	~TaskScheduler();
+	TaskScheduler(const TaskScheduler&) = delete;
+	TaskScheduler& operator=(const TaskScheduler&) = delete;
+
+	uint32_t GetWorkerCount() const { return _workerCount; }
+	TaskSchedulerStats GetStats() const;
+
+	// workers are started by the first loop, and stopped here (when no loop runs) before the module that runs them is unloaded
+	void Stop();
+
+	// bit n for logical processor n, 0 for all, false if the system refused it for a running worker
+	bool SetAffinity(uint64_t mask);
+	bool SetPriority(ThreadPriority priority);
+
+	// calls f(begin, end) on parts of [0, count) split in halves down to grain items or less (0 picks a grain for the worker count) and returns when all ran,
+	// rethrowing the first exception thrown by f
+	template<typename F> void ParallelFor(uint32_t count, uint32_t grain, F&& f)
+	{
+		if (!count)
+			return;
+
+		Loop loop;
+		loop.invoke = [](void* function, uint32_t begin, uint32_t end) { (*(std::remove_reference_t<F>*)function)(begin, end); };
+		loop.function = (void*)std::addressof(f);
+		loop.grain = grain ? grain : std::max<uint32_t>(1, count / ((_workerCount + 1) * 4));
+		Run(loop, count);
+	}
+
+	// calls f(left, top, right, bottom) on the tiles covering width x height, in parallel
+	template<typename F> void ParallelForTiles(uint32_t width, uint32_t height, uint32_t tileWidth, uint32_t tileHeight, uint32_t grain, F&& f)
+	{
+		if (!width || !height || !tileWidth || !tileHeight)
+			return;
+
+		auto tilesX = (width + tileWidth - 1) / tileWidth;
+		auto tilesY = (height + tileHeight - 1) / tileHeight;
+		ParallelFor(tilesX * tilesY, grain, [&](uint32_t begin, uint32_t end)
+			{
+				for (auto tile = begin; tile < end; tile++)
+				{
+					auto left = tile % tilesX * tileWidth;
+					auto top = tile / tilesX * tileHeight;
+					f(left, top, std::min<uint32_t>(left + tileWidth, width), std::min<uint32_t>(top + tileHeight, height));
+				}
+			});
+	}
+
+	// never destroyed, its workers are stopped with Stop
+	static TaskScheduler& GetShared();
+};
\ No newline at end of file
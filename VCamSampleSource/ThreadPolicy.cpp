@@ -0,0 +1,253 @@
+#include "ThreadPolicy.h"
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <cerrno>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#if defined(_WIN32)
+static const int _priorities[] = { THREAD_PRIORITY_NORMAL, THREAD_PRIORITY_ABOVE_NORMAL, THREAD_PRIORITY_HIGHEST, THREAD_PRIORITY_TIME_CRITICAL };
+#else
+static const int _nices[] = { 0, -5, -10 }; // raising the priority needs CAP_SYS_NICE
+
+static void ToCpuSet(uint64_t mask, cpu_set_t& set)
+{
+	CPU_ZERO(&set);
+	for (uint32_t i = 0; i < THREAD_POLICY_MAX_PROCESSORS; i++)
+	{
+		if (mask & (1ull << i))
+		{
+			CPU_SET(i, &set);
+		}
+	}
+}
+
+static uint64_t FromCpuSet(const cpu_set_t& set)
+{
+	uint64_t mask = 0;
+	for (uint32_t i = 0; i < THREAD_POLICY_MAX_PROCESSORS; i++)
+	{
+		if (CPU_ISSET(i, &set))
+		{
+			mask |= 1ull << i;
+		}
+	}
+	return mask;
+}
+#endif
+
+// on Windows, the handle is a pseudo handle only valid on the calling thread
+PolicyThread PolicyThread::GetCurrent()
+{
+#if defined(_WIN32)
+	return PolicyThread{ GetCurrentThread(), GetCurrentThreadId() };
+#else
+	return PolicyThread{ pthread_self(), (uint64_t)syscall(SYS_gettid) };
+#endif
+}
+
+uint64_t GetProcessAffinity()
+{
+#if defined(_WIN32)
+	DWORD_PTR processMask, systemMask;
+	return GetProcessAffinityMask(GetCurrentProcess(), &processMask, &systemMask) ? (uint64_t)processMask : 0;
+#else
+	// the main thread's, the process's id is its thread id
+	cpu_set_t set;
+	return sched_getaffinity(getpid(), sizeof(set), &set) ? 0 : FromCpuSet(set);
+#endif
+}
+
+uint32_t GetCurrentProcessor()
+{
+#if defined(_WIN32)
+	return GetCurrentProcessorNumber();
+#else
+	auto processor = sched_getcpu();
+	return processor < 0 ? THREAD_POLICY_NO_PROCESSOR : (uint32_t)processor;
+#endif
+}
+
+bool SetPolicyThreadAffinity(const PolicyThread& thread, uint64_t mask)
+{
+	auto allowed = GetProcessAffinity();
+	if (mask)
+	{
+		allowed &= mask;
+	}
+
+	if (!allowed)
+		return false;
+
+#if defined(_WIN32)
+	return SetThreadAffinityMask(thread.handle, (DWORD_PTR)allowed) != 0;
+#else
+	cpu_set_t set;
+	ToCpuSet(allowed, set);
+	return !pthread_setaffinity_np(thread.handle, sizeof(set), &set);
+#endif
+}
+
+bool SetPolicyThreadPriority(const PolicyThread& thread, ThreadPriority priority)
+{
+#if defined(_WIN32)
+	// the time critical priority of the process's class, the real-time class would be the whole frame server's
+	return SetThreadPriority(thread.handle, _priorities[(int)priority]) != FALSE;
+#else
+	sched_param param{};
+	if (priority == ThreadPriority::RealTime)
+	{
+		param.sched_priority = THREAD_POLICY_REALTIME_PRIORITY;
+		return !pthread_setschedparam(thread.handle, SCHED_FIFO, &param);
+	}
+
+	// back to time sharing if it was real-time, with a nice value
+	return !pthread_setschedparam(thread.handle, SCHED_OTHER, &param) && thread.id && !setpriority(PRIO_PROCESS, (id_t)thread.id, _nices[(int)priority]);
+#endif
+}
+
+ThreadPolicyScope::ThreadPolicyScope(ThreadPriority priority, uint64_t affinity) :
+	_affinity(0),
+	_policy(0),
+	_priority(0),
+	_nice(0),
+	_affinitySet(false),
+	_prioritySet(false),
+	_failed(false)
+{
+#if defined(_WIN32)
+	if (affinity)
+	{
+		auto allowed = affinity & GetProcessAffinity();
+		_affinity = allowed ? (uint64_t)SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)allowed) : 0; // the previous mask
+		_affinitySet = _affinity != 0;
+		_failed |= !_affinitySet;
+	}
+
+	if (priority != ThreadPriority::Normal)
+	{
+		_priority = GetThreadPriority(GetCurrentThread());
+		_prioritySet = _priority != THREAD_PRIORITY_ERROR_RETURN && SetThreadPriority(GetCurrentThread(), _priorities[(int)priority]);
+		_failed |= !_prioritySet;
+	}
+#else
+	auto thread = PolicyThread::GetCurrent();
+	if (affinity)
+	{
+		// restored even if setting it failed, the mask is read first
+		cpu_set_t set;
+		_affinitySet = !pthread_getaffinity_np(thread.handle, sizeof(set), &set);
+		if (_affinitySet)
+		{
+			_affinity = FromCpuSet(set);
+		}
+		_failed |= !_affinitySet || !SetPolicyThreadAffinity(thread, affinity);
+	}
+
+	if (priority != ThreadPriority::Normal)
+	{
+		// a nice value can be -1, errno tells it from an error
+		sched_param param{};
+		errno = 0;
+		_nice = getpriority(PRIO_PROCESS, (id_t)thread.id);
+		_prioritySet = !errno && !pthread_getschedparam(thread.handle, &_policy, &param);
+		if (_prioritySet)
+		{
+			_priority = param.sched_priority;
+		}
+		_failed |= !_prioritySet || !SetPolicyThreadPriority(thread, priority);
+	}
+#endif
+}
+
+ThreadPolicyScope::~ThreadPolicyScope()
+{
+#if defined(_WIN32)
+	if (_prioritySet)
+	{
+		SetThreadPriority(GetCurrentThread(), _priority);
+	}
+
+	if (_affinitySet)
+	{
+		SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)_affinity);
+	}
+#else
+	if (_prioritySet)
+	{
+		sched_param param{};
+		param.sched_priority = _priority;
+		pthread_setschedparam(pthread_self(), _policy, &param);
+		if (_policy != SCHED_FIFO && _policy != SCHED_RR)
+		{
+			setpriority(PRIO_PROCESS, (id_t)syscall(SYS_gettid), _nice);
+		}
+	}
+
+	if (_affinitySet)
+	{
+		cpu_set_t set;
+		ToCpuSet(_affinity, set);
+		pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+	}
+#endif
+}
+
+uint32_t ProcessorReservations::Reserve(uint64_t mask)
+{
+	auto allowed = GetProcessAffinity();
+	if (mask)
+	{
+		allowed &= mask;
+	}
+
+	std::lock_guard<std::mutex> lock(_lock);
+	uint32_t processor = THREAD_POLICY_NO_PROCESSOR;
+	for (uint32_t i = 0; i < THREAD_POLICY_MAX_PROCESSORS; i++)
+	{
+		if ((allowed & (1ull << i)) && (processor == THREAD_POLICY_NO_PROCESSOR || _counts[i] <= _counts[processor]))
+		{
+			processor = i;
+		}
+	}
+
+	if (processor != THREAD_POLICY_NO_PROCESSOR)
+	{
+		_counts[processor]++;
+	}
+	return processor;
+}
+
+void ProcessorReservations::Release(uint32_t processor)
+{
+	if (processor >= THREAD_POLICY_MAX_PROCESSORS)
+		return;
+
+	std::lock_guard<std::mutex> lock(_lock);
+	if (_counts[processor])
+	{
+		_counts[processor]--;
+	}
+}
+
+uint32_t ProcessorReservations::GetCount(uint32_t processor)
+{
+	if (processor >= THREAD_POLICY_MAX_PROCESSORS)
+		return 0;
+
+	std::lock_guard<std::mutex> lock(_lock);
+	return _counts[processor];
+}
+
+ProcessorReservations& ProcessorReservations::GetShared()
+{
+	static ProcessorReservations reservations;
+	return reservations;
+}
\ No newline at end of file
@@ -0,0 +1,86 @@
+#pragma once
+
+// Scheduling policy of the threads that produce frames: their priority, up to real-time, and the logical processors they may run on, so the
+// system doesn't preempt them with less urgent work or migrate them between cores, where they lose their caches. Processors are reserved
+// by the producers of busy streams, each stream gets the processor of its mask the fewest other streams have, so streams don't share cores
+// while there are enough of them.
+// On POSIX systems, real-time is SCHED_FIFO and the other priorities are nice values.
+#include <cstdint>
+#include <mutex>
+#include <thread>
+
+#define THREAD_POLICY_MAX_PROCESSORS 64 // masks have a bit per logical processor
+#define THREAD_POLICY_NO_PROCESSOR 0xFFFFFFFF
+#define THREAD_POLICY_REALTIME_PRIORITY 10 // SCHED_FIFO priority on Linux, under the kernel's interrupt threads (50)
+
+enum class ThreadPriority
+{
+	Normal,
+	AboveNormal,
+	Highest,
+	RealTime, // THREAD_PRIORITY_TIME_CRITICAL on Windows, SCHED_FIFO on Linux where it needs CAP_SYS_NICE or an RLIMIT_RTPRIO
+};
+
+// a thread to set the policy of, the kernel's thread id is needed on Linux where nice values are per thread id
+struct PolicyThread
+{
+	std::thread::native_handle_type handle;
+	uint64_t id; // 0 when unknown, the priority cannot be set then on Linux
+
+	// the calling thread
+	static PolicyThread GetCurrent();
+};
+
+// bit n for logical processor n, 0 for all those of the process, false if the system refused it
+bool SetPolicyThreadAffinity(const PolicyThread& thread, uint64_t mask);
+bool SetPolicyThreadPriority(const PolicyThread& thread, ThreadPriority priority);
+
+// the processors the process may run on
+uint64_t GetProcessAffinity();
+
+// the processor the calling thread runs on, to count migrations
+uint32_t GetCurrentProcessor();
+
+// sets the calling thread's priority & affinity for a scope (a frame request on a thread that isn't ours) and restores them when destroyed,
+// Normal & 0 leave them as they are
+class ThreadPolicyScope
+{
+	uint64_t _affinity; // previous ones
+	int _policy;
+	int _priority;
+	int _nice;
+	bool _affinitySet;
+	bool _prioritySet;
+	bool _failed;
+
+public:
+	ThreadPolicyScope(ThreadPriority priority, uint64_t affinity);
+	~ThreadPolicyScope();
+	ThreadPolicyScope(const ThreadPolicyScope&) = delete;
+	ThreadPolicyScope& operator=(const ThreadPolicyScope&) = delete;
+
+	// false if the system refused the priority or the affinity
+	bool IsApplied() const { return !_failed; }
+};
+
+// logical processors reserved by the producers of busy streams
+class ProcessorReservations
+{
+	std::mutex _lock;
+	uint32_t _counts[THREAD_POLICY_MAX_PROCESSORS];
+
+public:
+	ProcessorReservations() :
+		_counts()
+	{
+	}
+
+	// the processor of mask (0 for all those of the process) with the fewest reservations, the highest one on ties as interrupts tend to go to
+	// the first ones, THREAD_POLICY_NO_PROCESSOR when the process can run on none of them
+	uint32_t Reserve(uint64_t mask);
+	void Release(uint32_t processor);
+	uint32_t GetCount(uint32_t processor);
+
+	// one for the process, so the streams of different cameras don't pick the same processors
+	static ProcessorReservations& GetShared();
+};
\ No newline at end of file
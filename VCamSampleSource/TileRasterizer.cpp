@@ -0,0 +1,407 @@
+#include "TaskScheduler.h"
+#include "TileRasterizer.h"
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+#if defined(_M_IX86) || defined(_M_X64) || defined(__SSE2__)
+#include <emmintrin.h>
+#define RASTER_SSE
+#endif
+
+#define RASTER_MAX_SIZE 8192
+
+// alpha is 0 to 256
+static inline uint32_t BlendPixel(uint32_t dst, uint32_t src, uint32_t alpha)
+{
+	auto rb = ((dst & 0x00FF00FF) * (256 - alpha) + (src & 0x00FF00FF) * alpha + 0x00800080) >> 8;
+	auto ag = (((dst >> 8) & 0x00FF00FF) * (256 - alpha) + ((src >> 8) & 0x00FF00FF) * alpha + 0x00800080) >> 8;
+	return (rb & 0x00FF00FF) | ((ag & 0x00FF00FF) << 8);
+}
+
+static inline uint32_t CoverageToAlpha(float coverage)
+{
+	return (uint32_t)(std::min(std::max(coverage, 0.0f), 1.0f) * 256 + 0.5f);
+}
+
+static void FillSpan(uint32_t* pixels, uint32_t count, uint32_t color)
+{
+	uint32_t x = 0;
+#if defined(RASTER_SSE)
+	auto value = _mm_set1_epi32((int)color);
+	for (; x + 4 <= count; x += 4)
+	{
+		_mm_storeu_si128((__m128i*)(pixels + x), value);
+	}
+#endif
+	for (; x < count; x++)
+	{
+		pixels[x] = color;
+	}
+}
+
+// the same alpha for all pixels
+static void BlendSpan(uint32_t* pixels, uint32_t count, uint32_t color, uint32_t alpha)
+{
+	if (!alpha)
+		return;
+
+	if (alpha >= 256)
+	{
+		FillSpan(pixels, count, color);
+		return;
+	}
+
+	uint32_t x = 0;
+#if defined(RASTER_SSE)
+	// dst * (256 - a) + src * a fits in 16 bits since the weights add up to 256
+	auto zero = _mm_setzero_si128();
+	auto source = _mm_unpacklo_epi8(_mm_set1_epi32((int)color), zero);
+	auto sourceWeighted = _mm_mullo_epi16(source, _mm_set1_epi16((short)alpha));
+	auto weight = _mm_set1_epi16((short)(256 - alpha));
+	auto round = _mm_set1_epi16(128);
+	for (; x + 4 <= count; x += 4)
+	{
+		auto dst = _mm_loadu_si128((const __m128i*)(pixels + x));
+		auto lo = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(dst, zero), weight), sourceWeighted), round), 8);
+		auto hi = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(dst, zero), weight), sourceWeighted), round), 8);
+		_mm_storeu_si128((__m128i*)(pixels + x), _mm_packus_epi16(lo, hi));
+	}
+#endif
+	for (; x < count; x++)
+	{
+		pixels[x] = BlendPixel(pixels[x], color, alpha);
+	}
+}
+
+// an alpha per pixel, from 8-bit coverage
+static void BlendMaskSpan(uint32_t* pixels, uint32_t count, uint32_t color, const uint8_t* mask)
+{
+	uint32_t x = 0;
+#if defined(RASTER_SSE)
+	auto zero = _mm_setzero_si128();
+	auto source = _mm_unpacklo_epi8(_mm_set1_epi32((int)color), zero);
+	auto full = _mm_set1_epi16(256);
+	auto round = _mm_set1_epi16(128);
+	for (; x + 4 <= count; x += 4)
+	{
+		uint32_t coverage;
+		memcpy(&coverage, mask + x, 4);
+		if (!coverage)
+			continue;
+
+		// 0-255 to 0-256, each pixel's alpha repeated for its 4 channels
+		auto alphas = _mm_unpacklo_epi8(_mm_cvtsi32_si128((int)coverage), zero);
+		alphas = _mm_add_epi16(alphas, _mm_srli_epi16(alphas, 7));
+		alphas = _mm_unpacklo_epi16(alphas, alphas);
+		auto alphaLo = _mm_unpacklo_epi32(alphas, alphas);
+		auto alphaHi = _mm_unpackhi_epi32(alphas, alphas);
+
+		auto dst = _mm_loadu_si128((const __m128i*)(pixels + x));
+		auto lo = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(dst, zero), _mm_sub_epi16(full, alphaLo)), _mm_mullo_epi16(source, alphaLo));
+		auto hi = _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(dst, zero), _mm_sub_epi16(full, alphaHi)), _mm_mullo_epi16(source, alphaHi));
+		lo = _mm_srli_epi16(_mm_add_epi16(lo, round), 8);
+		hi = _mm_srli_epi16(_mm_add_epi16(hi, round), 8);
+		_mm_storeu_si128((__m128i*)(pixels + x), _mm_packus_epi16(lo, hi));
+	}
+#endif
+	for (; x < count; x++)
+	{
+		if (mask[x])
+		{
+			pixels[x] = BlendPixel(pixels[x], color, mask[x] + (mask[x] >> 7));
+		}
+	}
+}
+
+// how much of the pixel [x, x + 1) the span [start, end) covers
+static inline float Coverage(int32_t x, float start, float end)
+{
+	return std::min((float)x + 1, end) - std::max((float)x, start);
+}
+
+bool TileRasterizer::Start(uint32_t width, uint32_t height)
+{
+	if (!width || !height || width > RASTER_MAX_SIZE || height > RASTER_MAX_SIZE)
+		return false;
+
+	_width = width;
+	_height = height;
+	_tilesX = (width + RASTER_TILE_SIZE - 1) / RASTER_TILE_SIZE;
+	_tilesY = (height + RASTER_TILE_SIZE - 1) / RASTER_TILE_SIZE;
+	_binStarts.assign((size_t)_tilesX * _tilesY + 1, 0);
+	_primitives.clear();
+	_bins.clear();
+	return true;
+}
+
+bool TileRasterizer::SetGlyph(uint32_t index, const uint8_t* coverage, int32_t stride, uint32_t width, uint32_t height, int32_t left, int32_t top)
+{
+	if (index >= RASTER_MAX_GLYPHS || ((!coverage || !stride) && width && height))
+		return false;
+
+	// glyphs are set once, replaced ones are left in the coverage
+	auto& glyph = _glyphs[index];
+	glyph.width = width;
+	glyph.height = height;
+	glyph.left = left;
+	glyph.top = top;
+	glyph.offset = _coverage.size();
+	_coverage.resize(_coverage.size() + (size_t)width * height);
+	for (uint32_t y = 0; y < height; y++)
+	{
+		memcpy(_coverage.data() + glyph.offset + (size_t)y * width, coverage + (ptrdiff_t)y * stride, width);
+	}
+	return true;
+}
+
+void TileRasterizer::Begin(uint32_t clearColor)
+{
+	_clearColor = clearColor;
+	_primitives.clear();
+}
+
+void TileRasterizer::Add(const Primitive& primitive)
+{
+	if (primitive.left < primitive.right && primitive.top < primitive.bottom)
+	{
+		_primitives.push_back(primitive);
+	}
+}
+
+void TileRasterizer::FillRectangle(float left, float top, float right, float bottom, uint32_t color)
+{
+	Primitive primitive{};
+	primitive.shape = Shape::Rectangle;
+	primitive.color = color;
+	primitive.x0 = left;
+	primitive.y0 = top;
+	primitive.x1 = right;
+	primitive.y1 = bottom;
+	primitive.left = std::max((int32_t)floorf(left), 0);
+	primitive.top = std::max((int32_t)floorf(top), 0);
+	primitive.right = std::min((int32_t)ceilf(right), (int32_t)_width);
+	primitive.bottom = std::min((int32_t)ceilf(bottom), (int32_t)_height);
+	Add(primitive);
+}
+
+void TileRasterizer::DrawRectangle(float left, float top, float right, float bottom, float strokeWidth, uint32_t color)
+{
+	// top & bottom edges include the corners, so no pixel is blended twice
+	auto half = strokeWidth / 2;
+	FillRectangle(left - half, top - half, right + half, top + half, color);
+	FillRectangle(left - half, bottom - half, right + half, bottom + half, color);
+	FillRectangle(left - half, top + half, left + half, bottom - half, color);
+	FillRectangle(right - half, top + half, right + half, bottom - half, color);
+}
+
+void TileRasterizer::DrawEllipse(float centerX, float centerY, float radiusX, float radiusY, float strokeWidth, uint32_t color)
+{
+	if (radiusX <= 0 || radiusY <= 0)
+		return;
+
+	Primitive primitive{};
+	primitive.shape = Shape::Ellipse;
+	primitive.color = color;
+	primitive.x0 = centerX;
+	primitive.y0 = centerY;
+	primitive.x1 = radiusX;
+	primitive.y1 = radiusY;
+	primitive.strokeWidth = strokeWidth;
+	auto margin = strokeWidth / 2 + 1;
+	primitive.left = std::max((int32_t)floorf(centerX - radiusX - margin), 0);
+	primitive.top = std::max((int32_t)floorf(centerY - radiusY - margin), 0);
+	primitive.right = std::min((int32_t)ceilf(centerX + radiusX + margin), (int32_t)_width);
+	primitive.bottom = std::min((int32_t)ceilf(centerY + radiusY + margin), (int32_t)_height);
+	Add(primitive);
+}
+
+void TileRasterizer::DrawGlyph(uint32_t index, float x, float baseline, uint32_t color)
+{
+	if (index >= RASTER_MAX_GLYPHS)
+		return;
+
+	auto& glyph = _glyphs[index];
+	Primitive primitive{};
+	primitive.shape = Shape::Glyph;
+	primitive.color = color;
+	primitive.glyph = index;
+	primitive.x0 = floorf(x + 0.5f) + glyph.left; // unclipped origin of the bitmap
+	primitive.y0 = floorf(baseline + 0.5f) + glyph.top;
+	primitive.left = std::max((int32_t)primitive.x0, 0);
+	primitive.top = std::max((int32_t)primitive.y0, 0);
+	primitive.right = std::min((int32_t)primitive.x0 + (int32_t)glyph.width, (int32_t)_width);
+	primitive.bottom = std::min((int32_t)primitive.y0 + (int32_t)glyph.height, (int32_t)_height);
+	Add(primitive);
+}
+
+// counting sort of the primitives into the tiles they touch, keeping their order
+void TileRasterizer::Bin()
+{
+	std::fill(_binStarts.begin(), _binStarts.end(), 0);
+	for (auto& primitive : _primitives)
+	{
+		for (auto ty = (uint32_t)primitive.top / RASTER_TILE_SIZE; ty <= (uint32_t)(primitive.bottom - 1) / RASTER_TILE_SIZE; ty++)
+		{
+			for (auto tx = (uint32_t)primitive.left / RASTER_TILE_SIZE; tx <= (uint32_t)(primitive.right - 1) / RASTER_TILE_SIZE; tx++)
+			{
+				_binStarts[(size_t)ty * _tilesX + tx + 1]++;
+			}
+		}
+	}
+
+	for (size_t i = 1; i < _binStarts.size(); i++)
+	{
+		_binStarts[i] += _binStarts[i - 1];
+	}
+
+	// the starts are used as write positions, then moved back by one tile
+	_bins.resize(_binStarts.back());
+	for (uint32_t i = 0; i < (uint32_t)_primitives.size(); i++)
+	{
+		auto& primitive = _primitives[i];
+		for (auto ty = (uint32_t)primitive.top / RASTER_TILE_SIZE; ty <= (uint32_t)(primitive.bottom - 1) / RASTER_TILE_SIZE; ty++)
+		{
+			for (auto tx = (uint32_t)primitive.left / RASTER_TILE_SIZE; tx <= (uint32_t)(primitive.right - 1) / RASTER_TILE_SIZE; tx++)
+			{
+				_bins[_binStarts[(size_t)ty * _tilesX + tx]++] = i;
+			}
+		}
+	}
+
+	for (auto i = _binStarts.size() - 1; i > 0; i--)
+	{
+		_binStarts[i] = _binStarts[i - 1];
+	}
+	_binStarts[0] = 0;
+}
+
+void TileRasterizer::RenderTile(uint32_t tile, uint8_t* output, int32_t stride) const
+{
+	auto tileLeft = (int32_t)(tile % _tilesX * RASTER_TILE_SIZE);
+	auto tileTop = (int32_t)(tile / _tilesX * RASTER_TILE_SIZE);
+	auto tileRight = std::min(tileLeft + RASTER_TILE_SIZE, (int32_t)_width);
+	auto tileBottom = std::min(tileTop + RASTER_TILE_SIZE, (int32_t)_height);
+	auto row = [&](int32_t y) { return (uint32_t*)(output + (ptrdiff_t)y * stride); };
+
+	for (auto y = tileTop; y < tileBottom; y++)
+	{
+		FillSpan(row(y) + tileLeft, tileRight - tileLeft, _clearColor);
+	}
+
+	for (auto i = _binStarts[tile]; i < _binStarts[tile + 1]; i++)
+	{
+		auto& primitive = _primitives[_bins[i]];
+		auto left = std::max(primitive.left, tileLeft);
+		auto top = std::max(primitive.top, tileTop);
+		auto right = std::min(primitive.right, tileRight);
+		auto bottom = std::min(primitive.bottom, tileBottom);
+		switch (primitive.shape)
+		{
+		case Shape::Rectangle:
+		{
+			// the inside is filled, the edges are blended with their coverage
+			auto innerLeft = std::min(std::max((int32_t)ceilf(primitive.x0), left), right);
+			auto innerRight = std::max(std::min((int32_t)floorf(primitive.x1), right), innerLeft);
+			for (auto y = top; y < bottom; y++)
+			{
+				auto pixels = row(y);
+				auto rowAlpha = CoverageToAlpha(Coverage(y, primitive.y0, primitive.y1));
+				for (auto x = left; x < innerLeft; x++)
+				{
+					pixels[x] = BlendPixel(pixels[x], primitive.color, CoverageToAlpha(Coverage(x, primitive.x0, primitive.x1)) * rowAlpha >> 8);
+				}
+
+				BlendSpan(pixels + innerLeft, innerRight - innerLeft, primitive.color, rowAlpha);
+				for (auto x = innerRight; x < right; x++)
+				{
+					pixels[x] = BlendPixel(pixels[x], primitive.color, CoverageToAlpha(Coverage(x, primitive.x0, primitive.x1)) * rowAlpha >> 8);
+				}
+			}
+			break;
+		}
+
+		case Shape::Ellipse:
+		{
+			// distances are measured in the ellipse scaled to a circle of radius y1, exact for circles, which is what the pattern draws
+			auto scale = primitive.y1 / primitive.x1;
+			auto half = primitive.strokeWidth / 2;
+			auto outer = primitive.y1 + half + 1;
+			auto inner = primitive.y1 - half - 1;
+			for (auto y = top; y < bottom; y++)
+			{
+				auto dy = y + 0.5f - primitive.y0;
+				if (fabsf(dy) >= outer)
+					continue;
+
+				// only the pixels of the ring's two arcs on this row are visited
+				auto outerX = sqrtf(outer * outer - dy * dy) / scale;
+				auto innerX = inner > fabsf(dy) ? sqrtf(inner * inner - dy * dy) / scale : 0;
+				int32_t arcs[2][2] =
+				{
+					{ (int32_t)floorf(primitive.x0 - outerX), (int32_t)ceilf(primitive.x0 - innerX) },
+					{ (int32_t)floorf(primitive.x0 + innerX), (int32_t)ceilf(primitive.x0 + outerX) },
+				};
+				if (arcs[0][1] >= arcs[1][0])
+				{
+					arcs[0][1] = arcs[1][1];
+					arcs[1][0] = arcs[1][1];
+				}
+
+				auto pixels = row(y);
+				for (auto& arc : arcs)
+				{
+					for (auto x = std::max(arc[0], left); x < std::min(arc[1], right); x++)
+					{
+						auto dx = (x + 0.5f - primitive.x0) * scale;
+						auto coverage = half + 0.5f - fabsf(sqrtf(dx * dx + dy * dy) - primitive.y1);
+						auto alpha = CoverageToAlpha(std::min(coverage, primitive.strokeWidth));
+						if (alpha)
+						{
+							pixels[x] = BlendPixel(pixels[x], primitive.color, alpha);
+						}
+					}
+				}
+			}
+			break;
+		}
+
+		case Shape::Glyph:
+		{
+			auto& glyph = _glyphs[primitive.glyph];
+			auto originX = (int32_t)primitive.x0;
+			auto originY = (int32_t)primitive.y0;
+			for (auto y = top; y < bottom; y++)
+			{
+				auto mask = _coverage.data() + glyph.offset + (size_t)(y - originY) * glyph.width + (left - originX);
+				BlendMaskSpan(row(y) + left, right - left, primitive.color, mask);
+			}
+			break;
+		}
+		}
+	}
+}
+
+void TileRasterizer::Render(uint8_t* output, int32_t stride, TaskScheduler* scheduler)
+{
+	if (!output || !_width)
+		return;
+
+	Bin();
+	auto tiles = _tilesX * _tilesY;
+	if (!scheduler)
+	{
+		for (uint32_t tile = 0; tile < tiles; tile++)
+		{
+			RenderTile(tile, output, stride);
+		}
+		return;
+	}
+
+	scheduler->ParallelFor(tiles, 0, [&](uint32_t begin, uint32_t end)
+		{
+			for (auto tile = begin; tile < end; tile++)
+			{
+				RenderTile(tile, output, stride);
+			}
+		});
+}
\ No newline at end of file
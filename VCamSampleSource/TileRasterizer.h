@@ -0,0 +1,101 @@
+#pragma once
+
+// CPU rasterizer for the primitives the test pattern is made of: filled & stroked rectangles, stroked ellipses and glyphs from bitmaps made
+// by the caller. Primitives are recorded, binned into 64x64 tiles (in order, so they're drawn in order in each tile) and the tiles are rendered
+// in parallel, each one in the cache, with SSE2 spans for fills & blends. Edges are antialiased from their pixel coverage like Direct2D's.
+// Without SSE2, spans are filled & blended one pixel at a time.
+#include <cstdint>
+#include <vector>
+
+#define RASTER_TILE_SIZE 64
+#define RASTER_MAX_GLYPHS 128
+
+class TaskScheduler;
+
+class TileRasterizer
+{
+public:
+	enum class Shape : uint8_t
+	{
+		Rectangle,
+		Ellipse,
+		Glyph,
+	};
+
+	// bounds are pixels, clipped to the frame
+	struct Primitive
+	{
+		Shape shape;
+		uint32_t color;
+		float x0; // rectangle left, ellipse center
+		float y0;
+		float x1; // rectangle right, ellipse radii
+		float y1;
+		float strokeWidth;
+		uint32_t glyph;
+		int32_t left;
+		int32_t top;
+		int32_t right;
+		int32_t bottom;
+	};
+
+	struct Glyph
+	{
+		uint32_t width;
+		uint32_t height;
+		int32_t left; // from the pen position on the baseline
+		int32_t top;
+		size_t offset; // in the coverage of all glyphs
+	};
+
+private:
+	uint32_t _width;
+	uint32_t _height;
+	uint32_t _tilesX;
+	uint32_t _tilesY;
+	uint32_t _clearColor;
+	std::vector<Primitive> _primitives;
+	std::vector<uint32_t> _binStarts; // per tile, in _bins, plus the end
+	std::vector<uint32_t> _bins; // primitive indices
+	Glyph _glyphs[RASTER_MAX_GLYPHS];
+	std::vector<uint8_t> _coverage;
+
+	void Add(const Primitive& primitive);
+	void Bin();
+	void RenderTile(uint32_t tile, uint8_t* output, int32_t stride) const;
+
+public:
+	TileRasterizer() :
+		_width(0),
+		_height(0),
+		_tilesX(0),
+		_tilesY(0),
+		_clearColor(0),
+		_glyphs()
+	{
+	}
+
+	// false if the size is invalid, glyphs are kept
+	bool Start(uint32_t width, uint32_t height);
+	uint32_t GetWidth() const { return _width; }
+	uint32_t GetHeight() const { return _height; }
+
+	// coverage is 8-bit (0 transparent, 255 opaque), left & top place it from the pen position on the baseline
+	bool SetGlyph(uint32_t index, const uint8_t* coverage, int32_t stride, uint32_t width, uint32_t height, int32_t left, int32_t top);
+
+	// colors are BGRA in memory order (0xAARRGGBB), opaque, as in RGB32 frames
+	void Begin(uint32_t clearColor);
+	void FillRectangle(float left, float top, float right, float bottom, uint32_t color);
+
+	// the stroke is centered on the edges, like Direct2D's
+	void DrawRectangle(float left, float top, float right, float bottom, float strokeWidth, uint32_t color);
+	void DrawEllipse(float centerX, float centerY, float radiusX, float radiusY, float strokeWidth, uint32_t color);
+
+	// the glyph's pen position is snapped to whole pixels
+	void DrawGlyph(uint32_t index, float x, float baseline, uint32_t color);
+
+	// renders what was recorded since Begin to an RGB32 frame of the started size, in parallel when there's a scheduler, else on this thread
+	void Render(uint8_t* output, int32_t stride, TaskScheduler* scheduler);
+
+	uint32_t GetPrimitiveCount() const { return (uint32_t)_primitives.size(); }
+};
\ No newline at end of file
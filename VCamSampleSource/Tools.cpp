@@ -1,6 +1,8 @@
 #include "pch.h"
 #include "Undocumented.h"
 #include "Tools.h"
+#include "FrameBuffer.h"
+#include "ColorConvert.h"
 #include "EnumNames.h"
 
 std::string to_string(const std::wstring& ws)
@@ -99,6 +101,8 @@ const std::wstring GUID_ToStringW(const GUID& guid, bool resolve)
 		IFGUID(CLSID_VideoInputDeviceCategory);
 		IFGUID(MFVideoFormat_RGB32);
 		IFGUID(MFVideoFormat_NV12);
+		IFGUID(MFVideoFormat_I420);
+		IFGUID(MFVideoFormat_MJPG);
 
 		IFGUID(KSPROPSETID_Pin);
 		IFGUID(KSPROPSETID_Topology);
@@ -263,49 +267,48 @@ const LSTATUS RegWriteValue(HKEY key, PCWSTR name, DWORD value)
 	return RegSetValueEx(key, name, 0, REG_DWORD, reinterpret_cast<BYTE const*>(&value), sizeof(value));
 }
 
-static inline void RGB24ToYUY2(int r, int g, int b, BYTE* y, BYTE* u, BYTE* v)
+const LSTATUS RegReadValue(HKEY key, PCWSTR name, std::wstring& value)
 {
-	*y = ((66 * r + 129 * g + 25 * b + 128) >> 8) + 16;
-	*u = ((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128;
-	*v = ((112 * r - 94 * g - 18 * b + 128) >> 8) + 128;
+	DWORD size = 0;
+	auto status = RegGetValue(key, nullptr, name, RRF_RT_REG_SZ | RRF_RT_REG_EXPAND_SZ, nullptr, nullptr, &size);
+	if (status != ERROR_SUCCESS)
+		return status;
+
+	value.resize(size / sizeof(wchar_t));
+	status = RegGetValue(key, nullptr, name, RRF_RT_REG_SZ | RRF_RT_REG_EXPAND_SZ, nullptr, value.data(), &size);
+	if (status != ERROR_SUCCESS)
+		return status;
+
+	// size includes the terminating zero
+	value.resize(size ? size / sizeof(wchar_t) - 1 : 0);
+	return ERROR_SUCCESS;
 }
 
-static inline void RGB24ToY(int r, int g, int b, BYTE* y)
+const LSTATUS RegReadValue(HKEY key, PCWSTR name, DWORD& value)
 {
-	*y = ((66 * r + 129 * g + 25 * b + 128) >> 8) + 16;
+	DWORD size = sizeof(value);
+	return RegGetValue(key, nullptr, name, RRF_RT_REG_DWORD, nullptr, &value, &size);
 }
 
-static inline void RGB32ToNV12(BYTE rgb1[8], BYTE rgb2[8], BYTE* y1, BYTE* y2, BYTE* uv)
-{
-	RGB24ToYUY2(rgb1[2], rgb1[1], rgb1[0], y1, uv, uv + 1);
-	RGB24ToY(rgb1[6], rgb1[5], rgb1[4], y1 + 1);
-	RGB24ToYUY2(rgb2[2], rgb2[1], rgb2[0], y2, uv, uv + 1);
-	RGB24ToY(rgb2[6], rgb2[5], rgb2[4], y2 + 1);
-};
-
 HRESULT RGB32ToNV12(BYTE* input, ULONG inputSize, LONG inputStride, UINT width, UINT height, BYTE* output, ULONG ouputSize, LONG outputStride)
 {
 	RETURN_HR_IF_NULL(E_INVALIDARG, input);
 	RETURN_HR_IF_NULL(E_INVALIDARG, output);
-	RETURN_HR_IF(E_UNEXPECTED, width * 4 * height > inputSize);
-	RETURN_HR_IF(E_UNEXPECTED, width * 1.5 * height > ouputSize);
+	RETURN_HR_IF(E_INVALIDARG, inputStride < (LONG)width * 4 || outputStride < (LONG)width);
+	RETURN_HR_IF(E_UNEXPECTED, Rgb32View::GetSize(inputStride, height) > inputSize);
+	RETURN_HR_IF(E_UNEXPECTED, Nv12View::GetSize(outputStride, height) > ouputSize);
 
-	for (DWORD h = 0; h < height - 1; h += 2)
-	{
-		auto rgb1 = h * inputStride + input;
-		auto rgb2pRGB2 = (h + 1) * inputStride + input;
-		auto y1 = h * outputStride + output;
-		auto y2 = (h + 1) * outputStride + output;
-		auto uv = (h / 2 + height) * outputStride + output;
-		for (DWORD w = 0; w < width; w += 2)
-		{
-			RGB32ToNV12(rgb1, rgb2pRGB2, y1, y2, uv);
-			rgb1 += 8;
-			rgb2pRGB2 += 8;
-			y1 += 2;
-			y2 += 2;
-			uv += 2;
-		}
-	}
+	RGB32ToNV12(Rgb32View::FromBuffer(input, inputStride, width, height), Nv12View::FromBuffer(output, outputStride, width, height));
 	return S_OK;
 }
+
+// copies a KS property reply, or just returns its size if the buffer is too small
+HRESULT KsReply(const void* reply, ULONG size, LPVOID data, ULONG dataLength, ULONG* bytesReturned)
+{
+	*bytesReturned = size;
+	if (!data || dataLength < size)
+		return HRESULT_FROM_WIN32(ERROR_MORE_DATA);
+
+	CopyMemory(data, reply, size);
+	return S_OK;
+}
\ No newline at end of file
@@ -10,7 +10,40 @@ const std::wstring GetProcessName(DWORD pid);
 const LSTATUS RegWriteKey(HKEY key, PCWSTR path, HKEY* outKey);
 const LSTATUS RegWriteValue(HKEY key, PCWSTR name, const std::wstring& value);
 const LSTATUS RegWriteValue(HKEY key, PCWSTR name, DWORD value);
+const LSTATUS RegReadValue(HKEY key, PCWSTR name, std::wstring& value);
+const LSTATUS RegReadValue(HKEY key, PCWSTR name, DWORD& value);
 HRESULT RGB32ToNV12(BYTE* input, ULONG inputSize, LONG inputStride, UINT width, UINT height, BYTE* output, ULONG ouputSize, LONG outputStride);
+HRESULT KsReply(const void* reply, ULONG size, LPVOID data, ULONG dataLength, ULONG* bytesReturned);
+
+// runs a function on bands of rows in parallel on the shared task scheduler, as f(top, bottom)
+template<typename F> HRESULT ForEachBand(UINT height, UINT bandRows, F f)
+{
+	auto bands = (height + bandRows - 1) / bandRows;
+	try
+	{
+		TaskScheduler::GetShared().ParallelFor(bands, 1, [&](UINT first, UINT last)
+			{
+				for (auto band = first; band < last; band++)
+				{
+					auto top = band * bandRows;
+					f(top, std::min<UINT>(top + bandRows, height));
+				}
+			});
+	}
+	CATCH_RETURN();
+	return S_OK;
+}
+
+// runs a function on tiles in parallel on the shared task scheduler, as f(left, top, right, bottom), neighbor tiles tend to run on the same thread
+template<typename F> HRESULT ForEachTile(UINT width, UINT height, UINT tileWidth, UINT tileHeight, F f)
+{
+	try
+	{
+		TaskScheduler::GetShared().ParallelForTiles(width, height, tileWidth, tileHeight, 0, f);
+	}
+	CATCH_RETURN();
+	return S_OK;
+}
 
 _Ret_range_(== , _expr)
 inline bool assert_true(bool _expr)
@@ -72,4 +105,6 @@ struct registry_traits
 	{
 		return nullptr;
 	}
-};
\ No newline at end of file
+};
+
+using registry_key = winrt::handle_type<registry_traits>;
\ No newline at end of file
@@ -3,6 +3,7 @@
 #include "Tools.h"
 #include "EnumNames.h"
 #include "MFTools.h"
+#include "FrameTiming.h"
 #include "FrameGenerator.h"
 #include "MediaStream.h"
 #include "MediaSource.h"
@@ -76,6 +77,9 @@ STDAPI DllCanUnloadNow()
 	}
 
 	winrt::clear_factory_cache();
+
+	// no stream is left, the scheduler's workers must be gone before the code they run is unloaded
+	TaskScheduler::GetShared().Stop();
 	WINTRACE(L"DllCanUnloadNow S_OK");
 	return S_OK;
 }
@@ -93,8 +97,6 @@ STDAPI DllGetClassObject(_In_ REFCLSID rclsid, _In_ REFIID riid, _Outptr_ LPVOID
 	RETURN_HR(E_NOINTERFACE);
 }
 
-using registry_key = winrt::handle_type<registry_traits>;
-
 STDAPI DllRegisterServer()
 {
 	std::wstring exePath = wil::GetModuleFileNameW(_hModule).get();
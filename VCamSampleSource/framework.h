@@ -16,6 +16,7 @@
 #include <windows.h>
 #include <evntprov.h>
 #include <strsafe.h>
+#include <sddl.h>
 #include <initguid.h>
 #include <propvarutil.h>
 #include <mfapi.h>
@@ -36,7 +37,11 @@
 
 // std
 #include <string>
+#include <memory>
+#include <algorithm>
+#include <cmath>
 #include <format>
+#include <intrin.h>
 
 // WIL, requires "Microsoft.Windows.ImplementationLibrary" nuget
 #include "wil/result.h"
@@ -49,6 +54,8 @@
 
 // project globals
 #include "wintrace.h"
+#include "ThreadPolicy.h"
+#include "TaskScheduler.h"
 
 #pragma comment(lib, "mfsensorgroup")
 // 3cad447d-f283-4af4-a3b2-6f5363309f52